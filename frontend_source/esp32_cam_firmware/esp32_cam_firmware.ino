@@ -6,6 +6,11 @@
 #include "esp_camera.h"
 #include <WiFi.h>
 #include "esp_http_server.h"
+#include <capture_task.h>
+#include <camera_pipeline.h>
+#include <http_handlers.h>
+#include <rtsp_server.h>
+#include <substream_task.h>
 
 // ============================================
 // WiFi Configuration - CHANGE THESE!
@@ -41,96 +46,14 @@ const char* password = "0506983399";
 // HTTP Server Handlers
 // ============================================
 
-#define PART_BOUNDARY "123456789000000000000987654321"
-static const char* _STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
-
 httpd_handle_t stream_httpd = NULL;
 httpd_handle_t camera_httpd = NULL;
 
-// Single JPEG capture handler
-static esp_err_t capture_handler(httpd_req_t *req) {
-    camera_fb_t * fb = NULL;
-    esp_err_t res = ESP_OK;
-
-    fb = esp_camera_fb_get();
-    if (!fb) {
-        Serial.println("Camera capture failed");
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
-    }
-
-    httpd_resp_set_type(req, "image/jpeg");
-    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-
-    res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-    esp_camera_fb_return(fb);
-    return res;
-}
-
-// MJPEG Stream handler
-static esp_err_t stream_handler(httpd_req_t *req) {
-    camera_fb_t * fb = NULL;
-    esp_err_t res = ESP_OK;
-    size_t _jpg_buf_len = 0;
-    uint8_t * _jpg_buf = NULL;
-    char * part_buf[64];
-
-    res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-    if(res != ESP_OK){
-        return res;
-    }
-
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-
-    while(true){
-        fb = esp_camera_fb_get();
-        if (!fb) {
-            Serial.println("Camera capture failed");
-            res = ESP_FAIL;
-        } else {
-            if(fb->format != PIXFORMAT_JPEG){
-                bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-                esp_camera_fb_return(fb);
-                fb = NULL;
-                if(!jpeg_converted){
-                    Serial.println("JPEG compression failed");
-                    res = ESP_FAIL;
-                }
-            } else {
-                _jpg_buf_len = fb->len;
-                _jpg_buf = fb->buf;
-            }
-        }
-
-        if(res == ESP_OK){
-            res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-        }
-        if(res == ESP_OK){
-            size_t hlen = snprintf((char *)part_buf, 64, _STREAM_PART, _jpg_buf_len);
-            res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
-        }
-        if(res == ESP_OK){
-            res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
-        }
-
-        if(fb){
-            esp_camera_fb_return(fb);
-            fb = NULL;
-            _jpg_buf = NULL;
-        } else if(_jpg_buf){
-            free(_jpg_buf);
-            _jpg_buf = NULL;
-        }
+// Fed by the capture task, read by /stream and /capture
+camcore::CameraPipeline camera_pipeline;
 
-        if(res != ESP_OK){
-            break;
-        }
-    }
-    return res;
-}
+// Frame sizes the quality controller may fall back to under congestion
+static const int adaptive_frame_sizes[] = {FRAMESIZE_VGA, FRAMESIZE_QVGA};
 
 // Status/Info handler
 static esp_err_t status_handler(httpd_req_t *req) {
@@ -184,8 +107,12 @@ static esp_err_t index_handler(httpd_req_t *req) {
         "<button class='btn' onclick=\"fetch('/flash?state=1')\">💡 Flash ON</button>"
         "<button class='btn' onclick=\"fetch('/flash?state=0')\">Flash OFF</button>"
         "<br><br>"
-        "<p>Stream URL: <code>/stream</code></p>"
+        "<p>Stream URL: <code>:81/stream</code> (optional <code>?fps=5</code>)</p>"
+        "<p>RTSP URL: <code>rtsp://&lt;ip&gt;/stream</code> (same options)</p>"
         "<p>Snapshot URL: <code>/capture</code></p>"
+        "<p>Motion events: <code>/events</code></p>"
+        "<p>Last 10 s: <code>/clip?seconds=10</code> (<code>&amp;format=avi</code> to download)</p>"
+        "<p>Prometheus metrics: <code>/metrics</code></p>"
         "</body></html>";
 
     httpd_resp_set_type(req, "text/html");
@@ -195,6 +122,7 @@ static esp_err_t index_handler(httpd_req_t *req) {
 void startCameraServer() {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = 80;
+    config.lru_purge_enable = true;
 
     httpd_uri_t index_uri = {
         .uri       = "/",
@@ -206,8 +134,8 @@ void startCameraServer() {
     httpd_uri_t capture_uri = {
         .uri       = "/capture",
         .method    = HTTP_GET,
-        .handler   = capture_handler,
-        .user_ctx  = NULL
+        .handler   = camcore::captureHandler,
+        .user_ctx  = &camera_pipeline
     };
 
     httpd_uri_t status_uri = {
@@ -224,11 +152,32 @@ void startCameraServer() {
         .user_ctx  = NULL
     };
 
+    httpd_uri_t events_uri = {
+        .uri       = "/events",
+        .method    = HTTP_GET,
+        .handler   = camcore::eventsHandler,
+        .user_ctx  = &camera_pipeline
+    };
+
+    httpd_uri_t clip_uri = {
+        .uri       = "/clip",
+        .method    = HTTP_GET,
+        .handler   = camcore::clipHandler,
+        .user_ctx  = &camera_pipeline
+    };
+
+    httpd_uri_t metrics_uri = {
+        .uri       = "/metrics",
+        .method    = HTTP_GET,
+        .handler   = camcore::metricsHandler,
+        .user_ctx  = &camera_pipeline
+    };
+
     httpd_uri_t stream_uri = {
         .uri       = "/stream",
         .method    = HTTP_GET,
-        .handler   = stream_handler,
-        .user_ctx  = NULL
+        .handler   = camcore::streamHandler,
+        .user_ctx  = &camera_pipeline
     };
 
     Serial.println("Starting web server on port 80...");
@@ -237,6 +186,9 @@ void startCameraServer() {
         httpd_register_uri_handler(camera_httpd, &capture_uri);
         httpd_register_uri_handler(camera_httpd, &status_uri);
         httpd_register_uri_handler(camera_httpd, &flash_uri);
+        httpd_register_uri_handler(camera_httpd, &events_uri);
+        httpd_register_uri_handler(camera_httpd, &clip_uri);
+        httpd_register_uri_handler(camera_httpd, &metrics_uri);
     }
 
     config.server_port = 81;
@@ -245,6 +197,11 @@ void startCameraServer() {
     if (httpd_start(&stream_httpd, &config) == ESP_OK) {
         httpd_register_uri_handler(stream_httpd, &stream_uri);
     }
+
+    Serial.println("Starting RTSP server on port 554...");
+    if(!camcore::startRtspServer(&camera_pipeline, camcore::RtspServerConfig())){
+        Serial.println("⚠️ RTSP server failed to start");
+    }
 }
 
 // ============================================
@@ -312,6 +269,38 @@ void setup() {
     }
     Serial.println("✅ Camera initialized!");
 
+    // One capture task feeds every stream/snapshot client
+    camcore::FrameBroker::Config broker_config;
+    camcore::QualityController::Config quality_config;
+    quality_config.best_quality = config.jpeg_quality;
+    if(psramFound()){
+        quality_config.frame_sizes = adaptive_frame_sizes;
+        quality_config.frame_size_count = 2;
+    } else {
+        broker_config.slot_count = 3;
+        broker_config.slot_capacity =
+            camcore::jpegSlotCapacity(config.frame_size, config.jpeg_quality);
+    }
+    camera_pipeline.quality.begin(quality_config, config.frame_size);
+    camera_pipeline.motion.begin(camcore::MotionDetector::Config());
+    if(psramFound()){
+        // Pre-event footage for /clip, ~2 MB of PSRAM
+        if(!camera_pipeline.recorder.begin(camcore::FrameArena::Config())){
+            Serial.println("⚠️ Recorder disabled: not enough PSRAM");
+        }
+    }
+    if(!camera_pipeline.broker.begin(broker_config) ||
+       !camcore::startCaptureTask(&camera_pipeline, camcore::CaptureTaskConfig())){
+        Serial.println("❌ Frame broker init failed!");
+        return;
+    }
+    if(psramFound()){
+        // 1/2 and 1/4 scale copies for /stream?res= and /capture?res=
+        if(!camcore::startSubstreamTask(&camera_pipeline, camcore::SubstreamTaskConfig())){
+            Serial.println("⚠️ Substreams disabled: not enough PSRAM");
+        }
+    }
+
     // Camera settings tweaks
     sensor_t * s = esp_camera_sensor_get();
     if(s){
@@ -371,7 +360,11 @@ void setup() {
     Serial.printf("  📺 Web UI:    http://%s/\n", WiFi.localIP().toString().c_str());
     Serial.printf("  📷 Snapshot:  http://%s/capture\n", WiFi.localIP().toString().c_str());
     Serial.printf("  🎥 Stream:    http://%s:81/stream\n", WiFi.localIP().toString().c_str());
+    Serial.printf("  📡 RTSP:      rtsp://%s/stream\n", WiFi.localIP().toString().c_str());
     Serial.printf("  📊 Status:    http://%s/status\n", WiFi.localIP().toString().c_str());
+    Serial.printf("  🏃 Motion:    http://%s/events\n", WiFi.localIP().toString().c_str());
+    Serial.printf("  🎞️ Clip:      http://%s/clip?seconds=10\n", WiFi.localIP().toString().c_str());
+    Serial.printf("  📈 Metrics:   http://%s/metrics\n", WiFi.localIP().toString().c_str());
     Serial.println("========================================");
     Serial.println("For Frigate, use the stream URL above.");
     Serial.println("========================================");
@@ -0,0 +1,499 @@
+// Streaming load benchmark: runs the host firmware in-process (or targets
+// a board with --target) and drives N /stream and M /capture clients
+// against it. Reports per-client fps, frame-to-delivery latency
+// percentiles, bytes per frame on the wire and, in-process, heap
+// allocations per frame.
+//
+// Latency is measured from the frame's X-Timestamp (sensor capture time)
+// to the moment its last byte is read, so it needs the clocks of both
+// ends to agree: it is only reported in-process.
+
+#include <esp_timer.h>
+#include <host_alloc.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "host_firmware.h"
+
+namespace {
+
+struct BenchConfig {
+  int streams = 2;
+  int captures = 1;
+  float stream_fps = 0;  // ?fps= per stream client, 0 = unpaced
+  const char *res = nullptr;  // ?res= for every client
+  float warmup_s = 2;
+  float duration_s = 10;
+  const char *target = nullptr;  // host:port of a board
+  const char *json = nullptr;
+};
+
+struct ClientResult {
+  std::string name;
+  uint64_t frames = 0;
+  uint64_t wire_bytes = 0;
+  std::vector<int64_t> latency_us;
+  bool failed = false;
+};
+
+std::atomic<bool> g_measuring{false};
+std::atomic<bool> g_stop{false};
+
+// Blocking socket with a read buffer; counts every byte received.
+class Connection {
+public:
+  ~Connection() {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  bool open(const char *host, const char *port) {
+    addrinfo hints = {}, *res = nullptr;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+      return false;
+    fd_ = socket(res->ai_family, SOCK_STREAM, 0);
+    bool ok = fd_ >= 0 && connect(fd_, res->ai_addr, res->ai_addrlen) == 0;
+    freeaddrinfo(res);
+    if (ok) {
+      int one = 1;
+      setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      timeval tv = {2, 0};
+      setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    return ok;
+  }
+
+  bool send(const std::string &data) {
+    return ::send(fd_, data.data(), data.size(), MSG_NOSIGNAL) ==
+           (ssize_t)data.size();
+  }
+
+  // Reads one CRLF-terminated line without the terminator.
+  bool readLine(std::string *line) {
+    line->clear();
+    while (true) {
+      if (pos_ == len_ && !fill())
+        return false;
+      char c = buf_[pos_++];
+      if (c == '\n') {
+        if (!line->empty() && line->back() == '\r')
+          line->pop_back();
+        return true;
+      }
+      line->push_back(c);
+    }
+  }
+
+  bool read(char *out, size_t n) {
+    while (n > 0) {
+      if (pos_ == len_ && !fill())
+        return false;
+      size_t take = std::min(n, len_ - pos_);
+      memcpy(out, buf_ + pos_, take);
+      pos_ += take;
+      out += take;
+      n -= take;
+    }
+    return true;
+  }
+
+  uint64_t bytesRead() const { return bytes_; }
+
+private:
+  bool fill() {
+    while (!g_stop) {
+      ssize_t n = recv(fd_, buf_, sizeof(buf_), 0);
+      if (n > 0) {
+        pos_ = 0;
+        len_ = n;
+        bytes_ += n;
+        return true;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        continue;
+      return false;
+    }
+    return false;
+  }
+
+  int fd_ = -1;
+  char buf_[16384];
+  size_t pos_ = 0, len_ = 0;
+  uint64_t bytes_ = 0;
+};
+
+// Decodes Transfer-Encoding: chunked on top of a Connection, or passes an
+// unchunked body (mjpeg-relay) straight through.
+class ChunkedBody {
+public:
+  ChunkedBody(Connection *conn, bool chunked)
+      : conn_(conn), chunked_(chunked) {}
+
+  bool readLine(std::string *line) {
+    line->clear();
+    char c;
+    while (read(&c, 1)) {
+      if (c == '\n') {
+        if (!line->empty() && line->back() == '\r')
+          line->pop_back();
+        return true;
+      }
+      line->push_back(c);
+    }
+    return false;
+  }
+
+  bool read(char *out, size_t n) {
+    if (!chunked_)
+      return conn_->read(out, n);
+    while (n > 0) {
+      if (left_ == 0 && !nextChunk())
+        return false;
+      size_t take = std::min(n, left_);
+      if (!conn_->read(out, take))
+        return false;
+      left_ -= take;
+      out += take;
+      n -= take;
+    }
+    return true;
+  }
+
+private:
+  bool nextChunk() {
+    std::string line;
+    if (started_ && !conn_->readLine(&line))  // CRLF after the last chunk
+      return false;
+    started_ = true;
+    if (!conn_->readLine(&line))
+      return false;
+    left_ = strtoul(line.c_str(), nullptr, 16);
+    return left_ > 0;
+  }
+
+  Connection *conn_;
+  bool chunked_;
+  size_t left_ = 0;
+  bool started_ = false;
+};
+
+int64_t parseTimestamp(const std::string &value) {
+  return (int64_t)(strtod(value.c_str(), nullptr) * 1e6 + 0.5);
+}
+
+bool headerValue(const std::string &line, const char *name,
+                 std::string *value) {
+  size_t len = strlen(name);
+  if (line.size() <= len + 1 || strncasecmp(line.c_str(), name, len) != 0 ||
+      line[len] != ':')
+    return false;
+  size_t start = line.find_first_not_of(' ', len + 1);
+  *value = start == std::string::npos ? "" : line.substr(start);
+  return true;
+}
+
+void record(ClientResult *result, const Connection &conn,
+            uint64_t *wire_mark, int64_t timestamp_us, bool latency) {
+  uint64_t wire = conn.bytesRead();
+  if (g_measuring) {
+    result->frames++;
+    result->wire_bytes += wire - *wire_mark;
+    if (latency && timestamp_us > 0)
+      result->latency_us.push_back(esp_timer_get_time() - timestamp_us);
+  }
+  *wire_mark = wire;
+}
+
+void streamClient(const char *host, const char *port, float fps,
+                  const char *res, bool latency, ClientResult *result) {
+  HostAllocUntracked untracked;
+  Connection conn;
+  std::string request = "GET /stream?";
+  if (fps > 0)
+    request += "fps=" + std::to_string(fps) + "&";
+  if (res)
+    request += std::string("res=") + res;
+  request += " HTTP/1.1\r\nHost: bench\r\n\r\n";
+  if (!conn.open(host, port) || !conn.send(request)) {
+    result->failed = true;
+    return;
+  }
+
+  std::string line, value;
+  if (!conn.readLine(&line) || line.find(" 200 ") == std::string::npos) {
+    fprintf(stderr, "%s: %s\n", result->name.c_str(), line.c_str());
+    result->failed = true;
+    return;
+  }
+  bool chunked = false;
+  while (conn.readLine(&line) && !line.empty())
+    if (headerValue(line, "Transfer-Encoding", &value))
+      chunked = value.find("chunked") != std::string::npos;
+
+  ChunkedBody body(&conn, chunked);
+  std::vector<char> frame;
+  uint64_t wire_mark = conn.bytesRead();
+  while (!g_stop) {
+    size_t length = 0;
+    int64_t timestamp_us = 0;
+    bool in_headers = false;
+    while (body.readLine(&line)) {
+      if (line.empty()) {
+        if (in_headers)
+          break;
+        continue;
+      }
+      in_headers = true;
+      if (headerValue(line, "Content-Length", &value))
+        length = strtoul(value.c_str(), nullptr, 10);
+      else if (headerValue(line, "X-Timestamp", &value))
+        timestamp_us = parseTimestamp(value);
+    }
+    if (!in_headers || length == 0)
+      break;
+    frame.resize(length);
+    if (!body.read(frame.data(), length))
+      break;
+    record(result, conn, &wire_mark, timestamp_us, latency);
+  }
+}
+
+void captureClient(const char *host, const char *port, const char *res,
+                   bool latency, ClientResult *result) {
+  HostAllocUntracked untracked;
+  Connection conn;
+  if (!conn.open(host, port)) {
+    result->failed = true;
+    return;
+  }
+  std::string line, value, etag;
+  std::vector<char> frame;
+  uint64_t wire_mark = conn.bytesRead();
+  while (!g_stop) {
+    // Long-poll for the next frame on a kept-alive connection.
+    std::string request = "GET /capture?";
+    if (!etag.empty())
+      request += "after=" + etag + "&";
+    if (res)
+      request += std::string("res=") + res;
+    request += " HTTP/1.1\r\nHost: bench\r\n\r\n";
+    if (!conn.send(request) || !conn.readLine(&line))
+      break;
+    bool ok = line.find(" 200 ") != std::string::npos;
+    size_t length = 0;
+    int64_t timestamp_us = 0;
+    while (conn.readLine(&line) && !line.empty()) {
+      if (headerValue(line, "Content-Length", &value))
+        length = strtoul(value.c_str(), nullptr, 10);
+      else if (headerValue(line, "X-Timestamp", &value))
+        timestamp_us = parseTimestamp(value);
+      else if (headerValue(line, "ETag", &value))
+        etag = value.substr(1, value.size() - 2);
+    }
+    frame.resize(length);
+    if (length && !conn.read(frame.data(), length))
+      break;
+    if (ok)
+      record(result, conn, &wire_mark, timestamp_us, latency);
+  }
+}
+
+int64_t percentile(std::vector<int64_t> *samples, double p) {
+  if (samples->empty())
+    return -1;
+  size_t k = (size_t)(p * (samples->size() - 1) + 0.5);
+  std::nth_element(samples->begin(), samples->begin() + k, samples->end());
+  return (*samples)[k];
+}
+
+void printMs(FILE *out, int64_t us) {
+  if (us < 0)
+    fprintf(out, "%8s", "-");
+  else
+    fprintf(out, "%8.1f", us / 1000.0);
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --streams N         concurrent /stream clients (2)\n"
+          "  --captures N        concurrent /capture long-poll clients (1)\n"
+          "  --stream-fps F      ?fps= for stream clients (unpaced)\n"
+          "  --res NAME          ?res= for all clients, e.g. qvga (full)\n"
+          "  --warmup S          seconds before measuring (2)\n"
+          "  --duration S        seconds to measure (10)\n"
+          "  --target HOST:PORT  benchmark a board instead of the host "
+          "build\n"
+          "  --json FILE         also write results as JSON\n"
+          "in-process firmware options:\n",
+          argv0);
+  camcore::printFirmwareUsage();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  BenchConfig bench;
+  camcore::HostFirmwareConfig firmware;
+  firmware.max_stream_clients = 16;
+  firmware.max_open_sockets = 24;
+  for (int i = 1; i < argc; i++) {
+    const char *opt = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (camcore::parseFirmwareOption(argc, argv, &i, &firmware))
+      continue;
+    if (!value) {
+      usage(argv[0]);
+      return 2;
+    }
+    if (strcmp(opt, "--streams") == 0)
+      bench.streams = atoi(value);
+    else if (strcmp(opt, "--captures") == 0)
+      bench.captures = atoi(value);
+    else if (strcmp(opt, "--stream-fps") == 0)
+      bench.stream_fps = strtof(value, nullptr);
+    else if (strcmp(opt, "--res") == 0)
+      bench.res = value;
+    else if (strcmp(opt, "--warmup") == 0)
+      bench.warmup_s = strtof(value, nullptr);
+    else if (strcmp(opt, "--duration") == 0)
+      bench.duration_s = strtof(value, nullptr);
+    else if (strcmp(opt, "--target") == 0)
+      bench.target = value;
+    else if (strcmp(opt, "--json") == 0)
+      bench.json = value;
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+
+  static camcore::CameraPipeline pipeline;
+  std::string host = "127.0.0.1";
+  std::string port = std::to_string(firmware.port);
+  bool in_process = bench.target == nullptr;
+  if (in_process) {
+    httpd_handle_t server;
+    if (!camcore::startHostFirmware(firmware, &pipeline, &server))
+      return 1;
+  } else {
+    std::string target = bench.target;
+    size_t colon = target.rfind(':');
+    host = target.substr(0, colon);
+    port = colon == std::string::npos ? "80" : target.substr(colon + 1);
+  }
+
+  std::vector<ClientResult> results(bench.streams + bench.captures);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < bench.streams; i++) {
+    results[i].name = "stream#" + std::to_string(i);
+    threads.emplace_back(streamClient, host.c_str(), port.c_str(),
+                         bench.stream_fps, bench.res, in_process,
+                         &results[i]);
+  }
+  for (int i = 0; i < bench.captures; i++) {
+    ClientResult *r = &results[bench.streams + i];
+    r->name = "capture#" + std::to_string(i);
+    threads.emplace_back(captureClient, host.c_str(), port.c_str(),
+                         bench.res, in_process, r);
+  }
+
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds((int)(bench.warmup_s * 1000)));
+  uint64_t allocs_start = host_alloc_count();
+  uint32_t published_start = pipeline.broker.stats().published;
+  uint32_t scaled_start[2] = {pipeline.substreams[0].stats().published,
+                              pipeline.substreams[1].stats().published};
+  g_measuring = true;
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds((int)(bench.duration_s * 1000)));
+  g_measuring = false;
+  uint64_t allocs = host_alloc_count() - allocs_start;
+  uint32_t published = pipeline.broker.stats().published - published_start;
+  uint32_t scaled[2] = {
+      pipeline.substreams[0].stats().published - scaled_start[0],
+      pipeline.substreams[1].stats().published - scaled_start[1]};
+  g_stop = true;
+  for (std::thread &t : threads)
+    t.join();
+
+  printf("%-11s %7s %8s %8s %8s %8s %12s %8s\n", "client", "fps", "p50 ms",
+         "p90 ms", "p99 ms", "max ms", "bytes/frame", "frames");
+  uint64_t delivered = 0;
+  for (ClientResult &r : results) {
+    delivered += r.frames;
+    printf("%-11s %7.2f", r.name.c_str(), r.frames / bench.duration_s);
+    printMs(stdout, percentile(&r.latency_us, 0.5));
+    printMs(stdout, percentile(&r.latency_us, 0.9));
+    printMs(stdout, percentile(&r.latency_us, 0.99));
+    printMs(stdout, percentile(&r.latency_us, 1.0));
+    printf(" %12llu %8llu%s\n",
+           (unsigned long long)(r.frames ? r.wire_bytes / r.frames : 0),
+           (unsigned long long)r.frames, r.failed ? "  FAILED" : "");
+  }
+  if (in_process) {
+    printf("sensor frames published: %u (%.2f fps)\n", published,
+           published / bench.duration_s);
+    if (scaled[0] || scaled[1])
+      printf("substream frames scaled: %u at 1/2, %u at 1/4\n", scaled[0],
+             scaled[1]);
+    printf("heap allocations: %llu (%.2f per published frame, %.2f per "
+           "delivered frame)\n",
+           (unsigned long long)allocs,
+           published ? (double)allocs / published : 0.0,
+           delivered ? (double)allocs / delivered : 0.0);
+  }
+
+  if (bench.json) {
+    FILE *out = fopen(bench.json, "w");
+    if (!out) {
+      perror(bench.json);
+      return 1;
+    }
+    fprintf(out, "{\"duration_s\":%g,\"clients\":[", bench.duration_s);
+    for (size_t i = 0; i < results.size(); i++) {
+      ClientResult &r = results[i];
+      fprintf(out,
+              "%s{\"name\":\"%s\",\"fps\":%.3f,\"frames\":%llu,"
+              "\"bytes_per_frame\":%llu,\"p50_ms\":%.3f,\"p90_ms\":%.3f,"
+              "\"p99_ms\":%.3f,\"failed\":%s}",
+              i ? "," : "", r.name.c_str(), r.frames / bench.duration_s,
+              (unsigned long long)r.frames,
+              (unsigned long long)(r.frames ? r.wire_bytes / r.frames : 0),
+              percentile(&r.latency_us, 0.5) / 1000.0,
+              percentile(&r.latency_us, 0.9) / 1000.0,
+              percentile(&r.latency_us, 0.99) / 1000.0,
+              r.failed ? "true" : "false");
+    }
+    fprintf(out, "]");
+    if (in_process)
+      fprintf(out,
+              ",\"published\":%u,\"allocations\":%llu,"
+              "\"allocations_per_frame\":%.3f",
+              published, (unsigned long long)allocs,
+              published ? (double)allocs / published : 0.0);
+    fprintf(out, "}\n");
+    fclose(out);
+  }
+
+  fflush(stdout);
+  // Server and capture tasks are detached threads; leave without running
+  // static destructors underneath them.
+  _exit(0);
+}
@@ -0,0 +1,37 @@
+// Runs the camera firmware's pipeline and handlers as a Linux process, fed
+// by the simulated sensor. Point a browser, curl, ffmpeg or Frigate at it
+// like at a board.
+
+#include <esp_log.h>
+
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "host_firmware.h"
+
+static const char *TAG = "camera_host";
+
+int main(int argc, char **argv) {
+  camcore::HostFirmwareConfig config;
+  for (int i = 1; i < argc; i++) {
+    if (!camcore::parseFirmwareOption(argc, argv, &i, &config)) {
+      fprintf(stderr, "usage: %s [options]\n", argv[0]);
+      camcore::printFirmwareUsage();
+      return strcmp(argv[i], "--help") == 0 ? 0 : 2;
+    }
+  }
+
+  static camcore::CameraPipeline pipeline;
+  httpd_handle_t server = nullptr;
+  if (!camcore::startHostFirmware(config, &pipeline, &server))
+    return 1;
+
+  ESP_LOGI(TAG, "Stream:   http://localhost:%u/stream", config.port);
+  ESP_LOGI(TAG, "Snapshot: http://localhost:%u/capture", config.port);
+  ESP_LOGI(TAG, "Clip:     http://localhost:%u/clip?seconds=10",
+           config.port);
+  ESP_LOGI(TAG, "Metrics:  http://localhost:%u/metrics", config.port);
+  while (true)
+    std::this_thread::sleep_for(std::chrono::hours(1));
+}
@@ -0,0 +1,285 @@
+#include <esp_camera.h>
+#include <host_camera.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <host_alloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "host_jpeg.h"
+#include "jpeg_decoder.h"
+
+static const char *TAG = "camera";
+
+extern "C" const resolution_info_t resolution[FRAMESIZE_INVALID] = {
+    {96, 96},   {160, 120}, {176, 144},  {240, 176},  {240, 240},
+    {320, 240}, {400, 296}, {480, 320},  {640, 480},  {800, 600},
+    {1024, 768}, {1280, 720}, {1280, 1024}, {1600, 1200},
+};
+
+namespace {
+
+struct RecordedFrame {
+  std::vector<uint8_t> data;
+  int width;
+  int height;
+};
+
+struct HostCamera {
+  host_camera_config_t config = {15, nullptr};
+  camera_config_t camera;
+  sensor_t sensor;
+  std::mutex mutex;  // sensor settings
+
+  int64_t start_us = 0;
+  int64_t interval_us = 0;
+  int64_t last_frame = -1;  // grid index of the last frame handed out
+  bool fb_out = false;
+
+  std::vector<RecordedFrame> recorded;
+  size_t next_recorded = 0;
+
+  camera_fb_t fb;
+  std::vector<uint8_t> pixels;  // RGB888 scene
+  std::vector<uint8_t> frame;   // delivered buffer
+};
+
+HostCamera s_cam;
+
+void loadRecorded(const char *dir) {
+  DIR *d = opendir(dir);
+  if (!d) {
+    ESP_LOGE(TAG, "Cannot open %s", dir);
+    return;
+  }
+  std::vector<std::string> names;
+  while (struct dirent *e = readdir(d)) {
+    std::string name = e->d_name;
+    size_t dot = name.rfind('.');
+    std::string ext = dot == std::string::npos ? "" : name.substr(dot);
+    if (ext == ".jpg" || ext == ".jpeg" || ext == ".JPG")
+      names.push_back(std::string(dir) + "/" + name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+
+  for (const std::string &path : names) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+      continue;
+    RecordedFrame frame;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+      frame.data.insert(frame.data.end(), chunk, chunk + n);
+    fclose(f);
+    if (!camcore::jpegDimensions(frame.data.data(), frame.data.size(),
+                                 &frame.width, &frame.height)) {
+      ESP_LOGW(TAG, "Skipping %s: not a JPEG", path.c_str());
+      continue;
+    }
+    s_cam.recorded.push_back(std::move(frame));
+  }
+  ESP_LOGI(TAG, "Loaded %u recorded frames from %s",
+           (unsigned)s_cam.recorded.size(), dir);
+}
+
+// Gradient background with a 1/6-width box that bounces for 3 s and then
+// rests for 5 s.
+void renderScene(int width, int height, int64_t t_us) {
+  s_cam.pixels.resize((size_t)width * height * 3);
+  int64_t cycle_ms = (t_us / 1000) % 8000;
+  int64_t moving_ms = cycle_ms < 3000 ? cycle_ms : 3000;
+  int box = width / 6;
+  int travel = width - box;
+  int pos = (int)((moving_ms * width / 1500) % (2 * travel));
+  int bx = pos < travel ? pos : 2 * travel - pos;
+  int by = height / 2 - box / 2;
+
+  for (int y = 0; y < height; y++) {
+    uint8_t *row = &s_cam.pixels[(size_t)y * width * 3];
+    for (int x = 0; x < width; x++) {
+      bool in_box = x >= bx && x < bx + box && y >= by && y < by + box;
+      row[3 * x] = in_box ? 230 : (uint8_t)(x * 255 / width);
+      row[3 * x + 1] = in_box ? 40 : (uint8_t)(y * 255 / height);
+      row[3 * x + 2] = in_box ? 40 : 128;
+    }
+  }
+}
+
+void sceneRow(void *ctx, int y, uint8_t *row) {
+  int width = *static_cast<int *>(ctx);
+  memcpy(row, &s_cam.pixels[(size_t)y * width * 3], width * 3);
+}
+
+size_t appendFrame(void *arg, size_t index, const void *data, size_t len) {
+  (void)arg;
+  (void)index;
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  s_cam.frame.insert(s_cam.frame.end(), bytes, bytes + len);
+  return len;
+}
+
+// The OV2640's 0-63 scale (lower is better) mapped onto libjpeg's.
+int libjpegQuality(int sensor_quality) {
+  int q = 100 - sensor_quality * 3 / 2;
+  return q < 5 ? 5 : (q > 95 ? 95 : q);
+}
+
+void produceFrame(int64_t t_us) {
+  camera_fb_t *fb = &s_cam.fb;
+  fb->timestamp.tv_sec = t_us / 1000000;
+  fb->timestamp.tv_usec = t_us % 1000000;
+
+  if (!s_cam.recorded.empty()) {
+    RecordedFrame &rec = s_cam.recorded[s_cam.next_recorded];
+    s_cam.next_recorded = (s_cam.next_recorded + 1) % s_cam.recorded.size();
+    fb->buf = rec.data.data();
+    fb->len = rec.data.size();
+    fb->width = rec.width;
+    fb->height = rec.height;
+    fb->format = PIXFORMAT_JPEG;
+    return;
+  }
+
+  framesize_t size;
+  int quality;
+  {
+    std::lock_guard<std::mutex> lock(s_cam.mutex);
+    size = s_cam.sensor.status.framesize;
+    quality = s_cam.sensor.status.quality;
+  }
+  int width = resolution[size].width;
+  int height = resolution[size].height;
+  renderScene(width, height, t_us);
+  fb->width = width;
+  fb->height = height;
+  fb->format = s_cam.camera.pixel_format;
+
+  s_cam.frame.clear();
+  switch (fb->format) {
+  case PIXFORMAT_JPEG:
+    hostJpegEncode(width, height, 3, libjpegQuality(quality), sceneRow,
+                   &width, appendFrame, nullptr);
+    break;
+  case PIXFORMAT_RGB565:
+    for (size_t i = 0; i < s_cam.pixels.size(); i += 3) {
+      uint16_t p = ((s_cam.pixels[i] & 0xF8) << 8) |
+                   ((s_cam.pixels[i + 1] & 0xFC) << 3) |
+                   (s_cam.pixels[i + 2] >> 3);
+      s_cam.frame.push_back(p >> 8);
+      s_cam.frame.push_back(p & 0xFF);
+    }
+    break;
+  case PIXFORMAT_GRAYSCALE:
+    for (size_t i = 0; i < s_cam.pixels.size(); i += 3)
+      s_cam.frame.push_back((s_cam.pixels[i] * 77 + s_cam.pixels[i + 1] * 150 +
+                             s_cam.pixels[i + 2] * 29) >>
+                            8);
+    break;
+  default:  // RGB888, stored B, G, R as esp32-camera does
+    for (size_t i = 0; i < s_cam.pixels.size(); i += 3) {
+      s_cam.frame.push_back(s_cam.pixels[i + 2]);
+      s_cam.frame.push_back(s_cam.pixels[i + 1]);
+      s_cam.frame.push_back(s_cam.pixels[i]);
+    }
+    fb->format = PIXFORMAT_RGB888;
+    break;
+  }
+  fb->buf = s_cam.frame.data();
+  fb->len = s_cam.frame.size();
+}
+
+int setFramesize(sensor_t *sensor, framesize_t framesize) {
+  if (framesize >= FRAMESIZE_INVALID)
+    return -1;
+  std::lock_guard<std::mutex> lock(s_cam.mutex);
+  sensor->status.framesize = framesize;
+  return 0;
+}
+
+int setQuality(sensor_t *sensor, int quality) {
+  std::lock_guard<std::mutex> lock(s_cam.mutex);
+  sensor->status.quality = quality;
+  return 0;
+}
+
+int setLevel(sensor_t *sensor, int level) {
+  (void)sensor;
+  (void)level;
+  return 0;
+}
+
+}  // namespace
+
+extern "C" void host_camera_configure(const host_camera_config_t *config) {
+  s_cam.config = *config;
+}
+
+extern "C" esp_err_t esp_camera_init(const camera_config_t *config) {
+  HostAllocUntracked untracked;
+  s_cam.camera = *config;
+  memset(&s_cam.sensor, 0, sizeof(s_cam.sensor));
+  s_cam.sensor.status.framesize = config->frame_size;
+  s_cam.sensor.status.quality = config->jpeg_quality;
+  s_cam.sensor.pixformat = config->pixel_format;
+  s_cam.sensor.set_framesize = setFramesize;
+  s_cam.sensor.set_quality = setQuality;
+  s_cam.sensor.set_brightness = setLevel;
+  s_cam.sensor.set_contrast = setLevel;
+  s_cam.sensor.set_saturation = setLevel;
+
+  if (s_cam.config.jpeg_dir) {
+    loadRecorded(s_cam.config.jpeg_dir);
+    if (s_cam.recorded.empty())
+      return ESP_ERR_NOT_FOUND;
+  }
+  float fps = s_cam.config.fps > 0 ? s_cam.config.fps : 15;
+  s_cam.interval_us = (int64_t)(1000000 / fps);
+  s_cam.start_us = esp_timer_get_time();
+  s_cam.last_frame = -1;
+  // Size the frame buffer for the largest frame up front, like the
+  // driver's fixed framebuffers.
+  s_cam.frame.reserve(1600 * 1200 * 3);
+  ESP_LOGI(TAG, "Simulated sensor: %s at %.1f fps",
+           s_cam.recorded.empty() ? "test scene" : "recorded JPEGs", fps);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t esp_camera_deinit(void) {
+  s_cam.recorded.clear();
+  return ESP_OK;
+}
+
+extern "C" camera_fb_t *esp_camera_fb_get(void) {
+  if (s_cam.interval_us == 0 || s_cam.fb_out)
+    return nullptr;
+  int64_t now = esp_timer_get_time();
+  int64_t latest = (now - s_cam.start_us) / s_cam.interval_us;
+  int64_t index = latest > s_cam.last_frame ? latest : s_cam.last_frame + 1;
+  int64_t due_us = s_cam.start_us + index * s_cam.interval_us;
+  if (due_us > now)
+    std::this_thread::sleep_for(std::chrono::microseconds(due_us - now));
+  s_cam.last_frame = index;
+
+  HostAllocUntracked untracked;
+  produceFrame(due_us);
+  s_cam.fb_out = true;
+  return &s_cam.fb;
+}
+
+extern "C" void esp_camera_fb_return(camera_fb_t *fb) {
+  if (fb == &s_cam.fb)
+    s_cam.fb_out = false;
+}
+
+extern "C" sensor_t *esp_camera_sensor_get(void) { return &s_cam.sensor; }
@@ -0,0 +1,627 @@
+#include <esp_http_server.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+
+static const char *TAG = "httpd";
+
+namespace {
+
+const size_t kMaxRequestHead = 2048;
+const int kMaxRequestHeaders = 24;
+
+struct Header {
+  const char *field;
+  const char *value;
+};
+
+enum SessionState { kFree, kIdle, kHandling, kDetached };
+
+// Everything a request needs lives in its session, allocated once by
+// httpd_start(), so serving a request never touches the heap.
+struct Session {
+  int fd = -1;
+  SessionState state = kFree;
+  int64_t last_used_us = 0;
+  char recv[kMaxRequestHead];
+  size_t recv_len = 0;
+
+  httpd_req_t req;
+  char head[kMaxRequestHead];  // parsed copy of the request head
+  Header headers[kMaxRequestHeaders];
+  int header_count = 0;
+  const char *query = nullptr;
+  bool keep_alive = true;
+
+  const char *status = nullptr;
+  const char *content_type = nullptr;
+  Header *resp_headers = nullptr;
+  int resp_header_count = 0;
+  bool head_sent = false;
+  bool chunked = false;
+  bool complete = false;  // response fully sent
+  bool failed = false;
+  // Set by httpd_req_async_handler_begin(). Unlike `state`, it is only
+  // reset by the server task, so it can be read after the handler returns
+  // even if the async task has already finished.
+  bool detached = false;
+};
+
+struct Server {
+  httpd_config_t config;
+  int listen_fd = -1;
+  int wake_pipe[2] = {-1, -1};
+  std::thread thread;
+  std::atomic<bool> running{false};
+
+  std::mutex mutex;  // session states
+  Session *sessions = nullptr;
+  Header *resp_headers = nullptr;
+  httpd_uri_t *handlers = nullptr;
+  int handler_count = 0;
+};
+
+Session *sessionOf(httpd_req_t *req) {
+  return static_cast<Session *>(req->aux);
+}
+
+void wake(Server *server) {
+  char c = 0;
+  ssize_t n = write(server->wake_pipe[1], &c, 1);
+  (void)n;
+}
+
+void closeSession(Server *server, Session *s) {
+  std::lock_guard<std::mutex> lock(server->mutex);
+  if (s->fd >= 0)
+    close(s->fd);
+  s->fd = -1;
+  s->state = kFree;
+}
+
+bool sendAll(Session *s, struct iovec *iov, int count) {
+  while (count > 0) {
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    ssize_t n = sendmsg(s->fd, &msg, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    while (count > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+// Formats the status line and headers into `buf`.
+size_t formatHead(Session *s, char *buf, size_t len, ssize_t content_len) {
+  size_t n = snprintf(buf, len, "HTTP/1.1 %s\r\nContent-Type: %s\r\n",
+                      s->status ? s->status : "200 OK",
+                      s->content_type ? s->content_type : "text/html");
+  if (content_len >= 0)
+    n += snprintf(buf + n, len - n, "Content-Length: %d\r\n",
+                  (int)content_len);
+  else
+    n += snprintf(buf + n, len - n, "Transfer-Encoding: chunked\r\n");
+  for (int i = 0; i < s->resp_header_count && n < len; i++)
+    n += snprintf(buf + n, len - n, "%s: %s\r\n", s->resp_headers[i].field,
+                  s->resp_headers[i].value);
+  if (!s->keep_alive && n < len)
+    n += snprintf(buf + n, len - n, "Connection: close\r\n");
+  if (n < len)
+    n += snprintf(buf + n, len - n, "\r\n");
+  return n < len ? n : len;
+}
+
+bool parseRequest(Server *server, Session *s, size_t head_len) {
+  memcpy(s->head, s->recv, head_len);
+  s->head[head_len] = '\0';
+  s->header_count = 0;
+
+  char *line_end = strstr(s->head, "\r\n");
+  *line_end = '\0';
+  char *method = s->head;
+  char *uri = strchr(method, ' ');
+  if (!uri)
+    return false;
+  *uri++ = '\0';
+  char *version = strchr(uri, ' ');
+  if (!version)
+    return false;
+  *version++ = '\0';
+  if (strlen(uri) > HTTPD_MAX_URI_LEN)
+    return false;
+
+  httpd_req_t *req = &s->req;
+  memset(req, 0, sizeof(*req));
+  req->handle = server;
+  req->aux = s;
+  strcpy(req->uri, uri);
+  if (strcmp(method, "GET") == 0)
+    req->method = HTTP_GET;
+  else if (strcmp(method, "HEAD") == 0)
+    req->method = HTTP_HEAD;
+  else if (strcmp(method, "POST") == 0)
+    req->method = HTTP_POST;
+  else if (strcmp(method, "PUT") == 0)
+    req->method = HTTP_PUT;
+  else if (strcmp(method, "DELETE") == 0)
+    req->method = HTTP_DELETE;
+  else
+    return false;
+  char *q = strchr(req->uri, '?');
+  s->query = q ? q + 1 : nullptr;
+  s->keep_alive = strcmp(version, "HTTP/1.0") != 0;
+
+  char *p = line_end + 2;
+  while (*p && s->header_count < kMaxRequestHeaders) {
+    char *end = strstr(p, "\r\n");
+    if (!end || end == p)
+      break;
+    *end = '\0';
+    char *colon = strchr(p, ':');
+    if (colon) {
+      *colon = '\0';
+      char *value = colon + 1;
+      while (*value == ' ')
+        value++;
+      s->headers[s->header_count++] = Header{p, value};
+      if (strcasecmp(p, "Connection") == 0)
+        s->keep_alive = strcasecmp(value, "close") != 0;
+      else if (strcasecmp(p, "Content-Length") == 0)
+        req->content_len = strtoul(value, nullptr, 10);
+    }
+    p = end + 2;
+  }
+
+  s->status = nullptr;
+  s->content_type = nullptr;
+  s->resp_header_count = 0;
+  s->head_sent = s->chunked = s->complete = s->failed = false;
+  s->detached = false;
+  return true;
+}
+
+void sendError(Session *s, const char *status) {
+  s->status = status;
+  s->content_type = "text/plain";
+  httpd_resp_sendstr(&s->req, status);
+}
+
+// Back to the poll set if the connection can take another request.
+void finishRequest(Server *server, Session *s) {
+  bool reuse = s->keep_alive && !s->failed && s->complete;
+  if (!reuse) {
+    closeSession(server, s);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(server->mutex);
+  s->state = kIdle;
+  s->last_used_us = esp_timer_get_time();
+}
+
+void dispatch(Server *server, Session *s) {
+  httpd_req_t *req = &s->req;
+  size_t path_len = strcspn(req->uri, "?");
+  const httpd_uri_t *match = nullptr;
+  bool path_found = false;
+  for (int i = 0; i < server->handler_count; i++) {
+    const httpd_uri_t &h = server->handlers[i];
+    if (strlen(h.uri) == path_len && strncmp(h.uri, req->uri, path_len) == 0) {
+      path_found = true;
+      if ((int)h.method == req->method) {
+        match = &h;
+        break;
+      }
+    }
+  }
+
+  if (!match) {
+    sendError(s, path_found ? "405 Method Not Allowed" : "404 Not Found");
+    finishRequest(server, s);
+    return;
+  }
+
+  req->user_ctx = match->user_ctx;
+  esp_err_t res = match->handler(req);
+  if (s->detached)
+    return;  // the async task finishes the request
+  if (res != ESP_OK)
+    s->failed = true;
+  finishRequest(server, s);
+}
+
+// Reads what is available; dispatches once a full request head is in.
+void readSession(Server *server, Session *s) {
+  ssize_t n = recv(s->fd, s->recv + s->recv_len,
+                   sizeof(s->recv) - s->recv_len - 1, MSG_DONTWAIT);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+    closeSession(server, s);
+    return;
+  }
+  if (n < 0)
+    return;
+  s->recv_len += n;
+  s->recv[s->recv_len] = '\0';
+
+  char *end = strstr(s->recv, "\r\n\r\n");
+  if (!end) {
+    if (s->recv_len >= sizeof(s->recv) - 1)
+      closeSession(server, s);  // head too large
+    return;
+  }
+  size_t head_len = end - s->recv + 4;
+  bool ok = parseRequest(server, s, head_len - 2);
+  // Request bodies are not supported; drop what arrived of one.
+  size_t consumed = head_len + s->req.content_len;
+  if (consumed > s->recv_len)
+    consumed = s->recv_len;
+  memmove(s->recv, s->recv + consumed, s->recv_len - consumed);
+  s->recv_len -= consumed;
+  if (!ok) {
+    closeSession(server, s);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(server->mutex);
+    s->state = kHandling;
+    s->last_used_us = esp_timer_get_time();
+  }
+  dispatch(server, s);
+}
+
+void acceptClient(Server *server) {
+  int fd = accept4(server->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd < 0)
+    return;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  struct timeval tv = {server->config.send_wait_timeout, 0};
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  if (const char *sndbuf = getenv("CAMCORE_HTTPD_SNDBUF")) {
+    int size = atoi(sndbuf);
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  }
+
+  std::lock_guard<std::mutex> lock(server->mutex);
+  Session *free_slot = nullptr;
+  Session *lru = nullptr;
+  for (int i = 0; i < server->config.max_open_sockets; i++) {
+    Session *s = &server->sessions[i];
+    if (s->state == kFree && !free_slot)
+      free_slot = s;
+    if (s->state == kIdle && (!lru || s->last_used_us < lru->last_used_us))
+      lru = s;
+  }
+  if (!free_slot && server->config.lru_purge_enable && lru) {
+    ESP_LOGW(TAG, "Purging least recently used socket %d", lru->fd);
+    close(lru->fd);
+    lru->fd = -1;
+    lru->state = kFree;
+    free_slot = lru;
+  }
+  if (!free_slot) {
+    ESP_LOGW(TAG, "No free session for new connection");
+    close(fd);
+    return;
+  }
+  free_slot->fd = fd;
+  free_slot->state = kIdle;
+  free_slot->recv_len = 0;
+  free_slot->last_used_us = esp_timer_get_time();
+}
+
+void serverTask(Server *server) {
+  int max = server->config.max_open_sockets;
+  struct pollfd *fds = new struct pollfd[max + 2];
+  Session **owners = new Session *[max + 2];
+  while (server->running) {
+    int count = 0;
+    fds[count++] = {server->listen_fd, POLLIN, 0};
+    fds[count++] = {server->wake_pipe[0], POLLIN, 0};
+    {
+      std::lock_guard<std::mutex> lock(server->mutex);
+      for (int i = 0; i < max; i++) {
+        Session *s = &server->sessions[i];
+        if (s->state == kIdle) {
+          owners[count] = s;
+          fds[count++] = {s->fd, POLLIN, 0};
+        }
+      }
+    }
+    if (poll(fds, count, 1000) <= 0)
+      continue;
+    if (fds[1].revents) {
+      char drain[16];
+      ssize_t n = read(server->wake_pipe[0], drain, sizeof(drain));
+      (void)n;
+    }
+    if (fds[0].revents & POLLIN)
+      acceptClient(server);
+    for (int i = 2; i < count; i++)
+      if (fds[i].revents)
+        readSession(server, owners[i]);
+  }
+  delete[] fds;
+  delete[] owners;
+}
+
+}  // namespace
+
+extern "C" esp_err_t httpd_start(httpd_handle_t *handle,
+                                 const httpd_config_t *config) {
+  int fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return ESP_FAIL;
+  int one = 1, zero = 0;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+  struct sockaddr_in6 addr = {};
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(config->server_port);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, config->backlog_conn) != 0) {
+    ESP_LOGE(TAG, "Cannot listen on port %u (errno %d)",
+             (unsigned)config->server_port, errno);
+    close(fd);
+    return ESP_FAIL;
+  }
+
+  Server *server = new Server();
+  server->config = *config;
+  server->listen_fd = fd;
+  if (pipe2(server->wake_pipe, O_CLOEXEC) != 0) {
+    close(fd);
+    delete server;
+    return ESP_FAIL;
+  }
+  server->sessions = new Session[config->max_open_sockets];
+  server->resp_headers =
+      new Header[config->max_open_sockets * config->max_resp_headers];
+  for (int i = 0; i < config->max_open_sockets; i++)
+    server->sessions[i].resp_headers =
+        server->resp_headers + i * config->max_resp_headers;
+  server->handlers = new httpd_uri_t[config->max_uri_handlers];
+  server->running = true;
+  server->thread = std::thread(serverTask, server);
+  ESP_LOGI(TAG, "Started server on port: '%u'",
+           (unsigned)config->server_port);
+  *handle = server;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t httpd_stop(httpd_handle_t handle) {
+  Server *server = static_cast<Server *>(handle);
+  if (!server)
+    return ESP_ERR_INVALID_ARG;
+  server->running = false;
+  wake(server);
+  server->thread.join();
+  close(server->listen_fd);
+  // Sessions owned by async tasks stay open; those tasks still hold them.
+  for (int i = 0; i < server->config.max_open_sockets; i++) {
+    Session *s = &server->sessions[i];
+    if (s->state == kIdle)
+      closeSession(server, s);
+  }
+  return ESP_OK;
+}
+
+extern "C" esp_err_t httpd_register_uri_handler(
+    httpd_handle_t handle, const httpd_uri_t *uri_handler) {
+  Server *server = static_cast<Server *>(handle);
+  if (!server || !uri_handler)
+    return ESP_ERR_INVALID_ARG;
+  for (int i = 0; i < server->handler_count; i++)
+    if (strcmp(server->handlers[i].uri, uri_handler->uri) == 0 &&
+        server->handlers[i].method == uri_handler->method)
+      return ESP_ERR_HTTPD_HANDLER_EXISTS;
+  if (server->handler_count >= server->config.max_uri_handlers)
+    return ESP_ERR_HTTPD_HANDLERS_FULL;
+  server->handlers[server->handler_count++] = *uri_handler;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t httpd_get_client_list(httpd_handle_t handle, size_t *fds,
+                                           int *client_fds) {
+  Server *server = static_cast<Server *>(handle);
+  if (!server || !fds || !client_fds)
+    return ESP_ERR_INVALID_ARG;
+  std::lock_guard<std::mutex> lock(server->mutex);
+  size_t n = 0;
+  for (int i = 0; i < server->config.max_open_sockets; i++) {
+    const Session &s = server->sessions[i];
+    if (s.state == kFree)
+      continue;
+    if (n >= *fds)
+      return ESP_ERR_INVALID_ARG;
+    client_fds[n++] = s.fd;
+  }
+  *fds = n;
+  return ESP_OK;
+}
+
+extern "C" size_t httpd_req_get_url_query_len(httpd_req_t *req) {
+  const char *query = sessionOf(req)->query;
+  return query ? strlen(query) : 0;
+}
+
+extern "C" esp_err_t httpd_req_get_url_query_str(httpd_req_t *req, char *buf,
+                                                 size_t buf_len) {
+  const char *query = sessionOf(req)->query;
+  if (!query)
+    return ESP_ERR_NOT_FOUND;
+  if (buf_len == 0)
+    return ESP_ERR_INVALID_ARG;
+  snprintf(buf, buf_len, "%s", query);
+  return strlen(query) < buf_len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+extern "C" esp_err_t httpd_query_key_value(const char *qry, const char *key,
+                                           char *val, size_t val_size) {
+  if (!qry || !key || !val || val_size == 0)
+    return ESP_ERR_INVALID_ARG;
+  size_t key_len = strlen(key);
+  const char *p = qry;
+  while (*p) {
+    const char *end = strchr(p, '&');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+    if (len > key_len && strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+      const char *value = p + key_len + 1;
+      size_t value_len = len - key_len - 1;
+      size_t copy = value_len < val_size - 1 ? value_len : val_size - 1;
+      memcpy(val, value, copy);
+      val[copy] = '\0';
+      return copy == value_len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+    }
+    if (!end)
+      break;
+    p = end + 1;
+  }
+  return ESP_ERR_NOT_FOUND;
+}
+
+static const char *findHeader(httpd_req_t *req, const char *field) {
+  Session *s = sessionOf(req);
+  for (int i = 0; i < s->header_count; i++)
+    if (strcasecmp(s->headers[i].field, field) == 0)
+      return s->headers[i].value;
+  return nullptr;
+}
+
+extern "C" size_t httpd_req_get_hdr_value_len(httpd_req_t *req,
+                                              const char *field) {
+  const char *value = findHeader(req, field);
+  return value ? strlen(value) : 0;
+}
+
+extern "C" esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req,
+                                                 const char *field, char *val,
+                                                 size_t val_size) {
+  const char *value = findHeader(req, field);
+  if (!value)
+    return ESP_ERR_NOT_FOUND;
+  snprintf(val, val_size, "%s", value);
+  return strlen(value) < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+extern "C" int httpd_req_to_sockfd(httpd_req_t *req) {
+  return sessionOf(req)->fd;
+}
+
+extern "C" esp_err_t httpd_req_async_handler_begin(httpd_req_t *req,
+                                                   httpd_req_t **out) {
+  Session *s = sessionOf(req);
+  Server *server = static_cast<Server *>(req->handle);
+  std::lock_guard<std::mutex> lock(server->mutex);
+  s->state = kDetached;
+  s->detached = true;
+  *out = req;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t httpd_req_async_handler_complete(httpd_req_t *req) {
+  Server *server = static_cast<Server *>(req->handle);
+  finishRequest(server, sessionOf(req));
+  wake(server);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t httpd_resp_set_status(httpd_req_t *req,
+                                           const char *status) {
+  sessionOf(req)->status = status;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type) {
+  sessionOf(req)->content_type = type;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field,
+                                        const char *value) {
+  Session *s = sessionOf(req);
+  Server *server = static_cast<Server *>(req->handle);
+  if (s->resp_header_count >= server->config.max_resp_headers)
+    return ESP_ERR_HTTPD_RESP_HDR;
+  s->resp_headers[s->resp_header_count++] = Header{field, value};
+  return ESP_OK;
+}
+
+extern "C" esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf,
+                                     ssize_t len) {
+  Session *s = sessionOf(req);
+  if (len == HTTPD_RESP_USE_STRLEN)
+    len = buf ? strlen(buf) : 0;
+  char head[1024];
+  struct iovec iov[2] = {
+      {head, formatHead(s, head, sizeof(head), len)},
+      {const_cast<char *>(buf), req->method == HTTP_HEAD ? 0 : (size_t)len}};
+  s->head_sent = true;
+  s->complete = true;
+  if (!sendAll(s, iov, iov[1].iov_len ? 2 : 1)) {
+    s->failed = true;
+    return ESP_ERR_HTTPD_RESP_SEND;
+  }
+  return ESP_OK;
+}
+
+extern "C" esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf,
+                                           ssize_t len) {
+  Session *s = sessionOf(req);
+  if (len == HTTPD_RESP_USE_STRLEN || !buf)
+    len = buf ? strlen(buf) : 0;
+  char head[1024];
+  char size_line[16];
+  struct iovec iov[4];
+  int count = 0;
+  if (!s->head_sent) {
+    s->chunked = true;
+    s->head_sent = true;
+    iov[count++] = {head, formatHead(s, head, sizeof(head), -1)};
+  }
+  iov[count++] = {size_line, (size_t)snprintf(size_line, sizeof(size_line),
+                                              "%x\r\n", (unsigned)len)};
+  if (len > 0)
+    iov[count++] = {const_cast<char *>(buf), (size_t)len};
+  iov[count++] = {const_cast<char *>("\r\n"), 2};
+  if (len == 0 || !buf)
+    s->complete = true;
+  if (!sendAll(s, iov, count)) {
+    s->failed = true;
+    return ESP_ERR_HTTPD_RESP_SEND;
+  }
+  return ESP_OK;
+}
+
+extern "C" esp_err_t httpd_resp_sendstr(httpd_req_t *req, const char *str) {
+  return httpd_resp_send(req, str, HTTPD_RESP_USE_STRLEN);
+}
@@ -0,0 +1,165 @@
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <host_alloc.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+static const char *TAG = "freertos";
+
+namespace {
+
+// Thrown by vTaskDelete(NULL) to unwind the calling task's thread.
+struct TaskExit {};
+
+struct TaskStart {
+  TaskFunction_t fn;
+  void *arg;
+};
+
+thread_local int t_core_id = 0;
+
+void runTask(TaskStart start, int core) {
+  t_core_id = core;
+  try {
+    start.fn(start.arg);
+  } catch (const TaskExit &) {
+    host_alloc_untracked_end();
+  }
+}
+
+}  // namespace
+
+extern "C" BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn,
+                                              const char *name,
+                                              uint32_t stack_depth, void *arg,
+                                              UBaseType_t priority,
+                                              TaskHandle_t *handle,
+                                              BaseType_t core) {
+  (void)name;
+  (void)stack_depth;
+  (void)priority;
+  try {
+    std::thread(runTask, TaskStart{fn, arg},
+                core == tskNO_AFFINITY ? 0 : core % portNUM_PROCESSORS)
+        .detach();
+  } catch (const std::system_error &e) {
+    ESP_LOGE(TAG, "Cannot start task %s: %s", name, e.what());
+    return pdFAIL;
+  }
+  if (handle)
+    *handle = nullptr;  // tasks cannot be addressed from outside
+  return pdPASS;
+}
+
+extern "C" BaseType_t xTaskCreate(TaskFunction_t fn, const char *name,
+                                  uint32_t stack_depth, void *arg,
+                                  UBaseType_t priority,
+                                  TaskHandle_t *handle) {
+  return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, handle,
+                                 tskNO_AFFINITY);
+}
+
+extern "C" void vTaskDelete(TaskHandle_t task) {
+  // The exception object is heap-allocated; FreeRTOS has no equivalent, so
+  // keep it out of the allocation count.
+  if (task == nullptr) {
+    host_alloc_untracked_begin();
+    throw TaskExit();
+  }
+  ESP_LOGE(TAG, "Deleting another task is not supported on the host");
+}
+
+extern "C" void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+extern "C" TickType_t xTaskGetTickCount(void) {
+  return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+extern "C" BaseType_t xPortGetCoreID(void) { return t_core_id; }
+
+struct HostQueue {
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::vector<uint8_t> storage;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t head = 0;
+  UBaseType_t count = 0;
+};
+
+// Waits on `cond` until `ready` holds, for at most `ticks` (ms).
+template <typename Ready>
+static bool waitTicks(std::condition_variable &cond,
+                      std::unique_lock<std::mutex> &lock, TickType_t ticks,
+                      Ready ready) {
+  if (ticks == portMAX_DELAY) {
+    cond.wait(lock, ready);
+    return true;
+  }
+  return cond.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+extern "C" QueueHandle_t xQueueCreate(UBaseType_t length,
+                                      UBaseType_t item_size) {
+  if (length == 0 || item_size == 0)
+    return nullptr;
+  HostQueue *queue = new HostQueue;
+  queue->storage.resize((size_t)length * item_size);
+  queue->length = length;
+  queue->item_size = item_size;
+  return queue;
+}
+
+extern "C" void vQueueDelete(QueueHandle_t queue) { delete queue; }
+
+extern "C" BaseType_t xQueueSend(QueueHandle_t queue, const void *item,
+                                 TickType_t ticks_to_wait) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!waitTicks(queue->not_full, lock, ticks_to_wait,
+                 [queue] { return queue->count < queue->length; }))
+    return pdFAIL;
+  UBaseType_t tail = (queue->head + queue->count) % queue->length;
+  memcpy(&queue->storage[(size_t)tail * queue->item_size], item,
+         queue->item_size);
+  queue->count++;
+  queue->not_empty.notify_one();
+  return pdPASS;
+}
+
+extern "C" BaseType_t xQueueReceive(QueueHandle_t queue, void *item,
+                                    TickType_t ticks_to_wait) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!waitTicks(queue->not_empty, lock, ticks_to_wait,
+                 [queue] { return queue->count > 0; }))
+    return pdFALSE;
+  memcpy(item, &queue->storage[(size_t)queue->head * queue->item_size],
+         queue->item_size);
+  queue->head = (queue->head + 1) % queue->length;
+  queue->count--;
+  queue->not_full.notify_one();
+  return pdTRUE;
+}
+
+extern "C" BaseType_t xQueueReset(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  queue->head = 0;
+  queue->count = 0;
+  queue->not_full.notify_all();
+  return pdPASS;
+}
+
+extern "C" UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  return queue->count;
+}
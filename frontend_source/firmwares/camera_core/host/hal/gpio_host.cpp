@@ -0,0 +1,43 @@
+#include <driver/gpio.h>
+
+#include <esp_log.h>
+
+#include <atomic>
+
+static const char *TAG = "gpio";
+
+static std::atomic<uint8_t> s_levels[GPIO_NUM_MAX];
+static std::atomic<uint8_t> s_modes[GPIO_NUM_MAX];
+
+static bool validPin(gpio_num_t gpio_num) {
+  return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX;
+}
+
+extern "C" esp_err_t gpio_reset_pin(gpio_num_t gpio_num) {
+  if (!validPin(gpio_num))
+    return ESP_ERR_INVALID_ARG;
+  s_modes[gpio_num] = GPIO_MODE_INPUT;
+  s_levels[gpio_num] = 0;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t gpio_set_direction(gpio_num_t gpio_num,
+                                        gpio_mode_t mode) {
+  if (!validPin(gpio_num))
+    return ESP_ERR_INVALID_ARG;
+  s_modes[gpio_num] = mode;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+  if (!validPin(gpio_num))
+    return ESP_ERR_INVALID_ARG;
+  uint8_t value = level ? 1 : 0;
+  if (s_levels[gpio_num].exchange(value) != value)
+    ESP_LOGI(TAG, "GPIO%d -> %u", gpio_num, (unsigned)value);
+  return ESP_OK;
+}
+
+extern "C" int gpio_get_level(gpio_num_t gpio_num) {
+  return validPin(gpio_num) ? s_levels[gpio_num].load() : 0;
+}
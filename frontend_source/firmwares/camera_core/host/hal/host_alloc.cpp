@@ -0,0 +1,60 @@
+#include <host_alloc.h>
+
+#include <atomic>
+#include <cstddef>
+
+static std::atomic<uint64_t> s_allocs{0};
+static __thread int t_untracked = 0;
+
+extern "C" uint64_t host_alloc_count(void) { return s_allocs.load(); }
+extern "C" void host_alloc_untracked_begin(void) { t_untracked++; }
+extern "C" void host_alloc_untracked_end(void) { t_untracked--; }
+
+#ifdef CAMCORE_HOST_COUNT_ALLOCS
+
+// glibc's allocator entry points; everything below forwards to them.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+
+static inline void countAlloc() {
+  if (!t_untracked)
+    s_allocs.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" void *malloc(size_t size) {
+  countAlloc();
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+  countAlloc();
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+  countAlloc();
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size) {
+  countAlloc();
+  return __libc_memalign(alignment, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) {
+  countAlloc();
+  return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **out, size_t alignment, size_t size) {
+  countAlloc();
+  void *ptr = __libc_memalign(alignment, size);
+  if (!ptr)
+    return 12;  // ENOMEM
+  *out = ptr;
+  return 0;
+}
+
+#endif  // CAMCORE_HOST_COUNT_ALLOCS
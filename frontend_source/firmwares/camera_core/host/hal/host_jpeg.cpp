@@ -0,0 +1,147 @@
+#include "host_jpeg.h"
+
+#include <host_alloc.h>
+
+#include <csetjmp>
+#include <cstdio>
+#include <vector>
+
+#include <jpeglib.h>
+
+namespace {
+
+struct ErrorManager {
+  jpeg_error_mgr mgr;
+  jmp_buf jump;
+};
+
+void errorExit(j_common_ptr cinfo) {
+  ErrorManager *err = reinterpret_cast<ErrorManager *>(cinfo->err);
+  longjmp(err->jump, 1);
+}
+
+struct Destination {
+  jpeg_destination_mgr mgr;
+  jpg_out_cb out;
+  void *arg;
+  size_t index;
+  bool failed;
+  JOCTET buf[4096];
+};
+
+void flush(Destination *dest, size_t len) {
+  if (dest->failed || len == 0)
+    return;
+  if (dest->out(dest->arg, dest->index, dest->buf, len) != len)
+    dest->failed = true;  // keep draining; reported once finished
+  dest->index += len;
+}
+
+void initDestination(j_compress_ptr cinfo) {
+  Destination *dest = reinterpret_cast<Destination *>(cinfo->dest);
+  dest->mgr.next_output_byte = dest->buf;
+  dest->mgr.free_in_buffer = sizeof(dest->buf);
+}
+
+boolean emptyOutputBuffer(j_compress_ptr cinfo) {
+  Destination *dest = reinterpret_cast<Destination *>(cinfo->dest);
+  flush(dest, sizeof(dest->buf));
+  initDestination(cinfo);
+  return TRUE;
+}
+
+void termDestination(j_compress_ptr cinfo) {
+  Destination *dest = reinterpret_cast<Destination *>(cinfo->dest);
+  flush(dest, sizeof(dest->buf) - dest->mgr.free_in_buffer);
+}
+
+}  // namespace
+
+bool hostJpegEncode(int width, int height, int components, int quality,
+                    HostJpegRowFn rows, void *rows_ctx, jpg_out_cb out,
+                    void *out_arg) {
+  // libjpeg stands in for the sensor's or esp32-camera's encoder, whose
+  // allocations are not ours to count.
+  HostAllocUntracked untracked;
+
+  jpeg_compress_struct cinfo;
+  ErrorManager err;
+  Destination dest;
+  std::vector<uint8_t> row(width * components);
+
+  cinfo.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = errorExit;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_compress(&cinfo);
+    return false;
+  }
+  jpeg_create_compress(&cinfo);
+
+  dest.mgr.init_destination = initDestination;
+  dest.mgr.empty_output_buffer = emptyOutputBuffer;
+  dest.mgr.term_destination = termDestination;
+  dest.out = out;
+  dest.arg = out_arg;
+  dest.index = 0;
+  dest.failed = false;
+  cinfo.dest = &dest.mgr;
+
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = components;
+  cinfo.in_color_space = components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  if (components == 3) {
+    // 4:2:2 (16x8 MCUs), as the OV2640/OV5640 JPEG output.
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 1;
+  }
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    rows(rows_ctx, cinfo.next_scanline, row.data());
+    JSAMPROW row_ptr = row.data();
+    jpeg_write_scanlines(&cinfo, &row_ptr, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return !dest.failed;
+}
+
+bool hostJpegDecode(const uint8_t *jpeg, size_t len, int denom,
+                    jpg_writer_cb writer, void *arg) {
+  // Stands in for esp32-camera's decoder, as hostJpegEncode() does for
+  // its encoder.
+  HostAllocUntracked untracked;
+
+  jpeg_decompress_struct cinfo;
+  ErrorManager err;
+  std::vector<uint8_t> row;
+
+  cinfo.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = errorExit;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, jpeg, len);
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.out_color_space = JCS_RGB;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = denom;
+  jpeg_start_decompress(&cinfo);
+  uint16_t width = cinfo.output_width, height = cinfo.output_height;
+  row.resize((size_t)width * 3);
+  bool ok = writer(arg, 0, 0, width, height, nullptr);
+  while (ok && cinfo.output_scanline < height) {
+    uint16_t y = cinfo.output_scanline;
+    JSAMPROW row_ptr = row.data();
+    jpeg_read_scanlines(&cinfo, &row_ptr, 1);
+    ok = writer(arg, 0, y, width, 1, row.data());
+  }
+  if (ok)
+    jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return ok && writer(arg, width, height, width, height, nullptr);
+}
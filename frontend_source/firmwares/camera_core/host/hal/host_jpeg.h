@@ -0,0 +1,25 @@
+#pragma once
+
+// libjpeg wrapper shared by the simulated sensor, frame2jpg_cb() and
+// esp_jpg_decode().
+
+#include <cstddef>
+#include <cstdint>
+
+#include <img_converters.h>
+
+// Fills one row of `width * components` bytes (RGB or gray).
+typedef void (*HostJpegRowFn)(void *ctx, int y, uint8_t *row);
+
+// Compresses a width x height image, streaming the output to `out` the way
+// frame2jpg_cb() does. `quality` is libjpeg's 1-100. Returns false if the
+// encoder failed or `out` refused data.
+bool hostJpegEncode(int width, int height, int components, int quality,
+                    HostJpegRowFn rows, void *rows_ctx, jpg_out_cb out,
+                    void *out_arg);
+
+// Decodes at 1/`denom` (1, 2, 4 or 8) to RGB and hands it to `writer` the
+// way esp_jpg_decode() does, one row per call. Returns false if the data
+// did not decode or `writer` refused it.
+bool hostJpegDecode(const uint8_t *jpeg, size_t len, int denom,
+                    jpg_writer_cb writer, void *arg);
@@ -0,0 +1,77 @@
+#include <img_converters.h>
+
+#include <cstring>
+#include <vector>
+
+#include "host_jpeg.h"
+
+static void rowFromFrame(void *ctx, int y, uint8_t *row) {
+  const camera_fb_t *fb = static_cast<const camera_fb_t *>(ctx);
+  size_t width = fb->width;
+  switch (fb->format) {
+  case PIXFORMAT_RGB565: {
+    // Big-endian RGB565, as the sensor delivers it.
+    const uint8_t *src = fb->buf + (size_t)y * width * 2;
+    for (size_t x = 0; x < width; x++) {
+      uint16_t p = (src[2 * x] << 8) | src[2 * x + 1];
+      row[3 * x] = (p >> 8) & 0xF8;
+      row[3 * x + 1] = (p >> 3) & 0xFC;
+      row[3 * x + 2] = (p << 3) & 0xF8;
+    }
+    break;
+  }
+  case PIXFORMAT_RGB888: {
+    const uint8_t *src = fb->buf + (size_t)y * width * 3;
+    for (size_t x = 0; x < width; x++) {
+      row[3 * x] = src[3 * x + 2];
+      row[3 * x + 1] = src[3 * x + 1];
+      row[3 * x + 2] = src[3 * x];
+    }
+    break;
+  }
+  default:  // grayscale
+    memcpy(row, fb->buf + (size_t)y * width, width);
+    break;
+  }
+}
+
+extern "C" bool frame2jpg_cb(camera_fb_t *fb, int quality, jpg_out_cb cb,
+                             void *arg) {
+  int components;
+  switch (fb->format) {
+  case PIXFORMAT_RGB565:
+  case PIXFORMAT_RGB888:
+    components = 3;
+    break;
+  case PIXFORMAT_GRAYSCALE:
+    components = 1;
+    break;
+  default:
+    return false;
+  }
+  return hostJpegEncode(fb->width, fb->height, components,
+                        quality < 1 ? 1 : quality, rowFromFrame, fb, cb, arg);
+}
+
+extern "C" bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width,
+                           uint16_t height, pixformat_t format,
+                           uint8_t quality, jpg_out_cb cb, void *arg) {
+  camera_fb_t fb = {};
+  fb.buf = src;
+  fb.len = src_len;
+  fb.width = width;
+  fb.height = height;
+  fb.format = format;
+  return frame2jpg_cb(&fb, quality, cb, arg);
+}
+
+extern "C" esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale,
+                                    jpg_reader_cb reader, jpg_writer_cb writer,
+                                    void *arg) {
+  std::vector<uint8_t> jpeg(len);
+  if (reader(arg, 0, jpeg.data(), len) != len)
+    return ESP_FAIL;
+  return hostJpegDecode(jpeg.data(), len, 1 << scale, writer, arg)
+             ? ESP_OK
+             : ESP_FAIL;
+}
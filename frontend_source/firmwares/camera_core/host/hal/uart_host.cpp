@@ -0,0 +1,293 @@
+#include <driver/uart.h>
+
+#include <esp_log.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static const char *TAG = "uart";
+
+namespace {
+
+struct Port {
+  int fd = -1;
+  bool installed = false;
+  std::mutex mutex;
+  std::condition_variable cond;  // ring gained data or space
+  std::vector<uint8_t> ring;
+  size_t head = 0;
+  size_t count = 0;
+  bool full_posted = false;
+  QueueHandle_t queue = nullptr;
+  int wake[2] = {-1, -1};
+  std::atomic<bool> stop{false};
+  std::thread receiver;
+};
+
+Port s_ports[UART_NUM_MAX];
+
+// Bytes moved per UART_DATA event; the chip's RX FIFO threshold is in the
+// same range.
+const size_t kRxChunk = 120;
+
+bool validPort(uart_port_t port) { return port >= 0 && port < UART_NUM_MAX; }
+
+void makeRaw(int fd) {
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0)
+    return;  // not a tty (pipe, socket): nothing to configure
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+}
+
+void postEvent(Port *port, uart_event_type_t type, size_t size) {
+  if (!port->queue)
+    return;
+  uart_event_t event = {type, size, false};
+  if (xQueueSend(port->queue, &event, 0) != pdPASS)
+    ESP_LOGW(TAG, "Event queue full");
+}
+
+// Stands in for the RX interrupt: moves bytes from the descriptor into the
+// ring buffer and posts an event per chunk. With the ring full it stops
+// reading (the chip disables the RX interrupt) until the app makes room.
+void receive(Port *port) {
+  uint8_t buf[kRxChunk];
+  while (!port->stop) {
+    size_t room;
+    {
+      std::unique_lock<std::mutex> lock(port->mutex);
+      room = port->ring.size() - port->count;
+      if (room == 0) {
+        if (!port->full_posted) {
+          port->full_posted = true;
+          postEvent(port, UART_BUFFER_FULL, 0);
+        }
+        port->cond.wait(lock, [port] {
+          return port->stop || port->count < port->ring.size();
+        });
+        continue;
+      }
+      port->full_posted = false;
+    }
+
+    struct pollfd fds[2] = {{port->fd, POLLIN, 0}, {port->wake[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents)
+      break;
+    ssize_t n = read(port->fd, buf, room < sizeof(buf) ? room : sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+      continue;
+    if (n <= 0)
+      break;  // the other end of the pty went away: an idle line from now
+
+    {
+      std::lock_guard<std::mutex> lock(port->mutex);
+      size_t size = port->ring.size();
+      size_t tail = (port->head + port->count) % size;
+      size_t first = size - tail < (size_t)n ? size - tail : (size_t)n;
+      memcpy(&port->ring[tail], buf, first);
+      memcpy(&port->ring[0], buf + first, n - first);
+      port->count += n;
+      port->cond.notify_all();
+    }
+    postEvent(port, UART_DATA, n);
+  }
+}
+
+Port *installedPort(uart_port_t port) {
+  return validPort(port) && s_ports[port].installed ? &s_ports[port]
+                                                    : nullptr;
+}
+
+}  // namespace
+
+extern "C" esp_err_t host_uart_attach(uart_port_t port, int fd) {
+  if (!validPort(port) || fd < 0 || s_ports[port].installed)
+    return ESP_ERR_INVALID_ARG;
+  s_ports[port].fd = fd;
+  makeRaw(fd);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size,
+                                         int tx_buffer_size, int queue_size,
+                                         QueueHandle_t *uart_queue,
+                                         int intr_alloc_flags) {
+  (void)tx_buffer_size;
+  (void)intr_alloc_flags;
+  if (!validPort(port) || rx_buffer_size <= 0)
+    return ESP_ERR_INVALID_ARG;
+  Port &p = s_ports[port];
+  if (p.installed)
+    return ESP_FAIL;
+
+  if (p.fd < 0) {
+    char var[16];
+    snprintf(var, sizeof(var), "CAMCORE_UART%d", port);
+    const char *path = getenv(var);
+    if (!path) {
+      ESP_LOGE(TAG, "UART%d: set %s to a tty or pty path", port, var);
+      return ESP_ERR_NOT_FOUND;
+    }
+    int fd = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+      ESP_LOGE(TAG, "UART%d: cannot open %s (errno %d)", port, path, errno);
+      return ESP_FAIL;
+    }
+    host_uart_attach(port, fd);
+  }
+  if (pipe(p.wake) != 0)
+    return ESP_FAIL;
+
+  p.ring.assign(rx_buffer_size, 0);
+  p.head = p.count = 0;
+  p.full_posted = false;
+  p.queue = nullptr;
+  if (queue_size > 0 && uart_queue) {
+    p.queue = xQueueCreate(queue_size, sizeof(uart_event_t));
+    *uart_queue = p.queue;
+  }
+  p.stop = false;
+  p.installed = true;
+  p.receiver = std::thread(receive, &p);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t uart_driver_delete(uart_port_t port) {
+  Port *p = installedPort(port);
+  if (!p)
+    return ESP_ERR_INVALID_STATE;
+  p->stop = true;
+  if (write(p->wake[1], "", 1) < 0)
+    ESP_LOGW(TAG, "UART%d: cannot wake receiver", port);
+  {
+    std::lock_guard<std::mutex> lock(p->mutex);
+    p->cond.notify_all();
+  }
+  p->receiver.join();
+  close(p->wake[0]);
+  close(p->wake[1]);
+  close(p->fd);
+  if (p->queue)
+    vQueueDelete(p->queue);
+  p->queue = nullptr;
+  p->fd = -1;
+  p->installed = false;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t uart_param_config(uart_port_t port,
+                                       const uart_config_t *config) {
+  return validPort(port) && config ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+extern "C" esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts,
+                                  int cts) {
+  (void)tx;
+  (void)rx;
+  (void)rts;
+  (void)cts;
+  return validPort(port) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+extern "C" int uart_read_bytes(uart_port_t port, void *buf, uint32_t length,
+                               TickType_t ticks_to_wait) {
+  Port *p = installedPort(port);
+  if (!p)
+    return -1;
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(ticks_to_wait);
+  uint8_t *out = static_cast<uint8_t *>(buf);
+  uint32_t got = 0;
+  std::unique_lock<std::mutex> lock(p->mutex);
+  while (true) {
+    size_t size = p->ring.size();
+    while (got < length && p->count > 0) {
+      size_t n = size - p->head;
+      if (n > p->count)
+        n = p->count;
+      if (n > length - got)
+        n = length - got;
+      memcpy(out + got, &p->ring[p->head], n);
+      p->head = (p->head + n) % size;
+      p->count -= n;
+      got += n;
+      p->cond.notify_all();
+    }
+    if (got == length || ticks_to_wait == 0)
+      break;
+    if (ticks_to_wait == portMAX_DELAY)
+      p->cond.wait(lock);
+    else if (p->cond.wait_until(lock, deadline) == std::cv_status::timeout &&
+             p->count == 0)
+      break;
+  }
+  return (int)got;
+}
+
+extern "C" int uart_write_bytes(uart_port_t port, const void *src,
+                                size_t size) {
+  Port *p = installedPort(port);
+  if (!p)
+    return -1;
+  const uint8_t *in = static_cast<const uint8_t *>(src);
+  size_t sent = 0;
+  while (sent < size) {
+    ssize_t n = write(p->fd, in + sent, size - sent);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    sent += n;
+  }
+  return (int)sent;
+}
+
+extern "C" esp_err_t uart_get_buffered_data_len(uart_port_t port,
+                                                size_t *size) {
+  Port *p = installedPort(port);
+  if (!p)
+    return ESP_FAIL;
+  std::lock_guard<std::mutex> lock(p->mutex);
+  *size = p->count;
+  return ESP_OK;
+}
+
+extern "C" esp_err_t uart_flush_input(uart_port_t port) {
+  Port *p = installedPort(port);
+  if (!p)
+    return ESP_FAIL;
+  std::lock_guard<std::mutex> lock(p->mutex);
+  tcflush(p->fd, TCIFLUSH);
+  p->head = p->count = 0;
+  p->full_posted = false;
+  p->cond.notify_all();
+  return ESP_OK;
+}
+
+extern "C" esp_err_t uart_wait_tx_done(uart_port_t port,
+                                       TickType_t ticks_to_wait) {
+  (void)ticks_to_wait;
+  Port *p = installedPort(port);
+  if (!p)
+    return ESP_FAIL;
+  tcdrain(p->fd);
+  return ESP_OK;
+}
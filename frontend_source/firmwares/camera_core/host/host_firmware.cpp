@@ -0,0 +1,177 @@
+#include "host_firmware.h"
+
+#include <esp_log.h>
+#include <host_camera.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "capture_task.h"
+#include "http_handlers.h"
+#include "rtsp_server.h"
+#include "substream_task.h"
+
+namespace camcore {
+
+static const char *TAG = "host";
+
+static const struct {
+  const char *name;
+  framesize_t size;
+} kFrameSizes[] = {
+    {"qqvga", FRAMESIZE_QQVGA}, {"qvga", FRAMESIZE_QVGA},
+    {"cif", FRAMESIZE_CIF},     {"vga", FRAMESIZE_VGA},
+    {"svga", FRAMESIZE_SVGA},   {"xga", FRAMESIZE_XGA},
+    {"hd", FRAMESIZE_HD},       {"uxga", FRAMESIZE_UXGA},
+};
+
+// Fallback ladder for the quality controller, as on the boards.
+static const int kAdaptiveFrameSizes[] = {FRAMESIZE_VGA, FRAMESIZE_QVGA};
+
+void printFirmwareUsage() {
+  fprintf(stderr,
+          "  --port N            HTTP port (8081)\n"
+          "  --sensor-fps F      simulated sensor frame rate (15)\n"
+          "  --size NAME         qqvga|qvga|cif|vga|svga|xga|hd|uxga (vga)\n"
+          "  --quality Q         sensor JPEG quality, 0-63 lower=better (12)\n"
+          "  --rgb565            deliver RGB565 and encode in software\n"
+          "  --jpeg-dir DIR      replay the .jpg files in DIR\n"
+          "  --no-motion         disable motion scoring\n"
+          "  --no-substreams     disable ?res= substreams\n"
+          "  --recorder-mb N     pre-event recorder size, 0 = off (4)\n"
+          "  --max-streams N     concurrent /stream clients (4)\n"
+          "  --max-sockets N     httpd max_open_sockets (7)\n"
+          "  --rtsp-port N       RTSP port, 0 = off (8554)\n");
+}
+
+bool parseFirmwareOption(int argc, char **argv, int *i,
+                         HostFirmwareConfig *config) {
+  const char *opt = argv[*i];
+  const char *value = *i + 1 < argc ? argv[*i + 1] : nullptr;
+  if (strcmp(opt, "--rgb565") == 0) {
+    config->pixel_format = PIXFORMAT_RGB565;
+    return true;
+  }
+  if (strcmp(opt, "--no-motion") == 0) {
+    config->motion = false;
+    return true;
+  }
+  if (strcmp(opt, "--no-substreams") == 0) {
+    config->substreams = false;
+    return true;
+  }
+  if (!value)
+    return false;
+
+  if (strcmp(opt, "--port") == 0) {
+    config->port = atoi(value);
+  } else if (strcmp(opt, "--sensor-fps") == 0) {
+    config->sensor_fps = strtof(value, nullptr);
+  } else if (strcmp(opt, "--size") == 0) {
+    bool found = false;
+    for (const auto &fs : kFrameSizes)
+      if (strcmp(fs.name, value) == 0) {
+        config->frame_size = fs.size;
+        found = true;
+      }
+    if (!found)
+      return false;
+  } else if (strcmp(opt, "--quality") == 0) {
+    config->jpeg_quality = atoi(value);
+  } else if (strcmp(opt, "--jpeg-dir") == 0) {
+    config->jpeg_dir = value;
+  } else if (strcmp(opt, "--recorder-mb") == 0) {
+    config->recorder_bytes = (size_t)(strtof(value, nullptr) * 1024 * 1024);
+  } else if (strcmp(opt, "--max-streams") == 0) {
+    config->max_stream_clients = atoi(value);
+  } else if (strcmp(opt, "--max-sockets") == 0) {
+    config->max_open_sockets = atoi(value);
+  } else if (strcmp(opt, "--rtsp-port") == 0) {
+    config->rtsp_port = atoi(value);
+  } else {
+    return false;
+  }
+  (*i)++;
+  return true;
+}
+
+bool startHostFirmware(const HostFirmwareConfig &config,
+                       CameraPipeline *pipeline, httpd_handle_t *server) {
+  host_camera_config_t sensor = {config.sensor_fps, config.jpeg_dir};
+  host_camera_configure(&sensor);
+
+  camera_config_t camera = {};
+  camera.pixel_format = config.pixel_format;
+  camera.frame_size = config.frame_size;
+  camera.jpeg_quality = config.jpeg_quality;
+  camera.fb_count = 2;
+  camera.fb_location = CAMERA_FB_IN_PSRAM;
+  camera.grab_mode = CAMERA_GRAB_LATEST;
+  esp_err_t err = esp_camera_init(&camera);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Camera init failed with error 0x%x", err);
+    return false;
+  }
+
+  QualityController::Config quality;
+  quality.best_quality = config.jpeg_quality;
+  quality.frame_sizes = kAdaptiveFrameSizes;
+  quality.frame_size_count = 2;
+  pipeline->quality.begin(quality, config.frame_size);
+  if (config.motion)
+    pipeline->motion.begin(MotionDetector::Config());
+  if (config.recorder_bytes) {
+    FrameArena::Config recorder;
+    recorder.bytes = config.recorder_bytes;
+    recorder.max_frames = 1024;
+    pipeline->recorder.begin(recorder);
+  }
+
+  // Raw frames are encoded at the firmware's default quality, large enough
+  // for UXGA at that quality.
+  FrameBroker::Config broker;
+  if (config.pixel_format != PIXFORMAT_JPEG)
+    broker.slot_capacity = 512 * 1024;
+  if (!pipeline->broker.begin(broker) ||
+      !startCaptureTask(pipeline, CaptureTaskConfig())) {
+    ESP_LOGE(TAG, "Frame broker init failed");
+    return false;
+  }
+  if (config.substreams &&
+      !startSubstreamTask(pipeline, SubstreamTaskConfig())) {
+    ESP_LOGE(TAG, "Substream task init failed");
+    return false;
+  }
+
+  setMaxStreamClients(config.max_stream_clients);
+  httpd_config_t httpd = HTTPD_DEFAULT_CONFIG();
+  httpd.server_port = config.port;
+  httpd.max_open_sockets = config.max_open_sockets;
+  httpd.lru_purge_enable = true;
+  if (httpd_start(server, &httpd) != ESP_OK)
+    return false;
+
+  static const httpd_uri_t kUris[] = {
+      {"/stream", HTTP_GET, streamHandler, nullptr},
+      {"/capture", HTTP_GET, captureHandler, nullptr},
+      {"/events", HTTP_GET, eventsHandler, nullptr},
+      {"/clip", HTTP_GET, clipHandler, nullptr},
+      {"/metrics", HTTP_GET, metricsHandler, nullptr},
+  };
+  for (const httpd_uri_t &uri : kUris) {
+    httpd_uri_t bound = uri;
+    bound.user_ctx = pipeline;
+    httpd_register_uri_handler(*server, &bound);
+  }
+
+  if (config.rtsp_port) {
+    RtspServerConfig rtsp;
+    rtsp.port = config.rtsp_port;
+    if (!startRtspServer(pipeline, rtsp))
+      return false;
+  }
+  return true;
+}
+
+}  // namespace camcore
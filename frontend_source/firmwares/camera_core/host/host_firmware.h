@@ -0,0 +1,41 @@
+#pragma once
+
+#include <esp_camera.h>
+#include <esp_http_server.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "camera_pipeline.h"
+
+namespace camcore {
+
+// Everything the board firmwares decide in setup(), as options.
+struct HostFirmwareConfig {
+  uint16_t port = 8081;
+  float sensor_fps = 15;
+  framesize_t frame_size = FRAMESIZE_VGA;
+  int jpeg_quality = 12;
+  pixformat_t pixel_format = PIXFORMAT_JPEG;
+  const char *jpeg_dir = nullptr;  // recorded frames instead of a test scene
+  bool motion = true;
+  bool substreams = true;  // ?res= on /stream and /capture
+  size_t recorder_bytes = 4 * 1024 * 1024;  // 0 disables /clip
+  int max_stream_clients = 4;
+  uint16_t max_open_sockets = 7;
+  uint16_t rtsp_port = 8554;  // 0 disables RTSP
+};
+
+// Parses one command-line option at argv[*i] into `config`, advancing *i
+// past its value. Returns false for options it does not know.
+bool parseFirmwareOption(int argc, char **argv, int *i,
+                         HostFirmwareConfig *config);
+void printFirmwareUsage();
+
+// Brings up the simulated sensor, the pipeline, one HTTP server with
+// /stream, /capture, /events, /clip and /metrics and the RTSP server,
+// wired the way smart_sentry does it on the board (with PSRAM).
+bool startHostFirmware(const HostFirmwareConfig &config,
+                       CameraPipeline *pipeline, httpd_handle_t *server);
+
+}  // namespace camcore
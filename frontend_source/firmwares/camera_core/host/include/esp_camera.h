@@ -0,0 +1,121 @@
+#pragma once
+
+// Host build: the esp32-camera API, backed by a simulated sensor (see
+// host_camera.h). Enum values match esp32-camera so framesize_t numbers
+// mean the same thing on both builds.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "esp_err.h"
+
+typedef enum {
+  PIXFORMAT_RGB565,
+  PIXFORMAT_YUV422,
+  PIXFORMAT_YUV420,
+  PIXFORMAT_GRAYSCALE,
+  PIXFORMAT_JPEG,
+  PIXFORMAT_RGB888,
+  PIXFORMAT_RAW,
+  PIXFORMAT_RGB444,
+  PIXFORMAT_RGB555,
+} pixformat_t;
+
+typedef enum {
+  FRAMESIZE_96X96,
+  FRAMESIZE_QQVGA,
+  FRAMESIZE_QCIF,
+  FRAMESIZE_HQVGA,
+  FRAMESIZE_240X240,
+  FRAMESIZE_QVGA,
+  FRAMESIZE_CIF,
+  FRAMESIZE_HVGA,
+  FRAMESIZE_VGA,
+  FRAMESIZE_SVGA,
+  FRAMESIZE_XGA,
+  FRAMESIZE_HD,
+  FRAMESIZE_SXGA,
+  FRAMESIZE_UXGA,
+  FRAMESIZE_INVALID,
+} framesize_t;
+
+typedef enum {
+  CAMERA_GRAB_WHEN_EMPTY,
+  CAMERA_GRAB_LATEST,
+} camera_grab_mode_t;
+
+typedef enum {
+  CAMERA_FB_IN_PSRAM,
+  CAMERA_FB_IN_DRAM,
+} camera_fb_location_t;
+
+typedef struct {
+  int pin_pwdn;
+  int pin_reset;
+  int pin_xclk;
+  int pin_sccb_sda;
+  int pin_sccb_scl;
+  int pin_d7, pin_d6, pin_d5, pin_d4, pin_d3, pin_d2, pin_d1, pin_d0;
+  int pin_vsync;
+  int pin_href;
+  int pin_pclk;
+  int xclk_freq_hz;
+  int ledc_timer;
+  int ledc_channel;
+  pixformat_t pixel_format;
+  framesize_t frame_size;
+  int jpeg_quality;  // 0-63, lower is better
+  size_t fb_count;
+  camera_fb_location_t fb_location;
+  camera_grab_mode_t grab_mode;
+} camera_config_t;
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t width;
+  size_t height;
+  pixformat_t format;
+  struct timeval timestamp;  // on the esp_timer_get_time() clock
+} camera_fb_t;
+
+typedef struct {
+  framesize_t framesize;
+  uint8_t quality;
+  int8_t brightness;
+  int8_t contrast;
+  int8_t saturation;
+} camera_status_t;
+
+typedef struct _sensor sensor_t;
+struct _sensor {
+  camera_status_t status;
+  pixformat_t pixformat;
+  int (*set_framesize)(sensor_t *sensor, framesize_t framesize);
+  int (*set_quality)(sensor_t *sensor, int quality);
+  int (*set_brightness)(sensor_t *sensor, int level);
+  int (*set_contrast)(sensor_t *sensor, int level);
+  int (*set_saturation)(sensor_t *sensor, int level);
+};
+
+typedef struct {
+  uint16_t width;
+  uint16_t height;
+} resolution_info_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const resolution_info_t resolution[FRAMESIZE_INVALID];
+
+esp_err_t esp_camera_init(const camera_config_t *config);
+esp_err_t esp_camera_deinit(void);
+camera_fb_t *esp_camera_fb_get(void);
+void esp_camera_fb_return(camera_fb_t *fb);
+sensor_t *esp_camera_sensor_get(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,121 @@
+#pragma once
+
+// Host build: the esp_http_server API on POSIX sockets. Like the IDF
+// server, one server task parses requests and runs handlers in turn;
+// handlers that call httpd_req_async_handler_begin() hand their socket
+// to another task until httpd_req_async_handler_complete().
+//
+// Set CAMCORE_HTTPD_SNDBUF (bytes) to shrink each socket's send buffer
+// towards lwIP's, so send backpressure shows up at similar frame sizes.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#define ESP_ERR_HTTPD_BASE 0xb000
+#define ESP_ERR_HTTPD_HANDLERS_FULL (ESP_ERR_HTTPD_BASE + 1)
+#define ESP_ERR_HTTPD_HANDLER_EXISTS (ESP_ERR_HTTPD_BASE + 2)
+#define ESP_ERR_HTTPD_INVALID_REQ (ESP_ERR_HTTPD_BASE + 3)
+#define ESP_ERR_HTTPD_RESULT_TRUNC (ESP_ERR_HTTPD_BASE + 4)
+#define ESP_ERR_HTTPD_RESP_HDR (ESP_ERR_HTTPD_BASE + 5)
+#define ESP_ERR_HTTPD_RESP_SEND (ESP_ERR_HTTPD_BASE + 6)
+#define ESP_ERR_HTTPD_ALLOC_MEM (ESP_ERR_HTTPD_BASE + 7)
+#define ESP_ERR_HTTPD_TASK (ESP_ERR_HTTPD_BASE + 8)
+
+#define HTTPD_MAX_URI_LEN 512
+#define HTTPD_RESP_USE_STRLEN -1
+
+typedef void *httpd_handle_t;
+
+// Values match http_parser's method numbers, as in IDF.
+typedef enum {
+  HTTP_DELETE = 0,
+  HTTP_GET = 1,
+  HTTP_HEAD = 2,
+  HTTP_POST = 3,
+  HTTP_PUT = 4,
+} httpd_method_t;
+
+typedef struct httpd_req {
+  httpd_handle_t handle;
+  int method;
+  char uri[HTTPD_MAX_URI_LEN + 1];
+  size_t content_len;
+  void *aux;
+  void *user_ctx;
+} httpd_req_t;
+
+typedef struct httpd_uri {
+  const char *uri;
+  httpd_method_t method;
+  esp_err_t (*handler)(httpd_req_t *req);
+  void *user_ctx;
+} httpd_uri_t;
+
+typedef struct httpd_config {
+  unsigned task_priority;
+  size_t stack_size;
+  BaseType_t core_id;
+  uint16_t server_port;
+  uint16_t ctrl_port;
+  uint16_t max_open_sockets;
+  uint16_t max_uri_handlers;
+  uint16_t max_resp_headers;
+  uint16_t backlog_conn;
+  bool lru_purge_enable;
+  uint16_t recv_wait_timeout;  // seconds
+  uint16_t send_wait_timeout;  // seconds
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG()                                                \
+  {                                                                           \
+    .task_priority = tskIDLE_PRIORITY + 5, .stack_size = 4096,                \
+    .core_id = tskNO_AFFINITY, .server_port = 80, .ctrl_port = 32768,         \
+    .max_open_sockets = 7, .max_uri_handlers = 8, .max_resp_headers = 8,      \
+    .backlog_conn = 5, .lru_purge_enable = false, .recv_wait_timeout = 5,     \
+    .send_wait_timeout = 5,                                                   \
+  }
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config);
+esp_err_t httpd_stop(httpd_handle_t handle);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle,
+                                     const httpd_uri_t *uri_handler);
+esp_err_t httpd_get_client_list(httpd_handle_t handle, size_t *fds,
+                                int *client_fds);
+
+size_t httpd_req_get_url_query_len(httpd_req_t *req);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *req, char *buf,
+                                      size_t buf_len);
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val,
+                                size_t val_size);
+size_t httpd_req_get_hdr_value_len(httpd_req_t *req, const char *field);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *field,
+                                      char *val, size_t val_size);
+int httpd_req_to_sockfd(httpd_req_t *req);
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *req,
+                                        httpd_req_t **out);
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *req);
+
+// Header values are not copied and must stay valid until the response
+// headers are sent, as in IDF.
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status);
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field,
+                             const char *value);
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t len);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf,
+                                ssize_t len);
+esp_err_t httpd_resp_sendstr(httpd_req_t *req, const char *str);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+// Host build: esp32-camera's JPEG decoder entry point, backed by libjpeg's
+// scaled decode. As on the target, the writer is first called with null
+// data and the output size at (0, 0), then with blocks of RGB888 (R, G, B
+// order), then with null data once more at (width, height).
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum {
+  JPG_SCALE_NONE,
+  JPG_SCALE_2X,
+  JPG_SCALE_4X,
+  JPG_SCALE_8X,
+  JPG_SCALE_MAX = JPG_SCALE_8X
+} jpg_scale_t;
+
+typedef size_t (*jpg_reader_cb)(void *arg, size_t index, uint8_t *buf,
+                                size_t len);
+typedef bool (*jpg_writer_cb)(void *arg, uint16_t x, uint16_t y, uint16_t w,
+                              uint16_t h, uint8_t *data);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader,
+                         jpg_writer_cb writer, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
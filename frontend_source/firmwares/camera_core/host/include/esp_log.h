@@ -0,0 +1,29 @@
+#pragma once
+
+// Host build: ESP_LOGx print to stderr in the IDF format
+// "I (<ms>) <tag>: message". Debug and verbose are compiled in only with
+// CAMCORE_HOST_DEBUG.
+
+#include <stdio.h>
+
+#include "esp_timer.h"
+
+#define CAMCORE_HOST_LOG(letter, tag, format, ...)                            \
+  fprintf(stderr, letter " (%lld) %s: " format "\n",                          \
+          (long long)(esp_timer_get_time() / 1000), tag, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, format, ...)                                            \
+  CAMCORE_HOST_LOG("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)                                            \
+  CAMCORE_HOST_LOG("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)                                            \
+  CAMCORE_HOST_LOG("I", tag, format, ##__VA_ARGS__)
+#ifdef CAMCORE_HOST_DEBUG
+#define ESP_LOGD(tag, format, ...)                                            \
+  CAMCORE_HOST_LOG("D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...)                                            \
+  CAMCORE_HOST_LOG("V", tag, format, ##__VA_ARGS__)
+#else
+#define ESP_LOGD(tag, format, ...) ((void)0)
+#define ESP_LOGV(tag, format, ...) ((void)0)
+#endif
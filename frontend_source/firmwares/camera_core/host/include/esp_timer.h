@@ -0,0 +1,16 @@
+#pragma once
+
+// Host build: microseconds on the monotonic clock since process start,
+// standing in for time since boot.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
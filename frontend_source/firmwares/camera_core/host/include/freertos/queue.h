@@ -0,0 +1,27 @@
+#pragma once
+
+// Host build: fixed-size FreeRTOS queues (copy in, copy out) on a mutex and
+// condition variables. Storage is allocated once in xQueueCreate().
+
+#include "FreeRTOS.h"
+
+typedef struct HostQueue *QueueHandle_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item,
+                      TickType_t ticks_to_wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item,
+                         TickType_t ticks_to_wait);
+BaseType_t xQueueReset(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define xQueueSendToBack xQueueSend
@@ -0,0 +1,31 @@
+#pragma once
+
+// Host build: counts heap allocations (malloc, calloc, realloc, aligned
+// allocations and everything built on them, such as operator new) when the
+// host library is built with CAMCORE_HOST_COUNT_ALLOCS. Code that stands in
+// for hardware or third-party libraries (the simulated sensor, libjpeg,
+// benchmark clients) runs inside an untracked scope, so the count covers
+// camera_core and the HAL glue it calls.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Allocations so far; always 0 when counting is compiled out.
+uint64_t host_alloc_count(void);
+void host_alloc_untracked_begin(void);
+void host_alloc_untracked_end(void);
+
+#ifdef __cplusplus
+}
+
+class HostAllocUntracked {
+public:
+  HostAllocUntracked() { host_alloc_untracked_begin(); }
+  ~HostAllocUntracked() { host_alloc_untracked_end(); }
+  HostAllocUntracked(const HostAllocUntracked &) = delete;
+  HostAllocUntracked &operator=(const HostAllocUntracked &) = delete;
+};
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+// Host build: the simulated sensor behind esp_camera_fb_get(). Call
+// host_camera_configure() before esp_camera_init().
+//
+// By default the sensor renders a test scene at the configured frame size:
+// a gradient with a box that moves for 3 s and then rests for 5 s, so the
+// motion detector sees events start and stop. With PIXFORMAT_JPEG frames
+// are compressed the way the sensor would, and set_framesize()/set_quality()
+// take effect; other formats are delivered raw for frame2jpg_cb(). With
+// `jpeg_dir` the sensor instead cycles through the .jpg files in that
+// directory (e.g. frames recorded from a board).
+//
+// Frames are produced on a fixed 1/fps grid and handed out like
+// CAMERA_GRAB_LATEST: a caller that is early waits for the next frame, a
+// late one gets the most recent frame immediately.
+
+#include <esp_camera.h>
+
+typedef struct {
+  float fps;
+  const char *jpeg_dir;
+} host_camera_config_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void host_camera_configure(const host_camera_config_t *config);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+// Host build: frame2jpg_cb() and fmt2jpg_cb() encode with libjpeg. Only
+// RGB565, RGB888 and grayscale frames are supported. RGB888 is stored
+// B, G, R, as esp32-camera keeps it.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_camera.h"
+#include "esp_jpg_decode.h"
+
+typedef size_t (*jpg_out_cb)(void *arg, size_t index, const void *data,
+                             size_t len);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// `quality` is 0-100, higher is better (unlike the sensor's scale).
+bool frame2jpg_cb(camera_fb_t *fb, int quality, jpg_out_cb cb, void *arg);
+bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height,
+                pixformat_t format, uint8_t quality, jpg_out_cb cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,527 @@
+// SMS command latency benchmark: runs Sim7600/AtEngine against a scripted
+// fake SIM7600 on the other end of a pty and measures, per delivery path,
+// the time from the modem writing a message's last byte to the SMS handler
+// acting on it.
+//
+//   +CMT   the message is pushed to the UART (AT+CNMI=2,2, the default)
+//   +CMTI  only a notification; the engine fetches it with AT+CMGR
+//
+// Meanwhile the engine keeps AT+CSQ queries going back to back, so
+// messages land in the middle of command responses. It also sends SMS
+// (prompt and Ctrl-Z handling), an empty +CMT, a command the modem answers
+// only after its timeout, and an AT+CMGS whose prompt is lost (timeout
+// handling and resync: every later AT+CSQ must still get its own answer),
+// and counts heap allocations once setup is done. Every fourth stored
+// message answers its first AT+CMGR with an error; it must still be read
+// before it is deleted.
+
+#include <driver/uart.h>
+#include <esp_timer.h>
+#include <host_alloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "sim7600.h"
+
+namespace {
+
+struct BenchConfig {
+  int direct = 200;  // messages delivered as +CMT
+  int stored = 50;   // messages delivered as +CMTI
+  int outgoing = 10;
+  int interval_ms = 20;  // mean gap between incoming messages
+  int reply_us = 300;    // modem think time per command
+  int baud = 115200;     // 0 = unpaced pty
+  bool csq_load = true;
+};
+
+BenchConfig g_bench;
+std::atomic<bool> g_stop{false};
+
+int64_t nowUs() { return esp_timer_get_time(); }
+
+void sleepUs(int64_t us) {
+  if (us > 0)
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+// Scripted SIM7600: answers the setup commands, AT+CSQ, AT+CMGR/CMGD and
+// AT+CMGS, and lets the bench inject +CMT/+CMTI lines between (never
+// inside) response lines. Like a real modem it handles one command at a
+// time, and a stored message stays until AT+CMGD. AT+COPS? takes kLateReplyUs, past the engine's timeout, and
+// AT+CMGS to kLostPromptNumber enters the text prompt without sending
+// "> ", as if the prompt had been lost on the wire; only ESC gets it out.
+class FakeModem {
+public:
+  static const int kSlots = 64;
+  static const int64_t kLateReplyUs = 400000;
+  static constexpr const char *kLostPromptNumber = "+15550003";
+
+  explicit FakeModem(int fd) : fd_(fd) {}
+
+  void start() { thread_ = std::thread(&FakeModem::run, this); }
+  void join() { thread_.join(); }
+
+  // Writes at the configured baud rate. Returns the time the last chunk
+  // was handed to the pty.
+  int64_t write(const std::string &data) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return writeLocked(data);
+  }
+
+  int64_t injectCmt(const std::string &text) {
+    return write("\r\n+CMT: \"+15550001\",\"\",\"24/10/17,12:00:00+08\"\r\n" +
+                 text + "\r\n");
+  }
+
+  int64_t injectStored(const std::string &text) {
+    int index;
+    {
+      std::lock_guard<std::mutex> lock(store_mutex_);
+      busy_[next_index_ % kSlots] = next_index_ % 4 == 0;
+      index = next_index_++ % kSlots;
+      store_[index] = text;
+      read_[index] = false;
+    }
+    return write("\r\n+CMTI: \"SM\"," + std::to_string(index) + "\r\n");
+  }
+
+  // AT+CMGD of a stored message no AT+CMGR had returned.
+  int deletedUnread() const { return deleted_unread_; }
+
+private:
+  int64_t writeLocked(const std::string &data) {
+    const size_t chunk = g_bench.baud ? 16 : data.size();
+    int64_t last = nowUs();
+    for (size_t off = 0; off < data.size(); off += chunk) {
+      size_t n = std::min(chunk, data.size() - off);
+      last = nowUs();
+      if (::write(fd_, data.data() + off, n) != (ssize_t)n)
+        return last;
+      if (g_bench.baud)
+        sleepUs((int64_t)n * 10 * 1000000 / g_bench.baud);
+    }
+    return last;
+  }
+
+  void reply(const std::vector<std::string> &lines) {
+    sleepUs(g_bench.reply_us);
+    // Each line is written on its own so injected URCs can slip between
+    // an information line and the final result, as on a real modem.
+    for (const std::string &line : lines)
+      write("\r\n" + line + "\r\n");
+  }
+
+  void handle(const std::string &cmd) {
+    if (echo_)
+      write(cmd + "\r");
+    if (cmd == "AT" || cmd == "AT+CMGF=1" || cmd == "AT+CSCS=\"GSM\"" ||
+        cmd.rfind("AT+CNMI=", 0) == 0) {
+      reply({"OK"});
+    } else if (cmd.rfind("AT+CMGD=", 0) == 0) {
+      int index = atoi(cmd.c_str() + 8) % kSlots;
+      {
+        std::lock_guard<std::mutex> lock(store_mutex_);
+        if (!store_[index].empty() && !read_[index])
+          deleted_unread_++;
+        store_[index].clear();
+      }
+      reply({"OK"});
+    } else if (cmd == "ATE0") {
+      echo_ = false;
+      reply({"OK"});
+    } else if (cmd == "AT+CSQ") {
+      reply({"+CSQ: 21,99", "OK"});
+    } else if (cmd.rfind("AT+CMGR=", 0) == 0) {
+      int index = atoi(cmd.c_str() + 8) % kSlots;
+      std::string text;
+      bool busy;
+      {
+        std::lock_guard<std::mutex> lock(store_mutex_);
+        busy = busy_[index];
+        busy_[index] = false;
+        if (!busy) {
+          text = store_[index];
+          read_[index] = !text.empty();
+        }
+      }
+      if (busy)
+        reply({"+CMS ERROR: 500"});
+      else if (text.empty())
+        reply({"+CMS ERROR: 321"});
+      else
+        reply({"+CMGR: \"REC UNREAD\",\"+15550001\",\"\","
+               "\"24/10/17,12:00:00+08\"\r\n" +
+                   text,
+               "OK"});
+    } else if (cmd.rfind("AT+CMGS=", 0) == 0) {
+      sleepUs(g_bench.reply_us);
+      if (cmd.find(kLostPromptNumber) == std::string::npos)
+        write("\r\n> ");
+      prompt_ = true;
+    } else if (cmd == "AT+COPS?") {
+      sleepUs(kLateReplyUs);
+      reply({"+COPS: 0,0,\"FAKE\",7", "OK"});
+    } else {
+      reply({"ERROR"});
+    }
+  }
+
+  void run() {
+    HostAllocUntracked untracked;
+    std::string cmd;
+    char buf[256];
+    while (!g_stop) {
+      ssize_t n = read(fd_, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      for (ssize_t i = 0; i < n; i++) {
+        char c = buf[i];
+        if (prompt_) {
+          if (c == 0x1a) {
+            prompt_ = false;
+            cmd.clear();
+            reply({"+CMGS: " + std::to_string(++message_ref_), "OK"});
+          } else if (c == 0x1b) {  // cancel
+            prompt_ = false;
+            cmd.clear();
+            reply({"OK"});
+          }
+        } else if (c == 0x1b) {
+          // Ignored in command mode.
+        } else if (c == '\r') {
+          if (!cmd.empty())
+            handle(cmd);
+          cmd.clear();
+        } else if (c != '\n') {
+          cmd += c;
+        }
+      }
+    }
+  }
+
+  int fd_;
+  std::thread thread_;
+  std::mutex write_mutex_;
+  std::mutex store_mutex_;
+  std::string store_[kSlots];
+  bool read_[kSlots] = {};
+  bool busy_[kSlots] = {};  // the next AT+CMGR fails
+  int next_index_ = 0;
+  int message_ref_ = 0;
+  std::atomic<int> deleted_unread_{0};
+  bool echo_ = true;
+  bool prompt_ = false;
+};
+
+// Filled in by the modem task; the injecting thread waits on `handled`.
+struct Delivery {
+  std::vector<int64_t> sent_us;
+  std::vector<int64_t> acted_us;
+  std::atomic<int> handled{0};
+};
+
+Delivery g_delivery;
+std::atomic<int> g_sms_requests{0};
+std::atomic<int> g_sms_sent{0};
+std::atomic<int> g_sms_failed{0};
+std::atomic<bool> g_timeout_request{false};
+std::atomic<int64_t> g_timeout_us{-1};
+std::atomic<bool> g_lost_prompt_request{false};
+std::atomic<int> g_lost_prompt_result{-1};  // AtResult once completed
+std::atomic<int> g_empty_sms{0};
+std::atomic<bool> g_ready{false};
+std::atomic<uint32_t> g_csq_ok{0};
+std::atomic<uint32_t> g_csq_mismatched{0};
+int64_t g_sms_started_us[64];
+std::vector<int64_t> g_sms_latency_us;
+int64_t g_timeout_started_us = 0;
+
+// The firmware's handler pulses the PC reset line here; the bench only
+// notes when it would have.
+void onSms(void *ctx, const camcore::SmsMessage &sms) {
+  (void)ctx;
+  if (sms.text[0] == '\0') {
+    g_empty_sms++;
+    return;
+  }
+  const char *tag = strstr(sms.text, "REBOOT_SYSTEM #");
+  if (!tag)
+    return;
+  int id = atoi(tag + 15);
+  if (id < 0 || id >= (int)g_delivery.acted_us.size())
+    return;
+  g_delivery.acted_us[id] = nowUs();
+  g_delivery.handled++;
+}
+
+void onCsq(void *ctx, camcore::AtResult result, const char *response) {
+  (void)ctx;
+  if (result == camcore::AtResult::kOk && strcmp(response, "+CSQ: 21,99") == 0)
+    g_csq_ok++;
+  else
+    g_csq_mismatched++;
+}
+
+void onSmsSent(void *ctx, camcore::AtResult result, const char *response) {
+  int slot = (int)(intptr_t)ctx;
+  if (result == camcore::AtResult::kOk && strncmp(response, "+CMGS:", 6) == 0)
+    g_sms_latency_us.push_back(nowUs() - g_sms_started_us[slot]);
+  else
+    g_sms_failed++;
+  g_sms_sent++;
+}
+
+void onTimeoutProbe(void *ctx, camcore::AtResult result,
+                    const char *response) {
+  (void)ctx;
+  (void)response;
+  g_timeout_us = result == camcore::AtResult::kTimeout
+                     ? nowUs() - g_timeout_started_us
+                     : -2;
+}
+
+void onLostPrompt(void *ctx, camcore::AtResult result,
+                  const char *response) {
+  (void)ctx;
+  (void)response;
+  g_lost_prompt_result = (int)result;
+}
+
+// The firmware's ModemTask loop, minus Wi-Fi.
+void modemTask(camcore::Sim7600 *modem) {
+  int slot = 0;
+  while (!g_stop) {
+    modem->process(pdMS_TO_TICKS(50));
+    g_ready = modem->ready();
+    if (!modem->ready())
+      continue;
+    // Leave room in the queue for the AT+CSQ load.
+    while (g_sms_requests > 0 &&
+           modem->at().pending() < camcore::AtEngine::kMaxPending - 1) {
+      g_sms_requests--;
+      slot = (slot + 1) % 64;
+      g_sms_started_us[slot] = nowUs();
+      if (!modem->sendSms("+15550002", "WIFI CONNECTION LOST - SMART SENTRY",
+                          onSmsSent, (void *)(intptr_t)slot)) {
+        g_sms_failed++;
+        g_sms_sent++;
+      }
+    }
+    if (g_timeout_request.exchange(false)) {
+      g_timeout_started_us = nowUs();
+      modem->at().send("AT+COPS?", onTimeoutProbe, nullptr, 200);
+    }
+    if (g_lost_prompt_request.exchange(false))
+      modem->sendSms(FakeModem::kLostPromptNumber, "LOST PROMPT",
+                     onLostPrompt, nullptr);
+    if (g_bench.csq_load && modem->at().idle())
+      modem->at().send("AT+CSQ", onCsq, nullptr);
+  }
+}
+
+bool waitFor(const std::atomic<int> &value, int target, int timeout_ms) {
+  int64_t deadline = nowUs() + (int64_t)timeout_ms * 1000;
+  while (value < target && nowUs() < deadline)
+    sleepUs(200);
+  return value >= target;
+}
+
+// Injects `count` messages through `inject` with exponential gaps and
+// returns the handler latencies.
+template <typename Inject>
+std::vector<int64_t> deliver(int count, Inject inject, std::mt19937 *rng) {
+  std::exponential_distribution<double> gap(1.0 / g_bench.interval_ms);
+  g_delivery.sent_us.assign(count, 0);
+  g_delivery.acted_us.assign(count, 0);
+  g_delivery.handled = 0;
+  for (int i = 0; i < count; i++) {
+    g_delivery.sent_us[i] = inject("REBOOT_SYSTEM #" + std::to_string(i));
+    sleepUs((int64_t)(gap(*rng) * 1000));
+  }
+  waitFor(g_delivery.handled, count, 2000);
+  std::vector<int64_t> latency;
+  for (int i = 0; i < count; i++)
+    if (g_delivery.acted_us[i])
+      latency.push_back(g_delivery.acted_us[i] - g_delivery.sent_us[i]);
+  return latency;
+}
+
+int64_t percentile(std::vector<int64_t> *samples, double p) {
+  if (samples->empty())
+    return -1;
+  size_t k = (size_t)(p * (samples->size() - 1) + 0.5);
+  std::nth_element(samples->begin(), samples->begin() + k, samples->end());
+  return (*samples)[k];
+}
+
+void printRow(const char *name, int expected, std::vector<int64_t> samples) {
+  printf("%-18s %5zu/%-5d", name, samples.size(), expected);
+  for (double p : {0.5, 0.9, 0.99, 1.0}) {
+    int64_t us = percentile(&samples, p);
+    if (us < 0)
+      printf(" %9s", "-");
+    else
+      printf(" %9.1f", us / 1000.0);
+  }
+  printf("\n");
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --direct N      messages delivered as +CMT (200)\n"
+          "  --stored N      messages delivered as +CMTI (50)\n"
+          "  --outgoing N    SMS sent with AT+CMGS (10)\n"
+          "  --interval MS   mean gap between incoming messages (20)\n"
+          "  --reply-us US   fake modem think time per command (300)\n"
+          "  --baud B        wire speed of the fake modem, 0 = unpaced "
+          "(115200)\n"
+          "  --no-load       no back-to-back AT+CSQ while messages arrive\n",
+          argv0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  HostAllocUntracked untracked;
+  for (int i = 1; i < argc; i++) {
+    const char *opt = argv[i];
+    if (strcmp(opt, "--no-load") == 0) {
+      g_bench.csq_load = false;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[++i] : nullptr;
+    if (!value) {
+      usage(argv[0]);
+      return 2;
+    }
+    if (strcmp(opt, "--direct") == 0)
+      g_bench.direct = atoi(value);
+    else if (strcmp(opt, "--stored") == 0)
+      g_bench.stored = atoi(value);
+    else if (strcmp(opt, "--outgoing") == 0)
+      g_bench.outgoing = std::min(atoi(value), 64);
+    else if (strcmp(opt, "--interval") == 0)
+      g_bench.interval_ms = std::max(atoi(value), 1);
+    else if (strcmp(opt, "--reply-us") == 0)
+      g_bench.reply_us = atoi(value);
+    else if (strcmp(opt, "--baud") == 0)
+      g_bench.baud = atoi(value);
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    perror("pty");
+    return 1;
+  }
+  int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  if (slave < 0 || host_uart_attach(UART_NUM_2, slave) != ESP_OK) {
+    perror("pty slave");
+    return 1;
+  }
+
+  FakeModem fake(master);
+  fake.start();
+
+  static camcore::Sim7600 modem;
+  camcore::Sim7600::Config config;
+  config.send_timeout_ms = 500;  // the lost prompt times out quickly
+  int64_t begin_us = nowUs();
+  if (!modem.begin(config, onSms, nullptr))
+    return 1;
+  g_sms_latency_us.reserve(64);
+  std::thread task(modemTask, &modem);
+  while (!g_ready && nowUs() - begin_us < 5000000)
+    sleepUs(100);
+  if (!g_ready) {
+    fprintf(stderr, "modem setup did not complete\n");
+    return 1;
+  }
+  int64_t ready_us = nowUs() - begin_us;
+  uint64_t allocs_start = host_alloc_count();
+
+  std::mt19937 rng(1);
+  std::vector<int64_t> direct = deliver(
+      g_bench.direct,
+      [&fake](const std::string &text) { return fake.injectCmt(text); },
+      &rng);
+  std::vector<int64_t> stored = deliver(
+      g_bench.stored,
+      [&fake](const std::string &text) { return fake.injectStored(text); },
+      &rng);
+  fake.injectCmt("");
+  waitFor(g_empty_sms, 1, 1000);
+
+  g_sms_requests = g_bench.outgoing;
+  waitFor(g_sms_sent, g_bench.outgoing, 5000);
+  g_timeout_request = true;
+  int64_t deadline = nowUs() + 2000000;
+  while (g_timeout_us == -1 && nowUs() < deadline)
+    sleepUs(1000);
+  sleepUs(100000);  // a few more AT+CSQ after the timeout
+  uint32_t csq_before = g_csq_ok;
+  g_lost_prompt_request = true;
+  deadline = nowUs() + 2000000;
+  while (g_lost_prompt_result == -1 && nowUs() < deadline)
+    sleepUs(1000);
+  sleepUs(200000);
+  uint32_t csq_after_lost_prompt = g_csq_ok - csq_before;
+
+  uint64_t allocs = host_alloc_count() - allocs_start;
+  camcore::AtEngineStats stats = modem.at().stats();
+
+  printf("setup: ready after %.1f ms\n", ready_us / 1000.0);
+  printf("%-18s %11s %9s %9s %9s %9s\n", "path", "handled", "p50 ms",
+         "p90 ms", "p99 ms", "max ms");
+  printRow("+CMT (CNMI 2,2)", g_bench.direct, direct);
+  printRow("+CMTI + AT+CMGR", g_bench.stored, stored);
+  printRow("AT+CMGS to OK", g_bench.outgoing, g_sms_latency_us);
+  printf("empty +CMT: %s\n", g_empty_sms == 1 ? "delivered" : "missed");
+  printf("stored messages deleted unread: %d\n", fake.deletedUnread());
+  if (g_timeout_us >= 0)
+    printf("AT+COPS? (answers late): timed out after %.1f ms\n",
+           g_timeout_us / 1000.0);
+  else
+    printf("AT+COPS? (answers late): no timeout reported\n");
+  printf("AT+CMGS, prompt lost: %s, %u AT+CSQ answered after\n",
+         g_lost_prompt_result == (int)camcore::AtResult::kTimeout
+             ? "timed out"
+             : "no timeout reported",
+         (unsigned)csq_after_lost_prompt);
+  printf("AT+CSQ back to back: %u matched, %u mismatched\n",
+         (unsigned)g_csq_ok, (unsigned)g_csq_mismatched);
+  printf("engine: %u commands, %u ok, %u errors, %u timeouts, %u URCs, "
+         "%u unhandled lines, %u stale lines, %u overflows\n",
+         stats.commands, stats.ok, stats.errors, stats.timeouts, stats.urcs,
+         stats.unhandled_lines, stats.stale_lines, stats.rx_overflows);
+  printf("heap allocations after setup: %llu\n", (unsigned long long)allocs);
+
+  bool ok = direct.size() == (size_t)g_bench.direct &&
+            stored.size() == (size_t)g_bench.stored && g_sms_failed == 0 &&
+            g_timeout_us >= 0 && g_csq_mismatched == 0 &&
+            g_empty_sms == 1 && fake.deletedUnread() == 0 &&
+            g_lost_prompt_result == (int)camcore::AtResult::kTimeout &&
+            csq_after_lost_prompt > 0;
+  fflush(stdout);
+  _exit(ok ? 0 : 1);
+}
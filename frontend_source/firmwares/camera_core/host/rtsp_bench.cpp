@@ -0,0 +1,641 @@
+// RTSP/RTP-JPEG client benchmark: runs the host firmware in-process (or
+// targets a board with --target) and plays N RTSP sessions over UDP or
+// interleaved TCP. Each session rebuilds full JPEGs from the RFC 2435
+// packets and decodes them with libjpeg. It reports per-session fps,
+// capture-to-delivery latency percentiles, packets and bytes per frame,
+// lost packets, incomplete frames and frames libjpeg rejects.
+//
+// Latency maps each RTP timestamp to wall-clock time through the RTCP
+// sender reports, so it is only reported in-process where both ends share
+// a clock. --drop-every N discards every Nth UDP packet on arrival to show
+// what loss costs: the frame it belonged to, and nothing after it.
+
+#include <setjmp.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include "host_firmware.h"
+#include "jpeg_tables.h"
+
+namespace {
+
+struct BenchConfig {
+  int sessions = 1;
+  bool tcp = false;
+  const char *query = nullptr;  // appended to rtsp://.../stream?
+  int drop_every = 0;
+  float warmup_s = 2;
+  float duration_s = 10;
+  const char *target = nullptr;  // host:port of a board
+  const char *save = nullptr;    // last frame of session 0
+};
+
+struct SessionResult {
+  std::string name;
+  uint64_t frames = 0;
+  uint64_t packets = 0;
+  uint64_t wire_bytes = 0;  // RTP packets, plus the 4-byte TCP interleave
+  uint64_t lost_packets = 0;
+  uint64_t incomplete = 0;  // frames with a missing packet
+  uint64_t bad_jpeg = 0;    // reassembled but not decodable
+  int width = 0, height = 0;
+  std::vector<int64_t> latency_us;
+  bool failed = false;
+};
+
+std::atomic<bool> g_measuring{false};
+std::atomic<bool> g_stop{false};
+
+int64_t wallUs() {
+  timeval tv;
+  gettimeofday(&tv, nullptr);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+inline uint16_t be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+inline uint32_t be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// libjpeg's default error handler exits; this one jumps back instead.
+struct JpegError {
+  jpeg_error_mgr mgr;
+  jmp_buf jump;
+};
+
+void onJpegError(j_common_ptr cinfo) {
+  longjmp(reinterpret_cast<JpegError *>(cinfo->err)->jump, 1);
+}
+
+bool decodes(const std::vector<uint8_t> &jpeg, int *width, int *height) {
+  jpeg_decompress_struct cinfo;
+  JpegError err;
+  cinfo.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = onJpegError;
+  err.mgr.output_message = [](j_common_ptr) {};
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, jpeg.data(), jpeg.size());
+  jpeg_read_header(&cinfo, TRUE);
+  jpeg_start_decompress(&cinfo);
+  std::vector<uint8_t> row(cinfo.output_width * cinfo.output_components);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW p = row.data();
+    jpeg_read_scanlines(&cinfo, &p, 1);
+  }
+  *width = cinfo.output_width;
+  *height = cinfo.output_height;
+  bool clean = err.mgr.num_warnings == 0;  // corrupt data is a warning
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return clean;
+}
+
+// Rebuilds a JPEG from RFC 2435 packets the way a receiver such as
+// ffmpeg does: headers from the type, size and in-band tables, Annex K
+// Huffman tables, then the scan.
+class JpegAssembler {
+public:
+  enum Result { kPending, kFrame, kIncomplete };
+
+  // Takes one RTP packet; kFrame once the marker completes a frame,
+  // kIncomplete when a frame is abandoned because a packet is missing.
+  Result add(const uint8_t *pkt, size_t len) {
+    if (len < 20)
+      return kPending;
+    bool marker = pkt[1] & 0x80;
+    uint32_t ts = be32(pkt + 4);
+    const uint8_t *p = pkt + 12;
+    const uint8_t *end = pkt + len;
+    uint32_t offset = be32(p) & 0xFFFFFF;
+    uint8_t type = p[4], q = p[5], w8 = p[6], h8 = p[7];
+    p += 8;
+
+    Result result = kPending;
+    if (active_ && ts != ts_) {
+      active_ = false;
+      result = kIncomplete;  // the marker packet was lost
+    }
+    if (offset == 0) {
+      active_ = true;
+      broken_ = false;
+      ts_ = ts;
+      scan_.clear();
+      type_ = type;
+      width8_ = w8;
+      height8_ = h8;
+      dri_ = 0;
+    } else if (!active_) {
+      return result;
+    }
+    if (type & 64) {
+      if (end - p < 4)
+        return kPending;
+      dri_ = be16(p);
+      p += 4;
+    }
+    if (offset == 0 && q >= 128) {
+      if (end - p < 4)
+        return kPending;
+      uint16_t qlen = be16(p + 2);
+      p += 4;
+      if (qlen < 128 || end - p < qlen)
+        return kPending;
+      memcpy(qt_, p, 128);
+      p += qlen;
+    }
+    if (offset != scan_.size())
+      broken_ = true;
+    scan_.insert(scan_.end(), p, end);
+    if (!marker)
+      return result;
+    active_ = false;
+    if (broken_)
+      return kIncomplete;
+    build();
+    return kFrame;
+  }
+
+  uint32_t timestamp() const { return ts_; }
+  const std::vector<uint8_t> &jpeg() const { return jpeg_; }
+
+private:
+  void put(std::initializer_list<int> bytes) {
+    for (int b : bytes)
+      jpeg_.push_back((uint8_t)b);
+  }
+
+  void putHuffman(int cls_id, const uint8_t *bits, const uint8_t *vals,
+                  int count) {
+    put({0xFF, 0xC4, 0, 3 + 16 + count, cls_id});
+    jpeg_.insert(jpeg_.end(), bits + 1, bits + 17);
+    jpeg_.insert(jpeg_.end(), vals, vals + count);
+  }
+
+  void build() {
+    using namespace camcore;
+    int width = width8_ * 8, height = height8_ * 8;
+    jpeg_.clear();
+    put({0xFF, 0xD8, 0xFF, 0xDB, 0, 132, 0});
+    jpeg_.insert(jpeg_.end(), qt_, qt_ + 64);
+    put({1});
+    jpeg_.insert(jpeg_.end(), qt_ + 64, qt_ + 128);
+    put({0xFF, 0xC0, 0, 17, 8, height >> 8, height & 255, width >> 8,
+         width & 255, 3, 1, (type_ & 63) == 1 ? 0x22 : 0x21, 0, 2, 0x11, 1,
+         3, 0x11, 1});
+    putHuffman(0x00, kStdDcLumaBits, kStdDcLumaVals, 12);
+    putHuffman(0x10, kStdAcLumaBits, kStdAcLumaVals, 162);
+    putHuffman(0x01, kStdDcChromaBits, kStdDcChromaVals, 12);
+    putHuffman(0x11, kStdAcChromaBits, kStdAcChromaVals, 162);
+    if (dri_)
+      put({0xFF, 0xDD, 0, 4, dri_ >> 8, dri_ & 255});
+    put({0xFF, 0xDA, 0, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0});
+    jpeg_.insert(jpeg_.end(), scan_.begin(), scan_.end());
+    put({0xFF, 0xD9});
+  }
+
+  bool active_ = false;
+  bool broken_ = false;
+  uint32_t ts_ = 0;
+  uint8_t type_ = 0, width8_ = 0, height8_ = 0;
+  uint16_t dri_ = 0;
+  uint8_t qt_[128] = {};
+  std::vector<uint8_t> scan_;
+  std::vector<uint8_t> jpeg_;
+};
+
+// RTSP control connection with a read buffer shared with interleaved data.
+class RtspConnection {
+public:
+  ~RtspConnection() {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  bool open(const char *host, const char *port) {
+    addrinfo hints = {}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+      return false;
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    bool ok = fd_ >= 0 && connect(fd_, res->ai_addr, res->ai_addrlen) == 0;
+    freeaddrinfo(res);
+    return ok;
+  }
+
+  int fd() const { return fd_; }
+
+  // Sends a request and reads its response, skipping interleaved packets
+  // that arrive first. Returns the status code, 0 on failure.
+  int request(const std::string &method, const std::string &url,
+              const std::string &headers, std::string *response) {
+    std::string req = method + " " + url + " RTSP/1.0\r\nCSeq: " +
+                      std::to_string(++cseq_) + "\r\n" + headers;
+    if (!session_.empty())
+      req += "Session: " + session_ + "\r\n";
+    req += "\r\n";
+    if (send(fd_, req.data(), req.size(), MSG_NOSIGNAL) != (ssize_t)req.size())
+      return 0;
+    while (true) {
+      if (!fill(1))
+        return 0;
+      if (buf_[0] == '$') {
+        if (!fill(4) || !fill(4 + be16(&buf_[2])))
+          return 0;
+        consume(4 + be16(&buf_[2]));
+        continue;
+      }
+      std::string text(buf_.begin(), buf_.end());
+      size_t head = text.find("\r\n\r\n");
+      if (head == std::string::npos) {
+        if (!fill(buf_.size() + 1))
+          return 0;
+        continue;
+      }
+      size_t length = 0;
+      size_t cl = text.find("Content-Length:");
+      if (cl != std::string::npos && cl < head)
+        length = strtoul(text.c_str() + cl + 15, nullptr, 10);
+      if (!fill(head + 4 + length))
+        return 0;
+      *response = std::string(buf_.begin(), buf_.begin() + head + 4 + length);
+      consume(head + 4 + length);
+      size_t s = response->find("Session:");
+      if (s != std::string::npos) {
+        size_t v = response->find_first_not_of(' ', s + 8);
+        session_ = response->substr(v, response->find_first_of(";\r", v) - v);
+      }
+      return atoi(response->c_str() + 9);
+    }
+  }
+
+  // Next interleaved packet into `pkt`; false when the connection ends.
+  bool readInterleaved(uint8_t *channel, std::vector<uint8_t> *pkt) {
+    pkt->clear();
+    if (!fill(4))
+      return false;
+    if (buf_[0] != '$') {
+      // A response to a keep-alive; skip up to the end of its head.
+      std::string text(buf_.begin(), buf_.end());
+      size_t head = text.find("\r\n\r\n");
+      if (head == std::string::npos)
+        return fill(buf_.size() + 1);
+      consume(head + 4);
+      return true;
+    }
+    size_t len = be16(&buf_[2]);
+    if (!fill(4 + len))
+      return false;
+    *channel = buf_[1];
+    pkt->assign(buf_.begin() + 4, buf_.begin() + 4 + len);
+    consume(4 + len);
+    return true;
+  }
+
+private:
+  bool fill(size_t n) {
+    uint8_t tmp[16384];
+    while (buf_.size() < n) {
+      if (g_stop)
+        return false;
+      pollfd pfd = {fd_, POLLIN, 0};
+      if (poll(&pfd, 1, 200) == 0)
+        continue;
+      ssize_t got = recv(fd_, tmp, sizeof(tmp), 0);
+      if (got <= 0)
+        return false;
+      buf_.insert(buf_.end(), tmp, tmp + got);
+    }
+    return true;
+  }
+
+  void consume(size_t n) { buf_.erase(buf_.begin(), buf_.begin() + n); }
+
+  int fd_ = -1;
+  int cseq_ = 0;
+  std::string session_;
+  std::vector<uint8_t> buf_;
+};
+
+// Binds an even/odd UDP port pair for RTP and RTCP.
+bool openUdpPair(int fds[2], uint16_t *rtp_port) {
+  for (uint16_t port = 40000 + (getpid() % 500) * 2; port < 60000;
+       port += 2) {
+    for (int i = 0; i < 2; i++) {
+      fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(port + i);
+      if (bind(fds[i], (sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fds[i]);
+        if (i)
+          close(fds[0]);
+        fds[0] = fds[1] = -1;
+        break;
+      }
+    }
+    if (fds[0] >= 0) {
+      int size = 4 << 20;
+      setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+      *rtp_port = port;
+      return true;
+    }
+  }
+  return false;
+}
+
+struct SenderClock {
+  bool valid = false;
+  int64_t wall_us = 0;
+  uint32_t rtp = 0;
+
+  void update(const uint8_t *pkt, size_t len) {
+    if (len < 20 || pkt[1] != 200)
+      return;
+    uint64_t ntp = ((uint64_t)be32(pkt + 8) << 32) | be32(pkt + 12);
+    wall_us = (int64_t)((ntp >> 32) - 2208988800u) * 1000000 +
+              (int64_t)(((ntp & 0xFFFFFFFF) * 1000000) >> 32);
+    rtp = be32(pkt + 16);
+    valid = true;
+  }
+
+  int64_t wallOf(uint32_t rtp_time) const {
+    return wall_us + (int64_t)(int32_t)(rtp_time - rtp) * 100 / 9;
+  }
+};
+
+void session(const char *host, const char *port, const BenchConfig *bench,
+             bool latency, SessionResult *result) {
+  RtspConnection conn;
+  if (!conn.open(host, port)) {
+    result->failed = true;
+    return;
+  }
+  std::string url = std::string("rtsp://") + host + ":" + port + "/stream";
+  if (bench->query)
+    url += std::string("?") + bench->query;
+
+  int udp[2] = {-1, -1};
+  uint16_t client_port = 0;
+  if (!bench->tcp && !openUdpPair(udp, &client_port)) {
+    result->failed = true;
+    return;
+  }
+  std::string transport =
+      bench->tcp ? "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n"
+                 : "Transport: RTP/AVP;unicast;client_port=" +
+                       std::to_string(client_port) + "-" +
+                       std::to_string(client_port + 1) + "\r\n";
+  std::string response;
+  int status = conn.request("DESCRIBE", url, "Accept: application/sdp\r\n",
+                            &response);
+  size_t control = response.find("m=video");
+  control = response.find("a=control:", control);
+  std::string track = control == std::string::npos
+                          ? url
+                          : response.substr(control + 10,
+                                            response.find('\r', control) -
+                                                control - 10);
+  if (status == 200)
+    status = conn.request("SETUP", track, transport, &response);
+  if (status == 200)
+    status = conn.request("PLAY", url, "Range: npt=0.000-\r\n", &response);
+  if (status != 200) {
+    fprintf(stderr, "%s: RTSP %d\n", result->name.c_str(), status);
+    result->failed = true;
+    return;
+  }
+
+  JpegAssembler assembler;
+  SenderClock clock;
+  uint16_t expected_seq = 0;
+  bool have_seq = false;
+  uint64_t received = 0;
+  int64_t next_keepalive = wallUs() + 20000000;
+  std::vector<uint8_t> pkt(65536);
+
+  while (!g_stop) {
+    uint8_t channel = 0;
+    if (bench->tcp) {
+      if (!conn.readInterleaved(&channel, &pkt))
+        break;
+      if (pkt.empty())
+        continue;
+    } else {
+      pollfd pfd[2] = {{udp[0], POLLIN, 0}, {udp[1], POLLIN, 0}};
+      if (poll(pfd, 2, 200) <= 0)
+        continue;
+      int which = pfd[0].revents ? 0 : 1;
+      pkt.resize(65536);
+      ssize_t n = recv(udp[which], pkt.data(), pkt.size(), 0);
+      if (n <= 0)
+        continue;
+      pkt.resize(n);
+      channel = which;
+    }
+    if (!bench->tcp && wallUs() > next_keepalive) {
+      conn.request("GET_PARAMETER", url, "", &response);
+      next_keepalive = wallUs() + 20000000;
+    }
+    if (channel == 1) {
+      clock.update(pkt.data(), pkt.size());
+      continue;
+    }
+    if (pkt.size() < 12)
+      continue;
+    if (!bench->tcp && bench->drop_every && ++received % bench->drop_every == 0)
+      continue;
+
+    uint16_t seq = be16(&pkt[2]);
+    if (g_measuring) {
+      result->packets++;
+      result->wire_bytes += pkt.size() + (bench->tcp ? 4 : 0);
+      if (have_seq && seq != expected_seq)
+        result->lost_packets += (uint16_t)(seq - expected_seq);
+    }
+    have_seq = true;
+    expected_seq = seq + 1;
+
+    JpegAssembler::Result r = assembler.add(pkt.data(), pkt.size());
+    if (r == JpegAssembler::kIncomplete && g_measuring)
+      result->incomplete++;
+    if (r != JpegAssembler::kFrame || !g_measuring)
+      continue;
+    int64_t arrived = wallUs();
+    result->frames++;
+    if (latency && clock.valid)
+      result->latency_us.push_back(arrived -
+                                   clock.wallOf(assembler.timestamp()));
+    if (!decodes(assembler.jpeg(), &result->width, &result->height))
+      result->bad_jpeg++;
+    if (bench->save && result->name == "rtsp#0") {
+      FILE *out = fopen(bench->save, "wb");
+      if (out) {
+        fwrite(assembler.jpeg().data(), 1, assembler.jpeg().size(), out);
+        fclose(out);
+      }
+    }
+  }
+  conn.request("TEARDOWN", url, "", &response);
+  for (int fd : udp)
+    if (fd >= 0)
+      close(fd);
+}
+
+int64_t percentile(std::vector<int64_t> *samples, double p) {
+  if (samples->empty())
+    return -1;
+  size_t k = (size_t)(p * (samples->size() - 1) + 0.5);
+  std::nth_element(samples->begin(), samples->begin() + k, samples->end());
+  return (*samples)[k];
+}
+
+void printMs(FILE *out, int64_t us) {
+  if (us < 0)
+    fprintf(out, "%8s", "-");
+  else
+    fprintf(out, "%8.1f", us / 1000.0);
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --sessions N        concurrent RTSP sessions (1)\n"
+          "  --tcp               RTP interleaved on the RTSP connection\n"
+          "  --query Q           URL query, e.g. 'fps=5&res=qvga'\n"
+          "  --drop-every N      discard every Nth UDP packet on arrival\n"
+          "  --warmup S          seconds before measuring (2)\n"
+          "  --duration S        seconds to measure (10)\n"
+          "  --target HOST:PORT  benchmark a board instead of the host "
+          "build\n"
+          "  --save FILE         write session 0's last frame\n"
+          "in-process firmware options:\n",
+          argv0);
+  camcore::printFirmwareUsage();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  BenchConfig bench;
+  camcore::HostFirmwareConfig firmware;
+  for (int i = 1; i < argc; i++) {
+    const char *opt = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (camcore::parseFirmwareOption(argc, argv, &i, &firmware))
+      continue;
+    if (strcmp(opt, "--tcp") == 0) {
+      bench.tcp = true;
+      continue;
+    }
+    if (!value) {
+      usage(argv[0]);
+      return 2;
+    }
+    if (strcmp(opt, "--sessions") == 0)
+      bench.sessions = atoi(value);
+    else if (strcmp(opt, "--query") == 0)
+      bench.query = value;
+    else if (strcmp(opt, "--drop-every") == 0)
+      bench.drop_every = atoi(value);
+    else if (strcmp(opt, "--warmup") == 0)
+      bench.warmup_s = strtof(value, nullptr);
+    else if (strcmp(opt, "--duration") == 0)
+      bench.duration_s = strtof(value, nullptr);
+    else if (strcmp(opt, "--target") == 0)
+      bench.target = value;
+    else if (strcmp(opt, "--save") == 0)
+      bench.save = value;
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+
+  static camcore::CameraPipeline pipeline;
+  std::string host = "127.0.0.1";
+  std::string port = std::to_string(firmware.rtsp_port);
+  bool in_process = bench.target == nullptr;
+  if (in_process) {
+    httpd_handle_t server;
+    if (!firmware.rtsp_port ||
+        !camcore::startHostFirmware(firmware, &pipeline, &server))
+      return 1;
+  } else {
+    std::string target = bench.target;
+    size_t colon = target.rfind(':');
+    host = target.substr(0, colon);
+    port = colon == std::string::npos ? "554" : target.substr(colon + 1);
+  }
+
+  std::vector<SessionResult> results(bench.sessions);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < bench.sessions; i++) {
+    results[i].name = "rtsp#" + std::to_string(i);
+    threads.emplace_back(session, host.c_str(), port.c_str(), &bench,
+                         in_process, &results[i]);
+  }
+
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds((int)(bench.warmup_s * 1000)));
+  uint32_t published_start = pipeline.broker.stats().published;
+  g_measuring = true;
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds((int)(bench.duration_s * 1000)));
+  g_measuring = false;
+  uint32_t published = pipeline.broker.stats().published - published_start;
+  g_stop = true;
+  for (std::thread &t : threads)
+    t.join();
+
+  printf("%-8s %7s %8s %8s %8s %8s %12s %8s %6s %6s %6s %6s\n", "session",
+         "fps", "p50 ms", "p90 ms", "p99 ms", "max ms", "bytes/frame",
+         "pkts/fr", "lost", "incmpl", "badjpg", "frames");
+  for (SessionResult &r : results) {
+    printf("%-8s %7.2f", r.name.c_str(), r.frames / bench.duration_s);
+    printMs(stdout, percentile(&r.latency_us, 0.5));
+    printMs(stdout, percentile(&r.latency_us, 0.9));
+    printMs(stdout, percentile(&r.latency_us, 0.99));
+    printMs(stdout, percentile(&r.latency_us, 1.0));
+    printf(" %12llu %8.1f %6llu %6llu %6llu %6llu%s\n",
+           (unsigned long long)(r.frames ? r.wire_bytes / r.frames : 0),
+           r.frames ? (double)r.packets / r.frames : 0.0,
+           (unsigned long long)r.lost_packets,
+           (unsigned long long)r.incomplete, (unsigned long long)r.bad_jpeg,
+           (unsigned long long)r.frames, r.failed ? "  FAILED" : "");
+  }
+  if (!results.empty() && results[0].width)
+    printf("decoded frame size: %dx%d\n", results[0].width,
+           results[0].height);
+  if (in_process)
+    printf("sensor frames published: %u (%.2f fps)\n", published,
+           published / bench.duration_s);
+
+  fflush(stdout);
+  // Server and session tasks are detached threads; leave without running
+  // static destructors underneath them.
+  _exit(0);
+}
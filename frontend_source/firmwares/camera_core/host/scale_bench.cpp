@@ -0,0 +1,387 @@
+// Benchmarks the substream path behind /stream?res= as the firmware runs
+// it: frames are published to a CameraPipeline's broker and the substream
+// task decodes them at 1/2 or 1/4 with esp_jpg_decode() and re-encodes
+// them with fmt2jpg_cb() (libjpeg on the host). For synthetic 4:2:2
+// frames (textured, so that downscaling has real detail to lose) or
+// recorded JPEGs it reports the time from publish to the scaled frame
+// reaching a waiting reader, for each level and for both from one decode,
+// and the PSNR of each level against a box-filtered full-size decode.
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include "camera_pipeline.h"
+#include "substream_task.h"
+
+namespace {
+
+struct Options {
+  const char *size = nullptr;  // all of kSizes by default
+  int quality = 82;            // libjpeg scale; the sensor's 12
+  int iterations = 200;
+  const char *jpeg_dir = nullptr;
+  const char *out_dir = nullptr;
+};
+
+const struct {
+  const char *name;
+  int width, height;
+} kSizes[] = {
+    {"vga", 640, 480},
+    {"hd", 1280, 720},
+    {"uxga", 1600, 1200},
+};
+
+struct Image {
+  int width = 0, height = 0;
+  std::vector<uint8_t> rgb;
+};
+
+struct Input {
+  std::string name;
+  std::vector<uint8_t> jpeg;
+};
+
+double nowMs() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Gradients, a zone plate, hard-edged squares and noise.
+Image renderTexture(int width, int height) {
+  Image img;
+  img.width = width;
+  img.height = height;
+  img.rgb.resize((size_t)width * height * 3);
+  uint32_t seed = 12345;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      double dx = x - width / 2.0, dy = y - height / 2.0;
+      double zone = 40 * std::cos((dx * dx + dy * dy) * 3.0 / (width * 8.0));
+      double waves = 30 * std::sin(x * 0.05) * std::cos(y * 0.07);
+      bool square = ((x / 24) + (y / 24)) % 2 == 0 && y < height / 3;
+      seed = seed * 1103515245 + 12345;
+      int noise = (int)((seed >> 16) % 17) - 8;
+      double base = 128 + zone + waves + (square ? 35 : -35) * (y < height / 3);
+      uint8_t *px = &img.rgb[((size_t)y * width + x) * 3];
+      for (int c = 0; c < 3; c++) {
+        int v = (int)(base + noise + (c - 1) * 40.0 * x / width);
+        px[c] = (uint8_t)std::min(255, std::max(0, v));
+      }
+    }
+  }
+  return img;
+}
+
+std::vector<uint8_t> encode(const Image &img, int quality) {
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr err;
+  cinfo.err = jpeg_std_error(&err);
+  jpeg_create_compress(&cinfo);
+  unsigned char *buf = nullptr;
+  unsigned long len = 0;
+  jpeg_mem_dest(&cinfo, &buf, &len);
+  cinfo.image_width = img.width;
+  cinfo.image_height = img.height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.comp_info[0].h_samp_factor = 2;  // 4:2:2, as the sensors
+  cinfo.comp_info[0].v_samp_factor = 1;
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = const_cast<uint8_t *>(
+        &img.rgb[(size_t)cinfo.next_scanline * img.width * 3]);
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  std::vector<uint8_t> out(buf, buf + len);
+  free(buf);
+  return out;
+}
+
+// `denom` 1, 2 or 4 uses libjpeg's scaled IDCT.
+bool decode(const uint8_t *data, size_t len, int denom, Image *img) {
+  jpeg_decompress_struct cinfo;
+  jpeg_error_mgr err;
+  cinfo.err = jpeg_std_error(&err);
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, data, len);
+  if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  cinfo.out_color_space = JCS_RGB;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = denom;
+  jpeg_start_decompress(&cinfo);
+  img->width = cinfo.output_width;
+  img->height = cinfo.output_height;
+  img->rgb.resize((size_t)img->width * img->height * 3);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = &img->rgb[(size_t)cinfo.output_scanline * img->width * 3];
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+Image boxDownscale(const Image &src, int f) {
+  Image out;
+  out.width = (src.width + f - 1) / f;
+  out.height = (src.height + f - 1) / f;
+  out.rgb.resize((size_t)out.width * out.height * 3);
+  for (int y = 0; y < out.height; y++) {
+    for (int x = 0; x < out.width; x++) {
+      for (int c = 0; c < 3; c++) {
+        int sum = 0, n = 0;
+        for (int i = 0; i < f; i++)
+          for (int j = 0; j < f; j++) {
+            int sy = std::min(y * f + i, src.height - 1);
+            int sx = std::min(x * f + j, src.width - 1);
+            sum += src.rgb[((size_t)sy * src.width + sx) * 3 + c];
+            n++;
+          }
+        out.rgb[((size_t)y * out.width + x) * 3 + c] =
+            (uint8_t)((sum + n / 2) / n);
+      }
+    }
+  }
+  return out;
+}
+
+double psnr(const Image &a, const Image &b) {
+  if (a.width != b.width || a.height != b.height)
+    return 0;
+  double se = 0;
+  for (size_t i = 0; i < a.rgb.size(); i++) {
+    double d = (double)a.rgb[i] - b.rgb[i];
+    se += d * d;
+  }
+  double mse = se / a.rgb.size();
+  return mse > 0 ? 10 * std::log10(255.0 * 255.0 / mse) : 99;
+}
+
+// Fastest of the timed runs: on a shared or virtualized host the median
+// still moves with whatever else is running, the minimum much less.
+double fastest(const std::vector<double> &v) {
+  return *std::min_element(v.begin(), v.end());
+}
+
+// Publishes `in` once with a reader blocked on each level in `levels` (bit
+// 0 for 1/2, bit 1 for 1/4) and returns the time until the last of them
+// has its scaled frame, or a negative value if one did not arrive.
+double publishOnce(camcore::CameraPipeline *pipeline, const Input &in,
+                   int levels, camcore::FrameRef *out) {
+  double arrived[2] = {0, 0};
+  std::thread readers[2];
+  for (int i = 0; i < 2; i++) {
+    if (!(levels & (1 << i)))
+      continue;
+    camcore::FrameBroker *broker = &pipeline->substreams[i];
+    uint32_t after = broker->latestSeq();
+    readers[i] = std::thread([=, &arrived] {
+      out[i] = broker->waitNewer(after, 5000);
+      arrived[i] = nowMs();
+    });
+    while (broker->waiters() == 0)
+      std::this_thread::yield();
+  }
+  double start = nowMs();
+  pipeline->broker.publish(in.jpeg.data(), in.jpeg.size(),
+                           camcore::FrameInfo());
+  double last = start;
+  bool ok = true;
+  for (int i = 0; i < 2; i++) {
+    if (!readers[i].joinable())
+      continue;
+    readers[i].join();
+    ok = ok && out[i];
+    last = std::max(last, arrived[i]);
+  }
+  return ok ? last - start : -1;
+}
+
+// Fastest of `iterations` timed runs after one untimed run, which sizes
+// the task's RGB frames.
+double runLevels(camcore::CameraPipeline *pipeline, const Input &in,
+                 int levels, int iterations, camcore::FrameRef *out) {
+  if (publishOnce(pipeline, in, levels, out) < 0)
+    return -1;
+  std::vector<double> times(iterations);
+  for (int it = 0; it < iterations; it++) {
+    times[it] = publishOnce(pipeline, in, levels, out);
+    if (times[it] < 0)
+      return -1;
+  }
+  return fastest(times);
+}
+
+void writeFile(const char *dir, const std::string &name,
+               const uint8_t *data, size_t len) {
+  std::string path = std::string(dir) + "/" + name;
+  FILE *f = fopen(path.c_str(), "wb");
+  if (!f) {
+    perror(path.c_str());
+    return;
+  }
+  fwrite(data, 1, len, f);
+  fclose(f);
+}
+
+std::vector<Input> loadDir(const char *dir) {
+  std::vector<Input> inputs;
+  DIR *d = opendir(dir);
+  if (!d) {
+    perror(dir);
+    return inputs;
+  }
+  std::vector<std::string> names;
+  while (struct dirent *e = readdir(d)) {
+    std::string name = e->d_name;
+    size_t dot = name.rfind('.');
+    std::string ext = dot == std::string::npos ? "" : name.substr(dot);
+    if (ext == ".jpg" || ext == ".jpeg" || ext == ".JPG")
+      names.push_back(name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  for (const std::string &name : names) {
+    FILE *f = fopen((std::string(dir) + "/" + name).c_str(), "rb");
+    if (!f)
+      continue;
+    Input in;
+    in.name = name;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+      in.jpeg.insert(in.jpeg.end(), chunk, chunk + n);
+    fclose(f);
+    inputs.push_back(std::move(in));
+  }
+  return inputs;
+}
+
+void benchmark(camcore::CameraPipeline *pipeline, const Input &in,
+               const Options &opt) {
+  Image full;
+  if (!decode(in.jpeg.data(), in.jpeg.size(), 1, &full)) {
+    fprintf(stderr, "%s: not a JPEG\n", in.name.c_str());
+    return;
+  }
+  printf("%s: %dx%d, %zu bytes\n", in.name.c_str(), full.width, full.height,
+         in.jpeg.size());
+
+  camcore::FrameRef out[2];
+  for (int i = 0; i < 2; i++) {
+    int f = 2 << i;
+    double ms = runLevels(pipeline, in, 1 << i, opt.iterations, out);
+    if (ms < 0) {
+      fprintf(stderr, "%s: 1/%d scale failed\n", in.name.c_str(), f);
+      return;
+    }
+    Image scaled;
+    decode(out[i].data(), out[i].size(), 1, &scaled);
+    printf("  1/%d  %4dx%-4d  %7.2f ms  %7zu bytes  PSNR %.1f dB\n", f,
+           scaled.width, scaled.height, ms, out[i].size(),
+           psnr(scaled, boxDownscale(full, f)));
+    if (opt.out_dir)
+      writeFile(opt.out_dir, in.name + "." + std::to_string(f) + ".jpg",
+                out[i].data(), out[i].size());
+  }
+
+  double ms = runLevels(pipeline, in, 3, opt.iterations, out);
+  Image quarter;
+  if (ms >= 0 && decode(out[1].data(), out[1].size(), 1, &quarter))
+    printf("  1/2 + 1/4 from one decode  %7.2f ms  1/4 PSNR %.1f dB\n", ms,
+           psnr(quarter, boxDownscale(full, 4)));
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --size NAME         vga|hd|uxga synthetic frame (all three)\n"
+          "  --quality Q         libjpeg quality of synthetic frames (82)\n"
+          "  --jpeg-dir DIR      benchmark the .jpg files in DIR instead\n"
+          "  --iterations N      timed runs per measurement (200)\n"
+          "  --out DIR           write the scaled frames to DIR\n",
+          argv0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage(argv[0]);
+      return 2;
+    }
+    if (strcmp(argv[i], "--size") == 0)
+      opt.size = value;
+    else if (strcmp(argv[i], "--quality") == 0)
+      opt.quality = atoi(value);
+    else if (strcmp(argv[i], "--jpeg-dir") == 0)
+      opt.jpeg_dir = value;
+    else if (strcmp(argv[i], "--iterations") == 0)
+      opt.iterations = std::max(1, atoi(value));
+    else if (strcmp(argv[i], "--out") == 0)
+      opt.out_dir = value;
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+
+  std::vector<Input> inputs;
+  if (opt.jpeg_dir) {
+    inputs = loadDir(opt.jpeg_dir);
+  } else {
+    for (const auto &size : kSizes) {
+      if (opt.size && strcmp(opt.size, size.name) != 0)
+        continue;
+      Input in;
+      in.name = size.name;
+      in.jpeg = encode(renderTexture(size.width, size.height), opt.quality);
+      inputs.push_back(std::move(in));
+    }
+  }
+  if (inputs.empty()) {
+    usage(argv[0]);
+    return 2;
+  }
+  // One pipeline for every input, its slots sized for the largest.
+  size_t largest = 0;
+  for (const Input &in : inputs)
+    largest = std::max(largest, in.jpeg.size());
+  static camcore::CameraPipeline pipeline;
+  camcore::FrameBroker::Config source;
+  source.slot_capacity = largest;
+  camcore::SubstreamTaskConfig substreams;
+  substreams.slot_capacity = largest;
+  if (!pipeline.broker.begin(source) ||
+      !camcore::startSubstreamTask(&pipeline, substreams)) {
+    fprintf(stderr, "substream task did not start\n");
+    return 1;
+  }
+  for (const Input &in : inputs)
+    benchmark(&pipeline, in, opt);
+  return 0;
+}
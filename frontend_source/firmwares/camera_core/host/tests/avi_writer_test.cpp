@@ -0,0 +1,145 @@
+// Builds an MJPEG-AVI the way /clip?format=avi streams it and walks the
+// RIFF structure back: chunk sizes, header fields and idx1 offsets.
+
+#include <cstring>
+#include <vector>
+
+#include "avi_writer.h"
+#include "check.h"
+
+using namespace camcore;
+
+namespace {
+
+uint32_t le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool isFourcc(const uint8_t *p, const char *fourcc) {
+  return memcmp(p, fourcc, 4) == 0;
+}
+
+std::vector<uint8_t> buildAvi(const std::vector<std::vector<uint8_t>> &frames,
+                              AviClipInfo *info) {
+  *info = AviClipInfo();
+  info->width = 640;
+  info->height = 480;
+  info->us_per_frame = 66666;
+  info->frame_count = (uint32_t)frames.size();
+  for (const auto &f : frames) {
+    if (f.size() > info->max_frame_len)
+      info->max_frame_len = (uint32_t)f.size();
+    info->total_frame_len += (uint32_t)f.size();
+    info->odd_frames += f.size() & 1;
+  }
+
+  std::vector<uint8_t> out(kAviHeaderSize);
+  aviWriteHeader(out.data(), *info);
+  for (const auto &f : frames) {
+    size_t pos = out.size();
+    out.resize(pos + kAviChunkHeaderSize);
+    aviWriteChunkHeader(out.data() + pos, (uint32_t)f.size());
+    out.insert(out.end(), f.begin(), f.end());
+    if (f.size() & 1)
+      out.push_back(0);
+  }
+  size_t pos = out.size();
+  out.resize(pos + kAviChunkHeaderSize);
+  aviWriteIndexHeader(out.data() + pos, info->frame_count);
+  uint32_t movi_offset = 4;
+  for (const auto &f : frames) {
+    pos = out.size();
+    out.resize(pos + kAviIndexEntrySize);
+    aviWriteIndexEntry(out.data() + pos, movi_offset, (uint32_t)f.size());
+    movi_offset += kAviChunkHeaderSize + ((f.size() + 1) & ~(size_t)1);
+  }
+  return out;
+}
+
+void testStructure() {
+  std::vector<std::vector<uint8_t>> frames = {
+      std::vector<uint8_t>(1001, 0xA1),
+      std::vector<uint8_t>(2000, 0xB2),
+      std::vector<uint8_t>(3, 0xC3),
+  };
+  AviClipInfo info;
+  std::vector<uint8_t> avi = buildAvi(frames, &info);
+  const uint8_t *p = avi.data();
+
+  CHECK_EQ(aviFileSize(info), avi.size());
+  CHECK(isFourcc(p, "RIFF"));
+  CHECK_EQ(le32(p + 4), avi.size() - 8);
+  CHECK(isFourcc(p + 8, "AVI "));
+
+  // hdrl ends exactly where the movi list starts, after kAviHeaderSize
+  // minus the movi list header.
+  CHECK(isFourcc(p + 12, "LIST"));
+  CHECK(isFourcc(p + 20, "hdrl"));
+  size_t movi_list = 20 + le32(p + 16);
+  CHECK_EQ(movi_list, kAviHeaderSize - 12);
+
+  CHECK(isFourcc(p + 24, "avih"));
+  CHECK_EQ(le32(p + 28), 56);
+  const uint8_t *avih = p + 32;
+  CHECK_EQ(le32(avih), info.us_per_frame);
+  CHECK_EQ(le32(avih + 16), info.frame_count);
+  CHECK_EQ(le32(avih + 24), 1);                     // streams
+  CHECK_EQ(le32(avih + 28), 2000 + kAviChunkHeaderSize);  // buffer size
+  CHECK_EQ(le32(avih + 32), 640);
+  CHECK_EQ(le32(avih + 36), 480);
+
+  const uint8_t *strl = avih + 56;
+  CHECK(isFourcc(strl, "LIST"));
+  CHECK(isFourcc(strl + 8, "strl"));
+  CHECK_EQ(strl + 8 + le32(strl + 4), p + movi_list);
+  CHECK(isFourcc(strl + 12, "strh"));
+  CHECK_EQ(le32(strl + 16), 56);
+  CHECK(isFourcc(strl + 20, "vids"));
+  CHECK(isFourcc(strl + 24, "MJPG"));
+  CHECK_EQ(le32(strl + 52), info.frame_count);  // length
+  const uint8_t *strf = strl + 20 + 56;
+  CHECK(isFourcc(strf, "strf"));
+  CHECK_EQ(le32(strf + 4), 40);
+  CHECK(isFourcc(strf + 24, "MJPG"));
+
+  // movi: one '00dc' chunk per frame, word aligned.
+  const uint8_t *movi = p + movi_list;
+  CHECK(isFourcc(movi, "LIST"));
+  CHECK(isFourcc(movi + 8, "movi"));
+  const uint8_t *idx1 = movi + 8 + le32(movi + 4);
+  CHECK(idx1 + 8 <= p + avi.size());
+  CHECK(isFourcc(idx1, "idx1"));
+  CHECK_EQ(le32(idx1 + 4), frames.size() * kAviIndexEntrySize);
+  CHECK_EQ(idx1 + 8 + le32(idx1 + 4), p + avi.size());
+
+  // Each idx1 entry points (relative to the 'movi' FOURCC) at its chunk.
+  const uint8_t *chunk = movi + 12;
+  for (size_t i = 0; i < frames.size(); i++) {
+    const uint8_t *entry = idx1 + 8 + i * kAviIndexEntrySize;
+    CHECK(isFourcc(entry, "00dc"));
+    CHECK_EQ(le32(entry + 4), 0x10);  // keyframe
+    CHECK_EQ(movi + 8 + le32(entry + 8), chunk);
+    CHECK_EQ(le32(entry + 12), frames[i].size());
+    CHECK(isFourcc(chunk, "00dc"));
+    CHECK_EQ(le32(chunk + 4), frames[i].size());
+    CHECK(memcmp(chunk + 8, frames[i].data(), frames[i].size()) == 0);
+    chunk += 8 + ((frames[i].size() + 1) & ~(size_t)1);
+  }
+  CHECK_EQ(chunk, idx1);
+}
+
+void testEmptyClip() {
+  AviClipInfo info;
+  std::vector<uint8_t> avi = buildAvi({}, &info);
+  CHECK_EQ(aviFileSize(info), avi.size());
+  CHECK_EQ(avi.size(), kAviHeaderSize + kAviChunkHeaderSize);
+  CHECK_EQ(le32(avi.data() + 4), avi.size() - 8);
+}
+
+}  // namespace
+
+int main() {
+  testStructure();
+  testEmptyClip();
+  return camcore_test::checkResult();
+}
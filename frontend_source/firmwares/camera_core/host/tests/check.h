@@ -0,0 +1,41 @@
+#pragma once
+
+// Minimal assertions for the host unit tests. A failed CHECK prints the
+// expression and carries on, so one run lists every failure; main()
+// returns checkResult() for ctest.
+
+#include <cstdio>
+
+namespace camcore_test {
+
+inline int &checkFailures() {
+  static int failures = 0;
+  return failures;
+}
+
+inline int checkResult() {
+  if (checkFailures())
+    fprintf(stderr, "%d check(s) failed\n", checkFailures());
+  return checkFailures() ? 1 : 0;
+}
+
+}  // namespace camcore_test
+
+#define CHECK(cond)                                                       \
+  do {                                                                    \
+    if (!(cond)) {                                                        \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,    \
+              #cond);                                                     \
+      camcore_test::checkFailures()++;                                    \
+    }                                                                     \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                    \
+  do {                                                                    \
+    long long a_ = (long long)(a), b_ = (long long)(b);                   \
+    if (a_ != b_) {                                                       \
+      fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n",   \
+              __FILE__, __LINE__, #a, #b, a_, b_);                        \
+      camcore_test::checkFailures()++;                                    \
+    }                                                                     \
+  } while (0)
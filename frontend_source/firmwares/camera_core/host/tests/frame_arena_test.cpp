@@ -0,0 +1,160 @@
+// FrameArena on caller-owned memory: wraparound, FIFO eviction by bytes
+// and by index slots, and pins that hold back eviction.
+
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "check.h"
+#include "frame_arena.h"
+
+using namespace camcore;
+
+namespace {
+
+struct Arena {
+  std::vector<uint8_t> bytes;
+  std::vector<ArenaFrame> index;
+  FrameArena arena;
+
+  Arena(size_t size, size_t max_frames)
+      : bytes(size), index(max_frames) {
+    CHECK(arena.begin(bytes.data(), size, index.data(), max_frames));
+  }
+
+  // Frame n is `len` bytes of n, timestamped n ms.
+  bool append(uint8_t n, size_t len) {
+    std::vector<uint8_t> frame(len, n);
+    return arena.append(frame.data(), len, n * 1000);
+  }
+};
+
+// Checks that the clip holds exactly `frames`, each with its own bytes.
+void checkClip(FrameArena *arena, ArenaClip *clip,
+               std::initializer_list<uint8_t> frames) {
+  CHECK_EQ(clip->end_seq - clip->first_seq, frames.size());
+  if (clip->end_seq - clip->first_seq != frames.size())
+    return;
+  uint32_t seq = clip->first_seq;
+  for (uint8_t n : frames) {
+    const uint8_t *data;
+    ArenaFrame frame;
+    CHECK(arena->peek(*clip, seq, &data, &frame));
+    CHECK_EQ(frame.timestamp_us, n * 1000);
+    bool intact = true;
+    for (uint32_t i = 0; i < frame.len; i++)
+      intact &= data[i] == n;
+    CHECK(intact);
+    seq++;
+  }
+}
+
+void testWraparound() {
+  Arena a(1000, 16);
+  // 300-byte frames: three fit, the fourth wraps to offset 0 and leaves
+  // 100 bytes of dead tail.
+  for (uint8_t n = 1; n <= 3; n++)
+    CHECK(a.append(n, 300));
+  CHECK(a.append(4, 300));
+  CHECK_EQ(a.arena.stats().evicted, 1);
+  CHECK(a.append(5, 300));
+  CHECK_EQ(a.arena.stats().evicted, 2);
+
+  ArenaClip clip;
+  CHECK(a.arena.pinSince(0, &clip));
+  checkClip(&a.arena, &clip, {3, 4, 5});
+  const uint8_t *data;
+  ArenaFrame frame;
+  CHECK(a.arena.peek(clip, clip.first_seq + 1, &data, &frame));
+  CHECK_EQ(frame.offset, 0);
+  a.arena.unpin(&clip);
+
+  // Frame 6 fits before the end again and goes after frame 5; its odd
+  // length is padded to 4 bytes.
+  CHECK(a.append(6, 301));
+  CHECK(a.arena.pinSince(6000, &clip));
+  CHECK(a.arena.peek(clip, clip.first_seq, &data, &frame));
+  CHECK_EQ(frame.offset, 600);
+  CHECK_EQ(frame.len, 301);
+  a.arena.unpin(&clip);
+
+  CHECK(!a.append(7, 1001));
+  CHECK_EQ(a.arena.stats().dropped_oversize, 1);
+  CHECK_EQ(a.arena.stats().recorded, 6);
+}
+
+void testIndexFull() {
+  Arena a(10000, 4);
+  for (uint8_t n = 1; n <= 10; n++)
+    CHECK(a.append(n, 10));
+  CHECK_EQ(a.arena.stats().evicted, 6);
+  ArenaClip clip;
+  CHECK(a.arena.pinSince(0, &clip));
+  checkClip(&a.arena, &clip, {7, 8, 9, 10});
+  a.arena.unpin(&clip);
+}
+
+void testPinnedFrames() {
+  Arena a(1000, 16);
+  for (uint8_t n = 1; n <= 3; n++)
+    CHECK(a.append(n, 300));
+
+  ArenaClip clip;
+  CHECK(a.arena.pinSince(1000, &clip));
+  CHECK_EQ(clip.first_seq, 1);
+
+  // Frame 4 would overwrite pinned frame 1: new frames are dropped and
+  // the clip stays intact.
+  CHECK(!a.append(4, 300));
+  CHECK(!a.append(5, 300));
+  CHECK_EQ(a.arena.stats().dropped_pinned, 2);
+  checkClip(&a.arena, &clip, {1, 2, 3});
+
+  // Moving the pin past frame 1 lets the next append evict it, but not
+  // frame 2.
+  const uint8_t *data;
+  ArenaFrame frame;
+  CHECK(a.arena.frame(&clip, 2, &data, &frame));
+  CHECK(!a.arena.frame(&clip, 1, &data, &frame));  // no going back
+  CHECK(a.append(6, 300));
+  CHECK(!a.append(7, 300));
+  CHECK(a.arena.peek(clip, 2, &data, &frame));
+  CHECK_EQ(data[0], 2);
+
+  // Later clips see what the recorder kept.
+  ArenaClip other;
+  CHECK(a.arena.pinSince(0, &other));
+  checkClip(&a.arena, &other, {2, 3, 6});
+  ArenaClip third;
+  CHECK(!a.arena.pinSince(0, &third));  // both pins taken
+  a.arena.unpin(&other);
+
+  a.arena.unpin(&clip);
+  CHECK(a.append(8, 300));
+  CHECK(a.arena.pinSince(0, &clip));
+  checkClip(&a.arena, &clip, {3, 6, 8});
+  a.arena.unpin(&clip);
+}
+
+void testPinSince() {
+  Arena a(1000, 16);
+  ArenaClip clip;
+  CHECK(!a.arena.pinSince(0, &clip));  // empty
+  for (uint8_t n = 1; n <= 5; n++)
+    CHECK(a.append(n, 10));
+  CHECK_EQ(a.arena.newestTimestampUs(), 5000);
+  CHECK(a.arena.pinSince(3500, &clip));
+  checkClip(&a.arena, &clip, {4, 5});
+  a.arena.unpin(&clip);
+  CHECK(!a.arena.pinSince(6000, &clip));
+}
+
+}  // namespace
+
+int main() {
+  testWraparound();
+  testIndexFull();
+  testPinnedFrames();
+  testPinSince();
+  return camcore_test::checkResult();
+}
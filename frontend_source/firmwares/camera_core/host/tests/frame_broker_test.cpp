@@ -0,0 +1,149 @@
+// FrameBroker: slots pinned by a FrameRef are never written while the
+// producer keeps cycling the others, drops once every slot is taken, and
+// the oversize and busy counters.
+
+#include <cstring>
+#include <vector>
+
+#include "check.h"
+#include "frame_broker.h"
+
+using namespace camcore;
+
+namespace {
+
+const size_t kCapacity = 64;
+
+struct Broker {
+  FrameBroker broker;
+
+  explicit Broker(size_t slots) {
+    FrameBroker::Config config;
+    config.slot_count = slots;
+    config.slot_capacity = kCapacity;
+    CHECK(broker.begin(config));
+  }
+
+  // Frame n is 16 bytes of n, timestamped n ms.
+  uint32_t publish(uint8_t n) {
+    std::vector<uint8_t> frame(16, n);
+    FrameInfo info;
+    info.timestamp_us = n * 1000;
+    return broker.publish(frame.data(), frame.size(), info);
+  }
+};
+
+bool holds(const FrameRef &ref, uint8_t n) {
+  if (!ref || ref.size() != 16 || ref.timestampUs() != n * 1000)
+    return false;
+  for (size_t i = 0; i < ref.size(); i++) {
+    if (ref.data()[i] != n)
+      return false;
+  }
+  return true;
+}
+
+void testHeldSlotNotReused() {
+  Broker b(3);
+  CHECK(!b.broker.latest());
+  CHECK_EQ(b.publish(1), 1);
+  FrameRef held = b.broker.latest();
+  FrameRef copy = held;
+
+  // The other two slots take turns; the held one is left alone.
+  for (uint8_t n = 2; n < 50; n++) {
+    CHECK_EQ(b.publish(n), n);
+    FrameRef latest = b.broker.latest();
+    CHECK(holds(latest, n));
+    CHECK(latest.data() != held.data());
+  }
+  CHECK(holds(held, 1));
+  CHECK_EQ(held.seq(), 1);
+  CHECK_EQ(b.broker.stats().dropped_busy, 0);
+
+  // A copy keeps the pin after the original goes.
+  const uint8_t *pinned = copy.data();
+  held.reset();
+  CHECK_EQ(b.publish(50), 50);
+  CHECK_EQ(b.publish(51), 51);
+  CHECK(holds(copy, 1));
+
+  // Released, the slot is back in the rotation.
+  copy.reset();
+  bool reused = false;
+  for (uint8_t n = 52; n < 56; n++) {
+    CHECK_EQ(b.publish(n), n);
+    reused |= b.broker.latest().data() == pinned;
+  }
+  CHECK(reused);
+}
+
+void testAllSlotsPinned() {
+  Broker b(3);
+  CHECK_EQ(b.publish(1), 1);
+  FrameRef first = b.broker.latest();
+  CHECK_EQ(b.publish(2), 2);
+  FrameRef second = b.broker.latest();
+  CHECK_EQ(b.publish(3), 3);
+
+  // Two readers and the latest frame: nothing left to write into.
+  CHECK_EQ(b.publish(4), 0);
+  size_t capacity;
+  CHECK(!b.broker.beginFrame(&capacity));
+  CHECK_EQ(b.broker.stats().dropped_busy, 2);
+  CHECK_EQ(b.broker.latestSeq(), 3);
+  CHECK(holds(first, 1));
+  CHECK(holds(second, 2));
+
+  first.reset();
+  CHECK_EQ(b.publish(5), 4);
+  CHECK(holds(b.broker.latest(), 5));
+  CHECK(holds(second, 2));
+}
+
+void testOversizeAndAbort() {
+  Broker b(3);
+  CHECK_EQ(b.publish(1), 1);
+
+  std::vector<uint8_t> big(kCapacity + 1, 7);
+  CHECK_EQ(b.broker.publish(big.data(), big.size(), FrameInfo()), 0);
+
+  // An encoder that runs out of room, and one that gives up for another
+  // reason.
+  size_t capacity = 0;
+  CHECK(b.broker.beginFrame(&capacity) != nullptr);
+  CHECK_EQ(capacity, kCapacity);
+  b.broker.abortFrame(true);
+  CHECK(b.broker.beginFrame(&capacity) != nullptr);
+  b.broker.abortFrame();
+
+  FrameBrokerStats stats = b.broker.stats();
+  CHECK_EQ(stats.published, 1);
+  CHECK_EQ(stats.dropped_oversize, 2);
+  CHECK_EQ(stats.dropped_busy, 0);
+  CHECK(holds(b.broker.latest(), 1));
+  CHECK_EQ(b.publish(2), 2);
+}
+
+void testWaitNewer() {
+  Broker b(3);
+  CHECK(!b.broker.waitNewer(0, 0));
+  CHECK_EQ(b.publish(1), 1);
+  CHECK_EQ(b.publish(2), 2);
+  // Behind the latest frame: returns it at once, skipping seq 1.
+  FrameRef ref = b.broker.waitNewer(0, 0);
+  CHECK(holds(ref, 2));
+  CHECK(!b.broker.waitNewer(2, 0));
+  b.broker.close();
+  CHECK(!b.broker.waitNewer(0, 1000));
+}
+
+}  // namespace
+
+int main() {
+  testHeldSlotNotReused();
+  testAllSlotsPinned();
+  testOversizeAndAbort();
+  testWaitNewer();
+  return camcore_test::checkResult();
+}
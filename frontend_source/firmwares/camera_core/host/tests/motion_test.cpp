@@ -0,0 +1,227 @@
+// Motion scoring on a synthetic JPEG sequence: frames are encoded with
+// libjpeg the way the simulated sensor does, reduced to a luma DC grid by
+// jpegLumaDc() and scored by MotionDetector, as on the capture task.
+// Also feeds JpegDecoder truncated and corrupted headers.
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include "check.h"
+#include "hal/host_jpeg.h"
+#include "jpeg_decoder.h"
+#include "motion_detector.h"
+
+using namespace camcore;
+
+namespace {
+
+const int kWidth = 640, kHeight = 480;
+const int64_t kFrameUs = 100000;  // 10 fps
+const size_t kGridCells = 100 * 75;
+
+struct Scene {
+  int box_x = -1;  // < 0: no box
+  int brightness = 0;
+};
+
+void sceneRow(void *ctx, int y, uint8_t *row) {
+  const Scene *scene = static_cast<const Scene *>(ctx);
+  int box = kWidth / 6, box_y = kHeight / 2 - box / 2;
+  for (int x = 0; x < kWidth; x++) {
+    bool in_box = scene->box_x >= 0 && x >= scene->box_x &&
+                  x < scene->box_x + box && y >= box_y && y < box_y + box;
+    int v = in_box ? 230 : 40 + x * 120 / kWidth + scene->brightness;
+    v = v > 255 ? 255 : v;
+    row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = (uint8_t)v;
+  }
+}
+
+size_t appendJpeg(void *arg, size_t index, const void *data, size_t len) {
+  std::vector<uint8_t> *out = static_cast<std::vector<uint8_t> *>(arg);
+  out->resize(index + len);
+  memcpy(out->data() + index, data, len);
+  return len;
+}
+
+std::vector<uint8_t> encode(const Scene &scene) {
+  std::vector<uint8_t> jpeg;
+  Scene s = scene;
+  CHECK(hostJpegEncode(kWidth, kHeight, 3, 80, sceneRow, &s, appendJpeg,
+                       &jpeg));
+  return jpeg;
+}
+
+struct Runner {
+  JpegDecoder decoder;
+  std::vector<uint8_t> luma = std::vector<uint8_t>(kGridCells);
+  MotionDetector motion;
+  int64_t t_us = 0;
+
+  Runner() { motion.begin(MotionDetector::Config()); }
+
+  int feed(const std::vector<uint8_t> &jpeg) {
+    int w = 0, h = 0;
+    bool ok = jpegLumaDc(&decoder, jpeg.data(), jpeg.size(), luma.data(),
+                         kGridCells, &w, &h);
+    CHECK(ok);
+    t_us += kFrameUs;
+    return ok ? motion.update(luma.data(), w, h, t_us) : -1;
+  }
+
+  size_t events(MotionEvent *out, size_t max) {
+    return motion.waitEvents(0, 0, out, max);
+  }
+};
+
+// Static scene, a box crossing the frame for 3 s, then static again.
+void testStartAndStop() {
+  Runner r;
+  std::vector<uint8_t> still = encode(Scene());
+  for (int i = 0; i < 20; i++)
+    CHECK_EQ(r.feed(still), 0);
+
+  int64_t motion_start = r.t_us, motion_end = 0;
+  int peak = 0;
+  for (int i = 0; i < 30; i++) {
+    Scene scene;
+    scene.box_x = i * (kWidth - kWidth / 6) / 29;
+    int score = r.feed(encode(scene));
+    peak = score > peak ? score : peak;
+  }
+  motion_end = r.t_us;
+  CHECK(peak >= 20);
+  CHECK(r.motion.active());
+
+  for (int i = 0; i < 60; i++)
+    r.feed(still);
+  CHECK(!r.motion.active());
+
+  MotionEvent events[4];
+  size_t n = r.events(events, 4);
+  CHECK_EQ(n, 2);
+  if (n == 2) {
+    CHECK(events[0].start);
+    CHECK(events[0].timestamp_us > motion_start);
+    CHECK(events[0].timestamp_us <= motion_start + 5 * kFrameUs);
+    CHECK(!events[1].start);
+    CHECK(events[1].timestamp_us >= motion_end + 3000000);
+    CHECK(events[1].timestamp_us <= motion_end + 3000000 + 5 * kFrameUs);
+    CHECK_EQ(events[1].score_permille, peak);
+  }
+
+  // An id from before a reboot is stale: no wait, the whole log.
+  auto start = std::chrono::steady_clock::now();
+  uint32_t last_id = 0;
+  n = r.motion.waitEvents(1000, 5000, events, 4, &last_id);
+  auto waited = std::chrono::steady_clock::now() - start;
+  CHECK_EQ(n, 2);
+  CHECK_EQ(last_id, 2);
+  CHECK(waited < std::chrono::milliseconds(500));
+
+  // Up to date: waits for the timeout and returns nothing.
+  n = r.motion.waitEvents(2, 50, events, 4, &last_id);
+  CHECK_EQ(n, 0);
+}
+
+// Auto exposure brightening the whole frame is not motion.
+void testExposureShift() {
+  Runner r;
+  std::vector<uint8_t> still = encode(Scene());
+  for (int i = 0; i < 10; i++)
+    r.feed(still);
+  Scene bright;
+  bright.brightness = 30;
+  std::vector<uint8_t> brighter = encode(bright);
+  for (int i = 0; i < 10; i++)
+    CHECK(r.feed(brighter) < 20);
+  MotionEvent events[2];
+  CHECK_EQ(r.events(events, 2), 0);
+}
+
+// The box crosses the middle of the frame; only the top is watched.
+void testRegionMask() {
+  Runner r;
+  MotionRegion top = {0.0f, 0.0f, 1.0f, 0.2f};
+  r.motion.setRegions(&top, 1);
+  std::vector<uint8_t> still = encode(Scene());
+  for (int i = 0; i < 10; i++)
+    r.feed(still);
+  for (int i = 0; i < 30; i++) {
+    Scene scene;
+    scene.box_x = i * (kWidth - kWidth / 6) / 29;
+    CHECK_EQ(r.feed(encode(scene)), 0);
+  }
+  MotionEvent events[2];
+  CHECK_EQ(r.events(events, 2), 0);
+}
+
+// Offset of the first byte after the marker segment `marker`.
+size_t segmentEnd(const std::vector<uint8_t> &jpeg, uint8_t marker,
+                  size_t *start) {
+  size_t pos = 2;
+  while (pos + 4 <= jpeg.size()) {
+    size_t len = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+    if (jpeg[pos + 1] == marker) {
+      *start = pos;
+      return pos + 2 + len;
+    }
+    pos += 2 + len;
+  }
+  *start = 0;
+  return 0;
+}
+
+void testCorruptHeaders() {
+  std::vector<uint8_t> jpeg = encode(Scene());
+  JpegDecoder decoder;
+  CHECK(decoder.parse(jpeg.data(), jpeg.size()));
+  size_t sos;
+  size_t scan = segmentEnd(jpeg, 0xDA, &sos);
+  CHECK(scan > 0);
+
+  // Every header cut short fails; the copy is sized exactly so ASan
+  // builds catch reads past the end.
+  for (size_t len = 0; len < scan; len++) {
+    std::vector<uint8_t> cut(jpeg.begin(), jpeg.begin() + len);
+    CHECK(!decoder.parse(cut.data(), cut.size()));
+  }
+
+  size_t dqt, sof;
+  CHECK(segmentEnd(jpeg, 0xDB, &dqt) > 0);
+  CHECK(segmentEnd(jpeg, 0xC0, &sof) > 0);
+  struct {
+    size_t offset;
+    uint8_t value;
+  } corruptions[] = {
+      {dqt + 3, 3},       // DQT length shorter than one table
+      {dqt + 4, 0x05},    // quantization table id 5
+      {dqt + 4, 0x20},    // precision 2
+      {sof + 9, 4},       // 4 components
+      {sof + 3, 8},       // SOF length too short for 3 components
+      {sof + 12, 7},      // component 0 uses quantization table 7
+      {sos + 6, 0x51},    // DC Huffman table 5
+  };
+  for (const auto &c : corruptions) {
+    std::vector<uint8_t> bad = jpeg;
+    bad[c.offset] = c.value;
+    CHECK(!decoder.parse(bad.data(), bad.size()));
+  }
+
+  // A scan cut short decodes as far as it goes and then fails.
+  std::vector<uint8_t> short_scan(jpeg.begin(), jpeg.begin() + scan + 100);
+  std::vector<uint8_t> luma(kGridCells);
+  int w, h;
+  CHECK(!jpegLumaDc(&decoder, short_scan.data(), short_scan.size(),
+                    luma.data(), kGridCells, &w, &h));
+}
+
+}  // namespace
+
+int main() {
+  testStartAndStop();
+  testExposureShift();
+  testRegionMask();
+  testCorruptHeaders();
+  return camcore_test::checkResult();
+}
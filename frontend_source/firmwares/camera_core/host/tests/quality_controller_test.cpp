@@ -0,0 +1,116 @@
+// QualityController: the ladder it steps down under backpressure (quality
+// first, then frame size) and the hysteresis on the way back up.
+
+#include "check.h"
+#include "quality_controller.h"
+
+using namespace camcore;
+
+namespace {
+
+const int kFrameSizes[] = {9, 8, 5};  // SVGA, VGA, QVGA
+const int64_t kWindowUs = 1000000;
+
+struct Controller {
+  QualityController qc;
+  int64_t now_us = 0;
+
+  Controller() {
+    QualityController::Config config;
+    config.best_quality = 10;
+    config.worst_quality = 20;
+    config.quality_step = 5;
+    config.frame_sizes = kFrameSizes;
+    config.frame_size_count = 3;
+    qc.begin(config, kFrameSizes[0]);
+  }
+
+  // One window in which the worst client used `ratio` of its budget.
+  // Returns true when the level changed.
+  bool window(float ratio, QualityLevel *out) {
+    if (ratio > 0)
+      qc.reportSend((uint32_t)(ratio * 10000), 10000);
+    now_us += kWindowUs;
+    return qc.update(now_us, out);
+  }
+
+  // Windows at `ratio` until the level changes, at most `limit`. Returns
+  // how many it took, 0 if it never changed.
+  int windowsToChange(float ratio, int limit, QualityLevel *out) {
+    for (int n = 1; n <= limit; n++) {
+      if (window(ratio, out))
+        return n;
+    }
+    return 0;
+  }
+};
+
+void testStepDown() {
+  Controller c;
+  QualityLevel level = c.qc.current();
+  CHECK_EQ(level.quality, 10);
+  CHECK_EQ(level.frame_size, 9);
+
+  // Quality steps before the frame size, one level per change.
+  const QualityLevel ladder[] = {{15, 9}, {20, 9}, {20, 8}, {20, 5}};
+  for (const QualityLevel &want : ladder) {
+    CHECK(c.windowsToChange(1.0f, 10, &level) > 0);
+    CHECK_EQ(level.quality, want.quality);
+    CHECK_EQ(level.frame_size, want.frame_size);
+  }
+  CHECK_EQ(c.qc.level(), 4);
+  CHECK_EQ(c.windowsToChange(1.0f, 20, &level), 0);  // bottom of the ladder
+}
+
+void testSmoothing() {
+  Controller c;
+  QualityLevel level;
+  // A single slow window is averaged away.
+  CHECK(!c.window(1.0f, &level));
+  CHECK(!c.window(0.1f, &level));
+  CHECK_EQ(c.qc.level(), 0);
+
+  // Neither calm nor loaded: the level holds.
+  CHECK_EQ(c.windowsToChange(0.7f, 20, &level), 0);
+
+  // A report counts when its window ends, not before.
+  c.qc.reportSend(20000, 10000);
+  CHECK(!c.qc.update(c.now_us + kWindowUs / 2, &level));
+  CHECK(c.window(0.0f, &level));
+  CHECK_EQ(c.qc.level(), 1);
+
+  // Windows without reports (no clients) leave the level alone.
+  CHECK_EQ(c.windowsToChange(0.0f, 20, &level), 0);
+  CHECK_EQ(c.qc.level(), 1);
+}
+
+void testRecovery() {
+  Controller c;
+  QualityLevel level;
+  while (c.qc.level() < 2)
+    CHECK(c.windowsToChange(1.0f, 10, &level) > 0);
+
+  // Back up one level per recover_windows (3) calm windows.
+  CHECK_EQ(c.windowsToChange(0.1f, 10, &level), 3);
+  CHECK_EQ(c.qc.level(), 1);
+  CHECK_EQ(level.quality, 15);
+
+  // A load spike that does not degrade still restarts the calm count.
+  CHECK(!c.window(0.1f, &level));
+  CHECK(!c.window(0.1f, &level));
+  CHECK(!c.window(1.0f, &level));
+  CHECK_EQ(c.qc.level(), 1);
+  CHECK_EQ(c.windowsToChange(0.1f, 10, &level), 3);
+  CHECK_EQ(c.qc.level(), 0);
+  CHECK_EQ(level.quality, 10);
+  CHECK_EQ(c.windowsToChange(0.1f, 20, &level), 0);  // already the best
+}
+
+}  // namespace
+
+int main() {
+  testStepDown();
+  testSmoothing();
+  testRecovery();
+  return camcore_test::checkResult();
+}
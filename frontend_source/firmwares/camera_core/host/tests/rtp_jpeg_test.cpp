@@ -0,0 +1,116 @@
+// rtpJpegSource() on a libjpeg frame: the tables and scan it finds, and
+// headers that are cut short or carry segments too short for their
+// marker. Copies are sized exactly so ASan builds catch reads past the end.
+
+#include <cstring>
+#include <vector>
+
+#include "check.h"
+#include "hal/host_jpeg.h"
+#include "rtp_jpeg.h"
+
+using namespace camcore;
+
+namespace {
+
+const int kWidth = 320, kHeight = 240;
+
+void grayRow(void *ctx, int y, uint8_t *row) {
+  (void)ctx;
+  for (int x = 0; x < kWidth; x++)
+    row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = (uint8_t)(x + y);
+}
+
+size_t appendJpeg(void *arg, size_t index, const void *data, size_t len) {
+  std::vector<uint8_t> *out = static_cast<std::vector<uint8_t> *>(arg);
+  out->resize(index + len);
+  memcpy(out->data() + index, data, len);
+  return len;
+}
+
+std::vector<uint8_t> encode() {
+  std::vector<uint8_t> jpeg;
+  CHECK(hostJpegEncode(kWidth, kHeight, 3, 80, grayRow, nullptr, appendJpeg,
+                       &jpeg));
+  return jpeg;
+}
+
+// Offset of the SOS marker.
+size_t findSos(const std::vector<uint8_t> &jpeg) {
+  size_t pos = 2;
+  while (pos + 4 <= jpeg.size() && jpeg[pos + 1] != 0xDA)
+    pos += 2 + ((jpeg[pos + 2] << 8) | jpeg[pos + 3]);
+  return pos;
+}
+
+bool source(const std::vector<uint8_t> &jpeg, RtpJpegSource *out) {
+  return rtpJpegSource(jpeg.data(), jpeg.size(), out);
+}
+
+void testValid() {
+  std::vector<uint8_t> jpeg = encode();
+  RtpJpegSource src;
+  CHECK(source(jpeg, &src));
+  CHECK_EQ(src.width8, kWidth / 8);
+  CHECK_EQ(src.height8, kHeight / 8);
+  CHECK_EQ(src.restart_interval, 0);
+  CHECK(src.qt[0] && src.qt[1]);
+  size_t sos = findSos(jpeg);
+  CHECK_EQ(src.scan, jpeg.data() + sos + 2 + ((jpeg[sos + 2] << 8) |
+                                              jpeg[sos + 3]));
+  CHECK_EQ(src.scan + src.scan_len, jpeg.data() + jpeg.size() - 2);  // EOI
+}
+
+void testTruncated() {
+  std::vector<uint8_t> jpeg = encode();
+  size_t sos = findSos(jpeg);
+  size_t scan = sos + 2 + ((jpeg[sos + 2] << 8) | jpeg[sos + 3]);
+  RtpJpegSource src;
+  for (size_t len = 0; len <= scan; len++) {
+    std::vector<uint8_t> cut(jpeg.begin(), jpeg.begin() + len);
+    CHECK(!source(cut, &src));
+  }
+}
+
+// A DRI segment before SOS, `payload` bytes long.
+std::vector<uint8_t> withDri(const std::vector<uint8_t> &jpeg,
+                             size_t payload) {
+  size_t sos = findSos(jpeg);
+  std::vector<uint8_t> out(jpeg.begin(), jpeg.begin() + sos);
+  uint8_t head[] = {0xFF, 0xDD, 0, (uint8_t)(2 + payload)};
+  out.insert(out.end(), head, head + 4);
+  for (size_t i = 0; i < payload; i++)
+    out.push_back(i == payload - 1 ? 4 : 0);
+  out.insert(out.end(), jpeg.begin() + sos, jpeg.end());
+  return out;
+}
+
+void testShortSegments() {
+  std::vector<uint8_t> jpeg = encode();
+  RtpJpegSource src;
+
+  CHECK(source(withDri(jpeg, 2), &src));
+  CHECK_EQ(src.restart_interval, 4);
+  CHECK_EQ(src.type & 64, 64);
+  CHECK(!source(withDri(jpeg, 0), &src));
+  CHECK(!source(withDri(jpeg, 1), &src));
+
+  // SOS lengths that stop inside the component list, and the frame cut
+  // right after such a segment.
+  size_t sos = findSos(jpeg);
+  for (uint8_t seg_len = 2; seg_len < 12; seg_len++) {
+    std::vector<uint8_t> bad(jpeg.begin(), jpeg.begin() + sos + 2 + seg_len);
+    bad[sos + 2] = 0;
+    bad[sos + 3] = seg_len;
+    CHECK(!source(bad, &src));
+  }
+}
+
+}  // namespace
+
+int main() {
+  testValid();
+  testTruncated();
+  testShortSegments();
+  return camcore_test::checkResult();
+}
@@ -0,0 +1,91 @@
+// StreamPacer: frames on a fixed 1/fps grid, a resync instead of a burst
+// after a stall, and the idle keep-alive rate.
+
+#include "check.h"
+#include "stream_pacer.h"
+
+using namespace camcore;
+
+namespace {
+
+// Runs a client that sends whenever a frame is due, checking every `step`
+// microseconds from `from` to `to`. Returns the number of frames sent.
+int sendsBetween(StreamPacer *pacer, int64_t from, int64_t to,
+                 int64_t step = 1000) {
+  int sent = 0;
+  for (int64_t now = from; now < to; now += step) {
+    if (pacer->delayUs(now) == 0) {
+      pacer->markSent(now);
+      sent++;
+    }
+  }
+  return sent;
+}
+
+void testGrid() {
+  StreamPacer pacer(10);
+  CHECK(pacer.paced());
+  CHECK(!pacer.gated());
+  CHECK_EQ(pacer.intervalUs(), 100000);
+  CHECK_EQ(pacer.delayUs(0), 0);
+  pacer.markSent(0);
+  CHECK_EQ(pacer.delayUs(40000), 60000);
+
+  // A send that starts late does not shift the grid.
+  pacer.markSent(130000);
+  CHECK_EQ(pacer.delayUs(130000), 70000);
+  CHECK_EQ(sendsBetween(&pacer, 130000, 1130000), 10);
+}
+
+void testResyncAfterStall() {
+  StreamPacer pacer(10);
+  CHECK_EQ(sendsBetween(&pacer, 0, 1000000), 10);
+
+  // The client stalls in send() for 2.5 s. The next frame is a full
+  // interval after it gets back, not a burst of the 25 it missed.
+  pacer.markSent(3500000);
+  CHECK_EQ(pacer.delayUs(3500000), 100000);
+  CHECK_EQ(pacer.delayUs(3599999), 1);
+  CHECK_EQ(pacer.delayUs(3600000), 0);
+  CHECK_EQ(sendsBetween(&pacer, 3600000, 4600000), 10);
+}
+
+void testUnpaced() {
+  StreamPacer pacer(0);
+  CHECK(!pacer.paced());
+  pacer.markSent(0);
+  CHECK_EQ(pacer.delayUs(0), 0);
+  CHECK_EQ(sendsBetween(&pacer, 0, 100000), 100);
+
+  // Without an idle rate, motion changes nothing.
+  StreamPacer fixed(10);
+  fixed.setIdle(true, 0);
+  CHECK_EQ(fixed.intervalUs(), 100000);
+}
+
+void testIdle() {
+  StreamPacer pacer(10, 1);
+  CHECK(pacer.gated());
+  CHECK_EQ(sendsBetween(&pacer, 0, 1000000), 10);
+
+  // Idle: the next frame waits a full keep-alive interval.
+  pacer.setIdle(true, 1000000);
+  CHECK_EQ(pacer.intervalUs(), 1000000);
+  CHECK_EQ(pacer.delayUs(1000000), 1000000);
+  CHECK_EQ(sendsBetween(&pacer, 1000000, 5000000), 3);
+
+  // Motion: the first frame is due at once, then the full rate again.
+  pacer.setIdle(false, 5250000);
+  CHECK_EQ(pacer.delayUs(5250000), 0);
+  CHECK_EQ(sendsBetween(&pacer, 5250000, 6250000), 10);
+}
+
+}  // namespace
+
+int main() {
+  testGrid();
+  testResyncAfterStall();
+  testUnpaced();
+  testIdle();
+  return camcore_test::checkResult();
+}
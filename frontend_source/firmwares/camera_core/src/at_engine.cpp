@@ -0,0 +1,322 @@
+#include "at_engine.h"
+
+#include <esp_idf_version.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <cstring>
+
+namespace camcore {
+
+static const char *TAG = "at";
+
+static bool startsWith(const char *line, const char *prefix) {
+  return strncmp(line, prefix, strlen(prefix)) == 0;
+}
+
+static bool isErrorResult(const char *line) {
+  return strcmp(line, "ERROR") == 0 || startsWith(line, "+CME ERROR") ||
+         startsWith(line, "+CMS ERROR") || strcmp(line, "NO CARRIER") == 0 ||
+         strcmp(line, "BUSY") == 0 || strcmp(line, "NO ANSWER") == 0 ||
+         strcmp(line, "NO DIALTONE") == 0;
+}
+
+// Rounds up, so a wait never ends just short of a deadline and spins.
+static TickType_t ticksFromUs(int64_t us) {
+  if (us <= 0)
+    return 0;
+  return (TickType_t)((us * configTICK_RATE_HZ + 999999) / 1000000);
+}
+
+bool AtEngine::begin(const Config &config) {
+  config_ = config;
+
+  uart_config_t uart = {};
+  uart.baud_rate = config.baud_rate;
+  uart.data_bits = UART_DATA_8_BITS;
+  uart.parity = UART_PARITY_DISABLE;
+  uart.stop_bits = UART_STOP_BITS_1;
+  uart.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+  uart.source_clk = UART_SCLK_DEFAULT;
+#else
+  uart.source_clk = UART_SCLK_APB;
+#endif
+
+  esp_err_t err = uart_param_config(config.port, &uart);
+  if (err == ESP_OK)
+    err = uart_set_pin(config.port, config.tx_pin, config.rx_pin,
+                       UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+  if (err == ESP_OK)
+    err = uart_driver_install(config.port, config.rx_buffer_size, 0,
+                              config.event_queue_size, &events_, 0);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "UART%d init failed: %s", (int)config.port,
+             esp_err_to_name(err));
+    return false;
+  }
+  return true;
+}
+
+bool AtEngine::addUrc(const char *prefix, bool has_body, UrcHandler handler,
+                      void *ctx) {
+  if (urc_count_ == kMaxUrcs)
+    return false;
+  urcs_[urc_count_++] = {prefix, strlen(prefix), has_body, handler, ctx};
+  return true;
+}
+
+bool AtEngine::send(const char *command, AtCallback done, void *ctx,
+                    uint32_t timeout_ms, const char *payload) {
+  size_t len = strlen(command);
+  size_t payload_len = payload ? strlen(payload) : 0;
+  if (pending_count_ == kMaxPending || len >= kCommandSize ||
+      payload_len >= kPayloadSize) {
+    ESP_LOGW(TAG, "Cannot queue %s", command);
+    return false;
+  }
+  Command &cmd = pending_[(pending_head_ + pending_count_) % kMaxPending];
+  memcpy(cmd.text, command, len + 1);
+  memcpy(cmd.payload, payload_len ? payload : "", payload_len + 1);
+  cmd.done = done;
+  cmd.ctx = ctx;
+  cmd.timeout_ms = timeout_ms ? timeout_ms : config_.default_timeout_ms;
+  pending_count_++;
+  // From inside a completion callback the next command is started once the
+  // callback returns, so `response` stays intact while it runs.
+  if (!in_callback_)
+    startNext();
+  return true;
+}
+
+void AtEngine::process(TickType_t max_wait) {
+  TickType_t wait = max_wait;
+  if (in_flight_ || resyncing_) {
+    int64_t deadline = resyncing_ ? resync_deadline_us_ : deadline_us_;
+    TickType_t left = ticksFromUs(deadline - esp_timer_get_time());
+    if (left < wait)
+      wait = left;
+  }
+
+  uart_event_t event;
+  if (xQueueReceive(events_, &event, wait) == pdTRUE) {
+    int64_t start = esp_timer_get_time();
+    do {
+      switch (event.type) {
+      case UART_DATA:
+        readInput();
+        break;
+      case UART_FIFO_OVF:
+      case UART_BUFFER_FULL:
+        // Bytes were lost, so whatever line was in progress is garbage.
+        ESP_LOGW(TAG, "UART%d overflow, input dropped", (int)config_.port);
+        stats_.rx_overflows++;
+        uart_flush_input(config_.port);
+        xQueueReset(events_);
+        line_len_ = 0;
+        line_truncated_ = false;
+        body_urc_ = nullptr;
+        break;
+      default:
+        break;
+      }
+    } while (xQueueReceive(events_, &event, 0) == pdTRUE);
+    if (config_.work_time)
+      config_.work_time->observe((uint32_t)(esp_timer_get_time() - start));
+  }
+
+  if (in_flight_ && esp_timer_get_time() >= deadline_us_) {
+    ESP_LOGW(TAG, "%s: timed out", pending_[pending_head_].text);
+    startResync();
+    complete(AtResult::kTimeout);
+  } else if (resyncing_ && esp_timer_get_time() >= resync_deadline_us_) {
+    if (resync_finals_ == 0)
+      ESP_LOGW(TAG, "No answer to AT after a timeout");
+    resyncing_ = false;
+    startNext();
+  }
+}
+
+// The timed-out command is still at the head of the queue.
+void AtEngine::startResync() {
+  // ESC leaves the text prompt without sending; in command mode it is
+  // ignored ahead of the "AT".
+  if (pending_[pending_head_].payload[0] != '\0')
+    write("\x1b", 1);
+  write("AT\r", 3);
+  resyncing_ = true;
+  resync_finals_ = 0;
+  resync_deadline_us_ =
+      esp_timer_get_time() + (int64_t)config_.default_timeout_ms * 1000;
+}
+
+// At most two final results are outstanding: the timed-out command's, if
+// it ever answers, and the probe's. After the first, wait for the line to
+// go quiet in case the second follows.
+void AtEngine::resyncLine(bool final_result) {
+  stats_.stale_lines++;
+  if (!final_result) {
+    if (resync_finals_ > 0)
+      resync_deadline_us_ =
+          esp_timer_get_time() + (int64_t)kResyncQuietMs * 1000;
+    return;
+  }
+  if (++resync_finals_ == 2) {
+    resyncing_ = false;
+    startNext();
+    return;
+  }
+  resync_deadline_us_ = esp_timer_get_time() + (int64_t)kResyncQuietMs * 1000;
+}
+
+void AtEngine::readInput() {
+  uint8_t buf[128];
+  size_t buffered = 0;
+  while (uart_get_buffered_data_len(config_.port, &buffered) == ESP_OK &&
+         buffered > 0) {
+    int n = uart_read_bytes(config_.port, buf,
+                            buffered < sizeof(buf) ? buffered : sizeof(buf),
+                            0);
+    if (n <= 0)
+      break;
+    for (int i = 0; i < n; i++)
+      feed(buf[i]);
+  }
+}
+
+void AtEngine::feed(uint8_t byte) {
+  if (byte == '\n') {
+    // A claimed body line is delivered even when empty (an empty SMS).
+    if (line_len_ > 0 || body_urc_)
+      dispatchLine();
+    line_len_ = 0;
+    line_truncated_ = false;
+    return;
+  }
+  if (byte == '\r')
+    return;
+  if (line_len_ == kLineSize - 1) {
+    line_truncated_ = true;
+    return;
+  }
+  line_[line_len_++] = (char)byte;
+
+  // The text prompt is "> " with no line ending.
+  if (awaiting_prompt_ && line_len_ == 2 && line_[0] == '>' &&
+      line_[1] == ' ') {
+    const char *payload = pending_[pending_head_].payload;
+    awaiting_prompt_ = false;
+    line_len_ = 0;
+    write(payload, strlen(payload));
+    write("\x1a", 1);
+  }
+}
+
+void AtEngine::dispatchLine() {
+  line_[line_len_] = '\0';
+  if (line_truncated_)
+    stats_.truncated_lines++;
+
+  if (body_urc_) {
+    const Urc *urc = body_urc_;
+    body_urc_ = nullptr;
+    urc->handler(urc->ctx, urc_line_, line_);
+    return;
+  }
+
+  for (int i = 0; i < urc_count_; i++) {
+    const Urc &urc = urcs_[i];
+    if (strncmp(line_, urc.prefix, urc.prefix_len) != 0)
+      continue;
+    stats_.urcs++;
+    if (urc.has_body) {
+      memcpy(urc_line_, line_, line_len_ + 1);
+      body_urc_ = &urc;
+    } else {
+      urc.handler(urc.ctx, line_, "");
+    }
+    return;
+  }
+
+  if (resyncing_) {
+    resyncLine(strcmp(line_, "OK") == 0 || isErrorResult(line_));
+    return;
+  }
+  if (!in_flight_) {
+    stats_.unhandled_lines++;
+    ESP_LOGD(TAG, "Unhandled: %s", line_);
+    return;
+  }
+  if (strcmp(line_, "OK") == 0) {
+    complete(AtResult::kOk);
+  } else if (isErrorResult(line_)) {
+    appendResponse(line_);
+    complete(AtResult::kError);
+  } else if (strcmp(line_, pending_[pending_head_].text) != 0) {
+    appendResponse(line_);  // anything but the echo (before ATE0)
+  }
+}
+
+void AtEngine::startNext() {
+  if (in_flight_ || resyncing_ || pending_count_ == 0)
+    return;
+  const Command &cmd = pending_[pending_head_];
+  in_flight_ = true;
+  awaiting_prompt_ = cmd.payload[0] != '\0';
+  response_len_ = 0;
+  response_[0] = '\0';
+  deadline_us_ = esp_timer_get_time() + (int64_t)cmd.timeout_ms * 1000;
+  stats_.commands++;
+  write(cmd.text, strlen(cmd.text));
+  write("\r", 1);
+}
+
+void AtEngine::complete(AtResult result) {
+  const Command &cmd = pending_[pending_head_];
+  AtCallback done = cmd.done;
+  void *ctx = cmd.ctx;
+  pending_head_ = (pending_head_ + 1) % kMaxPending;
+  pending_count_--;
+  in_flight_ = false;
+  awaiting_prompt_ = false;
+
+  switch (result) {
+  case AtResult::kOk:
+    stats_.ok++;
+    break;
+  case AtResult::kError:
+    stats_.errors++;
+    break;
+  case AtResult::kTimeout:
+    stats_.timeouts++;
+    break;
+  }
+
+  if (done) {
+    in_callback_ = true;
+    done(ctx, result, response_);
+    in_callback_ = false;
+  }
+  startNext();
+}
+
+void AtEngine::appendResponse(const char *line) {
+  size_t room = kResponseSize - 1 - response_len_;
+  if (response_len_ > 0 && room > 0) {
+    response_[response_len_++] = '\n';
+    room--;
+  }
+  size_t len = strlen(line);
+  if (len > room)
+    len = room;
+  memcpy(response_ + response_len_, line, len);
+  response_len_ += len;
+  response_[response_len_] = '\0';
+}
+
+void AtEngine::write(const char *data, size_t len) {
+  if (len > 0 && uart_write_bytes(config_.port, data, len) != (int)len)
+    ESP_LOGW(TAG, "UART%d write failed", (int)config_.port);
+}
+
+}  // namespace camcore
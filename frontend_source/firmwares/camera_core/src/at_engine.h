@@ -0,0 +1,174 @@
+#pragma once
+
+#include <driver/uart.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "metrics.h"
+
+namespace camcore {
+
+enum class AtResult : uint8_t {
+  kOk,
+  kError,    // ERROR, +CME ERROR, +CMS ERROR, NO CARRIER...
+  kTimeout,  // no final result code within the command's timeout
+};
+
+// Called once per command with its final result. `response` holds the
+// information lines the command produced (joined by '\n', truncated to
+// AtEngine::kResponseSize), or the error line; it is only valid during the
+// call.
+typedef void (*AtCallback)(void *ctx, AtResult result, const char *response);
+
+// Called for an unsolicited result code. For URCs registered with a body
+// (such as +CMT, whose message text is on the next line) `body` is that
+// line, otherwise "".
+typedef void (*UrcHandler)(void *ctx, const char *line, const char *body);
+
+struct AtEngineStats {
+  uint32_t commands = 0;
+  uint32_t ok = 0;
+  uint32_t errors = 0;
+  uint32_t timeouts = 0;
+  uint32_t stale_lines = 0;      // discarded while resyncing after a timeout
+  uint32_t urcs = 0;
+  uint32_t unhandled_lines = 0;  // neither a response nor a known URC
+  uint32_t truncated_lines = 0;  // longer than kLineSize
+  uint32_t rx_overflows = 0;     // UART FIFO/ring overflow, input dropped
+};
+
+// Event-driven AT command engine for a modem on an ESP-IDF UART.
+//
+// process() sleeps on the UART driver's event queue, so a line is handled
+// as soon as its last byte arrives rather than on the next poll. Bytes go
+// through a fixed-size line buffer; nothing is allocated after begin().
+//
+// Lines are dispatched in this order: the body line of a pending URC, the
+// URC table (matched by prefix), final result codes, and finally the
+// information lines of the command in flight. URCs can therefore arrive in
+// the middle of a response without being mistaken for it.
+//
+// Commands are queued and written back to back: the next one goes out the
+// moment the previous one gets its final result code, with no fixed sleeps.
+// V.250 allows only one command on the wire at a time, so responses are
+// matched to the queue head.
+//
+// A command that times out may still answer later. To keep that answer
+// from being taken for the next command's, the engine then sends a bare
+// "AT" (after ESC if the command could be sitting at a text prompt) and
+// discards every line until the probe has been answered and the line has
+// been quiet for kResyncQuietMs, or until the default timeout passes.
+//
+// Not thread-safe: begin(), send() and process() belong to one task.
+class AtEngine {
+public:
+  static const size_t kLineSize = 256;
+  static const size_t kCommandSize = 64;
+  static const size_t kPayloadSize = 168;  // one SMS of text
+  static const size_t kResponseSize = 256;
+  static const int kMaxPending = 8;
+  static const int kMaxUrcs = 8;
+  static const uint32_t kResyncQuietMs = 100;
+
+  struct Config {
+    uart_port_t port = UART_NUM_2;
+    int tx_pin = UART_PIN_NO_CHANGE;
+    int rx_pin = UART_PIN_NO_CHANGE;
+    int baud_rate = 115200;
+    int rx_buffer_size = 1024;
+    int event_queue_size = 16;
+    uint32_t default_timeout_ms = 2000;
+    // Time spent handling each batch of UART events (optional).
+    LatencyHistogram *work_time = nullptr;
+  };
+
+  AtEngine() = default;
+  AtEngine(const AtEngine &) = delete;
+  AtEngine &operator=(const AtEngine &) = delete;
+
+  // Installs the UART driver with an event queue.
+  bool begin(const Config &config);
+
+  // Routes lines starting with `prefix` (e.g. "+CMTI:") to `handler`. With
+  // `has_body` the following line is delivered as the body. `prefix` must
+  // outlive the engine.
+  bool addUrc(const char *prefix, bool has_body, UrcHandler handler,
+              void *ctx);
+
+  // Queues `command` (without CR). `payload` is for commands that prompt
+  // with "> " (AT+CMGS): it is sent after the prompt, followed by Ctrl-Z.
+  // `timeout_ms` 0 uses the configured default. Returns false when the
+  // queue is full or the text does not fit.
+  bool send(const char *command, AtCallback done = nullptr,
+            void *ctx = nullptr, uint32_t timeout_ms = 0,
+            const char *payload = nullptr);
+
+  // Waits up to `max_wait` for UART events, handles every complete line,
+  // and fails the command in flight if its timeout expired. Returns early
+  // once something was handled.
+  void process(TickType_t max_wait);
+
+  // Commands queued or in flight, at most kMaxPending.
+  int pending() const { return pending_count_; }
+  bool idle() const { return pending_count_ == 0; }
+  AtEngineStats stats() const { return stats_; }
+
+private:
+  struct Command {
+    char text[kCommandSize];
+    char payload[kPayloadSize];
+    AtCallback done;
+    void *ctx;
+    uint32_t timeout_ms;
+  };
+
+  struct Urc {
+    const char *prefix;
+    size_t prefix_len;
+    bool has_body;
+    UrcHandler handler;
+    void *ctx;
+  };
+
+  void readInput();
+  void feed(uint8_t byte);
+  void dispatchLine();
+  void startNext();
+  void startResync();
+  void resyncLine(bool final_result);
+  void complete(AtResult result);
+  void appendResponse(const char *line);
+  void write(const char *data, size_t len);
+
+  Config config_;
+  QueueHandle_t events_ = nullptr;
+
+  char line_[kLineSize];
+  size_t line_len_ = 0;
+  bool line_truncated_ = false;
+
+  Urc urcs_[kMaxUrcs];
+  int urc_count_ = 0;
+  const Urc *body_urc_ = nullptr;  // waiting for this URC's body line
+  char urc_line_[kLineSize];
+
+  Command pending_[kMaxPending];
+  int pending_head_ = 0;
+  int pending_count_ = 0;
+  bool in_flight_ = false;
+  bool awaiting_prompt_ = false;
+  bool in_callback_ = false;
+  bool resyncing_ = false;
+  int resync_finals_ = 0;  // final results seen: late answer, then probe
+  int64_t resync_deadline_us_ = 0;
+  int64_t deadline_us_ = 0;
+  char response_[kResponseSize];
+  size_t response_len_ = 0;
+
+  AtEngineStats stats_;
+};
+
+}  // namespace camcore
@@ -0,0 +1,126 @@
+#include "avi_writer.h"
+
+#include <cstring>
+
+namespace camcore {
+
+static const uint32_t kAvifHasIndex = 0x10;
+static const uint32_t kAviifKeyframe = 0x10;
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  p[2] = (v >> 16) & 0xFF;
+  p[3] = (v >> 24) & 0xFF;
+  return p + 4;
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t *putFourcc(uint8_t *p, const char *fourcc) {
+  memcpy(p, fourcc, 4);
+  return p + 4;
+}
+
+static uint32_t moviSize(const AviClipInfo &info) {
+  return 4 + info.frame_count * kAviChunkHeaderSize + info.total_frame_len +
+         info.odd_frames;
+}
+
+uint32_t aviFileSize(const AviClipInfo &info) {
+  // RIFF header + hdrl list + movi list + idx1 chunk
+  return 12 + 200 + 8 + moviSize(info) + kAviChunkHeaderSize +
+         info.frame_count * kAviIndexEntrySize;
+}
+
+void aviWriteHeader(uint8_t *out, const AviClipInfo &info) {
+  uint32_t buffer_size = info.max_frame_len + kAviChunkHeaderSize;
+  uint8_t *p = out;
+
+  p = putFourcc(p, "RIFF");
+  p = put32(p, aviFileSize(info) - 8);
+  p = putFourcc(p, "AVI ");
+
+  p = putFourcc(p, "LIST");
+  p = put32(p, 192);
+  p = putFourcc(p, "hdrl");
+
+  p = putFourcc(p, "avih");
+  p = put32(p, 56);
+  p = put32(p, info.us_per_frame);
+  p = put32(p, info.us_per_frame
+                   ? (uint32_t)((uint64_t)info.max_frame_len * 1000000 /
+                                info.us_per_frame)
+                   : 0);  // max bytes per second
+  p = put32(p, 0);        // padding granularity
+  p = put32(p, kAvifHasIndex);
+  p = put32(p, info.frame_count);
+  p = put32(p, 0);  // initial frames
+  p = put32(p, 1);  // streams
+  p = put32(p, buffer_size);
+  p = put32(p, info.width);
+  p = put32(p, info.height);
+  for (int i = 0; i < 4; i++)
+    p = put32(p, 0);
+
+  p = putFourcc(p, "LIST");
+  p = put32(p, 116);
+  p = putFourcc(p, "strl");
+
+  p = putFourcc(p, "strh");
+  p = put32(p, 56);
+  p = putFourcc(p, "vids");
+  p = putFourcc(p, "MJPG");
+  p = put32(p, 0);  // flags
+  p = put16(p, 0);  // priority
+  p = put16(p, 0);  // language
+  p = put32(p, 0);  // initial frames
+  p = put32(p, info.us_per_frame);  // scale
+  p = put32(p, 1000000);            // rate: fps = rate / scale
+  p = put32(p, 0);                  // start
+  p = put32(p, info.frame_count);
+  p = put32(p, buffer_size);
+  p = put32(p, 0xFFFFFFFF);  // quality: default
+  p = put32(p, 0);           // sample size
+  p = put16(p, 0);
+  p = put16(p, 0);
+  p = put16(p, info.width);
+  p = put16(p, info.height);
+
+  p = putFourcc(p, "strf");
+  p = put32(p, 40);
+  p = put32(p, 40);  // BITMAPINFOHEADER size
+  p = put32(p, info.width);
+  p = put32(p, info.height);
+  p = put16(p, 1);   // planes
+  p = put16(p, 24);  // bit count
+  p = putFourcc(p, "MJPG");
+  p = put32(p, (uint32_t)info.width * info.height * 3);
+  for (int i = 0; i < 4; i++)
+    p = put32(p, 0);
+
+  p = putFourcc(p, "LIST");
+  p = put32(p, moviSize(info));
+  putFourcc(p, "movi");
+}
+
+void aviWriteChunkHeader(uint8_t *out, uint32_t len) {
+  put32(putFourcc(out, "00dc"), len);
+}
+
+void aviWriteIndexHeader(uint8_t *out, uint32_t frame_count) {
+  put32(putFourcc(out, "idx1"), frame_count * kAviIndexEntrySize);
+}
+
+void aviWriteIndexEntry(uint8_t *out, uint32_t movi_offset, uint32_t len) {
+  uint8_t *p = putFourcc(out, "00dc");
+  p = put32(p, kAviifKeyframe);
+  p = put32(p, movi_offset);
+  put32(p, len);
+}
+
+}  // namespace camcore
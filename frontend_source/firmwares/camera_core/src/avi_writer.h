@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace camcore {
+
+// Byte builders for an MJPEG-AVI (RIFF) file whose frame sizes are known
+// up front, so the file can be streamed front to back without seeking:
+//
+//   header (kAviHeaderSize)
+//   per frame: chunk header (kAviChunkHeaderSize), JPEG, pad byte if odd
+//   index header (kAviChunkHeaderSize), one kAviIndexEntrySize per frame
+struct AviClipInfo {
+  uint16_t width;
+  uint16_t height;
+  uint32_t frame_count;
+  uint32_t us_per_frame;
+  uint32_t max_frame_len;
+  uint32_t total_frame_len;  // sum of JPEG lengths, without padding
+  uint32_t odd_frames;       // frames that need a pad byte
+};
+
+static const size_t kAviHeaderSize = 224;
+static const size_t kAviChunkHeaderSize = 8;
+static const size_t kAviIndexEntrySize = 16;
+
+// Total file size for `info`.
+uint32_t aviFileSize(const AviClipInfo &info);
+
+// Writes RIFF, hdrl and the movi list header into `out`.
+void aviWriteHeader(uint8_t *out, const AviClipInfo &info);
+
+// '00dc' chunk header for a JPEG of `len` bytes.
+void aviWriteChunkHeader(uint8_t *out, uint32_t len);
+
+// 'idx1' chunk header for `frame_count` entries.
+void aviWriteIndexHeader(uint8_t *out, uint32_t frame_count);
+
+// One idx1 entry. `movi_offset` is the chunk's offset from the 'movi'
+// FOURCC, i.e. 4 for the first frame.
+void aviWriteIndexEntry(uint8_t *out, uint32_t movi_offset, uint32_t len);
+
+}  // namespace camcore
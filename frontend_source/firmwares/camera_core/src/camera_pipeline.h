@@ -0,0 +1,24 @@
+#pragma once
+
+#include "frame_arena.h"
+#include "frame_broker.h"
+#include "metrics.h"
+#include "motion_detector.h"
+#include "quality_controller.h"
+
+namespace camcore {
+
+// State shared by the capture task and the HTTP handlers. The firmware
+// owns one instance and passes it as `user_ctx` to every camcore handler.
+struct CameraPipeline {
+  FrameBroker broker;
+  // 1/2 and 1/4 scale copies of `broker`, made on demand by the substream
+  // task (see substream_task.h); not begun when it is not running.
+  FrameBroker substreams[2];
+  QualityController quality;
+  MotionDetector motion;
+  FrameArena recorder;  // pre-event footage for /clip
+  PipelineMetrics metrics;
+};
+
+}  // namespace camcore
@@ -0,0 +1,181 @@
+#include "capture_task.h"
+
+#include <esp_camera.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <img_converters.h>
+
+#include <cstring>
+
+#include "jpeg_decoder.h"
+#include "large_alloc.h"
+
+namespace camcore {
+
+static const char *TAG = "capture";
+
+struct CaptureTaskArgs {
+  CameraPipeline *pipeline;
+  CaptureTaskConfig config;
+  JpegDecoder *decoder;  // motion scoring, null when disabled
+  uint8_t *luma;
+  uint32_t frame_count;
+};
+
+static void applyQualityLevel(const QualityLevel &level) {
+  sensor_t *s = esp_camera_sensor_get();
+  if (!s)
+    return;
+  if (s->status.framesize != level.frame_size)
+    s->set_framesize(s, (framesize_t)level.frame_size);
+  s->set_quality(s, level.quality);
+  ESP_LOGI(TAG, "Encoder level: quality %d, framesize %d", level.quality,
+           level.frame_size);
+}
+
+// Frames carry the detector state as of the previous scored frame, so a
+// frame can be published before it has been scored.
+static void stampMotion(CaptureTaskArgs *args, FrameInfo *info) {
+  if (!args->decoder)
+    return;
+  MotionDetector *motion = &args->pipeline->motion;
+  info->motion_permille = (int16_t)motion->lastScore();
+  info->motion = motion->active();
+}
+
+// Scores every `motion_every`-th frame. Runs after publish() so the decode
+// is off the capture-to-delivery path.
+static void scoreMotion(CaptureTaskArgs *args, const uint8_t *jpg,
+                        size_t len, int64_t timestamp_us) {
+  bool due = args->frame_count++ % args->config.motion_every == 0;
+  if (!args->decoder || !due)
+    return;
+  int64_t start = esp_timer_get_time();
+  int w, h;
+  if (jpegLumaDc(args->decoder, jpg, len, args->luma,
+                 args->config.motion_grid_cells, &w, &h))
+    args->pipeline->motion.update(args->luma, w, h, timestamp_us);
+  args->pipeline->metrics.motion_score.observe(
+      (uint32_t)(esp_timer_get_time() - start));
+}
+
+struct SlotWriter {
+  uint8_t *buf;
+  size_t capacity;
+  size_t len;
+  bool overflow;
+};
+
+static size_t writeToSlot(void *arg, size_t index, const void *data,
+                          size_t len) {
+  SlotWriter *w = static_cast<SlotWriter *>(arg);
+  if (index + len > w->capacity) {
+    w->overflow = true;
+    return 0;  // aborts the encoder
+  }
+  memcpy(w->buf + index, data, len);
+  if (index + len > w->len)
+    w->len = index + len;
+  return len;
+}
+
+// Non-JPEG sensor modes: encode straight into a broker slot instead of a
+// fresh frame2jpg() allocation per frame.
+static void encodeAndPublish(CaptureTaskArgs *args, camera_fb_t *fb,
+                             FrameInfo *info) {
+  FrameBroker *broker = &args->pipeline->broker;
+  SlotWriter w = {nullptr, 0, 0, false};
+  w.buf = broker->beginFrame(&w.capacity);
+  if (!w.buf)
+    return;
+  int64_t start = esp_timer_get_time();
+  bool encoded =
+      frame2jpg_cb(fb, args->config.jpeg_quality, writeToSlot, &w);
+  args->pipeline->metrics.jpeg_encode.observe(
+      (uint32_t)(esp_timer_get_time() - start));
+  if (!encoded) {
+    if (!w.overflow)
+      ESP_LOGW(TAG, "JPEG compression failed");
+    broker->abortFrame(w.overflow);
+    return;
+  }
+  stampMotion(args, info);
+  broker->commitFrame(w.len, *info);
+  if (args->pipeline->recorder.enabled())
+    args->pipeline->recorder.append(w.buf, w.len, info->timestamp_us);
+  // The committed bytes stay ours until the next beginFrame().
+  scoreMotion(args, w.buf, w.len, info->timestamp_us);
+}
+
+static void captureTask(void *pvParameters) {
+  CaptureTaskArgs *args = static_cast<CaptureTaskArgs *>(pvParameters);
+  FrameBroker *broker = &args->pipeline->broker;
+  FrameArena *recorder = &args->pipeline->recorder;
+  QualityController *quality = &args->pipeline->quality;
+  PipelineMetrics *metrics = &args->pipeline->metrics;
+
+  while (true) {
+    int64_t wait_start = esp_timer_get_time();
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (!fb) {
+      ESP_LOGW(TAG, "Camera capture failed");
+      vTaskDelay(100 / portTICK_PERIOD_MS);
+      continue;
+    }
+    metrics->fb_wait.observe((uint32_t)(esp_timer_get_time() - wait_start));
+    FrameInfo info;
+    info.timestamp_us =
+        (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+
+    if (fb->format == PIXFORMAT_JPEG) {
+      stampMotion(args, &info);
+      broker->publish(fb->buf, fb->len, info);
+      if (recorder->enabled())
+        recorder->append(fb->buf, fb->len, info.timestamp_us);
+      scoreMotion(args, fb->buf, fb->len, info.timestamp_us);
+    } else {
+      encodeAndPublish(args, fb, &info);
+    }
+    esp_camera_fb_return(fb);
+
+    QualityLevel level;
+    if (quality->update(esp_timer_get_time(), &level))
+      applyQualityLevel(level);
+  }
+}
+
+size_t jpegSlotCapacity(int frame_size, int quality) {
+  if (frame_size < 0 || frame_size >= FRAMESIZE_INVALID)
+    return FrameBroker::Config().slot_capacity;
+  size_t pixels =
+      (size_t)resolution[frame_size].width * resolution[frame_size].height;
+  size_t capacity = pixels * 2 / (quality + 4);
+  return capacity < pixels / 5 ? capacity : pixels / 5;
+}
+
+bool startCaptureTask(CameraPipeline *pipeline,
+                      const CaptureTaskConfig &config) {
+  CaptureTaskArgs *args =
+      new CaptureTaskArgs{pipeline, config, nullptr, nullptr, 0};
+  if (pipeline->motion.enabled() && config.motion_every > 0) {
+    args->decoder = new JpegDecoder();
+    args->luma = static_cast<uint8_t *>(allocLarge(config.motion_grid_cells));
+    if (!args->luma) {
+      delete args->decoder;
+      args->decoder = nullptr;
+    }
+  }
+  BaseType_t ok =
+      xTaskCreatePinnedToCore(captureTask, "CaptureTask", config.stack_size,
+                              args, config.priority, NULL, config.core);
+  if (ok != pdPASS) {
+    delete args->decoder;
+    freeLarge(args->luma);
+    delete args;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace camcore
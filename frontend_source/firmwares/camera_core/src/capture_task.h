@@ -0,0 +1,36 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+#include "camera_pipeline.h"
+
+namespace camcore {
+
+struct CaptureTaskConfig {
+  int jpeg_quality = 80;  // only used when the sensor is not in JPEG mode
+  BaseType_t core = 1;
+  UBaseType_t priority = 5;
+  uint32_t stack_size = 4096;
+  // Motion scoring (when pipeline->motion has been begun): score every
+  // Nth frame on a luma grid of at most this many 8x8 blocks.
+  uint32_t motion_every = 1;
+  size_t motion_grid_cells = 100 * 75;  // up to SVGA
+};
+
+// Starts the one task that calls esp_camera_fb_get(). Every frame is
+// published to the pipeline's broker and the framebuffer is handed straight
+// back to the driver, so HTTP clients never hold camera framebuffers.
+// Frames are published and appended to the pre-event recorder (when
+// enabled) first, then scored for motion; each frame's FrameInfo carries
+// the score of the frame before it. Between frames the task applies level
+// changes from the quality controller to the sensor.
+bool startCaptureTask(CameraPipeline *pipeline,
+                      const CaptureTaskConfig &config);
+
+// Broker slot size for sensor JPEGs at `frame_size` (a framesize_t) and
+// sensor `quality` (0-63, lower is better): about 1 bit per pixel at
+// quality 12, and never more than the driver's own JPEG framebuffer
+// (width * height / 5), which no frame can outgrow.
+size_t jpegSlotCapacity(int frame_size, int quality);
+
+}  // namespace camcore
@@ -0,0 +1,163 @@
+#include "frame_arena.h"
+
+#include <cstring>
+
+#include "large_alloc.h"
+
+namespace camcore {
+
+FrameArena::~FrameArena() {
+  if (owned_) {
+    freeLarge(arena_);
+    freeLarge(index_);
+  }
+}
+
+bool FrameArena::begin(const Config &config) {
+  uint8_t *arena = static_cast<uint8_t *>(allocLarge(config.bytes));
+  ArenaFrame *index = static_cast<ArenaFrame *>(
+      allocLarge(config.max_frames * sizeof(ArenaFrame)));
+  if (!arena || !index) {
+    freeLarge(arena);
+    freeLarge(index);
+    return false;
+  }
+  owned_ = true;
+  return begin(arena, config.bytes, index, config.max_frames);
+}
+
+bool FrameArena::begin(uint8_t *arena, size_t bytes, ArenaFrame *index,
+                       size_t max_frames) {
+  if (!arena || !index || max_frames == 0)
+    return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  arena_ = arena;
+  bytes_ = bytes;
+  index_ = index;
+  max_frames_ = max_frames;
+  write_pos_ = 0;
+  first_seq_ = next_seq_ = 1;
+  return true;
+}
+
+const ArenaFrame &FrameArena::entry(uint32_t seq) const {
+  return index_[seq % max_frames_];
+}
+
+uint32_t FrameArena::oldestPinned() const {
+  uint32_t oldest = 0;
+  for (int i = 0; i < kMaxPins; i++)
+    if (pins_[i] && (!oldest || pins_[i] < oldest))
+      oldest = pins_[i];
+  return oldest;
+}
+
+bool FrameArena::append(const uint8_t *data, size_t len,
+                        int64_t timestamp_us) {
+  size_t need = (len + 3) & ~(size_t)3;
+  size_t pos;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!arena_ || need > bytes_) {
+      stats_.dropped_oversize++;
+      return false;
+    }
+
+    // Frames physically ahead of the write position are the oldest ones.
+    // When the frame does not fit before the end of the arena, the log
+    // wraps and the unused tail becomes dead space to evict as well.
+    size_t old_pos = write_pos_;
+    bool wrapped = old_pos + need > bytes_;
+    pos = wrapped ? 0 : old_pos;
+    uint32_t pinned = oldestPinned();
+    while (first_seq_ != next_seq_) {
+      const ArenaFrame &oldest = entry(first_seq_);
+      bool dead = wrapped && oldest.offset >= old_pos;
+      bool overlaps = oldest.offset >= pos && oldest.offset < pos + need;
+      bool full = next_seq_ - first_seq_ >= max_frames_;
+      if (!dead && !overlaps && !full)
+        break;
+      if (pinned && first_seq_ >= pinned) {
+        stats_.dropped_pinned++;
+        return false;
+      }
+      first_seq_++;
+      stats_.evicted++;
+    }
+    write_pos_ = pos + need;
+  }
+
+  // The reserved range belongs to no indexed frame, so the copy runs
+  // without the lock.
+  memcpy(arena_ + pos, data, len);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  ArenaFrame &e = index_[next_seq_ % max_frames_];
+  e.offset = (uint32_t)pos;
+  e.len = (uint32_t)len;
+  e.timestamp_us = timestamp_us;
+  next_seq_++;
+  stats_.recorded++;
+  return true;
+}
+
+bool FrameArena::pinSince(int64_t since_us, ArenaClip *clip) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (first_seq_ == next_seq_)
+    return false;
+  uint32_t first = next_seq_;
+  while (first > first_seq_ && entry(first - 1).timestamp_us >= since_us)
+    first--;
+  if (first == next_seq_)
+    return false;
+  for (int i = 0; i < kMaxPins; i++) {
+    if (!pins_[i]) {
+      pins_[i] = first;
+      clip->first_seq = first;
+      clip->end_seq = next_seq_;
+      clip->pin = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FrameArena::frame(ArenaClip *clip, uint32_t seq, const uint8_t **data,
+                       ArenaFrame *info) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (clip->pin < 0 || seq < pins_[clip->pin] || seq >= clip->end_seq)
+    return false;
+  pins_[clip->pin] = seq;
+  *info = entry(seq);
+  *data = arena_ + info->offset;
+  return true;
+}
+
+bool FrameArena::peek(const ArenaClip &clip, uint32_t seq,
+                      const uint8_t **data, ArenaFrame *info) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (clip.pin < 0 || seq < pins_[clip.pin] || seq >= clip.end_seq)
+    return false;
+  *info = entry(seq);
+  *data = arena_ + info->offset;
+  return true;
+}
+
+void FrameArena::unpin(ArenaClip *clip) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (clip->pin >= 0)
+    pins_[clip->pin] = 0;
+  clip->pin = -1;
+}
+
+int64_t FrameArena::newestTimestampUs() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return first_seq_ == next_seq_ ? 0 : entry(next_seq_ - 1).timestamp_us;
+}
+
+FrameArenaStats FrameArena::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+}  // namespace camcore
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace camcore {
+
+struct ArenaFrame {
+  uint32_t offset;
+  uint32_t len;
+  int64_t timestamp_us;
+};
+
+// Pinned range of recorded frames, [first_seq, end_seq).
+struct ArenaClip {
+  uint32_t first_seq = 0;
+  uint32_t end_seq = 0;
+  int pin = -1;
+};
+
+struct FrameArenaStats {
+  uint32_t recorded = 0;
+  uint32_t evicted = 0;
+  uint32_t dropped_pinned = 0;    // oldest frame still being exported
+  uint32_t dropped_oversize = 0;  // frame larger than the whole arena
+};
+
+// Pre-event recorder: a fixed byte arena holding the most recent JPEG
+// frames as a circular log, plus a fixed ring index (offset, length,
+// timestamp) per frame. Both are allocated once; append() never touches
+// the heap.
+//
+// Frames are laid out in arrival order, so the oldest frame is always the
+// next one physically ahead of the write position and eviction is strictly
+// FIFO. Exports pin the frame they are about to send; a pinned frame is
+// never evicted, so an export reads straight out of the arena and, if it
+// falls a whole lap behind, the recorder drops new frames instead.
+class FrameArena {
+public:
+  struct Config {
+    size_t bytes = 2 * 1024 * 1024;
+    size_t max_frames = 512;
+  };
+
+  FrameArena() = default;
+  ~FrameArena();
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  // Allocates the arena and index (PSRAM when available).
+  bool begin(const Config &config);
+  // Uses caller-owned memory instead; nothing is freed on destruction.
+  bool begin(uint8_t *arena, size_t bytes, ArenaFrame *index,
+             size_t max_frames);
+
+  bool enabled() const { return arena_ != nullptr; }
+
+  // Copies one frame into the log, evicting the oldest as needed. Returns
+  // false if the frame was dropped.
+  bool append(const uint8_t *data, size_t len, int64_t timestamp_us);
+
+  // Pins every recorded frame with timestamp >= since_us. Returns false if
+  // there is none or all pins are taken.
+  bool pinSince(int64_t since_us, ArenaClip *clip);
+
+  // Looks up a frame of a pinned clip and moves the pin forward to it, so
+  // frames before `seq` may be evicted from now on. `seq` must not go
+  // backwards.
+  bool frame(ArenaClip *clip, uint32_t seq, const uint8_t **data,
+             ArenaFrame *info);
+
+  // Same lookup without moving the pin, for exports that read the clip
+  // more than once.
+  bool peek(const ArenaClip &clip, uint32_t seq, const uint8_t **data,
+            ArenaFrame *info);
+
+  void unpin(ArenaClip *clip);
+
+  int64_t newestTimestampUs();
+  FrameArenaStats stats();
+
+private:
+  static const int kMaxPins = 2;
+
+  uint32_t oldestPinned() const;
+  const ArenaFrame &entry(uint32_t seq) const;
+
+  std::mutex mutex_;
+  uint8_t *arena_ = nullptr;
+  size_t bytes_ = 0;
+  ArenaFrame *index_ = nullptr;
+  size_t max_frames_ = 0;
+  bool owned_ = false;
+
+  size_t write_pos_ = 0;
+  uint32_t first_seq_ = 1;  // oldest recorded frame
+  uint32_t next_seq_ = 1;   // one past the newest
+  uint32_t pins_[kMaxPins] = {0, 0};
+  FrameArenaStats stats_;
+};
+
+}  // namespace camcore
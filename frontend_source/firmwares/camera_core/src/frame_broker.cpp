@@ -0,0 +1,173 @@
+#include "frame_broker.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "large_alloc.h"
+
+namespace camcore {
+
+FrameRef::FrameRef(FrameSlot *slot) : slot_(slot) {
+  slot_->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+FrameRef::FrameRef(const FrameRef &other) : slot_(other.slot_) {
+  if (slot_)
+    slot_->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+FrameRef::FrameRef(FrameRef &&other) noexcept : slot_(other.slot_) {
+  other.slot_ = nullptr;
+}
+
+FrameRef &FrameRef::operator=(FrameRef other) noexcept {
+  FrameSlot *tmp = slot_;
+  slot_ = other.slot_;
+  other.slot_ = tmp;
+  return *this;
+}
+
+void FrameRef::reset() {
+  if (slot_) {
+    slot_->refs.fetch_sub(1, std::memory_order_acq_rel);
+    slot_ = nullptr;
+  }
+}
+
+FrameBroker::~FrameBroker() {
+  close();
+  for (size_t i = 0; i < slot_count_; i++)
+    freeLarge(slots_[i].buf);
+  delete[] slots_;
+}
+
+bool FrameBroker::begin(const Config &config) {
+  slots_ = new FrameSlot[config.slot_count];
+  slot_count_ = config.slot_count;
+  for (size_t i = 0; i < slot_count_; i++) {
+    slots_[i].buf = static_cast<uint8_t *>(allocLarge(config.slot_capacity));
+    if (!slots_[i].buf)
+      return false;
+    slots_[i].capacity = config.slot_capacity;
+  }
+  return true;
+}
+
+FrameSlot *FrameBroker::findFreeSlot() {
+  // A slot with no readers that is not the latest frame cannot gain new
+  // readers: refs are only taken on latest_ (under mutex_) or by copying
+  // an existing ref.
+  for (size_t i = 0; i < slot_count_; i++) {
+    FrameSlot *slot = &slots_[i];
+    if (slot != latest_ && slot->refs.load(std::memory_order_acquire) == 0)
+      return slot;
+  }
+  return nullptr;
+}
+
+uint32_t FrameBroker::publish(const uint8_t *data, size_t len,
+                              const FrameInfo &info) {
+  size_t capacity;
+  uint8_t *buf = beginFrame(&capacity);
+  if (!buf)
+    return 0;
+  if (len > capacity) {
+    abortFrame(true);
+    return 0;
+  }
+  memcpy(buf, data, len);
+  return commitFrame(len, info);
+}
+
+uint8_t *FrameBroker::beginFrame(size_t *capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  writing_ = findFreeSlot();
+  if (!writing_) {
+    stats_.dropped_busy++;
+    return nullptr;
+  }
+  // Only this (single) producer writes into a free slot, so the caller
+  // fills it without holding the lock.
+  *capacity = writing_->capacity;
+  return writing_->buf;
+}
+
+uint32_t FrameBroker::commitFrame(size_t len, const FrameInfo &info) {
+  uint32_t seq;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    FrameSlot *slot = writing_;
+    writing_ = nullptr;
+    if (!slot)
+      return 0;
+    slot->len = len;
+    slot->info = info;
+    seq = next_seq_++;
+    if (next_seq_ == 0)
+      next_seq_ = 1;
+    slot->seq = seq;
+    if (latest_ && info.timestamp_us > latest_->info.timestamp_us) {
+      int64_t delta = info.timestamp_us - latest_->info.timestamp_us;
+      interval_us_ = interval_us_ ? (interval_us_ * 7 + delta) / 8 : delta;
+    }
+    latest_ = slot;
+    stats_.published++;
+  }
+  cond_.notify_all();
+  return seq;
+}
+
+void FrameBroker::abortFrame(bool oversize) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  writing_ = nullptr;
+  if (oversize)
+    stats_.dropped_oversize++;
+}
+
+FrameRef FrameBroker::latest() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return latest_ ? FrameRef(latest_) : FrameRef();
+}
+
+FrameRef FrameBroker::waitNewer(uint32_t after_seq, uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  waiters_++;
+  bool ready = cond_.wait_for(
+      lock, std::chrono::milliseconds(timeout_ms), [&] {
+        return closed_ || (latest_ && latest_->seq != after_seq);
+      });
+  waiters_--;
+  if (!ready || closed_)
+    return FrameRef();
+  return FrameRef(latest_);
+}
+
+void FrameBroker::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  cond_.notify_all();
+}
+
+int FrameBroker::waiters() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return waiters_;
+}
+
+uint32_t FrameBroker::latestSeq() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return latest_ ? latest_->seq : 0;
+}
+
+int64_t FrameBroker::frameIntervalUs() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return interval_us_;
+}
+
+FrameBrokerStats FrameBroker::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+}  // namespace camcore
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace camcore {
+
+class FrameBroker;
+
+// Per-frame metadata supplied by the producer.
+struct FrameInfo {
+  int64_t timestamp_us = 0;
+  int16_t motion_permille = -1;  // -1 = not scored
+  bool motion = false;           // motion detector active at this frame
+};
+
+// One published JPEG. Slots are allocated once in begin() and recycled;
+// a slot can only be reused once no FrameRef points at it and it is no
+// longer the latest frame.
+struct FrameSlot {
+  uint8_t *buf = nullptr;
+  size_t capacity = 0;
+  size_t len = 0;
+  uint32_t seq = 0;
+  FrameInfo info;
+  std::atomic<int> refs{0};
+};
+
+// Read-only, reference-counted handle to a published frame. Copying a
+// FrameRef shares the same bytes; nothing is copied out of the slot.
+class FrameRef {
+public:
+  FrameRef() = default;
+  FrameRef(const FrameRef &other);
+  FrameRef(FrameRef &&other) noexcept;
+  FrameRef &operator=(FrameRef other) noexcept;
+  ~FrameRef() { reset(); }
+
+  explicit operator bool() const { return slot_ != nullptr; }
+  const uint8_t *data() const { return slot_->buf; }
+  size_t size() const { return slot_->len; }
+  uint32_t seq() const { return slot_->seq; }
+  int64_t timestampUs() const { return slot_->info.timestamp_us; }
+  const FrameInfo &info() const { return slot_->info; }
+
+  void reset();
+
+private:
+  friend class FrameBroker;
+  explicit FrameRef(FrameSlot *slot);
+
+  FrameSlot *slot_ = nullptr;
+};
+
+struct FrameBrokerStats {
+  uint32_t published = 0;
+  uint32_t dropped_busy = 0;      // every slot pinned by a reader
+  uint32_t dropped_oversize = 0;  // frame larger than slot_capacity
+};
+
+// Single-producer, multi-consumer frame hand-off.
+//
+// The capture task is the only writer: it fills a free slot and publishes
+// it as the new latest frame. Readers (stream clients, /capture) take a
+// FrameRef to the latest frame and send straight from the slot. Readers
+// never see intermediate frames they were too slow for, and a reader that
+// stalls pins at most one slot, so the producer keeps running and simply
+// drops frames once every slot is pinned.
+class FrameBroker {
+public:
+  struct Config {
+    // At least 3: the latest frame, one a stalled reader pins, and one for
+    // the producer to fill.
+    size_t slot_count = 4;
+    size_t slot_capacity = 128 * 1024;
+  };
+
+  FrameBroker() = default;
+  ~FrameBroker();
+  FrameBroker(const FrameBroker &) = delete;
+  FrameBroker &operator=(const FrameBroker &) = delete;
+
+  // Allocates the slot pool (PSRAM when available). Returns false if any
+  // allocation failed.
+  bool begin(const Config &config);
+
+  // Copies one encoded frame into a free slot and publishes it. Returns
+  // the new sequence number, or 0 if the frame was dropped.
+  uint32_t publish(const uint8_t *data, size_t len, const FrameInfo &info);
+
+  // In-place variant for encoders: beginFrame() hands out a free slot's
+  // buffer (nullptr = drop this frame), then either commitFrame() with the
+  // bytes written or abortFrame(), with `oversize` set when the frame did
+  // not fit. The committed bytes stay valid for the producer until its
+  // next beginFrame().
+  uint8_t *beginFrame(size_t *capacity);
+  uint32_t commitFrame(size_t len, const FrameInfo &info);
+  void abortFrame(bool oversize = false);
+
+  // Latest published frame, or an empty ref before the first publish.
+  FrameRef latest();
+
+  // Blocks until a frame newer than `after_seq` is published, then
+  // returns the latest one. Returns an empty ref on timeout or close().
+  FrameRef waitNewer(uint32_t after_seq, uint32_t timeout_ms);
+
+  // Wakes every waiter; subsequent waits return immediately.
+  void close();
+
+  // begin() has allocated the slots.
+  bool enabled() const { return slot_count_ > 0; }
+
+  // Readers blocked in waitNewer() right now. Lets an on-demand producer
+  // skip frames nobody is waiting for.
+  int waiters();
+
+  uint32_t latestSeq();
+  FrameBrokerStats stats();
+
+  // Smoothed time between published frames, 0 until two frames exist.
+  int64_t frameIntervalUs();
+
+private:
+  FrameSlot *findFreeSlot();
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  FrameSlot *slots_ = nullptr;
+  size_t slot_count_ = 0;
+  FrameSlot *latest_ = nullptr;
+  FrameSlot *writing_ = nullptr;
+  uint32_t next_seq_ = 1;
+  int64_t interval_us_ = 0;
+  int waiters_ = 0;
+  bool closed_ = false;
+  FrameBrokerStats stats_;
+};
+
+}  // namespace camcore
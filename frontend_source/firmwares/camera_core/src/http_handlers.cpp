@@ -0,0 +1,632 @@
+#include "http_handlers.h"
+
+#include <esp_idf_version.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "avi_writer.h"
+#include "camera_pipeline.h"
+#include "jpeg_decoder.h"
+#include "stream_pacer.h"
+#include "substream_task.h"
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+#define CAMCORE_ASYNC_HANDLERS 1
+#endif
+
+namespace camcore {
+
+static const char *TAG = "http";
+
+#define PART_BOUNDARY "123456789000000000000987654321"
+static const char *_STREAM_CONTENT_TYPE =
+    "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
+// Boundary and part headers go out as one chunk per frame.
+static const char *_STREAM_PART = "\r\n--" PART_BOUNDARY "\r\n"
+                                  "Content-Type: image/jpeg\r\n"
+                                  "Content-Length: %u\r\n"
+                                  "X-Timestamp: %d.%06d\r\n"
+                                  "X-Frame-Seq: %u\r\n";
+// Percentage of the watched area that changed, and the detector state.
+static const char *_STREAM_MOTION = "X-Motion: %d.%d\r\n"
+                                    "X-Motion-Active: %d\r\n";
+
+static const uint32_t kFrameWaitMs = 1000;
+static const int kMaxMissedFrames = 10;  // give up after ~10 s of no frames
+static const uint32_t kFirstFrameWaitMs = 2000;
+static const uint32_t kLongPollMs = 10000;
+static const int64_t kGateCheckUs = 100000;  // idle clients re-check motion
+static const uint32_t kDefaultClipSeconds = 10;
+static const size_t kIndexBatch = 32;  // idx1 entries per chunk
+// res, fps, idle_fps, after, seconds and format all fit, with room left
+// for a client's own cache-busting parameter.
+static const size_t kMaxQueryLen = 128;
+
+static std::atomic<int> s_stream_clients{0};
+static int s_max_stream_clients = 4;
+
+void setMaxStreamClients(int max_clients) {
+  s_max_stream_clients = max_clients;
+}
+
+typedef esp_err_t (*RequestBody)(httpd_req_t *req);
+
+struct DetachedRequest {
+  httpd_req_t *req;
+  RequestBody body;
+};
+
+#ifdef CAMCORE_ASYNC_HANDLERS
+static void detachedRequestTask(void *pvParameters) {
+  DetachedRequest *job = static_cast<DetachedRequest *>(pvParameters);
+  job->body(job->req);
+  httpd_req_async_handler_complete(job->req);
+  delete job;
+  vTaskDelete(NULL);
+}
+#endif
+
+// esp_http_server runs every handler on its single server task, so a
+// long-running handler would block all other clients. Long-lived requests
+// are moved to their own task instead. On cores older than IDF 5.1 this
+// degrades to running inline (one stream at a time per server).
+static esp_err_t runDetached(httpd_req_t *req, RequestBody body,
+                             const char *name) {
+#ifdef CAMCORE_ASYNC_HANDLERS
+  httpd_req_t *async_req = NULL;
+  if (httpd_req_async_handler_begin(req, &async_req) != ESP_OK)
+    return ESP_FAIL;
+  DetachedRequest *job = new DetachedRequest{async_req, body};
+  if (xTaskCreate(detachedRequestTask, name, 4096, job, tskIDLE_PRIORITY + 4,
+                  NULL) != pdPASS) {
+    httpd_req_async_handler_complete(async_req);
+    delete job;
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+#else
+  return body(req);
+#endif
+}
+
+// A query that does not fit queryParam() gets 414 rather than having all
+// its parameters ignored. True when the request has been answered.
+static bool queryTooLong(httpd_req_t *req, esp_err_t *res) {
+  if (httpd_req_get_url_query_len(req) < kMaxQueryLen)
+    return false;
+  httpd_resp_set_status(req, "414 URI Too Long");
+  *res = httpd_resp_sendstr(req, "Query too long");
+  return true;
+}
+
+static bool queryParam(httpd_req_t *req, const char *key, char *value,
+                       size_t len) {
+  char query[kMaxQueryLen];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)
+    return false;
+  return httpd_query_key_value(query, key, value, len) == ESP_OK;
+}
+
+static bool queryU32(httpd_req_t *req, const char *key, uint32_t *out) {
+  char value[16];
+  if (!queryParam(req, key, value, sizeof(value)))
+    return false;
+  *out = strtoul(value, NULL, 10);
+  return true;
+}
+
+static int requestedScale(httpd_req_t *req, CameraPipeline *pipeline) {
+  char res[8];
+  if (!queryParam(req, "res", res, sizeof(res)))
+    return 0;
+  return substreamScale(pipeline, res, kFirstFrameWaitMs);
+}
+
+// The broker `?res=` selects. Answers the request itself and returns null
+// when the name is unknown or the substream task is not running.
+static FrameBroker *requestedBroker(httpd_req_t *req,
+                                   CameraPipeline *pipeline,
+                                   esp_err_t *res) {
+  int scale = requestedScale(req, pipeline);
+  if (scale < 0) {
+    httpd_resp_set_status(req, "400 Bad Request");
+    *res = httpd_resp_sendstr(req, "Unknown res");
+    return nullptr;
+  }
+  FrameBroker *broker =
+      scale ? &pipeline->substreams[scale - 1] : &pipeline->broker;
+  if (!broker->enabled()) {
+    httpd_resp_set_status(req, "404 Not Found");
+    *res = httpd_resp_sendstr(req, "Substreams disabled");
+    return nullptr;
+  }
+  return broker;
+}
+
+static esp_err_t sendUnavailable(httpd_req_t *req) {
+  httpd_resp_set_status(req, "503 Service Unavailable");
+  httpd_resp_set_hdr(req, "Retry-After", "1");
+  return httpd_resp_sendstr(req, "No frame available");
+}
+
+static void peerAddress(httpd_req_t *req, char *buf, size_t len) {
+  struct sockaddr_in6 addr;
+  socklen_t addr_len = sizeof(addr);
+  buf[0] = '\0';
+  if (getpeername(httpd_req_to_sockfd(req), (struct sockaddr *)&addr,
+                  &addr_len) != 0)
+    return;
+  if (addr.sin6_family == AF_INET)
+    inet_ntop(AF_INET, &((struct sockaddr_in *)&addr)->sin_addr, buf, len);
+  else
+    inet_ntop(AF_INET6, &addr.sin6_addr, buf, len);
+}
+
+static esp_err_t sendTimedChunk(httpd_req_t *req, LatencyHistogram *latency,
+                                const char *buf, size_t len) {
+  int64_t start = esp_timer_get_time();
+  esp_err_t res = httpd_resp_send_chunk(req, buf, len);
+  latency->observe((uint32_t)(esp_timer_get_time() - start));
+  return res;
+}
+
+static size_t formatPartHeader(char *buf, size_t len, size_t frame_len,
+                               int64_t ts, uint32_t seq,
+                               const FrameInfo *info) {
+  size_t n = snprintf(buf, len, _STREAM_PART, (unsigned)frame_len,
+                      (int)(ts / 1000000), (int)(ts % 1000000),
+                      (unsigned)seq);
+  if (info && info->motion_permille >= 0)
+    n += snprintf(buf + n, len - n, _STREAM_MOTION,
+                  info->motion_permille / 10, info->motion_permille % 10,
+                  info->motion ? 1 : 0);
+  n += snprintf(buf + n, len - n, "\r\n");
+  return n;
+}
+
+static size_t formatPartHeader(char *buf, size_t len, const FrameRef &frame) {
+  return formatPartHeader(buf, len, frame.size(), frame.timestampUs(),
+                          frame.seq(), &frame.info());
+}
+
+static esp_err_t streamBody(httpd_req_t *req) {
+  CameraPipeline *pipeline = static_cast<CameraPipeline *>(req->user_ctx);
+  esp_err_t res;
+  FrameBroker *broker = requestedBroker(req, pipeline, &res);
+  if (!broker) {
+    s_stream_clients--;
+    return res;
+  }
+  char part_buf[200];
+  // A substream is only scaled while someone waits on it, so its latest
+  // frame may be old: start with the next one.
+  uint32_t last_seq = broker != &pipeline->broker ? broker->latestSeq() : 0;
+  int missed = 0;
+
+  char param[8];
+  float fps = 0;
+  float idle_fps = 0;
+  if (queryParam(req, "fps", param, sizeof(param)))
+    fps = strtof(param, NULL);
+  // Keep-alive rate while the scene is static; needs the motion detector.
+  if (pipeline->motion.enabled() &&
+      queryParam(req, "idle_fps", param, sizeof(param)))
+    idle_fps = strtof(param, NULL);
+  StreamPacer pacer(fps, idle_fps);
+
+  PipelineMetrics *metrics = &pipeline->metrics;
+  char peer[48];
+  peerAddress(req, peer, sizeof(peer));
+  StreamClientStats *client = metrics->acquireClient(peer);
+
+  res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
+  if (res == ESP_OK)
+    res = httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  while (res == ESP_OK) {
+    int64_t now = esp_timer_get_time();
+    if (pacer.gated())
+      pacer.setIdle(!pipeline->motion.active(), now);
+    int64_t delay_us = pacer.delayUs(now);
+    if (delay_us > 0) {
+      if (pacer.gated() && delay_us > kGateCheckUs)
+        delay_us = kGateCheckUs;
+      vTaskDelay(pdMS_TO_TICKS((delay_us + 999) / 1000));
+      continue;
+    }
+
+    FrameRef frame = broker->waitNewer(last_seq, kFrameWaitMs);
+    if (!frame) {
+      if (++missed >= kMaxMissedFrames) {
+        ESP_LOGW(TAG, "No frames for %d s, closing stream", missed);
+        res = ESP_FAIL;
+      }
+      continue;
+    }
+    missed = 0;
+    if (last_seq && frame.seq() > last_seq + 1)
+      metrics->framesDropped(client, frame.seq() - last_seq - 1);
+
+    int64_t send_start = esp_timer_get_time();
+    size_t hlen = formatPartHeader(part_buf, sizeof(part_buf), frame);
+    res = sendTimedChunk(req, &metrics->send_chunk, part_buf, hlen);
+    if (res == ESP_OK)
+      res = sendTimedChunk(req, &metrics->send_chunk,
+                           (const char *)frame.data(), frame.size());
+    if (res == ESP_OK)
+      metrics->frameSent(client);
+    last_seq = frame.seq();
+    pacer.markSent(send_start);
+
+    // Time spent in send is the backpressure signal: compare it with the
+    // time this client has per frame.
+    int64_t budget_us =
+        pacer.paced() ? pacer.intervalUs() : broker->frameIntervalUs();
+    if (res == ESP_OK && budget_us > 0)
+      pipeline->quality.reportSend(
+          (uint32_t)(esp_timer_get_time() - send_start), (uint32_t)budget_us);
+  }
+
+  metrics->releaseClient(client);
+  s_stream_clients--;
+  return res;
+}
+
+esp_err_t streamHandler(httpd_req_t *req) {
+  esp_err_t res;
+  if (queryTooLong(req, &res))
+    return res;
+  if (++s_stream_clients > s_max_stream_clients) {
+    s_stream_clients--;
+    return sendUnavailable(req);
+  }
+  res = runDetached(req, streamBody, "stream_client");
+  if (res != ESP_OK)
+    s_stream_clients--;
+  return res;
+}
+
+static esp_err_t captureBody(httpd_req_t *req) {
+  CameraPipeline *pipeline = static_cast<CameraPipeline *>(req->user_ctx);
+  esp_err_t res;
+  FrameBroker *broker = requestedBroker(req, pipeline, &res);
+  if (!broker)
+    return res;
+  uint32_t after = 0;
+  bool long_poll = queryU32(req, "after", &after);
+
+  FrameRef frame;
+  if (broker != &pipeline->broker) {
+    // The latest substream frame may be old (see streamBody): wait for
+    // the next one, which is scaled because this request is waiting.
+    uint32_t latest = broker->latestSeq();
+    frame = broker->waitNewer(long_poll && after > latest ? after : latest,
+                              long_poll ? kLongPollMs : kFirstFrameWaitMs);
+  } else if (long_poll) {
+    frame = broker->waitNewer(after, kLongPollMs);
+  } else {
+    frame = broker->latest();
+    if (!frame)
+      frame = broker->waitNewer(0, kFirstFrameWaitMs);
+  }
+
+  char etag[16];
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Access-Control-Expose-Headers",
+                     "ETag, X-Timestamp");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  if (!frame) {
+    if (!long_poll)
+      return sendUnavailable(req);
+    // Long-poll timed out: nothing newer than what the client has.
+    snprintf(etag, sizeof(etag), "\"%u\"", (unsigned)after);
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+  }
+
+  snprintf(etag, sizeof(etag), "\"%u\"", (unsigned)frame.seq());
+  httpd_resp_set_hdr(req, "ETag", etag);
+  // Capture time, as on /stream parts; lets clients measure frame age.
+  char timestamp[24];
+  int64_t ts = frame.timestampUs();
+  snprintf(timestamp, sizeof(timestamp), "%d.%06d", (int)(ts / 1000000),
+           (int)(ts % 1000000));
+  httpd_resp_set_hdr(req, "X-Timestamp", timestamp);
+
+  char if_none_match[16];
+  if (!long_poll &&
+      httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match,
+                                  sizeof(if_none_match)) == ESP_OK &&
+      strcmp(if_none_match, etag) == 0) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+  }
+
+  char motion[8];
+  const FrameInfo &info = frame.info();
+  if (info.motion_permille >= 0) {
+    snprintf(motion, sizeof(motion), "%d.%d", info.motion_permille / 10,
+             info.motion_permille % 10);
+    httpd_resp_set_hdr(req, "X-Motion", motion);
+    httpd_resp_set_hdr(req, "X-Motion-Active", info.motion ? "1" : "0");
+  }
+
+  httpd_resp_set_type(req, "image/jpeg");
+  httpd_resp_set_hdr(req, "Content-Disposition",
+                     "inline; filename=capture.jpg");
+  return httpd_resp_send(req, (const char *)frame.data(), frame.size());
+}
+
+esp_err_t captureHandler(httpd_req_t *req) {
+  esp_err_t res;
+  if (queryTooLong(req, &res))
+    return res;
+  uint32_t after;
+  char name[8];
+  // Long polls and substream frames wait; keep the server task free.
+  if (queryU32(req, "after", &after) ||
+      queryParam(req, "res", name, sizeof(name)))
+    return runDetached(req, captureBody, "capture_poll");
+  return captureBody(req);
+}
+
+static esp_err_t eventsBody(httpd_req_t *req) {
+  CameraPipeline *pipeline = static_cast<CameraPipeline *>(req->user_ctx);
+  MotionDetector *motion = &pipeline->motion;
+  uint32_t after = 0;
+  bool long_poll = queryU32(req, "after", &after);
+
+  MotionEvent events[8];
+  uint32_t last_id;
+  size_t count = motion->waitEvents(after, long_poll ? kLongPollMs : 0,
+                                    events, 8, &last_id);
+  int score = motion->lastScore();
+  if (score < 0)
+    score = 0;
+
+  char json[768];
+  size_t len = snprintf(
+      json, sizeof(json),
+      "{\"enabled\":%s,\"motion\":%s,\"score\":%d.%d,\"last_id\":%u,"
+      "\"events\":[",
+      motion->enabled() ? "true" : "false",
+      motion->active() ? "true" : "false", score / 10, score % 10,
+      (unsigned)last_id);
+  for (size_t i = 0; i < count; i++) {
+    const MotionEvent &e = events[i];
+    len += snprintf(json + len, sizeof(json) - len,
+                    "%s{\"id\":%u,\"type\":\"%s\",\"ts\":%d.%03d,"
+                    "\"score\":%d.%d}",
+                    i ? "," : "", (unsigned)e.id, e.start ? "start" : "stop",
+                    (int)(e.timestamp_us / 1000000),
+                    (int)(e.timestamp_us / 1000 % 1000),
+                    e.score_permille / 10, e.score_permille % 10);
+  }
+  snprintf(json + len, sizeof(json) - len, "]}");
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  return httpd_resp_sendstr(req, json);
+}
+
+esp_err_t eventsHandler(httpd_req_t *req) {
+  esp_err_t res;
+  if (queryTooLong(req, &res))
+    return res;
+  uint32_t after;
+  if (queryU32(req, "after", &after))
+    return runDetached(req, eventsBody, "events_poll");
+  return eventsBody(req);
+}
+
+static esp_err_t sendClipMjpeg(httpd_req_t *req, FrameArena *recorder,
+                               ArenaClip *clip) {
+  char part_buf[160];
+  httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
+  esp_err_t res = ESP_OK;
+  for (uint32_t seq = clip->first_seq; res == ESP_OK && seq < clip->end_seq;
+       seq++) {
+    const uint8_t *data;
+    ArenaFrame frame;
+    if (!recorder->frame(clip, seq, &data, &frame))
+      return ESP_FAIL;
+    size_t hlen = formatPartHeader(part_buf, sizeof(part_buf), frame.len,
+                                   frame.timestamp_us, seq, NULL);
+    res = httpd_resp_send_chunk(req, part_buf, hlen);
+    if (res == ESP_OK)
+      res = httpd_resp_send_chunk(req, (const char *)data, frame.len);
+  }
+  if (res == ESP_OK)
+    res = httpd_resp_send_chunk(req, NULL, 0);
+  return res;
+}
+
+// The AVI header needs every frame size up front and the trailing idx1
+// needs them again, so the clip stays pinned from its first frame until the
+// index is out. The arena is read in three passes and nothing is buffered.
+static esp_err_t sendClipAvi(httpd_req_t *req, FrameArena *recorder,
+                             ArenaClip *clip) {
+  AviClipInfo info = {};
+  info.frame_count = clip->end_seq - clip->first_seq;
+  const uint8_t *data;
+  ArenaFrame frame;
+  for (uint32_t seq = clip->first_seq; seq < clip->end_seq; seq++) {
+    if (!recorder->peek(*clip, seq, &data, &frame))
+      return ESP_FAIL;
+    if (frame.len > info.max_frame_len)
+      info.max_frame_len = frame.len;
+    info.total_frame_len += frame.len;
+    info.odd_frames += frame.len & 1;
+  }
+  int64_t last_us = frame.timestamp_us;
+
+  if (!recorder->peek(*clip, clip->first_seq, &data, &frame))
+    return ESP_FAIL;
+  int width = 0, height = 0;
+  jpegDimensions(data, frame.len, &width, &height);
+  info.width = width;
+  info.height = height;
+  int64_t span_us = last_us - frame.timestamp_us;
+  info.us_per_frame = info.frame_count > 1 && span_us > 0
+                          ? (uint32_t)(span_us / (info.frame_count - 1))
+                          : 100000;
+
+  uint8_t header[kAviHeaderSize];
+  aviWriteHeader(header, info);
+  httpd_resp_set_type(req, "video/x-msvideo");
+  httpd_resp_set_hdr(req, "Content-Disposition",
+                     "attachment; filename=clip.avi");
+  esp_err_t res =
+      httpd_resp_send_chunk(req, (const char *)header, sizeof(header));
+
+  static const char kPad = 0;
+  uint8_t chunk[kAviChunkHeaderSize];
+  for (uint32_t seq = clip->first_seq; res == ESP_OK && seq < clip->end_seq;
+       seq++) {
+    if (!recorder->peek(*clip, seq, &data, &frame))
+      return ESP_FAIL;
+    aviWriteChunkHeader(chunk, frame.len);
+    res = httpd_resp_send_chunk(req, (const char *)chunk, sizeof(chunk));
+    if (res == ESP_OK)
+      res = httpd_resp_send_chunk(req, (const char *)data, frame.len);
+    if (res == ESP_OK && (frame.len & 1))
+      res = httpd_resp_send_chunk(req, &kPad, 1);
+  }
+
+  uint8_t index[kIndexBatch * kAviIndexEntrySize];
+  if (res == ESP_OK) {
+    aviWriteIndexHeader(index, info.frame_count);
+    res = httpd_resp_send_chunk(req, (const char *)index,
+                                kAviChunkHeaderSize);
+  }
+  uint32_t offset = 4;  // from the 'movi' FOURCC
+  size_t batched = 0;
+  for (uint32_t seq = clip->first_seq; res == ESP_OK && seq < clip->end_seq;
+       seq++) {
+    if (!recorder->peek(*clip, seq, &data, &frame))
+      return ESP_FAIL;
+    aviWriteIndexEntry(index + batched * kAviIndexEntrySize, offset,
+                       frame.len);
+    offset += kAviChunkHeaderSize + frame.len + (frame.len & 1);
+    if (++batched == kIndexBatch || seq + 1 == clip->end_seq) {
+      res = httpd_resp_send_chunk(req, (const char *)index,
+                                  batched * kAviIndexEntrySize);
+      batched = 0;
+    }
+  }
+  if (res == ESP_OK)
+    res = httpd_resp_send_chunk(req, NULL, 0);
+  return res;
+}
+
+static esp_err_t clipBody(httpd_req_t *req) {
+  CameraPipeline *pipeline = static_cast<CameraPipeline *>(req->user_ctx);
+  FrameArena *recorder = &pipeline->recorder;
+  if (!recorder->enabled()) {
+    httpd_resp_set_status(req, "404 Not Found");
+    return httpd_resp_sendstr(req, "Recorder disabled");
+  }
+
+  uint32_t seconds = kDefaultClipSeconds;
+  queryU32(req, "seconds", &seconds);
+  char format[8] = "mjpeg";
+  queryParam(req, "format", format, sizeof(format));
+
+  ArenaClip clip;
+  int64_t since_us =
+      recorder->newestTimestampUs() - (int64_t)seconds * 1000000;
+  if (!recorder->pinSince(since_us, &clip))
+    return sendUnavailable(req);
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  esp_err_t res = strcmp(format, "avi") == 0
+                      ? sendClipAvi(req, recorder, &clip)
+                      : sendClipMjpeg(req, recorder, &clip);
+  recorder->unpin(&clip);
+  if (res != ESP_OK)
+    ESP_LOGW(TAG, "Clip export aborted");
+  return res;
+}
+
+esp_err_t clipHandler(httpd_req_t *req) {
+  esp_err_t res;
+  if (queryTooLong(req, &res))
+    return res;
+  return runDetached(req, clipBody, "clip_export");
+}
+
+static bool sendMetricsChunk(void *ctx, const char *data, size_t len) {
+  return httpd_resp_send_chunk(static_cast<httpd_req_t *>(ctx), data, len) ==
+         ESP_OK;
+}
+
+esp_err_t metricsHandler(httpd_req_t *req) {
+  CameraPipeline *pipeline = static_cast<CameraPipeline *>(req->user_ctx);
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  MetricsWriter out(sendMetricsChunk, req);
+  pipeline->metrics.write(&out);
+
+  FrameBrokerStats broker = pipeline->broker.stats();
+  out.counter("camcore_frames_published_total",
+              "Frames published by the capture task.", broker.published);
+  out.describe("camcore_frames_dropped_total", "counter",
+               "Captured frames the broker could not store.");
+  out.printf("camcore_frames_dropped_total{reason=\"busy\"} %u\n"
+             "camcore_frames_dropped_total{reason=\"oversize\"} %u\n",
+             (unsigned)broker.dropped_busy, (unsigned)broker.dropped_oversize);
+
+  if (pipeline->recorder.enabled()) {
+    FrameArenaStats rec = pipeline->recorder.stats();
+    out.counter("camcore_recorder_frames_total",
+                "Frames appended to the pre-event recorder.", rec.recorded);
+    out.counter("camcore_recorder_evicted_total",
+                "Recorded frames overwritten by newer ones.", rec.evicted);
+    out.describe("camcore_recorder_dropped_total", "counter",
+                 "Frames the recorder could not store.");
+    out.printf("camcore_recorder_dropped_total{reason=\"pinned\"} %u\n"
+               "camcore_recorder_dropped_total{reason=\"oversize\"} %u\n",
+               (unsigned)rec.dropped_pinned, (unsigned)rec.dropped_oversize);
+  }
+
+  if (pipeline->substreams[0].enabled()) {
+    out.describe("camcore_substream_frames_total", "counter",
+                 "Frames scaled for substream clients.");
+    out.printf("camcore_substream_frames_total{scale=\"1/2\"} %u\n"
+               "camcore_substream_frames_total{scale=\"1/4\"} %u\n",
+               (unsigned)pipeline->substreams[0].stats().published,
+               (unsigned)pipeline->substreams[1].stats().published);
+  }
+
+  out.gauge("camcore_stream_clients", "Active /stream clients.",
+            s_stream_clients.load());
+  int fds[16];
+  size_t fd_count = sizeof(fds) / sizeof(fds[0]);
+  if (httpd_get_client_list(req->handle, &fd_count, fds) == ESP_OK)
+    out.gauge("camcore_http_open_sockets",
+              "Open sockets on the server answering this scrape.", fd_count);
+  writeHeapMetrics(&out);
+  out.gauge("camcore_uptime_seconds", "Time since boot.",
+            esp_timer_get_time() / 1e6);
+
+  if (!out.flush())
+    return ESP_FAIL;
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+}  // namespace camcore
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <esp_http_server.h>
+
+namespace camcore {
+
+// URI handlers serving frames from the CameraPipeline passed as `user_ctx`.
+//
+// /stream  multipart/x-mixed-replace MJPEG. Each client runs in its own
+//          task so several viewers share one capture; a client that falls
+//          behind skips to the newest frame. `?fps=N` paces the client to N
+//          frames per second, and send times feed the quality controller.
+//          `&idle_fps=M` drops to M fps while no motion is detected.
+//          Part headers carry X-Motion (% of watched area changed) and
+//          X-Motion-Active. `?res=qvga` (any frame size name, or half /
+//          quarter) serves the 1/2 or 1/4 scale substream instead, when
+//          the substream task runs.
+// /capture latest cached JPEG with `ETag: "<seq>"` and X-Timestamp. Honours
+//          If-None-Match, and `?after=<seq>` long-polls until a newer frame
+//          exists. Takes `?res=` like /stream; sequence numbers are per
+//          stream.
+// /events  motion state and recent start/stop events as JSON;
+//          `?after=<id>` long-polls for events newer than <id>.
+// /clip    the last `?seconds=N` (default 10) of pre-event footage from the
+//          recorder, as multipart MJPEG or, with `&format=avi`, as an
+//          MJPEG-AVI download. Frames are sent straight from the arena.
+// /metrics Prometheus text format: per-stage latency histograms, per-client
+//          frame counters, broker/recorder drops, sockets and heap.
+esp_err_t streamHandler(httpd_req_t *req);
+esp_err_t captureHandler(httpd_req_t *req);
+esp_err_t eventsHandler(httpd_req_t *req);
+esp_err_t clipHandler(httpd_req_t *req);
+esp_err_t metricsHandler(httpd_req_t *req);
+
+// Upper bound on concurrently served /stream clients; further clients get
+// 503 instead of tying up another task.
+void setMaxStreamClients(int max_clients);
+
+}  // namespace camcore
@@ -0,0 +1,472 @@
+#include "jpeg_decoder.h"
+
+#include <cstring>
+
+#include "jpeg_tables.h"
+
+namespace camcore {
+
+void JpegHuffTable::build() {
+  int32_t code = 0;
+  int32_t k = 0;
+  for (int l = 1; l <= 16; l++) {
+    valptr[l] = k;
+    mincode[l] = code;
+    code += bits[l];
+    k += bits[l];
+    maxcode[l] = bits[l] ? code - 1 : -1;
+    code <<= 1;
+  }
+  maxcode[17] = 0x7fffffff;
+
+  memset(lookup, 0, sizeof(lookup));
+  code = 0;
+  k = 0;
+  for (int l = 1; l <= 9; l++) {
+    for (int i = 0; i < bits[l]; i++, k++, code++) {
+      int shift = 9 - l;
+      uint16_t entry = (uint16_t)((l << 8) | vals[k]);
+      for (int fill = 0; fill < (1 << shift); fill++)
+        lookup[(code << shift) | fill] = entry;
+    }
+    code <<= 1;
+  }
+  built = true;
+}
+
+// Installs a Huffman table from bits[1..16] and vals. Cameras send the
+// same tables in every frame, so an unchanged table is not rebuilt.
+void JpegDecoder::setTable(int cls, int id, const uint8_t *bits,
+                           const uint8_t *vals, int count) {
+  JpegHuffTable *t = cls ? &ac_[id] : &dc_[id];
+  t->present = true;
+  if (t->built && memcmp(t->bits + 1, bits + 1, 16) == 0 &&
+      memcmp(t->vals, vals, count) == 0)
+    return;
+  t->bits[0] = 0;
+  memcpy(t->bits + 1, bits + 1, 16);
+  memcpy(t->vals, vals, count);
+  t->build();
+  if (!cls || id > 1)
+    return;
+
+  int16_t *fast = ac_fast_[id];
+  for (int i = 0; i < (1 << kFastBits); i++) {
+    fast[i] = 0;
+    uint16_t e = t->lookup[i];
+    int l = e >> 8, run = (e >> 4) & 15, s = e & 15;
+    if (!e || !s || l + s > kFastBits)
+      continue;
+    // The s bits after the code hold the value.
+    int v = (i >> (kFastBits - l - s)) & ((1 << s) - 1);
+    if (v < (1 << (s - 1)))
+      v -= (1 << s) - 1;
+    if (v >= -128 && v <= 127)
+      fast[i] = (int16_t)(v * 256 + (run << 4) + l + s);
+  }
+}
+
+static int tableCount(const uint8_t *bits) {
+  int count = 0;
+  for (int i = 1; i <= 16; i++)
+    count += bits[i];
+  return count;
+}
+
+static inline uint16_t be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+bool JpegDecoder::parse(const uint8_t *data, size_t len) {
+  header_ = JpegHeader();
+  memset(header_.qt_present, 0, sizeof(header_.qt_present));
+  for (int i = 0; i < 4; i++)
+    dc_[i].present = ac_[i].present = false;
+
+  if (len < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    return false;
+  size_t pos = 2;
+  bool have_sof = false;
+
+  while (pos + 4 <= len) {
+    if (data[pos] != 0xFF)
+      return false;
+    uint8_t marker = data[pos + 1];
+    if (marker == 0xFF) {  // fill byte
+      pos++;
+      continue;
+    }
+    pos += 2;
+    if (marker == 0xD9)
+      return false;  // EOI before SOS
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+      continue;  // standalone markers
+
+    uint16_t seg_len = be16(data + pos);
+    if (seg_len < 2 || pos + seg_len > len)
+      return false;
+    const uint8_t *seg = data + pos + 2;
+    const uint8_t *seg_end = data + pos + seg_len;
+
+    switch (marker) {
+    case 0xDB:  // DQT
+      while (seg < seg_end) {
+        int precision = seg[0] >> 4;
+        int id = seg[0] & 15;
+        if (precision > 1 || id > 3 || seg + 1 + (64 << precision) > seg_end)
+          return false;
+        seg++;
+        for (int i = 0; i < 64; i++) {
+          if (precision) {
+            header_.qt[id][i] = be16(seg);
+            seg += 2;
+          } else {
+            header_.qt[id][i] = *seg++;
+          }
+        }
+        header_.qt_present[id] = true;
+      }
+      break;
+
+    case 0xC4:  // DHT
+      while (seg + 17 <= seg_end) {
+        int cls = seg[0] >> 4;
+        int id = seg[0] & 15;
+        if (cls > 1 || id > 3)
+          return false;
+        int count = tableCount(seg);
+        if (count > 256 || seg + 17 + count > seg_end)
+          return false;
+        setTable(cls, id, seg, seg + 17, count);
+        seg += 17 + count;
+      }
+      break;
+
+    case 0xC0:  // SOF0 baseline
+    case 0xC1:  // SOF1 extended sequential, Huffman
+      if (seg_end - seg < 6 || seg[0] != 8)
+        return false;
+      header_.height = be16(seg + 1);
+      header_.width = be16(seg + 3);
+      header_.ncomp = seg[5];
+      if ((header_.ncomp != 1 && header_.ncomp != 3) ||
+          seg + 6 + header_.ncomp * 3 > seg_end || !header_.width ||
+          !header_.height)
+        return false;
+      for (int i = 0; i < header_.ncomp; i++) {
+        JpegComponent &c = header_.comp[i];
+        c.id = seg[6 + i * 3];
+        c.h = seg[7 + i * 3] >> 4;
+        c.v = seg[7 + i * 3] & 15;
+        c.tq = seg[8 + i * 3];
+        if (c.tq > 3 || c.h < 1 || c.h > 2 || c.v < 1 || c.v > 2)
+          return false;
+      }
+      have_sof = true;
+      break;
+
+    case 0xC2:
+    case 0xC3:
+    case 0xC5:
+    case 0xC6:
+    case 0xC7:
+    case 0xC9:
+    case 0xCA:
+    case 0xCB:
+    case 0xCD:
+    case 0xCE:
+    case 0xCF:
+      return false;  // progressive, lossless, hierarchical, arithmetic
+
+    case 0xDD:  // DRI
+      if (seg_end - seg < 2)
+        return false;
+      header_.restart_interval = be16(seg);
+      break;
+
+    case 0xDA: {  // SOS
+      if (!have_sof || seg_end - seg < 1 + header_.ncomp * 2 + 3 ||
+          seg[0] != header_.ncomp)
+        return false;
+      for (int i = 0; i < header_.ncomp; i++) {
+        uint8_t id = seg[1 + i * 2];
+        JpegComponent *c = nullptr;
+        for (int j = 0; j < header_.ncomp; j++)
+          if (header_.comp[j].id == id)
+            c = &header_.comp[j];
+        if (!c)
+          return false;
+        c->td = seg[2 + i * 2] >> 4;
+        c->ta = seg[2 + i * 2] & 15;
+        if (c->td > 3 || c->ta > 3)
+          return false;
+      }
+
+      if (header_.ncomp == 1)
+        header_.comp[0].h = header_.comp[0].v = 1;
+      header_.hmax = header_.vmax = 1;
+      for (int i = 0; i < header_.ncomp; i++) {
+        if (header_.comp[i].h > header_.hmax)
+          header_.hmax = header_.comp[i].h;
+        if (header_.comp[i].v > header_.vmax)
+          header_.vmax = header_.comp[i].v;
+        if (!header_.qt_present[header_.comp[i].tq])
+          return false;
+      }
+      header_.mcus_x =
+          (header_.width + 8 * header_.hmax - 1) / (8 * header_.hmax);
+      header_.mcus_y =
+          (header_.height + 8 * header_.vmax - 1) / (8 * header_.vmax);
+      for (int i = 0; i < header_.ncomp; i++) {
+        JpegComponent &c = header_.comp[i];
+        c.blocks_w = header_.mcus_x * c.h;
+        c.blocks_h = header_.mcus_y * c.v;
+      }
+
+      if (!dc_[0].present)
+        setTable(0, 0, kStdDcLumaBits, kStdDcLumaVals, 12);
+      if (!ac_[0].present)
+        setTable(1, 0, kStdAcLumaBits, kStdAcLumaVals, 162);
+      if (!dc_[1].present)
+        setTable(0, 1, kStdDcChromaBits, kStdDcChromaVals, 12);
+      if (!ac_[1].present)
+        setTable(1, 1, kStdAcChromaBits, kStdAcChromaVals, 162);
+      for (int i = 0; i < header_.ncomp; i++)
+        if (!dc_[header_.comp[i].td].present ||
+            !ac_[header_.comp[i].ta].present)
+          return false;
+
+      header_.scan = seg_end;
+      header_.scan_len = len - (seg_end - data);
+      return true;
+    }
+
+    default:  // APPn, COM, ...
+      break;
+    }
+    pos += seg_len;
+  }
+  return false;
+}
+
+namespace {
+
+// Bit buffer of the native word size: 32 bits on the ESP32, 64 on the
+// host. Refilled a byte at a time, only when a read needs more bits.
+typedef uintptr_t BitBuf;
+const int kBufBits = sizeof(BitBuf) * 8;
+
+// MSB-first bit reader over entropy-coded data. Stops at the first real
+// marker and feeds zeros from then on.
+struct BitReader {
+  const uint8_t *p;
+  const uint8_t *end;
+  BitBuf acc = 0;
+  int bits = 0;
+  int zeros_fed = 0;
+
+  void fill() {
+    while (bits <= kBufBits - 8) {
+      BitBuf b = 0;
+      if (p < end && (p[0] != 0xFF || (p + 1 < end && p[1] == 0x00))) {
+        b = *p;
+        p += (b == 0xFF) ? 2 : 1;  // skip stuffed zero
+      } else {
+        zeros_fed++;
+      }
+      acc |= b << (kBufBits - 8 - bits);
+      bits += 8;
+    }
+  }
+
+  uint32_t peek(int n) const { return (uint32_t)(acc >> (kBufBits - n)); }
+
+  void skip(int n) {
+    acc <<= n;
+    bits -= n;
+  }
+
+  uint32_t get(int n) {
+    if (bits < n)
+      fill();
+    uint32_t v = peek(n);
+    skip(n);
+    return v;
+  }
+
+  int decode(const JpegHuffTable &t) {
+    if (bits < 16)
+      fill();
+    uint16_t e = t.lookup[peek(9)];
+    if (e) {
+      skip(e >> 8);
+      return e & 0xFF;
+    }
+    for (int l = 10; l <= 16; l++) {
+      int32_t code = (int32_t)peek(l);
+      if (code <= t.maxcode[l]) {
+        skip(l);
+        return t.vals[t.valptr[l] + code - t.mincode[l]];
+      }
+    }
+    return -1;
+  }
+
+  // Drops buffered bits and steps over the next RSTn marker.
+  void restart() {
+    acc = 0;
+    bits = 0;
+    zeros_fed = 0;
+    while (p + 1 < end && !(p[0] == 0xFF && p[1] >= 0xD0 && p[1] <= 0xD7))
+      p++;
+    if (p + 1 < end)
+      p += 2;
+  }
+};
+
+inline int extend(uint32_t v, int s) {
+  return v < (1u << (s - 1)) ? (int)v - (1 << s) + 1 : (int)v;
+}
+
+}  // namespace
+
+bool JpegDecoder::decode(BlockVisitor visit, void *ctx, bool dc_only) {
+  const JpegHeader &h = header_;
+  if (!h.scan)
+    return false;
+  BitReader br;
+  br.p = h.scan;
+  br.end = h.scan + h.scan_len;
+
+  int16_t coef[64];
+  int pred[3] = {0, 0, 0};
+  uint32_t mcu = 0;
+
+  for (int my = 0; my < h.mcus_y; my++) {
+    for (int mx = 0; mx < h.mcus_x; mx++, mcu++) {
+      if (h.restart_interval && mcu && mcu % h.restart_interval == 0) {
+        br.restart();
+        pred[0] = pred[1] = pred[2] = 0;
+      }
+      for (int ci = 0; ci < h.ncomp; ci++) {
+        const JpegComponent &c = h.comp[ci];
+        const JpegHuffTable &dc = dc_[c.td];
+        const JpegHuffTable &ac = ac_[c.ta];
+        const int16_t *ac_fast = c.ta < 2 ? ac_fast_[c.ta] : nullptr;
+        for (int by = 0; by < c.v; by++) {
+          for (int bx = 0; bx < c.h; bx++) {
+            if (!dc_only)
+              memset(coef, 0, sizeof(coef));
+            int s = br.decode(dc);
+            if (s < 0 || s > 11)
+              return false;
+            if (s)
+              pred[ci] += extend(br.get(s), s);
+            coef[0] = (int16_t)pred[ci];
+
+            for (int k = 1; k < 64;) {
+              if (ac_fast) {
+                if (br.bits < kFastBits)
+                  br.fill();
+                int fast = ac_fast[br.peek(kFastBits)];
+                if (fast) {
+                  br.skip(fast & 15);
+                  k += (fast >> 4) & 15;
+                  if (k > 63)
+                    return false;
+                  if (!dc_only)
+                    coef[k] = (int16_t)(fast >> 8);
+                  k++;
+                  continue;
+                }
+              }
+              int rs = br.decode(ac);
+              if (rs < 0)
+                return false;
+              int r = rs >> 4;
+              s = rs & 15;
+              if (s == 0) {
+                if (r != 15)
+                  break;  // EOB
+                k += 16;
+                continue;
+              }
+              k += r;
+              if (k > 63)
+                return false;
+              uint32_t v = br.get(s);
+              if (!dc_only)
+                coef[k] = (int16_t)extend(v, s);
+              k++;
+            }
+            visit(ctx, ci, mx * c.h + bx, my * c.v + by, coef);
+          }
+        }
+      }
+      if (br.zeros_fed > 16)
+        return false;  // ran past the end of the scan
+    }
+  }
+  return true;
+}
+
+bool jpegDimensions(const uint8_t *jpeg, size_t len, int *width,
+                    int *height) {
+  if (len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+    return false;
+  size_t pos = 2;
+  while (pos + 9 <= len) {
+    if (jpeg[pos] != 0xFF)
+      return false;
+    uint8_t marker = jpeg[pos + 1];
+    if (marker == 0xFF) {
+      pos++;
+      continue;
+    }
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+        marker != 0xC8 && marker != 0xCC) {
+      *height = be16(jpeg + pos + 5);
+      *width = be16(jpeg + pos + 7);
+      return true;
+    }
+    if (marker == 0xDA || marker == 0xD9 || be16(jpeg + pos + 2) < 2)
+      return false;
+    pos += 2 + be16(jpeg + pos + 2);
+  }
+  return false;
+}
+
+namespace {
+
+struct LumaDcTarget {
+  uint8_t *out;
+  int stride;
+  int q0;
+};
+
+void storeLumaDc(void *ctx, int comp, int bx, int by, const int16_t *coef) {
+  if (comp != 0)
+    return;
+  LumaDcTarget *t = static_cast<LumaDcTarget *>(ctx);
+  // DC * q / 8 is the block mean, level-shifted by 128.
+  int v = 128 + coef[0] * t->q0 / 8;
+  t->out[by * t->stride + bx] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+}  // namespace
+
+bool jpegLumaDc(JpegDecoder *decoder, const uint8_t *jpeg, size_t len,
+                uint8_t *out, size_t cap, int *blocks_w, int *blocks_h) {
+  if (!decoder->parse(jpeg, len))
+    return false;
+  const JpegHeader &h = decoder->header();
+  const JpegComponent &y = h.comp[0];
+  if ((size_t)y.blocks_w * y.blocks_h > cap)
+    return false;
+  LumaDcTarget target = {out, y.blocks_w, h.qt[y.tq][0]};
+  if (!decoder->decode(storeLumaDc, &target, true))
+    return false;
+  *blocks_w = y.blocks_w;
+  *blocks_h = y.blocks_h;
+  return true;
+}
+
+}  // namespace camcore
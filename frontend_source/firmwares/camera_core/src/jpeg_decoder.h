@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace camcore {
+
+struct JpegHuffTable {
+  uint8_t bits[17];  // bits[n] = number of codes of length n
+  uint8_t vals[256];
+  // Derived by build(): canonical decoding limits plus a 9-bit lookahead
+  // table, entry = (code length << 8) | value, 0 when the code is longer.
+  int32_t maxcode[18];
+  int32_t valptr[17];
+  int32_t mincode[17];
+  uint16_t lookup[512];
+  bool present;  // defined for the current frame
+  bool built = false;
+
+  void build();
+};
+
+struct JpegComponent {
+  uint8_t id;
+  uint8_t h, v;  // sampling factors
+  uint8_t tq;    // quantization table
+  uint8_t td, ta;  // DC / AC Huffman tables
+  uint16_t blocks_w, blocks_h;  // block grid of this component
+};
+
+struct JpegHeader {
+  uint16_t width = 0;
+  uint16_t height = 0;
+  uint8_t ncomp = 0;
+  JpegComponent comp[3];
+  uint8_t hmax = 1, vmax = 1;
+  uint16_t mcus_x = 0, mcus_y = 0;
+  uint16_t restart_interval = 0;
+  uint16_t qt[4][64];  // zigzag order
+  bool qt_present[4];
+  const uint8_t *scan = nullptr;  // entropy-coded segment
+  size_t scan_len = 0;
+};
+
+// Baseline (SOF0/SOF1, Huffman, 8-bit) JPEG entropy decoder that stops at
+// quantized DCT coefficients: no dequantization, IDCT or colour conversion.
+// That is all motion scoring and DCT-domain rescaling need, and it runs in
+// a fraction of a full decode. Falls back to the Annex K Huffman tables
+// when the stream has no DHT.
+class JpegDecoder {
+public:
+  // Called once per 8x8 block in scan order. `coef` holds quantized
+  // coefficients in zigzag order; with dc_only only coef[0] is filled.
+  typedef void (*BlockVisitor)(void *ctx, int comp, int bx, int by,
+                               const int16_t *coef);
+
+  // Parses markers up to the start of scan. Returns false for anything
+  // other than a single-scan baseline JPEG with 1 or 3 components.
+  bool parse(const uint8_t *data, size_t len);
+
+  const JpegHeader &header() const { return header_; }
+
+  // Decodes the scan located by parse().
+  bool decode(BlockVisitor visit, void *ctx, bool dc_only);
+
+  // Bits looked up at once by the AC fast path.
+  static const int kFastBits = 9;
+
+private:
+  void setTable(int cls, int id, const uint8_t *bits, const uint8_t *vals,
+                int count);
+
+  JpegHeader header_;
+  JpegHuffTable dc_[4];
+  JpegHuffTable ac_[4];
+  // For AC tables 0 and 1 (the only ones baseline allows): a run/size
+  // symbol together with its value bits, when both fit in kFastBits.
+  // Entry = value << 8 | run << 4 | total bits, 0 = take the slow path.
+  int16_t ac_fast_[2][1 << kFastBits];
+};
+
+// Reads width/height from the SOF segment without touching the scan.
+bool jpegDimensions(const uint8_t *jpeg, size_t len, int *width,
+                    int *height);
+
+// Mean luma of every 8x8 Y block (the DC term), row-major into `out`.
+// Returns false if the JPEG cannot be decoded or the grid exceeds `cap`.
+bool jpegLumaDc(JpegDecoder *decoder, const uint8_t *jpeg, size_t len,
+                uint8_t *out, size_t cap, int *blocks_w, int *blocks_h);
+
+}  // namespace camcore
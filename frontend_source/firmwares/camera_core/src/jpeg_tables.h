@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+namespace camcore {
+
+// ITU-T T.81 Annex K tables. Used when a JPEG carries no DHT segment
+// (common for sensor MJPEG output).
+extern const uint8_t kZigzag[64];  // zigzag index -> natural (row-major)
+
+extern const uint8_t kStdDcLumaBits[17];
+extern const uint8_t kStdDcLumaVals[12];
+extern const uint8_t kStdDcChromaBits[17];
+extern const uint8_t kStdDcChromaVals[12];
+extern const uint8_t kStdAcLumaBits[17];
+extern const uint8_t kStdAcLumaVals[162];
+extern const uint8_t kStdAcChromaBits[17];
+extern const uint8_t kStdAcChromaVals[162];
+
+}  // namespace camcore
@@ -0,0 +1,22 @@
+#include "large_alloc.h"
+
+#include <cstdlib>
+
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+namespace camcore {
+
+void *allocLarge(size_t size) {
+#ifdef ESP_PLATFORM
+  void *ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (ptr)
+    return ptr;
+#endif
+  return malloc(size);
+}
+
+void freeLarge(void *ptr) { free(ptr); }
+
+}  // namespace camcore
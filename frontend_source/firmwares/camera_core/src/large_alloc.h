@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+
+namespace camcore {
+
+// Allocations for frame-sized buffers. On the ESP32 these come from PSRAM
+// when the board has it and fall back to internal RAM otherwise; on a host
+// build they are plain malloc/free.
+void *allocLarge(size_t size);
+void freeLarge(void *ptr);
+
+}  // namespace camcore
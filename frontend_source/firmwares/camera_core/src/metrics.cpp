@@ -0,0 +1,230 @@
+#include "metrics.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#endif
+
+namespace camcore {
+
+static const uint32_t kBucketBoundsUs[LatencyHistogram::kBuckets - 1] = {
+    100,   250,    500,    1000,   2500,   5000,   10000,
+    25000, 50000, 100000, 250000, 500000, 1000000};
+
+static inline int currentShard() {
+#ifdef ESP_PLATFORM
+  return xPortGetCoreID() % kMetricShards;
+#else
+  return 0;
+#endif
+}
+
+void MetricsWriter::printf(const char *fmt, ...) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf_ + len_, sizeof(buf_) - len_, fmt, args);
+    va_end(args);
+    if (n < 0)
+      return;
+    if (len_ + n < sizeof(buf_)) {
+      len_ += n;
+      return;
+    }
+    // Did not fit: drop the partial line, flush and retry once.
+    if (!flush())
+      return;
+  }
+}
+
+void MetricsWriter::describe(const char *name, const char *type,
+                             const char *help) {
+  printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void MetricsWriter::counter(const char *name, const char *help,
+                            uint64_t value) {
+  describe(name, "counter", help);
+  printf("%s %llu\n", name, (unsigned long long)value);
+}
+
+void MetricsWriter::gauge(const char *name, const char *help, double value) {
+  describe(name, "gauge", help);
+  printf("%s %g\n", name, value);
+}
+
+bool MetricsWriter::flush() {
+  if (len_ && ok_)
+    ok_ = sink_(ctx_, buf_, len_);
+  len_ = 0;
+  return ok_;
+}
+
+void LatencyHistogram::observe(uint32_t us) {
+  int bucket = 0;
+  while (bucket < kBuckets - 1 && us > kBucketBoundsUs[bucket])
+    bucket++;
+  Shard &shard = shards_[currentShard()];
+  shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  shard.sum_us.fetch_add(us, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::write(MetricsWriter *out, const char *name,
+                             const char *help) const {
+  out->describe(name, "histogram", help);
+  uint64_t count = 0;
+  uint64_t sum_us = 0;
+  for (int b = 0; b < kBuckets; b++) {
+    for (int s = 0; s < kMetricShards; s++)
+      count += shards_[s].buckets[b].load(std::memory_order_relaxed);
+    if (b < kBuckets - 1)
+      out->printf("%s_bucket{le=\"%u.%06u\"} %llu\n", name,
+                  (unsigned)(kBucketBoundsUs[b] / 1000000),
+                  (unsigned)(kBucketBoundsUs[b] % 1000000),
+                  (unsigned long long)count);
+    else
+      out->printf("%s_bucket{le=\"+Inf\"} %llu\n", name,
+                  (unsigned long long)count);
+  }
+  for (int s = 0; s < kMetricShards; s++)
+    sum_us += shards_[s].sum_us.load(std::memory_order_relaxed);
+  out->printf("%s_sum %llu.%06u\n%s_count %llu\n", name,
+              (unsigned long long)(sum_us / 1000000),
+              (unsigned)(sum_us % 1000000), name, (unsigned long long)count);
+}
+
+StreamClientStats *PipelineMetrics::acquireClient(const char *peer,
+                                                   const char *transport) {
+  for (int i = 0; i < kMaxClients; i++) {
+    StreamClientStats &c = clients_[i];
+    int expected = 0;
+    if (!c.state.compare_exchange_strong(expected, 1))
+      continue;
+    c.sent.store(0, std::memory_order_relaxed);
+    c.dropped.store(0, std::memory_order_relaxed);
+    snprintf(c.peer, sizeof(c.peer), "%s", peer ? peer : "");
+    c.transport = transport;
+    c.state.store(2);
+    return &c;
+  }
+  return nullptr;
+}
+
+void PipelineMetrics::releaseClient(StreamClientStats *client) {
+  if (client)
+    client->state.store(0);
+}
+
+void PipelineMetrics::frameSent(StreamClientStats *client) {
+  sent_total_.fetch_add(1, std::memory_order_relaxed);
+  if (client)
+    client->sent.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PipelineMetrics::framesDropped(StreamClientStats *client,
+                                    uint32_t count) {
+  dropped_total_.fetch_add(count, std::memory_order_relaxed);
+  if (client)
+    client->dropped.fetch_add(count, std::memory_order_relaxed);
+}
+
+bool PipelineMetrics::addHistogram(const char *name, const char *help,
+                                   LatencyHistogram *histogram) {
+  int n = extra_count_.load();
+  if (n >= kMaxExtra)
+    return false;
+  extra_[n] = Extra{name, help, histogram};
+  extra_count_.store(n + 1);
+  return true;
+}
+
+void PipelineMetrics::write(MetricsWriter *out) const {
+  fb_wait.write(out, "camcore_fb_get_wait_seconds",
+                "Time blocked in esp_camera_fb_get().");
+  jpeg_encode.write(out, "camcore_jpeg_encode_seconds",
+                    "Software JPEG encoding time per frame.");
+  motion_score.write(out, "camcore_motion_score_seconds",
+                     "Motion scoring time per scored frame.");
+  send_chunk.write(out, "camcore_send_chunk_seconds",
+                   "Latency of each httpd_resp_send_chunk() on /stream.");
+  substream_scale.write(out, "camcore_substream_scale_seconds",
+                        "Substream downscaling time per source frame.");
+  rtp_send.write(out, "camcore_rtp_send_seconds",
+                 "Time to send all RTP packets of one frame.");
+
+  out->counter("camcore_stream_frames_sent_total",
+               "Frames sent to all /stream and RTSP clients.",
+               sent_total_.load(std::memory_order_relaxed));
+  out->counter("camcore_stream_frames_dropped_total",
+               "Frames skipped by stream clients that fell behind.",
+               dropped_total_.load(std::memory_order_relaxed));
+
+  // Per-connection series are labelled by slot; a reused slot restarts
+  // from zero, which Prometheus treats as a counter reset.
+  static const char *kClientSent = "camcore_stream_client_frames_sent_total";
+  static const char *kClientDropped =
+      "camcore_stream_client_frames_dropped_total";
+  static const char *kClientLabels =
+      "%s{client=\"%d\",peer=\"%s\",transport=\"%s\"} %u\n";
+  out->describe(kClientSent, "counter", "Frames sent per stream client.");
+  for (int i = 0; i < kMaxClients; i++)
+    if (clients_[i].state.load() == 2)
+      out->printf(kClientLabels, kClientSent, i, clients_[i].peer,
+                  clients_[i].transport,
+                  (unsigned)clients_[i].sent.load(std::memory_order_relaxed));
+  out->describe(kClientDropped, "counter",
+                "Frames skipped per stream client.");
+  for (int i = 0; i < kMaxClients; i++)
+    if (clients_[i].state.load() == 2)
+      out->printf(
+          kClientLabels, kClientDropped, i, clients_[i].peer,
+          clients_[i].transport,
+          (unsigned)clients_[i].dropped.load(std::memory_order_relaxed));
+
+  int extra = extra_count_.load();
+  for (int i = 0; i < extra; i++)
+    extra_[i].histogram->write(out, extra_[i].name, extra_[i].help);
+}
+
+void writeHeapMetrics(MetricsWriter *out) {
+#ifdef ESP_PLATFORM
+  static const char *kNames[] = {
+      "camcore_heap_free_bytes", "camcore_heap_min_free_bytes",
+      "camcore_heap_largest_free_block_bytes",
+      "camcore_heap_fragmentation_ratio"};
+  static const char *kHelp[] = {
+      "Free heap.", "Lowest free heap since boot.",
+      "Largest block that can be allocated.",
+      "1 - largest free block / free heap."};
+  static const struct {
+    const char *name;
+    uint32_t caps;
+  } kRegions[] = {{"internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT},
+                  {"psram", MALLOC_CAP_SPIRAM}};
+
+  double values[2][4];
+  int regions = heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0 ? 2 : 1;
+  for (int r = 0; r < regions; r++) {
+    size_t free_bytes = heap_caps_get_free_size(kRegions[r].caps);
+    size_t largest = heap_caps_get_largest_free_block(kRegions[r].caps);
+    values[r][0] = free_bytes;
+    values[r][1] = heap_caps_get_minimum_free_size(kRegions[r].caps);
+    values[r][2] = largest;
+    values[r][3] = free_bytes ? 1.0 - (double)largest / free_bytes : 0;
+  }
+  for (int f = 0; f < 4; f++) {
+    out->describe(kNames[f], "gauge", kHelp[f]);
+    for (int r = 0; r < regions; r++)
+      out->printf("%s{region=\"%s\"} %g\n", kNames[f], kRegions[r].name,
+                  values[r][f]);
+  }
+#else
+  (void)out;
+#endif
+}
+
+}  // namespace camcore
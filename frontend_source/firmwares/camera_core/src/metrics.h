@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace camcore {
+
+// Counters are sharded per core: each core only increments its own shard,
+// so hot paths never contend on a cache line or a lock, and a scrape sums
+// the shards.
+static const int kMetricShards = 2;
+
+// Buffered Prometheus text-format output. Lines are collected in a fixed
+// buffer and handed to `sink` whenever it fills up, so a scrape of any size
+// needs no heap.
+class MetricsWriter {
+public:
+  // Returns false to abort the scrape (client gone).
+  typedef bool (*Sink)(void *ctx, const char *data, size_t len);
+
+  MetricsWriter(Sink sink, void *ctx) : sink_(sink), ctx_(ctx) {}
+
+  void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+  // `# HELP` and `# TYPE` lines.
+  void describe(const char *name, const char *type, const char *help);
+  // Single unlabelled sample with its HELP/TYPE lines.
+  void counter(const char *name, const char *help, uint64_t value);
+  void gauge(const char *name, const char *help, double value);
+
+  // Sends whatever is buffered. Returns false if any send failed.
+  bool flush();
+  bool ok() const { return ok_; }
+
+private:
+  Sink sink_;
+  void *ctx_;
+  char buf_[512];
+  size_t len_ = 0;
+  bool ok_ = true;
+};
+
+// Fixed-bucket latency histogram, exported in seconds. observe() is two
+// relaxed atomic adds on the calling core's shard.
+class LatencyHistogram {
+public:
+  static const int kBuckets = 14;  // the last one is +Inf
+
+  void observe(uint32_t us);
+
+  // Writes HELP/TYPE, buckets, sum and count for `name`.
+  void write(MetricsWriter *out, const char *name, const char *help) const;
+
+private:
+  struct Shard {
+    std::atomic<uint32_t> buckets[kBuckets] = {};
+    std::atomic<uint64_t> sum_us{0};
+  };
+  Shard shards_[kMetricShards];
+};
+
+// Frames sent and skipped by one /stream or RTSP connection.
+struct StreamClientStats {
+  std::atomic<int> state{0};  // 0 free, 1 being set up, 2 live
+  std::atomic<uint32_t> sent{0};
+  std::atomic<uint32_t> dropped{0};  // newer frames arrived while sending
+  char peer[48] = "";
+  const char *transport = "http";  // http, rtp/udp or rtp/tcp
+};
+
+// Camera pipeline instrumentation, owned by CameraPipeline. Firmwares can
+// register histograms of their own (e.g. the modem loop) to be exported on
+// the same /metrics page.
+class PipelineMetrics {
+public:
+  static const int kMaxClients = 8;
+  static const int kMaxExtra = 4;
+
+  LatencyHistogram fb_wait;          // esp_camera_fb_get()
+  LatencyHistogram jpeg_encode;      // frame2jpg_cb() for non-JPEG sensors
+  LatencyHistogram motion_score;     // DC decode + MotionDetector::update()
+  LatencyHistogram send_chunk;       // httpd_resp_send_chunk() on /stream
+  LatencyHistogram rtp_send;         // all RTP packets of one frame
+  LatencyHistogram substream_scale;  // decode + re-encode per source frame
+
+  // Claims a per-client slot, or returns null when all are taken (the
+  // client is then only counted in the totals). `transport` must be a
+  // string literal.
+  StreamClientStats *acquireClient(const char *peer,
+                                   const char *transport = "http");
+  void releaseClient(StreamClientStats *client);
+  void frameSent(StreamClientStats *client);
+  void framesDropped(StreamClientStats *client, uint32_t count);
+
+  // `name` and `help` must outlive the registry.
+  bool addHistogram(const char *name, const char *help,
+                    LatencyHistogram *histogram);
+
+  void write(MetricsWriter *out) const;
+
+private:
+  struct Extra {
+    const char *name;
+    const char *help;
+    LatencyHistogram *histogram;
+  };
+
+  StreamClientStats clients_[kMaxClients];
+  std::atomic<uint32_t> sent_total_{0};
+  std::atomic<uint32_t> dropped_total_{0};
+  Extra extra_[kMaxExtra] = {};
+  std::atomic<int> extra_count_{0};
+};
+
+// Free, minimum-ever-free and largest free block of internal RAM and PSRAM,
+// plus fragmentation (1 - largest block / free).
+void writeHeapMetrics(MetricsWriter *out);
+
+}  // namespace camcore
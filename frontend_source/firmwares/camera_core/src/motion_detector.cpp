@@ -0,0 +1,135 @@
+#include "motion_detector.h"
+
+#include <chrono>
+
+namespace camcore {
+
+void MotionDetector::begin(const Config &config) {
+  config_ = config;
+  enabled_ = true;
+  grid_w_ = grid_h_ = 0;
+}
+
+void MotionDetector::setRegions(const MotionRegion *regions, size_t count) {
+  regions_.assign(regions, regions + count);
+  grid_w_ = grid_h_ = 0;  // rebuild on the next frame
+}
+
+void MotionDetector::rebuildMask(int w, int h) {
+  grid_w_ = w;
+  grid_h_ = h;
+  mask_.assign((size_t)w * h, regions_.empty() ? 1 : 0);
+  for (const MotionRegion &r : regions_) {
+    int x0 = (int)(r.x * w), y0 = (int)(r.y * h);
+    int x1 = (int)((r.x + r.w) * w + 0.5f), y1 = (int)((r.y + r.h) * h + 0.5f);
+    for (int y = y0 < 0 ? 0 : y0; y < y1 && y < h; y++)
+      for (int x = x0 < 0 ? 0 : x0; x < x1 && x < w; x++)
+        mask_[y * w + x] = 1;
+  }
+  watched_cells_ = 0;
+  for (uint8_t m : mask_)
+    watched_cells_ += m;
+}
+
+int MotionDetector::update(const uint8_t *luma, int w, int h,
+                           int64_t timestamp_us) {
+  size_t cells = (size_t)w * h;
+  if (w != grid_w_ || h != grid_h_) {
+    // New geometry (first frame or frame size change): relearn.
+    rebuildMask(w, h);
+    background_.resize(cells);
+    for (size_t i = 0; i < cells; i++)
+      background_[i] = luma[i] << 4;
+    hot_frames_ = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_score_ = 0;
+    return 0;
+  }
+  if (watched_cells_ == 0)
+    return 0;
+
+  // Frame-wide brightness shift, so exposure changes are not motion.
+  int32_t shift_sum = 0;
+  for (size_t i = 0; i < cells; i++)
+    if (mask_[i])
+      shift_sum += (luma[i] << 4) - background_[i];
+  int32_t shift = shift_sum / watched_cells_;
+
+  // Changed cells learn 8x slower so a passing object does not burn a
+  // ghost into the background; a permanent change is still absorbed.
+  int32_t threshold = config_.cell_threshold << 4;
+  int changed = 0;
+  for (size_t i = 0; i < cells; i++) {
+    int32_t cur = luma[i] << 4;
+    int32_t bg = background_[i];
+    int32_t d = cur - bg - shift;
+    int learn = config_.background_shift;
+    if (d > threshold || d < -threshold) {
+      changed += mask_[i];
+      learn += 3;
+    }
+    background_[i] = (uint16_t)(bg + ((cur - bg) >> learn));
+  }
+  int score = changed * 1000 / watched_cells_;
+
+  hot_frames_ = score >= config_.start_permille ? hot_frames_ + 1 : 0;
+  if (score >= config_.stop_permille)
+    last_hot_us_ = timestamp_us;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  last_score_ = score;
+  if (!active_ && hot_frames_ >= config_.start_frames) {
+    active_ = true;
+    peak_ = score;
+    pushEvent(true, timestamp_us, score);
+  } else if (active_) {
+    if (score > peak_)
+      peak_ = score;
+    if (timestamp_us - last_hot_us_ > (int64_t)config_.hold_ms * 1000) {
+      active_ = false;
+      pushEvent(false, timestamp_us, peak_);
+    }
+  }
+  return score;
+}
+
+void MotionDetector::pushEvent(bool start, int64_t timestamp_us, int score) {
+  MotionEvent &e = events_[next_event_id_ % kEventLog];
+  e.id = next_event_id_++;
+  e.start = start;
+  e.timestamp_us = timestamp_us;
+  e.score_permille = (int16_t)score;
+  cond_.notify_all();
+}
+
+bool MotionDetector::active() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return active_;
+}
+
+int MotionDetector::lastScore() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return last_score_;
+}
+
+size_t MotionDetector::waitEvents(uint32_t after_id, uint32_t timeout_ms,
+                                  MotionEvent *out, size_t max,
+                                  uint32_t *last_id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // An id past the latest event predates a reboot: answer at once, like
+  // /capture?after= does, instead of holding the client until the timeout.
+  cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                 [&] { return next_event_id_ - 1 != after_id; });
+
+  uint32_t first = after_id < next_event_id_ ? after_id + 1 : 1;
+  if (next_event_id_ > kEventLog && first < next_event_id_ - kEventLog)
+    first = next_event_id_ - kEventLog;  // older events were overwritten
+  size_t n = 0;
+  for (uint32_t id = first; id < next_event_id_ && n < max; id++)
+    out[n++] = events_[id % kEventLog];
+  if (last_id)
+    *last_id = next_event_id_ - 1;
+  return n;
+}
+
+}  // namespace camcore
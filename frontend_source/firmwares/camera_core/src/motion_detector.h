@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace camcore {
+
+// Rectangle in fractions of the frame (0..1), so masks survive frame size
+// changes made by the quality controller.
+struct MotionRegion {
+  float x, y, w, h;
+};
+
+struct MotionEvent {
+  uint32_t id;
+  bool start;  // false = motion stopped
+  int64_t timestamp_us;
+  int16_t score_permille;  // score at start, peak score at stop
+};
+
+// Cheap per-frame motion score on a coarse luma grid (one cell per 8x8
+// JPEG block, see jpegLumaDc()).
+//
+// Each cell is compared against a slowly learned background. A cell counts
+// as changed when it differs by more than `cell_threshold` after removing
+// the frame-wide brightness shift (auto exposure). The score is the share
+// of watched cells that changed, in permille. Motion starts after
+// `start_frames` frames at or above `start_permille` and stops once the
+// score has stayed below `stop_permille` for `hold_ms`.
+class MotionDetector {
+public:
+  struct Config {
+    uint8_t cell_threshold = 15;
+    uint16_t start_permille = 20;
+    uint16_t stop_permille = 8;
+    uint8_t start_frames = 2;
+    uint32_t hold_ms = 3000;
+    uint8_t background_shift = 4;  // background learns 1/2^n per frame
+  };
+
+  void begin(const Config &config);
+  bool enabled() const { return enabled_; }
+
+  // Cells outside every region are ignored. No regions = whole frame.
+  void setRegions(const MotionRegion *regions, size_t count);
+
+  // Scores one luma grid. Returns the score in permille.
+  int update(const uint8_t *luma, int w, int h, int64_t timestamp_us);
+
+  bool active();
+  int lastScore();
+
+  // Copies events with id > after_id into `out`, waiting up to
+  // `timeout_ms` for one to arrive. An after_id newer than the latest
+  // event (from before a reboot) is stale and returns the whole log at
+  // once. Returns the number copied; `last_id` gets the latest id.
+  size_t waitEvents(uint32_t after_id, uint32_t timeout_ms, MotionEvent *out,
+                    size_t max, uint32_t *last_id = nullptr);
+
+private:
+  void rebuildMask(int w, int h);
+  void pushEvent(bool start, int64_t timestamp_us, int score);
+
+  static const size_t kEventLog = 16;
+
+  bool enabled_ = false;
+  Config config_;
+  std::vector<MotionRegion> regions_;
+
+  // Touched only by the capture task.
+  int grid_w_ = 0, grid_h_ = 0;
+  std::vector<uint16_t> background_;  // 12.4 fixed point
+  std::vector<uint8_t> mask_;
+  int watched_cells_ = 0;
+  int hot_frames_ = 0;
+  int64_t last_hot_us_ = 0;
+  int peak_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool active_ = false;
+  int last_score_ = -1;
+  MotionEvent events_[kEventLog];
+  uint32_t next_event_id_ = 1;
+};
+
+}  // namespace camcore
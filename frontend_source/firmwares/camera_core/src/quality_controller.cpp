@@ -0,0 +1,87 @@
+#include "quality_controller.h"
+
+namespace camcore {
+
+void QualityController::begin(const Config &config, int initial_frame_size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  config_ = config;
+  initial_frame_size_ = initial_frame_size;
+  int step = config_.quality_step > 0 ? config_.quality_step : 1;
+  quality_levels_ = (config_.worst_quality - config_.best_quality) / step + 1;
+  if (quality_levels_ < 1)
+    quality_levels_ = 1;
+  max_level_ = quality_levels_ - 1;
+  if (config_.frame_size_count > 1)
+    max_level_ += (int)config_.frame_size_count - 1;
+  level_ = 0;
+}
+
+QualityLevel QualityController::levelAt(int level) const {
+  int step = config_.quality_step > 0 ? config_.quality_step : 1;
+  QualityLevel out;
+  if (level < quality_levels_) {
+    out.quality = config_.best_quality + level * step;
+    out.frame_size = config_.frame_size_count ? config_.frame_sizes[0]
+                                              : initial_frame_size_;
+  } else {
+    out.quality = config_.best_quality + (quality_levels_ - 1) * step;
+    out.frame_size = config_.frame_sizes[level - quality_levels_ + 1];
+  }
+  return out;
+}
+
+void QualityController::reportSend(uint32_t send_us, uint32_t budget_us) {
+  if (budget_us == 0)
+    return;
+  float ratio = (float)send_us / budget_us;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (ratio > window_peak_)
+    window_peak_ = ratio;
+}
+
+bool QualityController::update(int64_t now_us, QualityLevel *out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (now_us - window_start_us_ < (int64_t)config_.window_ms * 1000)
+    return false;
+  window_start_us_ = now_us;
+
+  // Windows with no reports (no clients) leave the level alone.
+  if (window_peak_ == 0)
+    return false;
+  smoothed_ = 0.5f * smoothed_ + 0.5f * window_peak_;
+  window_peak_ = 0;
+
+  int next = level_;
+  if (smoothed_ > config_.degrade_above) {
+    calm_windows_ = 0;
+    if (level_ < max_level_)
+      next = level_ + 1;
+  } else if (smoothed_ < config_.recover_below) {
+    if (++calm_windows_ >= config_.recover_windows && level_ > 0) {
+      next = level_ - 1;
+      calm_windows_ = 0;
+    }
+  } else {
+    calm_windows_ = 0;
+  }
+
+  if (next == level_)
+    return false;
+  level_ = next;
+  // Give the new setting a clean window before judging it.
+  smoothed_ = (config_.degrade_above + config_.recover_below) / 2;
+  *out = levelAt(level_);
+  return true;
+}
+
+QualityLevel QualityController::current() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return levelAt(level_);
+}
+
+int QualityController::level() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return level_;
+}
+
+}  // namespace camcore
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace camcore {
+
+// Encoder settings for one step of the quality ladder. `quality` uses the
+// sensor's scale (lower = better); `frame_size` is a framesize_t value.
+struct QualityLevel {
+  int quality;
+  int frame_size;
+};
+
+// Backpressure-driven JPEG quality control.
+//
+// Stream clients report how long each frame took to push into the socket
+// against the time they had for it (their frame interval). When the worst
+// client keeps using most of its budget the TCP send queue is backing up,
+// so the controller steps down the ladder: first raising jpeg_quality, then
+// falling back to smaller frame sizes. Once every client has headroom again
+// for a few windows it steps back up one level at a time.
+class QualityController {
+public:
+  struct Config {
+    int best_quality = 10;
+    int worst_quality = 30;
+    int quality_step = 5;
+    // Allowed frame sizes, largest first. Empty keeps the size fixed.
+    const int *frame_sizes = nullptr;
+    size_t frame_size_count = 0;
+    uint32_t window_ms = 1000;
+    float degrade_above = 0.85f;  // smoothed send time / budget
+    float recover_below = 0.5f;
+    int recover_windows = 3;
+  };
+
+  void begin(const Config &config, int initial_frame_size);
+
+  // Called by a stream client after each frame.
+  void reportSend(uint32_t send_us, uint32_t budget_us);
+
+  // Called by the capture task between frames. Returns true and fills
+  // `out` when the encoder should switch to a new level.
+  bool update(int64_t now_us, QualityLevel *out);
+
+  QualityLevel current();
+  int level();
+
+private:
+  QualityLevel levelAt(int level) const;
+
+  std::mutex mutex_;
+  Config config_;
+  int initial_frame_size_ = 0;
+  int quality_levels_ = 1;
+  int max_level_ = 0;
+  int level_ = 0;
+  int64_t window_start_us_ = 0;
+  float window_peak_ = 0;
+  float smoothed_ = 0;
+  int calm_windows_ = 0;
+};
+
+}  // namespace camcore
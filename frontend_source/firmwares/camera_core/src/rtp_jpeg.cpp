@@ -0,0 +1,245 @@
+#include "rtp_jpeg.h"
+
+#include <cstring>
+
+#include "jpeg_tables.h"
+
+namespace camcore {
+
+static const uint8_t kDynamicQ = 255;  // tables travel in-band
+
+static inline uint16_t be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+static inline uint8_t *put16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v;
+  return p + 2;
+}
+
+static inline uint8_t *put32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+  return p + 4;
+}
+
+// `table` points at a DHT table's 16 code counts followed by its values;
+// null means the frame had none, which decoders fill with Annex K.
+static bool isStdTable(const uint8_t *table, const uint8_t *bits,
+                       const uint8_t *vals, size_t count) {
+  return !table || (memcmp(table, bits + 1, 16) == 0 &&
+                    memcmp(table + 16, vals, count) == 0);
+}
+
+bool rtpJpegSource(const uint8_t *jpeg, size_t len, RtpJpegSource *out) {
+  if (len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+    return false;
+  const uint8_t *qt[4] = {};
+  const uint8_t *dht[2][4] = {};  // [class][id]
+  uint8_t comp_id[3] = {}, tq[3] = {}, sampling[3] = {};
+  bool have_sof = false;
+  *out = RtpJpegSource();
+
+  size_t pos = 2;
+  while (pos + 4 <= len) {
+    if (jpeg[pos] != 0xFF)
+      return false;
+    uint8_t marker = jpeg[pos + 1];
+    if (marker == 0xFF) {  // fill byte
+      pos++;
+      continue;
+    }
+    pos += 2;
+    if (marker == 0xD9)
+      return false;  // EOI before SOS
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+      continue;
+
+    uint16_t seg_len = be16(jpeg + pos);
+    if (seg_len < 2 || pos + seg_len > len)
+      return false;
+    const uint8_t *seg = jpeg + pos + 2;
+    const uint8_t *seg_end = jpeg + pos + seg_len;
+    pos += seg_len;
+
+    switch (marker) {
+    case 0xDB:  // DQT
+      while (seg + 65 <= seg_end) {
+        if (seg[0] >> 4)
+          return false;  // 16-bit tables have no RFC 2435 form
+        qt[seg[0] & 3] = seg + 1;
+        seg += 65;
+      }
+      break;
+
+    case 0xC4:  // DHT
+      while (seg + 17 <= seg_end) {
+        size_t count = 0;
+        for (int i = 1; i <= 16; i++)
+          count += seg[i];
+        if (seg + 17 + count > seg_end)
+          return false;
+        dht[(seg[0] >> 4) & 1][seg[0] & 3] = seg + 1;
+        seg += 17 + count;
+      }
+      break;
+
+    case 0xC0:  // SOF0 baseline
+    case 0xC1:  // SOF1 extended sequential, Huffman
+      if (seg_end - seg < 15 || seg[0] != 8 || seg[5] != 3)
+        return false;
+      for (int i = 0; i < 3; i++) {
+        comp_id[i] = seg[6 + i * 3];
+        sampling[i] = seg[7 + i * 3];
+        tq[i] = seg[8 + i * 3] & 3;
+      }
+      if ((sampling[0] != 0x21 && sampling[0] != 0x22) ||
+          sampling[1] != 0x11 || sampling[2] != 0x11 || tq[1] != tq[2])
+        return false;
+      out->type = sampling[0] == 0x22 ? 1 : 0;
+      if (be16(seg + 3) > 2040 || be16(seg + 1) > 2040)
+        return false;
+      out->width8 = (be16(seg + 3) + 7) / 8;
+      out->height8 = (be16(seg + 1) + 7) / 8;
+      have_sof = true;
+      break;
+
+    case 0xDD:  // DRI
+      if (seg_end - seg < 2)
+        return false;
+      out->restart_interval = be16(seg);
+      break;
+
+    case 0xDA: {  // SOS
+      if (!have_sof || seg_end - seg < 1 + 3 * 2 + 3 || seg[0] != 3 ||
+          !qt[tq[0]] || !qt[tq[1]])
+        return false;
+      // Receivers rebuild a scan with components in SOF order, luma on
+      // Huffman tables 0 and chroma on 1, both from Annex K.
+      for (int i = 0; i < 3; i++) {
+        if (seg[1 + i * 2] != comp_id[i])
+          return false;
+        int td = seg[2 + i * 2] >> 4 & 3, ta = seg[2 + i * 2] & 3;
+        if (td != (i ? 1 : 0) || ta != (i ? 1 : 0))
+          return false;
+      }
+      if (!isStdTable(dht[0][0], kStdDcLumaBits, kStdDcLumaVals, 12) ||
+          !isStdTable(dht[1][0], kStdAcLumaBits, kStdAcLumaVals, 162) ||
+          !isStdTable(dht[0][1], kStdDcChromaBits, kStdDcChromaVals, 12) ||
+          !isStdTable(dht[1][1], kStdAcChromaBits, kStdAcChromaVals, 162))
+        return false;
+      if (out->restart_interval)
+        out->type |= 64;
+      out->qt[0] = qt[tq[0]];
+      out->qt[1] = qt[tq[1]];
+
+      // Sensors may pad the buffer after EOI.
+      size_t end = len;
+      while (end >= pos + 2 &&
+             !(jpeg[end - 2] == 0xFF && jpeg[end - 1] == 0xD9))
+        end--;
+      out->scan = jpeg + pos;
+      out->scan_len = (end >= pos + 2 ? end - 2 : len) - pos;
+      return out->scan_len > 0;
+    }
+
+    case 0xC2:
+    case 0xC3:
+    case 0xC5:
+    case 0xC6:
+    case 0xC7:
+    case 0xC9:
+    case 0xCA:
+    case 0xCB:
+    case 0xCD:
+    case 0xCE:
+    case 0xCF:
+      return false;  // progressive, lossless, hierarchical, arithmetic
+    }
+  }
+  return false;
+}
+
+bool RtpJpegPacketizer::sendFrame(const RtpJpegSource &src, uint32_t rtp_time,
+                                  size_t max_packet, Sink sink, void *ctx) {
+  uint8_t head[kMaxHeader];
+  size_t offset = 0;
+  do {
+    uint8_t *p = head + 12;
+    // JPEG header: type-specific, 24-bit fragment offset, type, Q, size.
+    p = put32(p, (uint32_t)offset & 0xFFFFFF);
+    *p++ = src.type;
+    *p++ = kDynamicQ;
+    *p++ = src.width8;
+    *p++ = src.height8;
+    if (src.type & 64) {
+      // F = L = 1 and count 0x3FFF: restart intervals are not aligned to
+      // packets, so the receiver decodes whole frames.
+      p = put16(p, src.restart_interval);
+      p = put16(p, 0xFFFF);
+    }
+    if (offset == 0) {
+      *p++ = 0;  // MBZ
+      *p++ = 0;  // 8-bit precision
+      p = put16(p, 128);
+      memcpy(p, src.qt[0], 64);
+      memcpy(p + 64, src.qt[1], 64);
+      p += 128;
+    }
+    size_t head_len = p - head;
+    if (max_packet <= head_len)
+      return false;
+    size_t chunk = src.scan_len - offset;
+    if (chunk > max_packet - head_len)
+      chunk = max_packet - head_len;
+    bool last = offset + chunk == src.scan_len;
+
+    head[0] = 0x80;  // version 2
+    head[1] = kPayloadType | (last ? 0x80 : 0);
+    put16(head + 2, seq_++);
+    put32(head + 4, rtp_time);
+    put32(head + 8, ssrc_);
+    if (!sink(ctx, head, head_len, src.scan + offset, chunk))
+      return false;
+    packets_++;
+    octets_ += head_len - 12 + chunk;
+    offset += chunk;
+  } while (offset < src.scan_len);
+  return true;
+}
+
+size_t rtcpSenderReport(uint8_t *buf, const RtpJpegPacketizer &rtp,
+                        uint64_t ntp_time, uint32_t rtp_time,
+                        const char *cname) {
+  uint8_t *p = buf;
+  *p++ = 0x80;
+  *p++ = 200;  // SR
+  p = put16(p, 6);
+  p = put32(p, rtp.ssrc());
+  p = put32(p, (uint32_t)(ntp_time >> 32));
+  p = put32(p, (uint32_t)ntp_time);
+  p = put32(p, rtp_time);
+  p = put32(p, rtp.packets());
+  p = put32(p, rtp.octets());
+
+  size_t name_len = strlen(cname);
+  if (name_len > 255)
+    name_len = 255;
+  // Chunk: SSRC, CNAME item, then at least one zero byte up to a word.
+  size_t item_len = 2 + name_len;
+  size_t pad = 4 - item_len % 4;
+  *p++ = 0x81;
+  *p++ = 202;  // SDES
+  p = put16(p, (uint16_t)((8 + item_len + pad) / 4 - 1));
+  p = put32(p, rtp.ssrc());
+  *p++ = 1;  // CNAME
+  *p++ = (uint8_t)name_len;
+  memcpy(p, cname, name_len);
+  p += name_len;
+  memset(p, 0, pad);
+  p += pad;
+  return p - buf;
+}
+
+}  // namespace camcore
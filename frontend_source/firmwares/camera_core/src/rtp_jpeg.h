@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace camcore {
+
+// The parts of a baseline JPEG that RTP/JPEG (RFC 2435) carries, pointing
+// into the frame itself. The receiver rebuilds the headers from `type`,
+// the size and the quantization tables.
+struct RtpJpegSource {
+  uint8_t type = 0;  // 0 = 4:2:2, 1 = 4:2:0, +64 with restart markers
+  uint8_t width8 = 0, height8 = 0;  // size in 8-pixel units
+  uint16_t restart_interval = 0;
+  const uint8_t *qt[2] = {};  // luma and chroma, 64 bytes in zigzag order
+  const uint8_t *scan = nullptr;  // entropy-coded data, without EOI
+  size_t scan_len = 0;
+};
+
+// Locates the tables and the scan. Fails for anything RFC 2435 cannot
+// describe: not 3 components with 2x1 or 2x2 luma and 1x1 chroma,
+// chroma components with different tables, 16-bit tables, Huffman tables
+// other than the Annex K ones, or a side over 2040 pixels.
+bool rtpJpegSource(const uint8_t *jpeg, size_t len, RtpJpegSource *out);
+
+// Splits frames into RTP packets (payload type 26). Every packet is a
+// header built here plus a slice of the scan, so the scan goes out
+// straight from the frame buffer.
+class RtpJpegPacketizer {
+public:
+  static const uint8_t kPayloadType = 26;
+  // RTP + JPEG + restart marker + quantization table headers.
+  static const size_t kMaxHeader = 12 + 8 + 4 + 4 + 128;
+
+  // Returns false to stop sending the frame.
+  typedef bool (*Sink)(void *ctx, const uint8_t *head, size_t head_len,
+                       const uint8_t *payload, size_t payload_len);
+
+  RtpJpegPacketizer(uint32_t ssrc, uint16_t first_seq)
+      : ssrc_(ssrc), seq_(first_seq) {}
+
+  // Sends one frame as packets of at most `max_packet` bytes (RTP header
+  // included). The last one has the marker bit. Returns false if the
+  // sink gave up.
+  bool sendFrame(const RtpJpegSource &src, uint32_t rtp_time,
+                 size_t max_packet, Sink sink, void *ctx);
+
+  uint32_t ssrc() const { return ssrc_; }
+  uint16_t nextSeq() const { return seq_; }
+  // For RTCP sender reports.
+  uint32_t packets() const { return packets_; }
+  uint32_t octets() const { return octets_; }
+
+private:
+  uint32_t ssrc_;
+  uint16_t seq_;
+  uint32_t packets_ = 0;
+  uint32_t octets_ = 0;
+};
+
+// RTCP sender report (RFC 3550 6.4.1, no report blocks) followed by an
+// SDES CNAME, as one compound packet. Returns its length; `buf` needs
+// 44 + strlen(cname) bytes.
+size_t rtcpSenderReport(uint8_t *buf, const RtpJpegPacketizer &rtp,
+                        uint64_t ntp_time, uint32_t rtp_time,
+                        const char *cname);
+
+}  // namespace camcore
@@ -0,0 +1,724 @@
+#include "rtsp_server.h"
+
+#include <esp_http_server.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "rtp_jpeg.h"
+#include "stream_pacer.h"
+#include "substream_task.h"
+
+namespace camcore {
+
+static const char *TAG = "rtsp";
+
+static const int64_t kSessionTimeoutUs = 60 * 1000000LL;
+// From accept to the first complete request.
+static const int64_t kFirstRequestTimeoutUs = 5 * 1000000LL;
+static const uint32_t kPollMs = 1000;       // idle sessions check timeouts
+static const uint32_t kFrameWaitMs = 200;   // bounds control latency
+static const int kMaxMissedFrames = 50;     // give up after ~10 s
+static const uint32_t kFirstFrameWaitMs = 2000;
+static const int64_t kGateCheckUs = 100000;  // idle clients re-check motion
+static const int64_t kSenderReportUs = 5000000;
+static const int kSendRetries = 10;  // one-tick waits for lwIP pbufs
+static const int kSendTimeoutS = 5;
+// No MTU on the RTSP connection; the interleave header has 16 bits.
+static const size_t kInterleavedPacket = 8192;
+static const uint32_t kNtpUnixOffset = 2208988800u;  // 1900 to 1970
+
+static const char *kPublic =
+    "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, "
+    "GET_PARAMETER, SET_PARAMETER\r\n";
+
+struct RtspServer {
+  CameraPipeline *pipeline;
+  RtspServerConfig config;
+  int listen_fd = -1;
+  std::atomic<uint32_t> slots{0};  // bit n set while session n runs
+  uint32_t random = 0;             // xorshift state, listener task only
+};
+
+struct RtspRequest {
+  char method[16] = "";
+  char url[160] = "";
+  char cseq[12] = "0";
+  char transport[128] = "";
+  char session[24] = "";
+  size_t content_length = 0;
+};
+
+struct RtspSession {
+  RtspSession(RtspServer *server, int slot, int fd, uint32_t id,
+              uint32_t ssrc, uint16_t seq)
+      : server(server), slot(slot), fd(fd), id(id), rtp(ssrc, seq) {}
+
+  RtspServer *server;
+  int slot;
+  int fd;  // RTSP connection, also carries interleaved RTP
+  sockaddr_in peer_addr = {};
+  char peer[16] = "";
+  uint32_t id;
+
+  bool requested = false;  // a request arrived
+  bool setup = false;
+  bool playing = false;
+  bool closing = false;
+  bool failed = false;  // a send failed, the connection is gone
+  bool tcp = false;
+  uint8_t channel = 0;  // interleaved RTP channel, RTCP on the next one
+  int rtp_fd = -1;
+  int rtcp_fd = -1;
+
+  FrameBroker *broker = nullptr;
+  StreamPacer pacer{0};
+  RtpJpegPacketizer rtp;
+  uint32_t rtp_offset = 0;
+  bool warned = false;
+
+  int64_t last_seen_us = 0;
+  char in[1024];
+  size_t in_len = 0;
+  size_t skip = 0;  // interleaved bytes from the client still to discard
+  char out[1024];
+};
+
+static uint32_t nextRandom(RtspServer *server) {
+  uint32_t x = server->random;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return server->random = x;
+}
+
+static uint32_t rtpTime(const RtspSession *s, int64_t us) {
+  return s->rtp_offset + (uint32_t)(us * 9 / 100);  // 90 kHz
+}
+
+// Writes every byte or fails; advances through `iov` on short writes.
+static bool sendAll(int fd, struct iovec *iov, int count) {
+  struct msghdr msg = {};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+  while (msg.msg_iovlen > 0) {
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+      n -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + n;
+      msg.msg_iov->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+static bool sendInterleaved(RtspSession *s, uint8_t channel,
+                            const uint8_t *head, size_t head_len,
+                            const uint8_t *payload, size_t len) {
+  uint8_t prefix[4] = {'$', channel, (uint8_t)((head_len + len) >> 8),
+                       (uint8_t)(head_len + len)};
+  struct iovec iov[3] = {{prefix, 4},
+                         {(void *)head, head_len},
+                         {(void *)payload, len}};
+  if (!sendAll(s->fd, iov, len ? 3 : 2)) {
+    s->failed = true;
+    return false;
+  }
+  return true;
+}
+
+// RtpJpegPacketizer::Sink. Over UDP a packet is retried for a few ticks
+// while lwIP is out of buffers, then the rest of the frame is dropped.
+static bool sendRtpPacket(void *ctx, const uint8_t *head, size_t head_len,
+                          const uint8_t *payload, size_t len) {
+  RtspSession *s = static_cast<RtspSession *>(ctx);
+  if (s->tcp)
+    return sendInterleaved(s, s->channel, head, head_len, payload, len);
+
+  struct iovec iov[2] = {{(void *)head, head_len}, {(void *)payload, len}};
+  struct msghdr msg = {};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  for (int attempt = 0;; attempt++) {
+    if (sendmsg(s->rtp_fd, &msg, 0) >= 0)
+      return true;
+    if ((errno == ENOMEM || errno == ENOBUFS || errno == EAGAIN) &&
+        attempt < kSendRetries) {
+      vTaskDelay(1);
+      continue;
+    }
+    if (errno != ENOMEM && errno != ENOBUFS && errno != EAGAIN)
+      s->failed = true;
+    return false;
+  }
+}
+
+static void sendSenderReport(RtspSession *s, int64_t now_us) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  uint64_t ntp = ((uint64_t)(tv.tv_sec + kNtpUnixOffset) << 32) |
+                 (((uint64_t)tv.tv_usec << 32) / 1000000);
+  uint8_t report[64];
+  size_t len =
+      rtcpSenderReport(report, s->rtp, ntp, rtpTime(s, now_us), "camcore");
+  if (s->tcp)
+    sendInterleaved(s, s->channel + 1, report, len, nullptr, 0);
+  else
+    send(s->rtcp_fd, report, len, 0);
+}
+
+static void closeUdp(RtspSession *s) {
+  if (s->rtp_fd >= 0)
+    close(s->rtp_fd);
+  if (s->rtcp_fd >= 0)
+    close(s->rtcp_fd);
+  s->rtp_fd = s->rtcp_fd = -1;
+}
+
+// Binds this slot's RTP/RTCP port pair and connects it to the client's.
+static bool openUdp(RtspSession *s, uint16_t client_rtp,
+                    uint16_t client_rtcp) {
+  closeUdp(s);
+  uint16_t port = s->server->config.rtp_port + 2 * s->slot;
+  int *fds[2] = {&s->rtp_fd, &s->rtcp_fd};
+  uint16_t client_ports[2] = {client_rtp, client_rtcp};
+  for (int i = 0; i < 2; i++) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+      return false;
+    *fds[i] = fd;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(port + i);
+    sockaddr_in remote = s->peer_addr;
+    remote.sin_port = htons(client_ports[i]);
+    if (bind(fd, (sockaddr *)&local, sizeof(local)) != 0 ||
+        connect(fd, (sockaddr *)&remote, sizeof(remote)) != 0) {
+      ESP_LOGW(TAG, "UDP port %u: errno %d", (unsigned)(port + i), errno);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void respond(RtspSession *s, const RtspRequest &req,
+                    const char *status, const char *headers = "",
+                    const char *body = nullptr) {
+  size_t body_len = body ? strlen(body) : 0;
+  int n = snprintf(s->out, sizeof(s->out), "RTSP/1.0 %s\r\nCSeq: %s\r\n%s",
+                   status, req.cseq, headers);
+  if (s->setup && n > 0 && (size_t)n < sizeof(s->out))
+    n += snprintf(s->out + n, sizeof(s->out) - n,
+                  "Session: %08X;timeout=%d\r\n", (unsigned)s->id,
+                  (int)(kSessionTimeoutUs / 1000000));
+  if (n > 0 && (size_t)n < sizeof(s->out))
+    n += snprintf(s->out + n, sizeof(s->out) - n,
+                  "Content-Length: %u\r\n\r\n", (unsigned)body_len);
+  if (n < 0 || (size_t)n >= sizeof(s->out)) {
+    s->failed = true;
+    return;
+  }
+  struct iovec iov[2] = {{s->out, (size_t)n}, {(void *)body, body_len}};
+  if (!sendAll(s->fd, iov, body_len ? 2 : 1))
+    s->failed = true;
+}
+
+static bool urlParam(const char *url, const char *key, char *value,
+                     size_t len) {
+  const char *query = strchr(url, '?');
+  return query && httpd_query_key_value(query + 1, key, value, len) == ESP_OK;
+}
+
+// True if `url`, absolute or not, names /stream.
+static bool isStreamPath(const char *url) {
+  if (strncasecmp(url, "rtsp://", 7) == 0) {
+    url = strchr(url + 7, '/');
+    if (!url)
+      return false;
+  }
+  size_t len = strcspn(url, "?");
+  return len == 7 && strncmp(url, "/stream", 7) == 0;
+}
+
+// Applies the URL's ?res=, ?fps= and ?idle_fps= to the session. Returns
+// null, or the status to answer with.
+static const char *applyUrlOptions(RtspSession *s, const char *url) {
+  if (!isStreamPath(url))
+    return "404 Not Found";
+  CameraPipeline *pipeline = s->server->pipeline;
+  char param[8];
+  int scale = 0;
+  if (urlParam(url, "res", param, sizeof(param)))
+    scale = substreamScale(pipeline, param, kFirstFrameWaitMs);
+  if (scale < 0)
+    return "400 Bad Request";
+  FrameBroker *broker =
+      scale ? &pipeline->substreams[scale - 1] : &pipeline->broker;
+  if (!broker->enabled())
+    return "404 Not Found";
+
+  float fps = 0, idle_fps = 0;
+  if (urlParam(url, "fps", param, sizeof(param)))
+    fps = strtof(param, NULL);
+  // Keep-alive rate while the scene is static; needs the motion detector.
+  if (pipeline->motion.enabled() &&
+      urlParam(url, "idle_fps", param, sizeof(param)))
+    idle_fps = strtof(param, NULL);
+  s->broker = broker;
+  s->pacer = StreamPacer(fps, idle_fps);
+  return nullptr;
+}
+
+static void handleDescribe(RtspSession *s, const RtspRequest &req) {
+  const char *status = applyUrlOptions(s, req.url);
+  if (status) {
+    respond(s, req, status);
+    return;
+  }
+  sockaddr_in local = {};
+  socklen_t len = sizeof(local);
+  char ip[16] = "0.0.0.0";
+  if (getsockname(s->fd, (sockaddr *)&local, &len) == 0)
+    inet_ntop(AF_INET, &local.sin_addr, ip, sizeof(ip));
+  // The media control URL is absolute, so SETUP comes back with the
+  // request's query and its options.
+  char sdp[384];
+  snprintf(sdp, sizeof(sdp),
+           "v=0\r\n"
+           "o=- %u 1 IN IP4 %s\r\n"
+           "s=camcore\r\n"
+           "c=IN IP4 0.0.0.0\r\n"
+           "t=0 0\r\n"
+           "a=control:*\r\n"
+           "m=video 0 RTP/AVP %d\r\n"
+           "a=rtpmap:%d JPEG/90000\r\n"
+           "a=control:%s\r\n",
+           (unsigned)s->id, ip, RtpJpegPacketizer::kPayloadType,
+           RtpJpegPacketizer::kPayloadType, req.url);
+  respond(s, req, "200 OK", "Content-Type: application/sdp\r\n", sdp);
+}
+
+static void handleSetup(RtspSession *s, const RtspRequest &req) {
+  const char *status = applyUrlOptions(s, req.url);
+  if (status) {
+    respond(s, req, status);
+    return;
+  }
+  char headers[192];
+  const char *t = req.transport;
+  if (strstr(t, "RTP/AVP/TCP")) {
+    const char *interleaved = strstr(t, "interleaved=");
+    s->tcp = true;
+    s->channel = interleaved ? (uint8_t)atoi(interleaved + 12) : 0;
+    closeUdp(s);
+    snprintf(headers, sizeof(headers),
+             "Transport: RTP/AVP/TCP;unicast;interleaved=%u-%u;"
+             "ssrc=%08X\r\n",
+             (unsigned)s->channel, (unsigned)s->channel + 1,
+             (unsigned)s->rtp.ssrc());
+  } else {
+    const char *ports = strstr(t, "client_port=");
+    if (!strstr(t, "RTP/AVP") || strstr(t, "multicast") || !ports) {
+      respond(s, req, "461 Unsupported Transport");
+      return;
+    }
+    char *end;
+    unsigned rtp_port = strtoul(ports + 12, &end, 10);
+    unsigned rtcp_port = *end == '-' ? strtoul(end + 1, NULL, 10)
+                                     : rtp_port + 1;
+    s->tcp = false;
+    if (!openUdp(s, rtp_port, rtcp_port)) {
+      closeUdp(s);
+      respond(s, req, "500 Internal Server Error");
+      return;
+    }
+    uint16_t server_port = s->server->config.rtp_port + 2 * s->slot;
+    snprintf(headers, sizeof(headers),
+             "Transport: RTP/AVP;unicast;client_port=%u-%u;"
+             "server_port=%u-%u;ssrc=%08X\r\n",
+             rtp_port, rtcp_port, (unsigned)server_port,
+             (unsigned)server_port + 1, (unsigned)s->rtp.ssrc());
+  }
+  s->setup = true;
+  respond(s, req, "200 OK", headers);
+}
+
+static void handlePlay(RtspSession *s, const RtspRequest &req) {
+  if (!s->setup) {
+    respond(s, req, "455 Method Not Valid in This State");
+    return;
+  }
+  char headers[256];
+  snprintf(headers, sizeof(headers),
+           "Range: npt=0.000-\r\nRTP-Info: url=%s;seq=%u;rtptime=%u\r\n",
+           req.url, (unsigned)s->rtp.nextSeq(),
+           (unsigned)rtpTime(s, esp_timer_get_time()));
+  respond(s, req, "200 OK", headers);
+  if (!s->playing)
+    ESP_LOGI(TAG, "Playing to %s over %s", s->peer, s->tcp ? "TCP" : "UDP");
+  s->playing = true;
+}
+
+static void handleRequest(RtspSession *s, const RtspRequest &req) {
+  const char *m = req.method;
+  s->requested = true;
+  if (s->setup && req.session[0] &&
+      strtoul(req.session, NULL, 16) != s->id) {
+    respond(s, req, "454 Session Not Found");
+  } else if (strcmp(m, "OPTIONS") == 0) {
+    respond(s, req, "200 OK", kPublic);
+  } else if (strcmp(m, "DESCRIBE") == 0) {
+    handleDescribe(s, req);
+  } else if (strcmp(m, "SETUP") == 0) {
+    handleSetup(s, req);
+  } else if (strcmp(m, "PLAY") == 0) {
+    handlePlay(s, req);
+  } else if (strcmp(m, "PAUSE") == 0) {
+    s->playing = false;
+    respond(s, req, "200 OK");
+  } else if (strcmp(m, "TEARDOWN") == 0) {
+    respond(s, req, "200 OK");
+    s->closing = true;
+  } else if (strcmp(m, "GET_PARAMETER") == 0 ||
+             strcmp(m, "SET_PARAMETER") == 0) {
+    respond(s, req, "200 OK");  // keep-alive
+  } else {
+    respond(s, req, "501 Not Implemented", kPublic);
+  }
+}
+
+static const char *headerValue(const char *line, const char *name) {
+  size_t n = strlen(name);
+  if (strncasecmp(line, name, n) != 0 || line[n] != ':')
+    return nullptr;
+  line += n + 1;
+  while (*line == ' ')
+    line++;
+  return line;
+}
+
+// Parses the request head in `text`, which ends with an empty line.
+static void parseRequest(char *text, RtspRequest *req) {
+  char *eol = strstr(text, "\r\n");
+  *eol = '\0';
+  sscanf(text, "%15s %159s", req->method, req->url);
+  for (char *line = eol + 2; (eol = strstr(line, "\r\n")); line = eol + 2) {
+    *eol = '\0';
+    const char *v;
+    if ((v = headerValue(line, "CSeq")))
+      snprintf(req->cseq, sizeof(req->cseq), "%s", v);
+    else if ((v = headerValue(line, "Transport")))
+      snprintf(req->transport, sizeof(req->transport), "%s", v);
+    else if ((v = headerValue(line, "Session")))
+      snprintf(req->session, sizeof(req->session), "%s", v);
+    else if ((v = headerValue(line, "Content-Length")))
+      req->content_length = strtoul(v, NULL, 10);
+  }
+}
+
+static size_t findHeadEnd(const char *p, size_t len) {
+  for (size_t i = 3; i < len; i++)
+    if (p[i] == '\n' && p[i - 1] == '\r' && p[i - 2] == '\n' &&
+        p[i - 3] == '\r')
+      return i + 1;
+  return 0;
+}
+
+// Handles every complete request and skips interleaved packets (RTCP
+// receiver reports) in what the client sent so far. Returns false once
+// the connection is gone or a request does not fit the buffer.
+static bool readControl(RtspSession *s) {
+  ssize_t n = recv(s->fd, s->in + s->in_len, sizeof(s->in) - s->in_len,
+                   MSG_DONTWAIT);
+  if (n == 0)
+    return false;
+  if (n < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  s->in_len += n;
+  s->last_seen_us = esp_timer_get_time();
+
+  size_t pos = 0;
+  while (pos < s->in_len && !s->closing && !s->failed) {
+    char *p = s->in + pos;
+    size_t avail = s->in_len - pos;
+    if (s->skip) {
+      size_t drop = s->skip < avail ? s->skip : avail;
+      s->skip -= drop;
+      pos += drop;
+      continue;
+    }
+    if (p[0] == '$') {
+      if (avail < 4)
+        break;
+      s->skip = 4 + ((uint8_t)p[2] << 8 | (uint8_t)p[3]);
+      continue;
+    }
+    size_t head = findHeadEnd(p, avail);
+    if (!head)
+      break;
+    // Parsed from a copy in the response buffer, which is free until
+    // handleRequest() answers.
+    RtspRequest req;
+    memcpy(s->out, p, head);
+    s->out[head - 1] = '\0';
+    parseRequest(s->out, &req);
+    if (head + req.content_length > sizeof(s->in))
+      return false;
+    if (head + req.content_length > avail)
+      break;
+    handleRequest(s, req);
+    pos += head + req.content_length;
+  }
+  memmove(s->in, s->in + pos, s->in_len - pos);
+  s->in_len -= pos;
+  return s->in_len < sizeof(s->in) && !s->failed;
+}
+
+// Waits up to `timeout_ms` for RTSP requests or RTCP and handles them.
+// Returns false once the session should end.
+static bool pollInput(RtspSession *s, uint32_t timeout_ms) {
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(s->fd, &fds);
+  int max_fd = s->fd;
+  if (s->rtcp_fd >= 0) {
+    FD_SET(s->rtcp_fd, &fds);
+    if (s->rtcp_fd > max_fd)
+      max_fd = s->rtcp_fd;
+  }
+  struct timeval tv = {(time_t)(timeout_ms / 1000),
+                       (suseconds_t)(timeout_ms % 1000 * 1000)};
+  int ready = select(max_fd + 1, &fds, NULL, NULL, &tv);
+  if (ready < 0)
+    return errno == EINTR;
+  if (ready > 0 && FD_ISSET(s->fd, &fds) && !readControl(s))
+    return false;
+  if (ready > 0 && s->rtcp_fd >= 0 && FD_ISSET(s->rtcp_fd, &fds)) {
+    uint8_t report[256];
+    while (recv(s->rtcp_fd, report, sizeof(report), MSG_DONTWAIT) > 0)
+      s->last_seen_us = esp_timer_get_time();
+  }
+  return !s->closing && !s->failed;
+}
+
+static void sessionTask(void *pvParameters) {
+  RtspSession *s = static_cast<RtspSession *>(pvParameters);
+  CameraPipeline *pipeline = s->server->pipeline;
+  PipelineMetrics *metrics = &pipeline->metrics;
+  StreamClientStats *client = nullptr;
+  uint32_t last_seq = 0;
+  int missed = 0;
+  int64_t next_report_us = 0;
+  int64_t start_us = esp_timer_get_time();
+  s->last_seen_us = start_us;
+
+  while (true) {
+    int64_t now = esp_timer_get_time();
+    // Bytes that never complete a request do not keep a slot.
+    if (!s->requested && now - start_us > kFirstRequestTimeoutUs) {
+      ESP_LOGI(TAG, "No request from %s", s->peer);
+      break;
+    }
+    // A TCP session that plays ends with its connection.
+    if ((!s->tcp || !s->playing) && now - s->last_seen_us > kSessionTimeoutUs) {
+      ESP_LOGI(TAG, "Session %08X timed out", (unsigned)s->id);
+      break;
+    }
+    if (!s->playing) {
+      if (!pollInput(s, kPollMs))
+        break;
+      continue;
+    }
+    if (!client) {
+      client = metrics->acquireClient(s->peer, s->tcp ? "rtp/tcp" : "rtp/udp");
+      // A substream is only scaled while someone waits on it, so its
+      // latest frame may be old: start with the next one.
+      last_seq = s->broker != &pipeline->broker ? s->broker->latestSeq() : 0;
+    }
+    if (!pollInput(s, 0))
+      break;
+
+    if (s->pacer.gated())
+      s->pacer.setIdle(!pipeline->motion.active(), now);
+    int64_t delay_us = s->pacer.delayUs(now);
+    if (delay_us > 0) {
+      if (s->pacer.gated() && delay_us > kGateCheckUs)
+        delay_us = kGateCheckUs;
+      if (delay_us > kFrameWaitMs * 1000)
+        delay_us = kFrameWaitMs * 1000;
+      if (!pollInput(s, (uint32_t)((delay_us + 999) / 1000)))
+        break;
+      continue;
+    }
+
+    FrameRef frame = s->broker->waitNewer(last_seq, kFrameWaitMs);
+    if (!frame) {
+      if (++missed >= kMaxMissedFrames) {
+        ESP_LOGW(TAG, "No frames for %d s, closing session",
+                 missed * (int)kFrameWaitMs / 1000);
+        break;
+      }
+      continue;
+    }
+    missed = 0;
+    if (last_seq && frame.seq() > last_seq + 1)
+      metrics->framesDropped(client, frame.seq() - last_seq - 1);
+    last_seq = frame.seq();
+
+    RtpJpegSource src;
+    if (!rtpJpegSource(frame.data(), frame.size(), &src)) {
+      if (!s->warned)
+        ESP_LOGW(TAG, "Frame %u has no RFC 2435 form, skipping",
+                 (unsigned)frame.seq());
+      s->warned = true;
+      metrics->framesDropped(client, 1);
+      continue;
+    }
+
+    int64_t send_start = esp_timer_get_time();
+    if (send_start >= next_report_us) {
+      sendSenderReport(s, send_start);
+      next_report_us = send_start + kSenderReportUs;
+    }
+    bool sent = s->rtp.sendFrame(
+        src, rtpTime(s, frame.timestampUs()),
+        s->tcp ? kInterleavedPacket : s->server->config.max_packet,
+        sendRtpPacket, s);
+    int64_t send_us = esp_timer_get_time() - send_start;
+    metrics->rtp_send.observe((uint32_t)send_us);
+    if (s->failed)
+      break;
+    if (sent)
+      metrics->frameSent(client);
+    else
+      metrics->framesDropped(client, 1);
+    s->pacer.markSent(send_start);
+
+    // Only TCP pushes back; a UDP send returns as soon as lwIP has the
+    // packet, whatever happens to it on the air.
+    int64_t budget_us =
+        s->pacer.paced() ? s->pacer.intervalUs() : s->broker->frameIntervalUs();
+    if (s->tcp && budget_us > 0)
+      pipeline->quality.reportSend((uint32_t)send_us, (uint32_t)budget_us);
+  }
+
+  if (s->playing)
+    ESP_LOGI(TAG, "Session %08X to %s ended", (unsigned)s->id, s->peer);
+  metrics->releaseClient(client);
+  closeUdp(s);
+  close(s->fd);
+  s->server->slots.fetch_and(~(1u << s->slot));
+  delete s;
+  vTaskDelete(NULL);
+}
+
+static int claimSlot(RtspServer *server) {
+  for (int i = 0; i < server->config.max_sessions && i < 32; i++) {
+    uint32_t bit = 1u << i;
+    if (!(server->slots.fetch_or(bit) & bit))
+      return i;
+  }
+  return -1;
+}
+
+static void listenerTask(void *pvParameters) {
+  RtspServer *server = static_cast<RtspServer *>(pvParameters);
+  while (true) {
+    sockaddr_in addr = {};
+    socklen_t addr_len = sizeof(addr);
+    int fd = accept(server->listen_fd, (sockaddr *)&addr, &addr_len);
+    if (fd < 0) {
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+    int slot = claimSlot(server);
+    if (slot < 0) {
+      static const char kBusy[] = "RTSP/1.0 503 Service Unavailable\r\n\r\n";
+      send(fd, kBusy, sizeof(kBusy) - 1, MSG_NOSIGNAL);
+      close(fd);
+      continue;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv = {kSendTimeoutS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    uint32_t id = nextRandom(server);
+    uint32_t ssrc = nextRandom(server);
+    RtspSession *s = new RtspSession(server, slot, fd, id, ssrc,
+                                     (uint16_t)nextRandom(server));
+    s->rtp_offset = nextRandom(server);
+    s->peer_addr = addr;
+    inet_ntop(AF_INET, &addr.sin_addr, s->peer, sizeof(s->peer));
+    if (xTaskCreate(sessionTask, "rtsp_session", server->config.stack_size,
+                    s, server->config.priority, NULL) != pdPASS) {
+      close(fd);
+      server->slots.fetch_and(~(1u << slot));
+      delete s;
+    }
+  }
+}
+
+bool startRtspServer(CameraPipeline *pipeline,
+                     const RtspServerConfig &config) {
+  RtspServer *server = new RtspServer();
+  server->pipeline = pipeline;
+  server->config = config;
+  server->random = (uint32_t)esp_timer_get_time() | 1;
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(config.port);
+  if (fd < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+      bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+    ESP_LOGE(TAG, "Cannot listen on port %u: errno %d",
+             (unsigned)config.port, errno);
+    if (fd >= 0)
+      close(fd);
+    delete server;
+    return false;
+  }
+  server->listen_fd = fd;
+  if (xTaskCreate(listenerTask, "rtsp_server", 3072, server,
+                  config.priority, NULL) != pdPASS) {
+    close(fd);
+    delete server;
+    return false;
+  }
+  ESP_LOGI(TAG, "RTSP on port %u", (unsigned)config.port);
+  return true;
+}
+
+}  // namespace camcore
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "camera_pipeline.h"
+
+namespace camcore {
+
+struct RtspServerConfig {
+  uint16_t port = 554;
+  // Session n sends RTP from rtp_port + 2n and RTCP from the port above.
+  uint16_t rtp_port = 6970;
+  int max_sessions = 2;
+  UBaseType_t priority = 4;  // as /stream clients
+  uint32_t stack_size = 4096;
+  // Largest RTP packet over UDP; 1400 stays below the Wi-Fi MTU with room
+  // for VPN or PPPoE headers.
+  size_t max_packet = 1400;
+};
+
+// Starts an RTSP (RFC 2326) server that plays the pipeline's frames as
+// RTP/JPEG (RFC 2435). The quantization tables and the entropy-coded scan
+// are sent straight from the broker slot; nothing is decoded or
+// re-encoded. Clients choose RTP over UDP, where a lost packet costs one
+// frame instead of stalling the stream behind a retransmit, or RTP
+// interleaved on the RTSP connection (`RTP/AVP/TCP`) where UDP is blocked.
+//
+// rtsp://<ip>/stream takes the same `?res=`, `?fps=` and `?idle_fps=` as
+// /stream. Each session runs in its own task and, like /stream, always
+// sends the newest frame, so a slow link skips frames rather than queueing
+// them. UDP sessions end when neither RTSP requests nor RTCP receiver
+// reports arrive for 60 s; a connection without a request in 5 s is closed.
+bool startRtspServer(CameraPipeline *pipeline,
+                     const RtspServerConfig &config);
+
+}  // namespace camcore
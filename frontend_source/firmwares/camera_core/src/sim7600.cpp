@@ -0,0 +1,212 @@
+#include "sim7600.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace camcore {
+
+static const char *TAG = "sim7600";
+
+static const char *const kSetup[] = {
+    "AT",
+    "ATE0",               // no echo
+    "AT+CMGF=1",          // text mode
+    "AT+CSCS=\"GSM\"",    // character set of the text
+    "AT+CNMI=2,2,0,0,0",  // deliver new messages as +CMT
+};
+static const int kSetupSteps = sizeof(kSetup) / sizeof(kSetup[0]);
+
+static const size_t kSmsChars = 160;
+
+// Double-quoted fields on the first line of a +CMT/+CMGR header, e.g.
+// +CMT: "+15551234567","","24/10/17,12:00:00+08"
+struct QuotedFields {
+  char value[4][32];
+  int count;
+};
+
+static void parseQuoted(const char *line, QuotedFields *out) {
+  out->count = 0;
+  const char *eol = strchr(line, '\n');
+  const char *p = strchr(line, '"');
+  while (p && out->count < 4) {
+    const char *end = strchr(p + 1, '"');
+    if (!end || (eol && end > eol))
+      break;
+    size_t len = end - p - 1;
+    if (len >= sizeof(out->value[0]))
+      len = sizeof(out->value[0]) - 1;
+    memcpy(out->value[out->count], p + 1, len);
+    out->value[out->count++][len] = '\0';
+    p = strchr(end + 1, '"');
+  }
+}
+
+bool Sim7600::begin(const Config &config, SmsHandler on_sms, void *ctx) {
+  config_ = config;
+  on_sms_ = on_sms;
+  ctx_ = ctx;
+  if (!at_.begin(config.at) || !at_.addUrc("+CMT:", true, onCmt, this) ||
+      !at_.addUrc("+CMTI:", false, onCmti, this))
+    return false;
+  startSetup();
+  return true;
+}
+
+void Sim7600::startSetup() {
+  ready_ = false;
+  setup_done_ = 0;
+  sendSetupStep();
+}
+
+// Setup goes one command at a time, so it never needs more than one queue
+// slot; a step that fails or cannot be queued restarts the sequence after
+// retry_ms.
+void Sim7600::sendSetupStep() {
+  if (at_.send(kSetup[setup_done_], onSetupStep, this))
+    return;
+  ESP_LOGW(TAG, "%s: command queue full", kSetup[setup_done_]);
+  retry_at_us_ = esp_timer_get_time() + (int64_t)config_.retry_ms * 1000;
+}
+
+void Sim7600::onSetupStep(void *ctx, AtResult result, const char *response) {
+  Sim7600 *self = static_cast<Sim7600 *>(ctx);
+  if (result != AtResult::kOk) {
+    ESP_LOGW(TAG, "%s failed: %s", kSetup[self->setup_done_],
+             result == AtResult::kTimeout ? "timeout" : response);
+    self->retry_at_us_ =
+        esp_timer_get_time() + (int64_t)self->config_.retry_ms * 1000;
+    return;
+  }
+  if (++self->setup_done_ < kSetupSteps) {
+    self->sendSetupStep();
+    return;
+  }
+  ESP_LOGI(TAG, "Modem ready");
+  self->ready_ = true;
+}
+
+void Sim7600::process(TickType_t max_wait) {
+  if (retry_at_us_) {
+    int64_t left_us = retry_at_us_ - esp_timer_get_time();
+    if (left_us <= 0) {
+      retry_at_us_ = 0;
+      startSetup();
+    } else if (pdMS_TO_TICKS(left_us / 1000 + 1) < max_wait) {
+      max_wait = pdMS_TO_TICKS(left_us / 1000 + 1);
+    }
+  }
+  if (!reading_ && stored_count_ > 0)
+    readNextStored();
+  at_.process(max_wait);
+}
+
+bool Sim7600::sendSms(const char *number, const char *text, AtCallback done,
+                      void *ctx) {
+  char command[AtEngine::kCommandSize];
+  char payload[kSmsChars + 1];
+  int len = snprintf(command, sizeof(command), "AT+CMGS=\"%s\"", number);
+  if (len < 0 || (size_t)len >= sizeof(command))
+    return false;
+  snprintf(payload, sizeof(payload), "%s", text);
+  return at_.send(command, done, ctx, config_.send_timeout_ms, payload);
+}
+
+void Sim7600::onCmt(void *ctx, const char *line, const char *body) {
+  Sim7600 *self = static_cast<Sim7600 *>(ctx);
+  QuotedFields fields;
+  parseQuoted(line, &fields);
+  SmsMessage sms = {fields.count > 0 ? fields.value[0] : "",
+                    fields.count > 1 ? fields.value[fields.count - 1] : "",
+                    body};
+  if (self->on_sms_)
+    self->on_sms_(self->ctx_, sms);
+}
+
+void Sim7600::onCmti(void *ctx, const char *line, const char *body) {
+  (void)body;
+  Sim7600 *self = static_cast<Sim7600 *>(ctx);
+  const char *comma = strrchr(line, ',');
+  if (!comma)
+    return;
+  if (self->stored_count_ == kMaxStoredReads) {
+    ESP_LOGW(TAG, "Too many stored messages, leaving %s on the SIM", line);
+    return;
+  }
+  int tail = (self->stored_head_ + self->stored_count_) % kMaxStoredReads;
+  self->stored_[tail] = (uint16_t)atoi(comma + 1);
+  self->stored_count_++;
+  if (!self->reading_)
+    self->readNextStored();
+}
+
+// AT+CMGR for the oldest stored index, or AT+CMGD once it was delivered.
+// A command that cannot be queued is retried from process().
+void Sim7600::readNextStored() {
+  reading_ = false;
+  if (stored_count_ == 0)
+    return;
+  int index = stored_[stored_head_];
+  char command[24];
+  snprintf(command, sizeof(command), "AT+CMG%c=%d", stored_read_ ? 'D' : 'R',
+           index);
+  reading_ = at_.send(command, stored_read_ ? onCmgd : onCmgr, this);
+}
+
+// Drops the oldest index and starts on the next one.
+void Sim7600::nextStored() {
+  stored_head_ = (stored_head_ + 1) % kMaxStoredReads;
+  stored_count_--;
+  stored_read_ = false;
+  stored_attempts_ = 0;
+  readNextStored();
+}
+
+void Sim7600::onCmgd(void *ctx, AtResult result, const char *response) {
+  Sim7600 *self = static_cast<Sim7600 *>(ctx);
+  if (result != AtResult::kOk &&
+      ++self->stored_attempts_ < kMaxStoredAttempts) {
+    self->readNextStored();
+    return;
+  }
+  if (result != AtResult::kOk)
+    ESP_LOGW(TAG, "AT+CMGD=%d failed: %s, leaving it on the SIM",
+             self->stored_[self->stored_head_],
+             result == AtResult::kTimeout ? "timeout" : response);
+  self->nextStored();
+}
+
+void Sim7600::onCmgr(void *ctx, AtResult result, const char *response) {
+  Sim7600 *self = static_cast<Sim7600 *>(ctx);
+  // "+CMGR: <stat>,<oa>,<alpha>,<scts>" then the text on the next line(s).
+  const char *text = strchr(response, '\n');
+  if (result != AtResult::kOk || strncmp(response, "+CMGR:", 6) != 0 ||
+      !text) {
+    if (++self->stored_attempts_ < kMaxStoredAttempts) {
+      self->readNextStored();
+      return;
+    }
+    // Not deleted: the message stays on the SIM rather than being lost.
+    ESP_LOGW(TAG, "AT+CMGR=%d failed: %s, leaving it on the SIM",
+             self->stored_[self->stored_head_],
+             result == AtResult::kTimeout ? "timeout" : response);
+    self->nextStored();
+    return;
+  }
+  QuotedFields fields;
+  parseQuoted(response, &fields);
+  SmsMessage sms = {fields.count > 1 ? fields.value[1] : "",
+                    fields.count > 2 ? fields.value[fields.count - 1] : "",
+                    text + 1};
+  if (self->on_sms_)
+    self->on_sms_(self->ctx_, sms);
+  self->stored_read_ = true;
+  self->stored_attempts_ = 0;
+  self->readNextStored();
+}
+
+}  // namespace camcore
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+#include <cstdint>
+
+#include "at_engine.h"
+
+namespace camcore {
+
+// One received text message. The strings are only valid during the call.
+struct SmsMessage {
+  const char *sender;
+  const char *timestamp;  // service centre time, "yy/MM/dd,hh:mm:ss+zz"
+  const char *text;
+};
+
+typedef void (*SmsHandler)(void *ctx, const SmsMessage &sms);
+
+// Text-mode SMS on a SIM7600 through AtEngine.
+//
+// New messages are routed straight to the UART (AT+CNMI=2,2): the modem
+// sends "+CMT: <header>" followed by the text, so a message reaches the
+// handler as soon as its last byte does, with no +CMTI notification and
+// AT+CMGL/AT+CMGR round trip in between. Messages the modem still stores
+// (class 2, or received before setup finished) arrive as +CMTI; their
+// indices are queued and read with AT+CMGR, then deleted, one command at a
+// time so a burst of notifications cannot fill the command queue. A message
+// is deleted only once the handler has had it; a read that keeps failing
+// leaves it on the SIM.
+//
+// The setup commands are sent one after another; if one fails or cannot be
+// queued, the whole sequence is retried after `retry_ms`.
+class Sim7600 {
+public:
+  static const int kMaxStoredReads = 16;
+  static const int kMaxStoredAttempts = 3;  // per AT+CMGR / AT+CMGD
+
+  struct Config {
+    AtEngine::Config at;
+    uint32_t retry_ms = 5000;
+    uint32_t send_timeout_ms = 60000;  // AT+CMGS waits for the network
+  };
+
+  bool begin(const Config &config, SmsHandler on_sms, void *ctx);
+
+  // Drives the AT engine; call in a loop from the modem task.
+  void process(TickType_t max_wait);
+
+  // Queues a text message (truncated to 160 characters).
+  bool sendSms(const char *number, const char *text,
+               AtCallback done = nullptr, void *ctx = nullptr);
+
+  // The setup sequence has completed.
+  bool ready() const { return ready_; }
+  AtEngine &at() { return at_; }
+
+private:
+  static void onSetupStep(void *ctx, AtResult result, const char *response);
+  static void onCmt(void *ctx, const char *line, const char *body);
+  static void onCmti(void *ctx, const char *line, const char *body);
+  static void onCmgr(void *ctx, AtResult result, const char *response);
+  static void onCmgd(void *ctx, AtResult result, const char *response);
+  void startSetup();
+  void sendSetupStep();
+  void readNextStored();
+  void nextStored();
+
+  AtEngine at_;
+  Config config_;
+  SmsHandler on_sms_ = nullptr;
+  void *ctx_ = nullptr;
+  int setup_done_ = 0;  // setup steps answered OK
+  bool ready_ = false;
+  int64_t retry_at_us_ = 0;
+
+  uint16_t stored_[kMaxStoredReads];  // +CMTI indices still to read
+  int stored_head_ = 0;
+  int stored_count_ = 0;
+  bool reading_ = false;     // an AT+CMGR or AT+CMGD is queued
+  bool stored_read_ = false;  // the oldest index was delivered, delete it
+  int stored_attempts_ = 0;   // failures of its current command
+};
+
+}  // namespace camcore
@@ -0,0 +1,38 @@
+#include "stream_pacer.h"
+
+namespace camcore {
+
+StreamPacer::StreamPacer(float fps, float idle_fps) {
+  if (fps > 0)
+    interval_us_ = (int64_t)(1000000.0f / fps);
+  if (idle_fps > 0)
+    idle_interval_us_ = (int64_t)(1000000.0f / idle_fps);
+}
+
+void StreamPacer::setIdle(bool idle, int64_t now_us) {
+  if (!gated() || idle == idle_)
+    return;
+  idle_ = idle;
+  if (!idle)
+    next_due_us_ = now_us;  // motion: send the next frame right away
+  else
+    next_due_us_ = now_us + idle_interval_us_;
+}
+
+int64_t StreamPacer::delayUs(int64_t now_us) const {
+  if (!paced() || next_due_us_ <= now_us)
+    return 0;
+  return next_due_us_ - now_us;
+}
+
+void StreamPacer::markSent(int64_t now_us) {
+  if (!paced())
+    return;
+  int64_t interval = intervalUs();
+  next_due_us_ += interval;
+  // More than one interval late: resync instead of sending a burst.
+  if (next_due_us_ < now_us)
+    next_due_us_ = now_us + interval;
+}
+
+}  // namespace camcore
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+namespace camcore {
+
+// Per-connection frame scheduler for `/stream?fps=N&idle_fps=M`.
+//
+// Frames are due on a fixed grid of 1/fps intervals. A client that falls
+// behind is not allowed to burst to catch up: the grid restarts from "now",
+// and since the broker always hands out the newest frame the frames it
+// missed are simply dropped (drop-oldest). While the scene is idle (no
+// motion) the grid switches to the slower keep-alive rate, and the first
+// frame after motion starts is due immediately.
+class StreamPacer {
+public:
+  // fps <= 0 means "as fast as frames arrive"; idle_fps <= 0 disables the
+  // keep-alive rate.
+  explicit StreamPacer(float fps, float idle_fps = 0);
+
+  bool paced() const { return intervalUs() > 0; }
+  bool gated() const { return idle_interval_us_ > 0; }
+  int64_t intervalUs() const {
+    return idle_ ? idle_interval_us_ : interval_us_;
+  }
+
+  void setIdle(bool idle, int64_t now_us);
+
+  // Microseconds to wait before the next frame is due (0 if due now).
+  int64_t delayUs(int64_t now_us) const;
+
+  // Call once a frame has been handed to the socket.
+  void markSent(int64_t now_us);
+
+private:
+  int64_t interval_us_ = 0;
+  int64_t idle_interval_us_ = 0;
+  int64_t next_due_us_ = 0;
+  bool idle_ = false;
+};
+
+}  // namespace camcore
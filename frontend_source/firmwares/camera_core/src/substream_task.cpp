@@ -0,0 +1,245 @@
+#include "substream_task.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <img_converters.h>
+
+#include <cstring>
+
+#include "jpeg_decoder.h"
+#include "large_alloc.h"
+
+namespace camcore {
+
+static const char *TAG = "substream";
+
+static const int kLevels = 2;
+static const uint32_t kFrameWaitMs = 1000;
+
+// RGB888, stored B, G, R as esp32-camera's converters keep it. Grows to the
+// largest frame seen and is reused after that.
+struct RgbFrame {
+  uint8_t *buf = nullptr;
+  size_t capacity = 0;
+  int width = 0, height = 0;
+};
+
+struct SubstreamTaskArgs {
+  CameraPipeline *pipeline;
+  SubstreamTaskConfig config;
+  RgbFrame rgb[kLevels];  // 1/2, 1/4
+};
+
+static bool reserve(RgbFrame *f, int width, int height) {
+  size_t size = (size_t)width * height * 3;
+  if (size > f->capacity) {
+    freeLarge(f->buf);
+    f->buf = static_cast<uint8_t *>(allocLarge(size));
+    f->capacity = f->buf ? size : 0;
+    if (!f->buf)
+      return false;
+  }
+  f->width = width;
+  f->height = height;
+  return true;
+}
+
+struct DecodeJob {
+  const uint8_t *jpeg;
+  size_t len;
+  RgbFrame *out;
+};
+
+static size_t readJpeg(void *arg, size_t index, uint8_t *buf, size_t len) {
+  DecodeJob *job = static_cast<DecodeJob *>(arg);
+  if (index >= job->len)
+    return 0;
+  if (len > job->len - index)
+    len = job->len - index;
+  if (buf)  // null skips
+    memcpy(buf, job->jpeg + index, len);
+  return len;
+}
+
+// The decoder's blocks are R, G, B; the first call (null data at 0, 0)
+// carries the output size.
+static bool writeRgb(void *arg, uint16_t x, uint16_t y, uint16_t w,
+                     uint16_t h, uint8_t *data) {
+  RgbFrame *out = static_cast<DecodeJob *>(arg)->out;
+  if (!data)
+    return x || y || reserve(out, w, h);
+  if (x >= out->width)
+    return true;
+  int cols = x + w > out->width ? out->width - x : w;
+  for (int r = 0; r < h && y + r < out->height; r++) {
+    const uint8_t *src = data + (size_t)r * w * 3;
+    uint8_t *dst = out->buf + ((size_t)(y + r) * out->width + x) * 3;
+    for (int i = 0; i < cols; i++, src += 3, dst += 3) {
+      dst[0] = src[2];
+      dst[1] = src[1];
+      dst[2] = src[0];
+    }
+  }
+  return true;
+}
+
+// 2x2 box filter, `src` to `dst` at half the size.
+static bool halve(const RgbFrame &src, RgbFrame *dst) {
+  if (!reserve(dst, src.width / 2, src.height / 2))
+    return false;
+  size_t stride = (size_t)src.width * 3;
+  for (int y = 0; y < dst->height; y++) {
+    const uint8_t *top = src.buf + (size_t)y * 2 * stride;
+    const uint8_t *bottom = top + stride;
+    uint8_t *out = dst->buf + (size_t)y * dst->width * 3;
+    for (int i = 0; i < dst->width * 3; i++) {
+      int x = i / 3 * 6 + i % 3;
+      out[i] = (top[x] + top[x + 3] + bottom[x] + bottom[x + 3] + 2) >> 2;
+    }
+  }
+  return true;
+}
+
+struct SlotWriter {
+  uint8_t *buf;
+  size_t capacity;
+  size_t len;
+  bool overflow;
+};
+
+static size_t writeToSlot(void *arg, size_t index, const void *data,
+                          size_t len) {
+  SlotWriter *w = static_cast<SlotWriter *>(arg);
+  if (index + len > w->capacity) {
+    w->overflow = true;
+    return 0;  // aborts the encoder
+  }
+  memcpy(w->buf + index, data, len);
+  if (index + len > w->len)
+    w->len = index + len;
+  return len;
+}
+
+// Encodes rgb[level] straight into a slot of that level's broker.
+static void publishLevel(SubstreamTaskArgs *args, int level,
+                         const FrameRef &frame) {
+  FrameBroker *broker = &args->pipeline->substreams[level];
+  const RgbFrame &rgb = args->rgb[level];
+  SlotWriter w = {nullptr, 0, 0, false};
+  w.buf = broker->beginFrame(&w.capacity);
+  if (!w.buf)
+    return;
+  if (!fmt2jpg_cb(rgb.buf, (size_t)rgb.width * rgb.height * 3, rgb.width,
+                  rgb.height, PIXFORMAT_RGB888, args->config.jpeg_quality,
+                  writeToSlot, &w)) {
+    ESP_LOGD(TAG, "1/%d scale of frame %u dropped", 2 << level,
+             (unsigned)frame.seq());
+    broker->abortFrame(w.overflow);
+    return;
+  }
+  broker->commitFrame(w.len, frame.info());
+}
+
+static void scaleFrame(SubstreamTaskArgs *args, const FrameRef &frame) {
+  CameraPipeline *pipeline = args->pipeline;
+  bool wanted[kLevels];
+  for (int i = 0; i < kLevels; i++)
+    wanted[i] = pipeline->substreams[i].waiters() > 0;
+  if (!wanted[0] && !wanted[1])
+    return;
+
+  // One decode at the larger scale wanted; the 1/4 level is boxed down
+  // from the 1/2 one when both have readers.
+  int64_t start = esp_timer_get_time();
+  int first = wanted[0] ? 0 : 1;
+  DecodeJob job = {frame.data(), frame.size(), &args->rgb[first]};
+  if (esp_jpg_decode(frame.size(), first ? JPG_SCALE_4X : JPG_SCALE_2X,
+                     readJpeg, writeRgb, &job) != ESP_OK) {
+    ESP_LOGW(TAG, "Frame %u did not decode", (unsigned)frame.seq());
+    return;
+  }
+  if (wanted[0])
+    publishLevel(args, 0, frame);
+  if (wanted[1] && (first == 1 || halve(args->rgb[0], &args->rgb[1])))
+    publishLevel(args, 1, frame);
+  pipeline->metrics.substream_scale.observe(
+      (uint32_t)(esp_timer_get_time() - start));
+}
+
+static void substreamTask(void *pvParameters) {
+  SubstreamTaskArgs *args = static_cast<SubstreamTaskArgs *>(pvParameters);
+  FrameBroker *source = &args->pipeline->broker;
+  uint32_t last_seq = 0;
+  while (true) {
+    FrameRef frame = source->waitNewer(last_seq, kFrameWaitMs);
+    if (!frame)
+      continue;
+    last_seq = frame.seq();
+    scaleFrame(args, frame);
+  }
+}
+
+// `?res=` names, by frame width as in framesize_t.
+static const struct {
+  const char *name;
+  int width;
+} kResolutions[] = {
+    {"qqvga", 160}, {"qvga", 320}, {"cif", 400},  {"hvga", 480},
+    {"vga", 640},   {"svga", 800}, {"xga", 1024}, {"hd", 1280},
+    {"sxga", 1280}, {"uxga", 1600},
+};
+
+int substreamScale(CameraPipeline *pipeline, const char *name,
+                   uint32_t wait_ms) {
+  if (strcmp(name, "full") == 0)
+    return 0;
+  if (strcmp(name, "half") == 0)
+    return 1;
+  if (strcmp(name, "quarter") == 0)
+    return 2;
+  int want = -1;
+  for (const auto &r : kResolutions)
+    if (strcmp(name, r.name) == 0)
+      want = r.width;
+  if (want < 0)
+    return -1;
+
+  FrameRef frame = pipeline->broker.waitNewer(0, wait_ms);
+  int width, height;
+  if (!frame || !jpegDimensions(frame.data(), frame.size(), &width, &height))
+    return 0;
+  for (int scale = 2; scale > 0; scale--)
+    if (((width + (1 << scale) - 1) >> scale) >= want)
+      return scale;
+  return 0;
+}
+
+bool startSubstreamTask(CameraPipeline *pipeline,
+                        const SubstreamTaskConfig &config) {
+  FrameBroker::Config half;
+  half.slot_count = config.slot_count;
+  half.slot_capacity = config.slot_capacity;
+  FrameBroker::Config quarter = half;
+  quarter.slot_capacity = config.slot_capacity / 4;
+  if (!pipeline->substreams[0].begin(half) ||
+      !pipeline->substreams[1].begin(quarter)) {
+    ESP_LOGE(TAG, "Substream broker allocation failed");
+    return false;
+  }
+
+  SubstreamTaskArgs *args = new SubstreamTaskArgs();
+  args->pipeline = pipeline;
+  args->config = config;
+  BaseType_t ok =
+      xTaskCreatePinnedToCore(substreamTask, "SubstreamTask",
+                              config.stack_size, args, config.priority, NULL,
+                              config.core);
+  if (ok != pdPASS) {
+    delete args;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace camcore
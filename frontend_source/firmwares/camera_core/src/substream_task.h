@@ -0,0 +1,43 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "camera_pipeline.h"
+
+namespace camcore {
+
+struct SubstreamTaskConfig {
+  BaseType_t core = 0;
+  UBaseType_t priority = 3;  // below the capture task and stream clients
+  uint32_t stack_size = 4096;
+  size_t slot_count = 3;
+  size_t slot_capacity = 48 * 1024;  // 1/2 scale; 1/4 gets a quarter
+  int jpeg_quality = 80;             // fmt2jpg_cb()'s 1-100, higher is better
+};
+
+// Begins the pipeline's substream brokers and starts the task that fills
+// them with 1/2 and 1/4 scale copies of each published frame: a scaled
+// esp_jpg_decode() to RGB888, re-encoded with fmt2jpg_cb() straight into a
+// broker slot. Work follows demand: a source frame is scaled only for the
+// levels that have a reader blocked in waitNewer() at that moment, and when
+// both do, one 1/2 decode feeds both, the 1/4 frame boxed down from it.
+// With no substream clients the task only wakes up per frame to check, and
+// paced clients cost no more than the frames they take. The RGB frames
+// (1/2 and 1/4 of the source, 3 bytes a pixel) are allocated once, on
+// first use. Scaled frames keep the source's timestamp and motion info.
+bool startSubstreamTask(CameraPipeline *pipeline,
+                        const SubstreamTaskConfig &config);
+
+// Scale a `?res=` name asks for: 0 for the full frame, 1 or 2 for the 1/2
+// or 1/4 substream. Takes full, half, quarter or a frame size name; a
+// frame size picks the smallest stream that is still at least that wide,
+// so `res=vga` is the 1/2 substream of a UXGA sensor and the full frame
+// of a VGA one. The size comes from the latest frame, waiting up to
+// `wait_ms` for the first one. -1 for an unknown name.
+int substreamScale(CameraPipeline *pipeline, const char *name,
+                   uint32_t wait_ms);
+
+}  // namespace camcore
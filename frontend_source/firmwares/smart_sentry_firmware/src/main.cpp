@@ -4,6 +4,13 @@
 #include <esp_camera.h>
 #include <esp_http_server.h>
 
+#include <capture_task.h>
+#include <camera_pipeline.h>
+#include <http_handlers.h>
+#include <rtsp_server.h>
+#include <sim7600.h>
+#include <substream_task.h>
+
 // Pin definitions for ESP32S3-CAM (Typical Freenove/AI-Thinker S3)
 #define PWDN_GPIO_NUM -1
 #define RESET_GPIO_NUM -1
@@ -34,81 +41,54 @@ TaskHandle_t modemTaskHandle = NULL;
 // Global Server handle
 httpd_handle_t stream_httpd = NULL;
 
-// --- MJPEG STREAMS HANDLER ---
-#define PART_BOUNDARY "123456789000000000000987654321"
-static const char *_STREAM_CONTENT_TYPE =
-    "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char *_STREAM_PART =
-    "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
-
-esp_err_t stream_handler(httpd_req_t *req) {
-  camera_fb_t *fb = NULL;
-  esp_err_t res = ESP_OK;
-  size_t _jpg_buf_len = 0;
-  uint8_t *_jpg_buf = NULL;
-  char *part_buf[64];
-
-  res = httpd_req_set_type(req, _STREAM_CONTENT_TYPE);
-  if (res != ESP_OK)
-    return res;
+// Fed by the capture task, read by /stream and /capture
+camcore::CameraPipeline cameraPipeline;
 
-  while (true) {
-    fb = esp_camera_fb_get();
-    if (!fb) {
-      Serial.println("Camera capture failed");
-      res = ESP_FAIL;
-    } else {
-      if (fb->format != PIXFORMAT_JPEG) {
-        bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-        esp_camera_fb_return(fb);
-        fb = NULL;
-        if (!jpeg_converted) {
-          Serial.println("JPEG compression failed");
-          res = ESP_FAIL;
-        }
-      } else {
-        _jpg_buf_len = fb->len;
-        _jpg_buf = fb->buf;
-      }
-    }
-    if (res == ESP_OK) {
-      size_t hlen = snprintf((char *)part_buf, 64, _STREAM_PART, _jpg_buf_len);
-      res = httpd_req_send_chunk(req, (const char *)part_buf, hlen);
-    }
-    if (res == ESP_OK) {
-      res = httpd_req_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
-    }
-    if (res == ESP_OK) {
-      res =
-          httpd_req_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-    }
-    if (fb) {
-      esp_camera_fb_return(fb);
-      fb = NULL;
-      _jpg_buf = NULL;
-    } else if (_jpg_buf) {
-      free(_jpg_buf);
-      _jpg_buf = NULL;
-    }
-    if (res != ESP_OK)
-      break;
-    vTaskDelay(1); // Small delay to prevent watchdog
-  }
-  return res;
-}
+// SIM7600 on UART2, driven by ModemTask
+camcore::Sim7600 modem;
+
+// Time to handle each batch of modem UART events, exported on /metrics
+camcore::LatencyHistogram modemEventLatency;
+
+// Frame sizes the quality controller may fall back to under congestion
+static const int adaptiveFrameSizes[] = {FRAMESIZE_VGA, FRAMESIZE_QVGA};
 
 void startCameraServer() {
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   config.server_port = 81; // Stream on 81
+  config.lru_purge_enable = true;
 
   httpd_uri_t stream_uri = {.uri = "/stream",
                             .method = HTTP_GET,
-                            .handler = stream_handler,
-                            .user_ctx = NULL};
+                            .handler = camcore::streamHandler,
+                            .user_ctx = &cameraPipeline};
+
+  httpd_uri_t capture_uri = {.uri = "/capture",
+                             .method = HTTP_GET,
+                             .handler = camcore::captureHandler,
+                             .user_ctx = &cameraPipeline};
+
+  httpd_uri_t events_uri = {.uri = "/events",
+                            .method = HTTP_GET,
+                            .handler = camcore::eventsHandler,
+                            .user_ctx = &cameraPipeline};
+
+  httpd_uri_t clip_uri = {.uri = "/clip",
+                          .method = HTTP_GET,
+                          .handler = camcore::clipHandler,
+                          .user_ctx = &cameraPipeline};
+
+  httpd_uri_t metrics_uri = {.uri = "/metrics",
+                             .method = HTTP_GET,
+                             .handler = camcore::metricsHandler,
+                             .user_ctx = &cameraPipeline};
 
   if (httpd_start(&stream_httpd, &config) == ESP_OK) {
     httpd_register_uri_handler(stream_httpd, &stream_uri);
+    httpd_register_uri_handler(stream_httpd, &capture_uri);
+    httpd_register_uri_handler(stream_httpd, &events_uri);
+    httpd_register_uri_handler(stream_httpd, &clip_uri);
+    httpd_register_uri_handler(stream_httpd, &metrics_uri);
   }
 }
 
@@ -137,14 +117,23 @@ void StreamTask(void *pvParameters) {
   config.xclk_freq_hz = 20000000;
   config.pixel_format = PIXFORMAT_JPEG;
 
+  camcore::FrameBroker::Config brokerConfig;
+  camcore::QualityController::Config qualityConfig;
   if (psramFound()) {
     config.frame_size = FRAMESIZE_VGA;
     config.jpeg_quality = 12;
     config.fb_count = 2;
+    config.fb_location = CAMERA_FB_IN_PSRAM;
+    config.grab_mode = CAMERA_GRAB_LATEST;
+    qualityConfig.frame_sizes = adaptiveFrameSizes;
+    qualityConfig.frame_size_count = 2;
   } else {
     config.frame_size = FRAMESIZE_SVGA;
     config.jpeg_quality = 12;
     config.fb_count = 1;
+    brokerConfig.slot_count = 3;
+    brokerConfig.slot_capacity =
+        camcore::jpegSlotCapacity(config.frame_size, config.jpeg_quality);
   }
 
   esp_err_t err = esp_camera_init(&config);
@@ -153,7 +142,35 @@ void StreamTask(void *pvParameters) {
     vTaskDelete(NULL);
   }
 
+  qualityConfig.best_quality = config.jpeg_quality;
+  cameraPipeline.quality.begin(qualityConfig, config.frame_size);
+  cameraPipeline.motion.begin(camcore::MotionDetector::Config());
+  if (psramFound()) {
+    // Pre-event footage for /clip; the S3 module has PSRAM to spare
+    camcore::FrameArena::Config recorderConfig;
+    recorderConfig.bytes = 4 * 1024 * 1024;
+    recorderConfig.max_frames = 1024;
+    if (!cameraPipeline.recorder.begin(recorderConfig))
+      Serial.println("Recorder disabled: PSRAM allocation failed");
+  }
+
+  camcore::CaptureTaskConfig captureConfig;
+  captureConfig.core = 1;
+  if (!cameraPipeline.broker.begin(brokerConfig) ||
+      !camcore::startCaptureTask(&cameraPipeline, captureConfig)) {
+    Serial.println("Frame broker init failed");
+    vTaskDelete(NULL);
+  }
+  // 1/2 and 1/4 scale copies for /stream?res= and /capture?res=
+  if (psramFound() &&
+      !camcore::startSubstreamTask(&cameraPipeline,
+                                   camcore::SubstreamTaskConfig()))
+    Serial.println("Substreams disabled: allocation failed");
+
   startCameraServer();
+  // rtsp://<ip>/stream, RTP/JPEG for NVRs that take RTSP only
+  if (!camcore::startRtspServer(&cameraPipeline, camcore::RtspServerConfig()))
+    Serial.println("RTSP server failed to start");
 
   while (true) {
     vTaskDelay(1000 / portTICK_PERIOD_MS);
@@ -161,40 +178,53 @@ void StreamTask(void *pvParameters) {
 }
 
 // --- TASK B: CORE 0 - MODEM & SMS ---
+// millis() at which the PC reset line is released, 0 = not held
+static unsigned long resetReleaseAt = 0;
+
+// Runs on ModemTask as soon as the message's last byte arrives (+CMT).
+static void onSms(void *ctx, const camcore::SmsMessage &sms) {
+  Serial.printf("SMS from %s: %s\n", sms.sender, sms.text);
+  if (strstr(sms.text, "REBOOT_SYSTEM") && resetReleaseAt == 0) {
+    Serial.println("SMS Command REBOOT_SYSTEM identified!");
+    digitalWrite(PC_RESET_PIN, LOW);
+    resetReleaseAt = millis() + 1000;
+  }
+}
+
+static void onAlertSent(void *ctx, camcore::AtResult result,
+                        const char *response) {
+  Serial.printf("WiFi alert SMS %s\n",
+                result == camcore::AtResult::kOk ? "sent" : "failed");
+}
+
 void ModemTask(void *pvParameters) {
   Serial.println("Starting ModemTask on Core 0");
-  HardwareSerial SerialModem(2);
-  SerialModem.begin(115200, SERIAL_8N1, MODEM_RX, MODEM_TX);
 
   pinMode(PC_RESET_PIN, OUTPUT);
   digitalWrite(PC_RESET_PIN, HIGH); // Assuming active-low reset
 
-  // Basic Modem Init
-  SerialModem.println("AT");
-  vTaskDelay(500 / portTICK_PERIOD_MS);
-  SerialModem.println("AT+CMGF=1"); // SMS Text mode
-  vTaskDelay(500 / portTICK_PERIOD_MS);
-  SerialModem.println("AT+CNMI=2,1,0,0,0"); // Notify on SMS arrival
+  camcore::Sim7600::Config modemConfig;
+  modemConfig.at.port = UART_NUM_2;
+  modemConfig.at.tx_pin = MODEM_TX;
+  modemConfig.at.rx_pin = MODEM_RX;
+  modemConfig.at.work_time = &modemEventLatency;
+  if (!modem.begin(modemConfig, onSms, nullptr)) {
+    Serial.println("Modem UART init failed");
+    vTaskDelete(NULL);
+  }
 
   unsigned long lastWifiCheck = millis();
   bool wifiAlerSent = false;
 
   while (true) {
-    // Handle incoming data/SMS
-    if (SerialModem.available()) {
-      String line = SerialModem.readStringUntil('\n');
-      if (line.indexOf("+CMTI:") != -1) {
-        // New SMS arrived
-        Serial.println("New SMS notification received");
-        SerialModem.println("AT+CMGL=\"REC UNREAD\"");
-      }
-      if (line.indexOf("REBOOT_SYSTEM") != -1) {
-        Serial.println("SMS Command REBOOT_SYSTEM identified!");
-        digitalWrite(PC_RESET_PIN, LOW);
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
-        digitalWrite(PC_RESET_PIN, HIGH);
-        Serial.println("PC Reset triggered.");
-      }
+    // Sleeps on the UART event queue: returns as soon as the modem sends
+    // something, or after at most 250 ms for the housekeeping below.
+    modem.process(pdMS_TO_TICKS(250));
+
+    if (resetReleaseAt != 0 && (long)(millis() - resetReleaseAt) >= 0) {
+      digitalWrite(PC_RESET_PIN, HIGH);
+      resetReleaseAt = 0;
+      Serial.println("PC Reset triggered.");
     }
 
     // WiFi Heartbeat / Alert Logic
@@ -202,18 +232,15 @@ void ModemTask(void *pvParameters) {
       lastWifiCheck = millis();
       wifiAlerSent = false;
     } else {
-      if (millis() - lastWifiCheck > (5 * 60 * 1000) && !wifiAlerSent) {
+      if (millis() - lastWifiCheck > (5 * 60 * 1000) && !wifiAlerSent &&
+          modem.ready()) {
         Serial.println("WiFi lost for >5 mins. Sending SMS alert...");
-        SerialModem.println(
-            "AT+CMGS=\"+YOUR_PHONE_NUMBER\""); // Replace with real number
-        vTaskDelay(500 / portTICK_PERIOD_MS);
-        SerialModem.print("WIFI CONNECTION LOST - SMART SENTRY");
-        SerialModem.write(26); // CTRL+Z
-        wifiAlerSent = true;
+        // Replace with real number
+        wifiAlerSent = modem.sendSms("+YOUR_PHONE_NUMBER",
+                                     "WIFI CONNECTION LOST - SMART SENTRY",
+                                     onAlertSent, nullptr);
       }
     }
-
-    vTaskDelay(2000 / portTICK_PERIOD_MS); // Polling interval
   }
 }
 
@@ -230,6 +257,10 @@ void setup() {
   Serial.println("\nWiFi connected.");
   Serial.println(WiFi.localIP());
 
+  cameraPipeline.metrics.addHistogram(
+      "camcore_modem_event_seconds",
+      "Time to handle one batch of modem UART events.", &modemEventLatency);
+
   // Create FreeRTOS Tasks
   xTaskCreatePinnedToCore(StreamTask, "StreamTask", 8192, NULL,
                           2, // High priority
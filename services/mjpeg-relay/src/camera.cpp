@@ -0,0 +1,311 @@
+#include "camera.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace relay {
+
+static const size_t kReadBufSize = 64 * 1024;
+static const int64_t kRetryMinUs = 500000;
+static const int64_t kRetryMaxUs = 10000000;
+static const int64_t kStallCheckUs = 1000000;
+
+Camera::Camera(EventLoop *loop, FramePool *pool, const Config &config)
+    : loop_(loop), pool_(pool), config_(config), parser_(this),
+      read_buf_(new uint8_t[kReadBufSize]), retry_us_(kRetryMinUs),
+      retry_timer_([this] { retry(); }),
+      stall_timer_([this] { checkStall(); }) {}
+
+Camera::~Camera() {
+  loop_->cancel(&retry_timer_);
+  loop_->cancel(&stall_timer_);
+  if (fd_ >= 0) {
+    loop_->remove(fd_);
+    close(fd_);
+  }
+}
+
+bool Camera::begin() {
+  const std::string &url = config_.url;
+  if (url.compare(0, 7, "http://") != 0) {
+    fprintf(stderr, "camera %s: only http:// URLs are supported\n",
+            name().c_str());
+    return false;
+  }
+  size_t host_start = 7;
+  size_t path_start = url.find('/', host_start);
+  std::string authority = url.substr(host_start, path_start - host_start);
+  std::string path = path_start == std::string::npos ? "/"
+                                                      : url.substr(path_start);
+  size_t colon = authority.rfind(':');
+  if (colon != std::string::npos && authority.find(']') == std::string::npos) {
+    host_ = authority.substr(0, colon);
+    port_ = authority.substr(colon + 1);
+  } else {
+    host_ = authority;
+    port_ = "80";
+  }
+  if (host_.size() > 2 && host_.front() == '[' && host_.back() == ']')
+    host_ = host_.substr(1, host_.size() - 2);
+  if (host_.empty() || port_.empty()) {
+    fprintf(stderr, "camera %s: bad URL %s\n", name().c_str(), url.c_str());
+    return false;
+  }
+  request_ = "GET " + path + " HTTP/1.1\r\nHost: " + authority +
+             "\r\nUser-Agent: mjpeg-relay\r\nConnection: close\r\n\r\n";
+  if (config_.idle_timeout_us == 0)
+    connect();
+  return true;
+}
+
+void Camera::use() {
+  last_use_us_ = nowUs();
+  if (state_ == State::kIdle && !retry_timer_.armed())
+    connect();
+}
+
+bool Camera::wanted(int64_t now) const {
+  return config_.idle_timeout_us == 0 || subscribers() > 0 ||
+         now - last_use_us_ < config_.idle_timeout_us;
+}
+
+void Camera::retry() {
+  if (wanted(nowUs()))
+    connect();
+  else
+    retry_us_ = kRetryMinUs;
+}
+
+void Camera::connect() {
+  addrinfo hints = {}, *res = nullptr;
+  hints.ai_socktype = SOCK_STREAM;
+  // Blocking lookup; cameras are normally configured by address.
+  int err = getaddrinfo(host_.c_str(), port_.c_str(), &hints, &res);
+  if (err != 0) {
+    fprintf(stderr, "camera %s: %s: %s\n", name().c_str(), host_.c_str(),
+            gai_strerror(err));
+    disconnect(nullptr);
+    return;
+  }
+  fd_ = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd_ >= 0 && ::connect(fd_, res->ai_addr, res->ai_addrlen) != 0 &&
+      errno != EINPROGRESS) {
+    close(fd_);
+    fd_ = -1;
+  }
+  freeaddrinfo(res);
+  if (fd_ < 0 || !loop_->add(fd_, EPOLLOUT, this)) {
+    disconnect(strerror(errno));
+    return;
+  }
+  int one = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  state_ = State::kConnecting;
+  parser_.reset();
+  last_data_us_ = nowUs();
+  loop_->arm(&stall_timer_, kStallCheckUs);
+}
+
+// Drops the connection and schedules the next attempt. `why` is logged
+// unless null (already reported).
+void Camera::disconnect(const char *why) {
+  if (why)
+    fprintf(stderr, "camera %s: %s, retrying in %.1f s\n", name().c_str(),
+            why, retry_us_ / 1e6);
+  if (fd_ >= 0) {
+    loop_->remove(fd_);
+    close(fd_);
+    fd_ = -1;
+  }
+  stats_.reconnects++;
+  state_ = State::kIdle;
+  stats_.connected = false;
+  assembling_.reset();
+  loop_->cancel(&stall_timer_);
+  loop_->arm(&retry_timer_, retry_us_);
+  retry_us_ = std::min(retry_us_ * 2, kRetryMaxUs);
+}
+
+// Closes an upstream nobody is using. The last frame goes too: a client
+// arriving later must not get it as the current one.
+void Camera::hangUp() {
+  fprintf(stderr, "camera %s: no clients, disconnecting\n", name().c_str());
+  loop_->remove(fd_);
+  close(fd_);
+  fd_ = -1;
+  state_ = State::kIdle;
+  stats_.connected = false;
+  assembling_.reset();
+  latest_.reset();
+  loop_->cancel(&stall_timer_);
+}
+
+void Camera::checkStall() {
+  int64_t now = nowUs();
+  if (!wanted(now)) {
+    hangUp();
+    return;
+  }
+  if (now - last_data_us_ > config_.stall_timeout_us) {
+    disconnect(state_ == State::kConnecting ? "connect timed out"
+                                            : "no data from upstream");
+    return;
+  }
+  loop_->arm(&stall_timer_, kStallCheckUs);
+}
+
+bool Camera::sendRequest() {
+  int err = 0;
+  socklen_t len = sizeof(err);
+  getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+  if (err != 0) {
+    disconnect(strerror(err));
+    return false;
+  }
+  // A fresh socket's send buffer always takes a request this small.
+  ssize_t n = send(fd_, request_.data(), request_.size(), MSG_NOSIGNAL);
+  if (n != (ssize_t)request_.size()) {
+    disconnect("request not sent");
+    return false;
+  }
+  loop_->modify(fd_, EPOLLIN | EPOLLRDHUP, this);
+  state_ = State::kStreaming;
+  stats_.connected = true;
+  fprintf(stderr, "camera %s: connected to %s\n", name().c_str(),
+          config_.url.c_str());
+  return true;
+}
+
+void Camera::onEvent(uint32_t events) {
+  if (fd_ < 0)
+    return;
+  if (state_ == State::kConnecting) {
+    if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+      sendRequest();
+    return;
+  }
+  readAll();
+}
+
+void Camera::readAll() {
+  while (fd_ >= 0) {
+    ssize_t n = recv(fd_, read_buf_.get(), kReadBufSize, 0);
+    if (n > 0) {
+      last_data_us_ = nowUs();
+      stats_.bytes += n;
+      if (!parser_.feed(read_buf_.get(), n)) {
+        disconnect(parser_.error());
+        return;
+      }
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      return;
+    disconnect(n == 0 ? "upstream closed the connection" : strerror(errno));
+    return;
+  }
+}
+
+void Camera::onPartBegin() {
+  assembling_ = pool_->acquire();
+  discard_ = false;
+}
+
+void Camera::onPartHeader(const char *name, const char *value) {
+  Frame *frame = assembling_.get();
+  if (!frame)
+    return;
+  if (strcasecmp(name, "X-Timestamp") == 0)
+    snprintf(frame->timestamp, sizeof(frame->timestamp), "%s", value);
+  else if (strcasecmp(name, "X-Motion") == 0)
+    snprintf(frame->motion, sizeof(frame->motion), "%s", value);
+  else if (strcasecmp(name, "X-Motion-Active") == 0)
+    frame->motion_active = atoi(value) ? 1 : 0;
+}
+
+void Camera::onPartBody(size_t length) {
+  if (!assembling_)
+    return;
+  if (length > config_.max_frame_bytes || !assembling_->reserve(length))
+    discard_ = true;
+}
+
+void Camera::onPartData(const uint8_t *data, size_t len) {
+  Frame *frame = assembling_.get();
+  if (!frame || discard_)
+    return;
+  if (frame->size() + len > config_.max_frame_bytes) {
+    discard_ = true;
+    return;
+  }
+  frame->append(data, len);
+}
+
+void Camera::onPartEnd() {
+  FrameRef frame = std::move(assembling_);
+  if (!frame || discard_)
+    return;
+  // Anything but a JPEG (an error page in the middle of a stream, ...)
+  // is not passed on.
+  if (frame->size() < 4 || frame->data()[0] != 0xFF ||
+      frame->data()[1] != 0xD8)
+    return;
+  frame->seq = ++seq_;
+  frame->received_us = nowUs();
+  frame->buildPartHeader();
+  stats_.frames++;
+  retry_us_ = kRetryMinUs;
+  publish(std::move(frame));
+}
+
+void Camera::publish(FrameRef frame) {
+  latest_ = std::move(frame);
+  notifying_ = true;
+  // Index loop: subscribers may be added or removed (set to null) on the
+  // way; new ones are skipped as they were not waiting for this frame.
+  size_t count = subscribers_.size();
+  for (size_t i = 0; i < count; i++)
+    if (subscribers_[i])
+      subscribers_[i]->onFrame(latest_);
+  notifying_ = false;
+  subscribers_.erase(
+      std::remove(subscribers_.begin(), subscribers_.end(), nullptr),
+      subscribers_.end());
+}
+
+void Camera::subscribe(Subscriber *subscriber) {
+  subscribers_.push_back(subscriber);
+  use();
+}
+
+void Camera::unsubscribe(Subscriber *subscriber) {
+  auto it = std::find(subscribers_.begin(), subscribers_.end(), subscriber);
+  if (it == subscribers_.end())
+    return;
+  last_use_us_ = nowUs();  // the idle timeout runs from the last one leaving
+  if (notifying_)
+    *it = nullptr;
+  else
+    subscribers_.erase(it);
+}
+
+size_t Camera::subscribers() const {
+  return subscribers_.size() -
+         std::count(subscribers_.begin(), subscribers_.end(), nullptr);
+}
+
+}  // namespace relay
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "event_loop.h"
+#include "frame_pool.h"
+#include "mjpeg_parser.h"
+
+namespace relay {
+
+struct CameraStats {
+  bool connected = false;
+  uint64_t frames = 0;       // complete frames received
+  uint64_t bytes = 0;        // bytes received, framing included
+  uint64_t reconnects = 0;   // connections lost or refused
+  uint64_t frames_sent = 0;  // frames handed to clients, all of them
+  uint64_t frames_dropped = 0;  // replaced before a slow client took them
+};
+
+// One upstream camera: a single HTTP connection to its MJPEG stream, the
+// latest complete frame, and the clients waiting for the next one.
+// Reconnects with backoff when the connection fails, ends or goes quiet.
+// The connection is opened when the first client asks for a frame and
+// closed once nobody has for idle_timeout_us, so the camera only streams
+// while someone is watching.
+class Camera : public EventLoop::Handler, private MjpegParser::Listener {
+public:
+  class Subscriber {
+  public:
+    virtual ~Subscriber() {}
+    virtual void onFrame(const FrameRef &frame) = 0;
+  };
+
+  struct Config {
+    std::string name;
+    std::string url;  // http://host[:port]/path[?query]
+    int64_t stall_timeout_us = 5000000;
+    // 0 keeps the upstream connected from begin() on.
+    int64_t idle_timeout_us = 10000000;
+    size_t max_frame_bytes = 8 * 1024 * 1024;
+  };
+
+  Camera(EventLoop *loop, FramePool *pool, const Config &config);
+  ~Camera();
+
+  // Parses the URL, and connects unless that waits for the first client.
+  // False if the URL is unusable.
+  bool begin();
+
+  // A client wants frames: connects if idle and restarts the idle timeout.
+  // latest() is empty until the first frame arrives.
+  void use();
+
+  const std::string &name() const { return config_.name; }
+  const FrameRef &latest() const { return latest_; }
+  CameraStats &stats() { return stats_; }
+
+  // Subscribers get every frame from now on, in the loop thread, and keep
+  // the upstream connected. They may unsubscribe (themselves or others)
+  // from inside onFrame().
+  void subscribe(Subscriber *subscriber);
+  void unsubscribe(Subscriber *subscriber);
+  size_t subscribers() const;
+
+  void onEvent(uint32_t events) override;
+
+private:
+  enum class State { kIdle, kConnecting, kStreaming };
+
+  void connect();
+  void disconnect(const char *why);
+  void hangUp();
+  bool wanted(int64_t now) const;
+  void retry();
+  void checkStall();
+  bool sendRequest();
+  void readAll();
+  void publish(FrameRef frame);
+
+  void onPartBegin() override;
+  void onPartHeader(const char *name, const char *value) override;
+  void onPartBody(size_t length) override;
+  void onPartData(const uint8_t *data, size_t len) override;
+  void onPartEnd() override;
+
+  EventLoop *loop_;
+  FramePool *pool_;
+  Config config_;
+  std::string host_, port_, request_;
+
+  State state_ = State::kIdle;
+  int fd_ = -1;
+  MjpegParser parser_;
+  std::unique_ptr<uint8_t[]> read_buf_;
+  int64_t last_data_us_ = 0;
+  int64_t last_use_us_ = 0;
+  int64_t retry_us_;
+  EventLoop::Timer retry_timer_;
+  EventLoop::Timer stall_timer_;
+
+  FrameRef assembling_;
+  bool discard_ = false;  // oversized part, skipped until the next one
+  FrameRef latest_;
+  uint64_t seq_ = 0;
+  std::vector<Subscriber *> subscribers_;
+  bool notifying_ = false;
+  CameraStats stats_;
+};
+
+}  // namespace relay
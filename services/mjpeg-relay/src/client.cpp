@@ -0,0 +1,442 @@
+#include "client.h"
+
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "relay.h"
+
+namespace relay {
+
+static const int64_t kLongPollUs = 10000000;
+// Long enough to connect to an idle upstream and get its first frame.
+static const int64_t kFirstFrameWaitUs = 5000000;
+
+static const char kStreamHeadFmt[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: multipart/x-mixed-replace;boundary=%s\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Cache-Control: no-cache, no-store\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+// Copies the value of `key` from a query string ("a=1&b=2").
+static bool queryValue(const char *query, const char *key, char *out,
+                       size_t cap) {
+  size_t key_len = strlen(key);
+  for (const char *p = query; p && *p;) {
+    const char *end = strchr(p, '&');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+    if (len > key_len && strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+      size_t n = len - key_len - 1;
+      if (n >= cap)
+        n = cap - 1;
+      memcpy(out, p + key_len + 1, n);
+      out[n] = '\0';
+      return true;
+    }
+    p = end ? end + 1 : nullptr;
+  }
+  return false;
+}
+
+Client::Client(Relay *relay, int fd, const char *peer)
+    : relay_(relay), fd_(fd), peer_(peer), pacer_(0),
+      wait_timer_([this] { captureTimedOut(); }) {
+  if_none_match_[0] = '\0';
+  head_.reserve(512);
+}
+
+Client::~Client() { close(); }
+
+bool Client::begin() {
+  return relay_->loop()->add(fd_, EPOLLIN | EPOLLRDHUP, this);
+}
+
+void Client::close() {
+  if (fd_ < 0)
+    return;
+  if (camera_)
+    camera_->unsubscribe(this);
+  camera_ = nullptr;
+  relay_->loop()->cancel(&wait_timer_);
+  relay_->loop()->remove(fd_);
+  ::close(fd_);
+  fd_ = -1;
+  sending_.reset();
+  pending_.reset();
+}
+
+bool Client::stalled(int64_t now_us, int64_t timeout_us) const {
+  return want_write_ && now_us - last_progress_us_ > timeout_us;
+}
+
+void Client::onEvent(uint32_t events) {
+  if (closed())
+    return;
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    relay_->closeClient(this);
+    return;
+  }
+  if (events & EPOLLOUT)
+    flush();
+  if (!closed() && (events & (EPOLLIN | EPOLLRDHUP)))
+    readInput();
+}
+
+void Client::readInput() {
+  while (true) {
+    if (in_len_ == sizeof(in_)) {
+      if (state_ != State::kStream) {
+        keep_alive_ = false;
+        sendSimple("431 Request Header Fields Too Large", "text/plain",
+                   "Request too large\n", false);
+        return;
+      }
+      in_len_ = 0;  // a stream client has nothing more to say
+    }
+    ssize_t n = recv(fd_, in_ + in_len_, sizeof(in_) - in_len_, 0);
+    if (n > 0) {
+      in_len_ += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      break;
+    relay_->closeClient(this);
+    return;
+  }
+  if (state_ == State::kRequest)
+    handleRequest();
+}
+
+void Client::handleRequest() {
+  char *end = static_cast<char *>(memmem(in_, in_len_, "\r\n\r\n", 4));
+  if (!end)
+    return;
+  *end = '\0';
+  size_t request_len = end + 4 - in_;
+
+  // Request line: METHOD SP target SP version
+  char *line_end = strstr(in_, "\r\n");
+  if (line_end)
+    *line_end = '\0';
+  char method[8] = "", target[512] = "", version[16] = "";
+  sscanf(in_, "%7s %511s %15s", method, target, version);
+  keep_alive_ = strcmp(version, "HTTP/1.1") == 0;
+  if_none_match_[0] = '\0';
+  for (char *h = line_end ? line_end + 2 : end; h < end;) {
+    char *next = strstr(h, "\r\n");
+    if (next)
+      *next = '\0';
+    char *colon = strchr(h, ':');
+    if (colon) {
+      *colon = '\0';
+      const char *value = colon + 1;
+      while (*value == ' ')
+        value++;
+      if (strcasecmp(h, "Connection") == 0)
+        keep_alive_ = strcasecmp(value, "close") != 0 &&
+                      (keep_alive_ || strcasecmp(value, "keep-alive") == 0);
+      else if (strcasecmp(h, "If-None-Match") == 0)
+        snprintf(if_none_match_, sizeof(if_none_match_), "%s", value);
+    }
+    h = next ? next + 2 : end;
+  }
+  in_len_ -= request_len;
+  memmove(in_, in_ + request_len, in_len_);
+
+  if (strcmp(method, "GET") != 0) {
+    sendSimple("405 Method Not Allowed", "text/plain", "GET only\n",
+               keep_alive_);
+    return;
+  }
+  char *query = strchr(target, '?');
+  if (query)
+    *query++ = '\0';
+
+  if (strcmp(target, "/metrics") == 0) {
+    std::string metrics;
+    relay_->formatMetrics(&metrics);
+    sendSimple("200 OK", "text/plain; version=0.0.4", metrics, keep_alive_);
+    return;
+  }
+
+  // "/<camera>/<endpoint>" or "/<endpoint>" for the first camera.
+  const char *endpoint = target + 1;
+  std::string name;
+  if (const char *slash = strchr(endpoint, '/')) {
+    name.assign(endpoint, slash - endpoint);
+    endpoint = slash + 1;
+  }
+  Camera *camera = relay_->camera(name);
+  bool stream = strcmp(endpoint, "stream") == 0;
+  bool capture =
+      strcmp(endpoint, "capture") == 0 || strcmp(endpoint, "snapshot") == 0;
+  if (!camera || (!stream && !capture)) {
+    sendSimple("404 Not Found", "text/plain",
+               camera ? "Not found\n" : "Unknown camera\n", keep_alive_);
+    return;
+  }
+  if (stream)
+    startStream(camera, query);
+  else
+    startCapture(camera, query);
+}
+
+void Client::startStream(Camera *camera, const char *query) {
+  char param[16];
+  float fps = 0, idle_fps = 0;
+  if (queryValue(query, "fps", param, sizeof(param)))
+    fps = strtof(param, nullptr);
+  if (queryValue(query, "idle_fps", param, sizeof(param)))
+    idle_fps = strtof(param, nullptr);
+  pacer_ = camcore::StreamPacer(fps, idle_fps);
+
+  state_ = State::kStream;
+  keep_alive_ = false;
+  camera_ = camera;
+  camera_->subscribe(this);
+  char head[256];
+  int n = snprintf(head, sizeof(head), kStreamHeadFmt, kPartBoundary);
+  head_.assign(head, n);
+  flush();
+  // Start with the latest frame, as the firmware does.
+  if (!closed() && camera_->latest())
+    onFrame(camera_->latest());
+}
+
+void Client::startCapture(Camera *camera, const char *query) {
+  char param[24];
+  bool long_poll = queryValue(query, "after", param, sizeof(param));
+  uint64_t after = long_poll ? strtoull(param, nullptr, 10) : 0;
+  camera_ = camera;
+  camera->use();
+  const FrameRef &latest = camera->latest();
+
+  if (latest && long_poll && latest->seq != after) {
+    // Newer than the client's frame, or the ETag is from before a relay
+    // restart: either way the latest frame is the answer.
+    sendCapture(latest);
+    return;
+  }
+  if (latest && !long_poll) {
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%llu\"", (unsigned long long)latest->seq);
+    if (strcmp(if_none_match_, etag) == 0)
+      sendNotModified(latest->seq);
+    else
+      sendCapture(latest);
+    return;
+  }
+
+  after_ = after;
+  state_ = State::kCaptureWait;
+  camera_->subscribe(this);
+  relay_->loop()->arm(&wait_timer_,
+                      long_poll ? kLongPollUs : kFirstFrameWaitUs);
+}
+
+void Client::captureTimedOut() {
+  if (state_ != State::kCaptureWait)
+    return;
+  camera_->unsubscribe(this);
+  if (camera_->latest())
+    sendNotModified(after_);  // long-poll: nothing newer than `after`
+  else
+    sendSimple("503 Service Unavailable", "text/plain",
+               "No frame from the camera yet\n", keep_alive_);
+}
+
+void Client::onFrame(const FrameRef &frame) {
+  if (state_ == State::kCaptureWait) {
+    // As in startCapture(): any frame but the client's own, so an `after`
+    // from before a relay restart does not wait for the count to catch up.
+    if (frame->seq == after_)
+      return;
+    camera_->unsubscribe(this);
+    relay_->loop()->cancel(&wait_timer_);
+    sendCapture(frame);
+    return;
+  }
+  if (state_ != State::kStream)
+    return;
+
+  int64_t now = nowUs();
+  if (pacer_.gated() && frame->motion_active >= 0)
+    pacer_.setIdle(frame->motion_active == 0, now);
+  if (pacer_.delayUs(now) > 0)
+    return;
+  pacer_.markSent(now);
+  queue(frame);
+}
+
+void Client::sendCapture(const FrameRef &frame) {
+  char head[512];
+  int n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: image/jpeg\r\n"
+                   "Content-Length: %zu\r\n"
+                   "ETag: \"%llu\"\r\n",
+                   frame->size(), (unsigned long long)frame->seq);
+  if (frame->timestamp[0])
+    n += snprintf(head + n, sizeof(head) - n, "X-Timestamp: %s\r\n",
+                  frame->timestamp);
+  if (frame->motion[0])
+    n += snprintf(head + n, sizeof(head) - n, "X-Motion: %s\r\n",
+                  frame->motion);
+  if (frame->motion_active >= 0)
+    n += snprintf(head + n, sizeof(head) - n, "X-Motion-Active: %d\r\n",
+                  frame->motion_active);
+  n += snprintf(head + n, sizeof(head) - n,
+                "Access-Control-Allow-Origin: *\r\n"
+                "Access-Control-Expose-Headers: ETag, X-Timestamp\r\n"
+                "Cache-Control: no-cache\r\n"
+                "%s\r\n",
+                keep_alive_ ? "" : "Connection: close\r\n");
+  state_ = State::kResponse;
+  head_.assign(head, n);
+  sending_ = frame;
+  send_part_header_ = false;
+  camera_->stats().frames_sent++;
+  flush();
+}
+
+void Client::sendNotModified(uint64_t seq) {
+  char head[256];
+  int n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 304 Not Modified\r\n"
+                   "ETag: \"%llu\"\r\n"
+                   "Access-Control-Allow-Origin: *\r\n"
+                   "Access-Control-Expose-Headers: ETag, X-Timestamp\r\n"
+                   "Cache-Control: no-cache\r\n"
+                   "%s\r\n",
+                   (unsigned long long)seq,
+                   keep_alive_ ? "" : "Connection: close\r\n");
+  state_ = State::kResponse;
+  head_.assign(head, n);
+  flush();
+}
+
+void Client::sendSimple(const char *status, const char *content_type,
+                        const std::string &body, bool keep_alive) {
+  char head[256];
+  int n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 %s\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Length: %zu\r\n"
+                   "%s\r\n",
+                   status, content_type, body.size(),
+                   keep_alive ? "" : "Connection: close\r\n");
+  keep_alive_ = keep_alive;
+  state_ = State::kResponse;
+  head_.assign(head, n);
+  body_ = body;
+  flush();
+}
+
+void Client::queue(const FrameRef &frame) {
+  if (sending_) {
+    if (pending_)
+      camera_->stats().frames_dropped++;
+    pending_ = frame;
+    return;
+  }
+  sending_ = frame;
+  send_part_header_ = true;
+  flush();
+}
+
+// Writes head_, the frame (or body_) with one writev() per round, picking
+// up where the socket last stopped.
+void Client::flush() {
+  if (!want_write_)
+    last_progress_us_ = nowUs();
+  while (!closed()) {
+    iovec iov[3];
+    int count = 0;
+    size_t skip = sent_;
+    auto add = [&](const void *data, size_t len) {
+      if (skip >= len) {
+        skip -= len;
+        return;
+      }
+      iov[count].iov_base = (char *)data + skip;
+      iov[count].iov_len = len - skip;
+      count++;
+      skip = 0;
+    };
+    add(head_.data(), head_.size());
+    if (sending_) {
+      if (send_part_header_)
+        add(sending_->partHeader(), sending_->partHeaderSize());
+      add(sending_->data(), sending_->size());
+    } else {
+      add(body_.data(), body_.size());
+    }
+
+    if (count == 0) {
+      bool frame_done = sending_ && state_ == State::kStream;
+      head_.clear();
+      body_.clear();
+      sending_.reset();
+      sent_ = 0;
+      if (frame_done) {
+        camera_->stats().frames_sent++;
+        if (pending_) {
+          sending_ = std::move(pending_);
+          send_part_header_ = true;
+          continue;
+        }
+      }
+      if (want_write_) {
+        relay_->loop()->modify(fd_, EPOLLIN | EPOLLRDHUP, this);
+        want_write_ = false;
+      }
+      if (state_ == State::kResponse)
+        responseDone();
+      return;
+    }
+
+    ssize_t n = writev(fd_, iov, count);
+    if (n > 0) {
+      sent_ += n;
+      last_progress_us_ = nowUs();
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN) {
+      if (!want_write_) {
+        relay_->loop()->modify(fd_, EPOLLIN | EPOLLOUT | EPOLLRDHUP, this);
+        want_write_ = true;
+      }
+      return;
+    }
+    relay_->closeClient(this);
+    return;
+  }
+}
+
+void Client::responseDone() {
+  if (!keep_alive_) {
+    relay_->closeClient(this);
+    return;
+  }
+  if (camera_)
+    camera_->unsubscribe(this);
+  camera_ = nullptr;
+  state_ = State::kRequest;
+  if (in_len_)
+    handleRequest();
+}
+
+}  // namespace relay
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "camera.h"
+#include "event_loop.h"
+#include "frame_pool.h"
+#include "stream_pacer.h"
+
+namespace relay {
+
+class Relay;
+
+// One downstream HTTP connection. It serves, with the camera firmware's
+// URL layout under an optional camera name prefix:
+//
+//   /<camera>/stream    MJPEG, honours ?fps= and ?idle_fps= as the firmware
+//   /<camera>/capture   latest frame; ?after=<seq> long-polls, ETag = seq
+//   /<camera>/snapshot  same as /capture
+//   /metrics            Prometheus counters
+//
+// A stream client holds at most two frames: the one being written and the
+// newest one after it. A slower client skips frames; nothing is queued.
+class Client : public EventLoop::Handler, public Camera::Subscriber {
+public:
+  Client(Relay *relay, int fd, const char *peer);
+  ~Client();
+
+  bool begin();
+  void close();
+  bool closed() const { return fd_ < 0; }
+  // No write progress for this long while output is pending.
+  bool stalled(int64_t now_us, int64_t timeout_us) const;
+
+  void onEvent(uint32_t events) override;
+  void onFrame(const FrameRef &frame) override;
+
+private:
+  enum class State { kRequest, kStream, kCaptureWait, kResponse };
+
+  void readInput();
+  void handleRequest();
+  void startStream(Camera *camera, const char *query);
+  void startCapture(Camera *camera, const char *query);
+  void sendCapture(const FrameRef &frame);
+  void sendNotModified(uint64_t seq);
+  void sendSimple(const char *status, const char *content_type,
+                  const std::string &body, bool keep_alive);
+  void captureTimedOut();
+
+  void queue(const FrameRef &frame);
+  void flush();
+  void responseDone();
+
+  Relay *relay_;
+  int fd_;
+  std::string peer_;
+  State state_ = State::kRequest;
+  bool keep_alive_ = true;
+
+  char in_[4096];
+  size_t in_len_ = 0;
+  char if_none_match_[32];
+
+  Camera *camera_ = nullptr;  // subscribed to while set
+  camcore::StreamPacer pacer_;
+  uint64_t after_ = 0;
+  EventLoop::Timer wait_timer_;
+
+  // Output: head_, then (for a stream part) the frame's part header, then
+  // body_ or the frame's JPEG. sent_ counts bytes of all of them.
+  std::string head_;
+  std::string body_;
+  FrameRef sending_;
+  bool send_part_header_ = false;
+  FrameRef pending_;  // newest stream frame behind sending_
+  size_t sent_ = 0;
+  bool want_write_ = false;
+  int64_t last_progress_us_ = 0;
+};
+
+}  // namespace relay
@@ -0,0 +1,98 @@
+#include "event_loop.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+
+namespace relay {
+
+static const int kMaxEvents = 64;
+static const int kMaxWaitMs = 1000;
+
+int64_t nowUs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+EventLoop::EventLoop() : epfd_(epoll_create1(EPOLL_CLOEXEC)) {
+  if (epfd_ < 0)
+    perror("epoll_create1");
+}
+
+EventLoop::~EventLoop() {
+  if (epfd_ >= 0)
+    close(epfd_);
+}
+
+bool EventLoop::add(int fd, uint32_t events, Handler *handler) {
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = handler;
+  return epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+bool EventLoop::modify(int fd, uint32_t events, Handler *handler) {
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = handler;
+  return epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void EventLoop::remove(int fd) { epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr); }
+
+void EventLoop::arm(Timer *timer, int64_t delay_us) {
+  cancel(timer);
+  timer->it_ = timers_.emplace(nowUs() + delay_us, timer);
+  timer->armed_ = true;
+}
+
+void EventLoop::cancel(Timer *timer) {
+  if (!timer->armed_)
+    return;
+  timers_.erase(timer->it_);
+  timer->armed_ = false;
+}
+
+void EventLoop::runTimers() {
+  int64_t now = nowUs();
+  while (!timers_.empty() && timers_.begin()->first <= now) {
+    Timer *timer = timers_.begin()->second;
+    timers_.erase(timers_.begin());
+    timer->armed_ = false;
+    timer->fn_();
+  }
+}
+
+void EventLoop::run(const volatile int *stop) {
+  epoll_event events[kMaxEvents];
+  while (!*stop) {
+    int wait_ms = kMaxWaitMs;
+    if (!timers_.empty()) {
+      int64_t due_ms = (timers_.begin()->first - nowUs() + 999) / 1000;
+      if (due_ms < wait_ms)
+        wait_ms = due_ms < 0 ? 0 : (int)due_ms;
+    }
+    int n = epoll_wait(epfd_, events, kMaxEvents, wait_ms);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      return;
+    }
+    for (int i = 0; i < n; i++)
+      static_cast<Handler *>(events[i].data.ptr)->onEvent(events[i].events);
+    runTimers();
+
+    // Deferred work may defer more (a close that releases a frame, ...).
+    while (!deferred_.empty()) {
+      std::vector<std::function<void()>> batch;
+      batch.swap(deferred_);
+      for (auto &fn : batch)
+        fn();
+    }
+  }
+}
+
+}  // namespace relay
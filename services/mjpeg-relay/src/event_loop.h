@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace relay {
+
+// Monotonic clock shared by the loop, timers and frame timestamps.
+int64_t nowUs();
+
+// Single-threaded epoll loop with one-shot timers. Everything in the relay
+// runs on it, so no state needs locking.
+class EventLoop {
+public:
+  class Handler {
+  public:
+    virtual ~Handler() {}
+    virtual void onEvent(uint32_t events) = 0;
+  };
+
+  class Timer {
+  public:
+    explicit Timer(std::function<void()> fn) : fn_(std::move(fn)) {}
+    bool armed() const { return armed_; }
+
+  private:
+    friend class EventLoop;
+    std::function<void()> fn_;
+    std::multimap<int64_t, Timer *>::iterator it_;
+    bool armed_ = false;
+  };
+
+  EventLoop();
+  ~EventLoop();
+
+  bool ok() const { return epfd_ >= 0; }
+
+  bool add(int fd, uint32_t events, Handler *handler);
+  bool modify(int fd, uint32_t events, Handler *handler);
+  void remove(int fd);
+
+  // (Re)arms `timer` to fire once after `delay_us`.
+  void arm(Timer *timer, int64_t delay_us);
+  void cancel(Timer *timer);
+
+  // Runs `fn` after the current batch of events, when no handler is on
+  // the stack; objects delete themselves this way.
+  void defer(std::function<void()> fn) { deferred_.push_back(std::move(fn)); }
+
+  // Returns when `*stop` becomes nonzero (checked at least once a second).
+  void run(const volatile int *stop);
+
+private:
+  void runTimers();
+
+  int epfd_ = -1;
+  std::multimap<int64_t, Timer *> timers_;
+  std::vector<std::function<void()>> deferred_;
+};
+
+}  // namespace relay
@@ -0,0 +1,116 @@
+#include "frame_pool.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace relay {
+
+bool Frame::reserve(size_t n) {
+  if (n <= capacity_)
+    return true;
+  size_t capacity = capacity_ ? capacity_ : 16 * 1024;
+  while (capacity < n)
+    capacity *= 2;
+  std::unique_ptr<uint8_t[]> data(new (std::nothrow) uint8_t[capacity]);
+  if (!data)
+    return false;
+  if (size_)
+    memcpy(data.get(), data_.get(), size_);
+  data_ = std::move(data);
+  capacity_ = capacity;
+  return true;
+}
+
+void Frame::append(const uint8_t *p, size_t n) {
+  if (!reserve(size_ + n))
+    return;
+  memcpy(data_.get() + size_, p, n);
+  size_ += n;
+}
+
+void Frame::clear() {
+  seq = 0;
+  received_us = 0;
+  timestamp[0] = '\0';
+  motion[0] = '\0';
+  motion_active = -1;
+  size_ = 0;
+  part_header_len_ = 0;
+}
+
+// Same layout as the firmware's /stream parts, so consumers cannot tell
+// the relay from a camera.
+void Frame::buildPartHeader() {
+  int n = snprintf(part_header_, sizeof(part_header_),
+                   "\r\n--%s\r\n"
+                   "Content-Type: image/jpeg\r\n"
+                   "Content-Length: %zu\r\n"
+                   "X-Frame-Seq: %llu\r\n",
+                   kPartBoundary, size_, (unsigned long long)seq);
+  if (timestamp[0])
+    n += snprintf(part_header_ + n, sizeof(part_header_) - n,
+                  "X-Timestamp: %s\r\n", timestamp);
+  if (motion[0])
+    n += snprintf(part_header_ + n, sizeof(part_header_) - n,
+                  "X-Motion: %s\r\n", motion);
+  if (motion_active >= 0)
+    n += snprintf(part_header_ + n, sizeof(part_header_) - n,
+                  "X-Motion-Active: %d\r\n", motion_active);
+  n += snprintf(part_header_ + n, sizeof(part_header_) - n, "\r\n");
+  part_header_len_ = (size_t)n < sizeof(part_header_)
+                         ? (size_t)n
+                         : sizeof(part_header_) - 1;
+}
+
+FrameRef::FrameRef(Frame *frame) : frame_(frame) {
+  if (frame_)
+    frame_->refs_++;
+}
+
+FrameRef &FrameRef::operator=(const FrameRef &other) {
+  if (other.frame_)
+    other.frame_->refs_++;
+  reset();
+  frame_ = other.frame_;
+  return *this;
+}
+
+FrameRef &FrameRef::operator=(FrameRef &&other) {
+  if (this != &other) {
+    reset();
+    frame_ = other.frame_;
+    other.frame_ = nullptr;
+  }
+  return *this;
+}
+
+void FrameRef::reset() {
+  if (frame_ && --frame_->refs_ == 0)
+    frame_->pool_->release(frame_);
+  frame_ = nullptr;
+}
+
+FrameRef FramePool::acquire() {
+  Frame *frame;
+  if (!free_.empty()) {
+    frame = free_.back();
+    free_.pop_back();
+  } else {
+    frames_.emplace_back(new Frame());
+    frame = frames_.back().get();
+    frame->pool_ = this;
+  }
+  frame->clear();
+  return FrameRef(frame);
+}
+
+void FramePool::release(Frame *frame) { free_.push_back(frame); }
+
+size_t FramePool::bytes() const {
+  size_t total = 0;
+  for (const auto &frame : frames_)
+    total += frame->capacity();
+  return total;
+}
+
+}  // namespace relay
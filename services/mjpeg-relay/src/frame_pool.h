@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace relay {
+
+// Multipart boundary of /stream, the same as the camera firmware's.
+constexpr char kPartBoundary[] = "123456789000000000000987654321";
+
+class FramePool;
+
+// One JPEG from upstream together with the multipart part header the relay
+// sends in front of it. Clients send straight out of it with writev(), so
+// a frame is stored once however many clients it goes to.
+class Frame {
+public:
+  uint64_t seq = 0;          // per camera, keeps counting across reconnects
+  int64_t received_us = 0;   // nowUs() when the last byte arrived
+  char timestamp[24] = "";   // upstream X-Timestamp, "" if none
+  char motion[8] = "";       // upstream X-Motion, "" if none
+  int motion_active = -1;    // upstream X-Motion-Active, -1 if none
+
+  const uint8_t *data() const { return data_.get(); }
+  uint8_t *data() { return data_.get(); }
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+
+  // Makes room for `n` bytes, keeping the first size() ones.
+  bool reserve(size_t n);
+  void append(const uint8_t *p, size_t n);
+  void clear();
+
+  // "\r\n--boundary\r\n" and the part headers, built once per frame.
+  const char *partHeader() const { return part_header_; }
+  size_t partHeaderSize() const { return part_header_len_; }
+  void buildPartHeader();
+
+private:
+  friend class FramePool;
+  friend class FrameRef;
+
+  std::unique_ptr<uint8_t[]> data_;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+  char part_header_[192];
+  size_t part_header_len_ = 0;
+  int refs_ = 0;
+  FramePool *pool_ = nullptr;
+};
+
+// Counted reference to a pooled Frame; the last one returns it to the pool.
+class FrameRef {
+public:
+  FrameRef() {}
+  explicit FrameRef(Frame *frame);
+  FrameRef(const FrameRef &other) : FrameRef(other.frame_) {}
+  FrameRef(FrameRef &&other) : frame_(other.frame_) { other.frame_ = nullptr; }
+  ~FrameRef() { reset(); }
+
+  FrameRef &operator=(const FrameRef &other);
+  FrameRef &operator=(FrameRef &&other);
+
+  void reset();
+  explicit operator bool() const { return frame_ != nullptr; }
+  Frame *operator->() const { return frame_; }
+  Frame *get() const { return frame_; }
+
+private:
+  Frame *frame_ = nullptr;
+};
+
+// Recycles frames and their buffers. Buffers only grow, so once every
+// frame in circulation has held a full-size JPEG nothing is allocated per
+// frame. The pool holds no more frames than were ever in use at once.
+class FramePool {
+public:
+  FrameRef acquire();
+
+  size_t frames() const { return frames_.size(); }
+  size_t inUse() const { return frames_.size() - free_.size(); }
+  size_t bytes() const;
+
+private:
+  friend class FrameRef;
+  void release(Frame *frame);
+
+  std::vector<std::unique_ptr<Frame>> frames_;
+  std::vector<Frame *> free_;
+};
+
+}  // namespace relay
@@ -0,0 +1,115 @@
+// mjpeg_relay: pulls each camera's MJPEG stream once and serves it to any
+// number of local clients. See README.md.
+
+#include <signal.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "event_loop.h"
+#include "relay.h"
+
+namespace {
+
+volatile int g_stop = 0;
+
+void onSignal(int) { g_stop = 1; }
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s --camera NAME=URL [--camera NAME=URL ...] [options]\n"
+          "  --camera NAME=URL   upstream MJPEG stream, e.g.\n"
+          "                      esp32_cam=http://192.168.1.100:81/stream\n"
+          "                      (the first one also answers /stream and "
+          "/capture)\n"
+          "  --listen HOST:PORT  address to serve on (0.0.0.0:8090)\n"
+          "  --max-clients N     concurrent client connections (256)\n"
+          "  --client-sndbuf B   client socket send buffer, 0 = kernel "
+          "default (0)\n"
+          "  --stall-timeout S   reconnect upstream after S s without data "
+          "(5)\n"
+          "  --upstream-idle S   disconnect upstream S s after the last client,"
+          " 0 = never (10)\n",
+          argv0);
+}
+
+bool validName(const std::string &name) {
+  if (name.empty() || name == "metrics")
+    return false;
+  for (char c : name)
+    if (!isalnum((unsigned char)c) && c != '_' && c != '-')
+      return false;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  relay::RelayConfig config;
+  int64_t stall_timeout_us = 5000000;
+  int64_t idle_timeout_us = 10000000;
+  for (int i = 1; i < argc; i++) {
+    const char *opt = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      usage(argv[0]);
+      return 2;
+    }
+    if (strcmp(opt, "--camera") == 0) {
+      const char *eq = strchr(value, '=');
+      relay::Camera::Config camera;
+      if (eq) {
+        camera.name.assign(value, eq - value);
+        camera.url = eq + 1;
+      }
+      if (!eq || !validName(camera.name)) {
+        fprintf(stderr, "--camera wants NAME=URL with NAME in [A-Za-z0-9_-]\n");
+        return 2;
+      }
+      config.cameras.push_back(camera);
+    } else if (strcmp(opt, "--listen") == 0) {
+      std::string listen = value;
+      size_t colon = listen.rfind(':');
+      if (colon == std::string::npos) {
+        usage(argv[0]);
+        return 2;
+      }
+      config.listen_host = listen.substr(0, colon);
+      config.listen_port = listen.substr(colon + 1);
+    } else if (strcmp(opt, "--max-clients") == 0) {
+      config.max_clients = strtoul(value, nullptr, 10);
+    } else if (strcmp(opt, "--client-sndbuf") == 0) {
+      config.client_sndbuf = atoi(value);
+    } else if (strcmp(opt, "--stall-timeout") == 0) {
+      stall_timeout_us = (int64_t)(atof(value) * 1e6);
+    } else if (strcmp(opt, "--upstream-idle") == 0) {
+      idle_timeout_us = (int64_t)(atof(value) * 1e6);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+  }
+  if (config.cameras.empty()) {
+    usage(argv[0]);
+    return 2;
+  }
+  for (relay::Camera::Config &camera : config.cameras) {
+    camera.stall_timeout_us = stall_timeout_us;
+    camera.idle_timeout_us = idle_timeout_us;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  relay::EventLoop loop;
+  relay::Relay server(&loop, config);
+  if (!loop.ok() || !server.begin())
+    return 1;
+  loop.run(&g_stop);
+  return 0;
+}
@@ -0,0 +1,281 @@
+#include "mjpeg_parser.h"
+
+#include <strings.h>
+
+#include <cstdlib>
+#include <cstring>
+
+namespace relay {
+
+namespace {
+
+// Splits "Name: value" in place; false if there is no colon.
+bool splitHeader(char *line, char **name, char **value) {
+  char *colon = strchr(line, ':');
+  if (!colon)
+    return false;
+  *colon = '\0';
+  char *v = colon + 1;
+  while (*v == ' ' || *v == '\t')
+    v++;
+  size_t len = strlen(v);
+  while (len && (v[len - 1] == ' ' || v[len - 1] == '\t'))
+    v[--len] = '\0';
+  *name = line;
+  *value = v;
+  return true;
+}
+
+}  // namespace
+
+void MjpegParser::reset() {
+  http_ = Http::kStatus;
+  chunk_ = Chunk::kSize;
+  part_ = Part::kBoundary;
+  chunked_ = false;
+  chunk_left_ = 0;
+  part_left_ = 0;
+  http_line_ = Line();
+  part_line_ = Line();
+  delimiter_len_ = 0;
+  matched_ = 0;
+  error_ = nullptr;
+}
+
+bool MjpegParser::fail(const char *error) {
+  error_ = error;
+  http_ = Http::kFailed;
+  return false;
+}
+
+bool MjpegParser::takeLine(Line *line, const uint8_t **p, const uint8_t *end) {
+  if (line->done)
+    *line = Line();
+  while (*p < end) {
+    char c = (char)*(*p)++;
+    if (c == '\n') {
+      if (line->len && line->text[line->len - 1] == '\r')
+        line->len--;
+      line->text[line->len] = '\0';
+      line->done = true;
+      return true;
+    }
+    if (line->len < sizeof(line->text) - 1)
+      line->text[line->len++] = c;
+    else
+      line->overflow = true;
+  }
+  return false;
+}
+
+bool MjpegParser::feed(const uint8_t *data, size_t len) {
+  const uint8_t *p = data;
+  const uint8_t *end = data + len;
+  while (p < end) {
+    switch (http_) {
+    case Http::kStatus:
+    case Http::kHeaders:
+      if (takeLine(&http_line_, &p, end) && !responseLine())
+        return false;
+      break;
+
+    case Http::kBody:
+      if (!chunked_) {
+        if (!body(p, end - p))
+          return false;
+        p = end;
+        break;
+      }
+      if (chunk_ == Chunk::kData) {
+        size_t take = (size_t)(end - p) < chunk_left_ ? end - p : chunk_left_;
+        if (!body(p, take))
+          return false;
+        p += take;
+        chunk_left_ -= take;
+        if (chunk_left_ == 0)
+          chunk_ = Chunk::kDataEnd;
+      } else if (takeLine(&http_line_, &p, end)) {
+        if (chunk_ == Chunk::kDataEnd) {
+          chunk_ = Chunk::kSize;  // the CRLF after the chunk data
+          break;
+        }
+        char *tail;
+        chunk_left_ = strtoul(http_line_.text, &tail, 16);
+        if (tail == http_line_.text)
+          return fail("bad chunk size");
+        if (chunk_left_ == 0)
+          return fail("upstream ended the stream");
+        chunk_ = Chunk::kData;
+      }
+      break;
+
+    case Http::kFailed:
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MjpegParser::responseLine() {
+  Line &line = http_line_;
+  if (line.overflow)
+    return fail("response header too long");
+
+  if (http_ == Http::kStatus) {
+    const char *space = strchr(line.text, ' ');
+    if (strncmp(line.text, "HTTP/1.", 7) != 0 || !space)
+      return fail("not an HTTP response");
+    if (atoi(space + 1) != 200)
+      return fail("upstream did not answer 200");
+    http_ = Http::kHeaders;
+    return true;
+  }
+
+  if (line.len == 0) {
+    if (delimiter_len_ == 0)
+      return fail("not a multipart response");
+    http_ = Http::kBody;
+    return true;
+  }
+
+  char *name, *value;
+  if (!splitHeader(line.text, &name, &value))
+    return true;
+  if (strcasecmp(name, "Transfer-Encoding") == 0) {
+    chunked_ = strcasestr(value, "chunked") != nullptr;
+  } else if (strcasecmp(name, "Content-Type") == 0) {
+    if (strncasecmp(value, "multipart/", 10) != 0)
+      return fail("not a multipart response");
+    const char *b = strcasestr(value, "boundary=");
+    if (!b)
+      return fail("no multipart boundary");
+    b += 9;
+    size_t blen = strcspn(b, ";");
+    if (blen >= 2 && b[0] == '"' && b[blen - 1] == '"') {
+      b++;
+      blen -= 2;
+    }
+    if (blen == 0 || blen + 4 >= sizeof(delimiter_))
+      return fail("bad multipart boundary");
+    memcpy(delimiter_, "\r\n--", 4);
+    memcpy(delimiter_ + 4, b, blen);
+    delimiter_len_ = blen + 4;
+  }
+  return true;
+}
+
+bool MjpegParser::body(const uint8_t *data, size_t len) {
+  const uint8_t *p = data;
+  const uint8_t *end = data + len;
+  while (p < end) {
+    switch (part_) {
+    case Part::kBoundary:
+    case Part::kHeaders:
+    case Part::kLineRest:
+      if (takeLine(&part_line_, &p, end) && !partLine())
+        return false;
+      break;
+
+    case Part::kCounted: {
+      size_t take = (size_t)(end - p) < part_left_ ? end - p : part_left_;
+      listener_->onPartData(p, take);
+      p += take;
+      part_left_ -= take;
+      if (part_left_ == 0) {
+        listener_->onPartEnd();
+        part_ = Part::kBoundary;
+      }
+      break;
+    }
+
+    case Part::kDelimited:
+      delimited(&p, end);
+      break;
+    }
+  }
+  return true;
+}
+
+bool MjpegParser::partLine() {
+  Line &line = part_line_;
+  // "--boundary", i.e. the delimiter without its leading CRLF.
+  const char *dash_boundary = delimiter_ + 2;
+  size_t dash_len = delimiter_len_ - 2;
+
+  switch (part_) {
+  case Part::kBoundary:
+    // Preamble, the CRLF ending a counted part, or the boundary itself.
+    if (line.overflow || line.len < dash_len ||
+        memcmp(line.text, dash_boundary, dash_len) != 0)
+      return true;
+    if (strncmp(line.text + dash_len, "--", 2) == 0)
+      return fail("upstream ended the stream");
+    break;
+
+  case Part::kLineRest:
+    // Whatever followed a delimiter found by scanning, up to its CRLF.
+    if (strncmp(line.text, "--", 2) == 0)
+      return fail("upstream ended the stream");
+    break;
+
+  case Part::kHeaders: {
+    if (line.overflow)
+      return fail("part header too long");
+    if (line.len == 0) {
+      listener_->onPartBody(part_left_);
+      part_ = part_left_ ? Part::kCounted : Part::kDelimited;
+      matched_ = 0;
+      return true;
+    }
+    char *name, *value;
+    if (!splitHeader(line.text, &name, &value))
+      return true;
+    if (strcasecmp(name, "Content-Length") == 0)
+      part_left_ = strtoul(value, nullptr, 10);
+    listener_->onPartHeader(name, value);
+    return true;
+  }
+
+  default:
+    return true;
+  }
+
+  part_ = Part::kHeaders;
+  part_left_ = 0;
+  listener_->onPartBegin();
+  return true;
+}
+
+// Passes data through until the delimiter. Only a CR can start it, so
+// everything up to the next CR goes out in one piece.
+void MjpegParser::delimited(const uint8_t **p, const uint8_t *end) {
+  while (*p < end) {
+    if (matched_ == 0) {
+      const uint8_t *cr =
+          static_cast<const uint8_t *>(memchr(*p, '\r', end - *p));
+      const uint8_t *stop = cr ? cr : end;
+      if (stop > *p)
+        listener_->onPartData(*p, stop - *p);
+      *p = stop;
+      if (!cr)
+        return;
+    }
+    if (**p == (uint8_t)delimiter_[matched_]) {
+      (*p)++;
+      if (++matched_ == delimiter_len_) {
+        matched_ = 0;
+        listener_->onPartEnd();
+        part_ = Part::kLineRest;
+        return;
+      }
+      continue;
+    }
+    // A false start: those bytes were data after all. The current byte is
+    // looked at again from the beginning of the delimiter.
+    listener_->onPartData(reinterpret_cast<const uint8_t *>(delimiter_),
+                          matched_);
+    matched_ = 0;
+  }
+}
+
+}  // namespace relay
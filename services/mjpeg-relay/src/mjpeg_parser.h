@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace relay {
+
+// Push parser for an MJPEG HTTP response (`multipart/x-mixed-replace`) as
+// the camera firmware sends it: status line and headers, optional chunked
+// transfer coding, then parts separated by the boundary from Content-Type.
+// It takes bytes in whatever pieces recv() returns and never buffers more
+// than one line; part bodies are passed through as they arrive. Parts with
+// a Content-Length are read by count; others are cut at the next boundary.
+class MjpegParser {
+public:
+  class Listener {
+  public:
+    virtual ~Listener() {}
+    virtual void onPartBegin() = 0;
+    virtual void onPartHeader(const char *name, const char *value) = 0;
+    // Headers done; `length` is the Content-Length, 0 if there was none.
+    virtual void onPartBody(size_t length) = 0;
+    virtual void onPartData(const uint8_t *data, size_t len) = 0;
+    virtual void onPartEnd() = 0;
+  };
+
+  explicit MjpegParser(Listener *listener) : listener_(listener) {}
+
+  void reset();
+
+  // Returns false once the stream is unusable (error() says why); the
+  // connection should then be dropped.
+  bool feed(const uint8_t *data, size_t len);
+
+  const char *error() const { return error_; }
+
+private:
+  enum class Http { kStatus, kHeaders, kBody, kFailed };
+  enum class Chunk { kSize, kData, kDataEnd };
+  enum class Part { kBoundary, kHeaders, kCounted, kDelimited, kLineRest };
+
+  // One CRLF-terminated line, collected across feed() calls. Lines longer
+  // than the buffer are consumed but flagged.
+  struct Line {
+    char text[256];
+    size_t len = 0;
+    bool overflow = false;
+    bool done = false;
+  };
+
+  static bool takeLine(Line *line, const uint8_t **p, const uint8_t *end);
+
+  bool fail(const char *error);
+  bool responseLine();
+  bool body(const uint8_t *data, size_t len);
+  bool partLine();
+  void delimited(const uint8_t **p, const uint8_t *end);
+
+  Listener *listener_;
+  Http http_ = Http::kStatus;
+  Chunk chunk_ = Chunk::kSize;
+  Part part_ = Part::kBoundary;
+  bool chunked_ = false;
+  size_t chunk_left_ = 0;
+  size_t part_left_ = 0;
+
+  Line http_line_;  // status, headers and chunk sizes
+  Line part_line_;  // boundaries and part headers, inside the chunks
+  char delimiter_[80];  // "\r\n--" boundary
+  size_t delimiter_len_ = 0;
+  size_t matched_ = 0;  // delimiter bytes seen at the end of a part
+  const char *error_ = nullptr;
+};
+
+}  // namespace relay
@@ -0,0 +1,196 @@
+#include "relay.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "client.h"
+
+namespace relay {
+
+static const int64_t kSweepUs = 1000000;
+
+Relay::Relay(EventLoop *loop, const RelayConfig &config)
+    : loop_(loop), config_(config), sweep_timer_([this] { sweep(); }) {}
+
+Relay::~Relay() {
+  loop_->cancel(&sweep_timer_);
+  for (Client *client : clients_)
+    delete client;
+  if (listen_fd_ >= 0)
+    close(listen_fd_);
+}
+
+bool Relay::begin() {
+  addrinfo hints = {}, *res = nullptr;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  int err = getaddrinfo(config_.listen_host.c_str(),
+                        config_.listen_port.c_str(), &hints, &res);
+  if (err != 0) {
+    fprintf(stderr, "listen %s: %s\n", config_.listen_host.c_str(),
+            gai_strerror(err));
+    return false;
+  }
+  listen_fd_ =
+      socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  bool ok = listen_fd_ >= 0 &&
+            setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one,
+                       sizeof(one)) == 0 &&
+            bind(listen_fd_, res->ai_addr, res->ai_addrlen) == 0 &&
+            listen(listen_fd_, 128) == 0 &&
+            loop_->add(listen_fd_, EPOLLIN, this);
+  freeaddrinfo(res);
+  if (!ok) {
+    fprintf(stderr, "listen %s:%s: %s\n", config_.listen_host.c_str(),
+            config_.listen_port.c_str(), strerror(errno));
+    return false;
+  }
+
+  for (const Camera::Config &camera_config : config_.cameras) {
+    cameras_.emplace_back(new Camera(loop_, &pool_, camera_config));
+    if (!cameras_.back()->begin())
+      return false;
+  }
+  loop_->arm(&sweep_timer_, kSweepUs);
+  fprintf(stderr, "relaying %zu camera(s) on %s:%s\n", cameras_.size(),
+          config_.listen_host.c_str(), config_.listen_port.c_str());
+  return true;
+}
+
+Camera *Relay::camera(const std::string &name) {
+  if (name.empty())
+    return cameras_.empty() ? nullptr : cameras_.front().get();
+  for (auto &camera : cameras_)
+    if (camera->name() == name)
+      return camera.get();
+  return nullptr;
+}
+
+void Relay::onEvent(uint32_t) { acceptAll(); }
+
+void Relay::acceptAll() {
+  while (true) {
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int fd = accept4(listen_fd_, (sockaddr *)&addr, &len,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN)
+        perror("accept4");
+      return;
+    }
+    if (clients_.size() >= config_.max_clients) {
+      static const char kBusy[] =
+          "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n"
+          "Connection: close\r\n\r\n";
+      send(fd, kBusy, sizeof(kBusy) - 1, MSG_NOSIGNAL);
+      close(fd);
+      rejected_++;
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (config_.client_sndbuf > 0)
+      setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &config_.client_sndbuf,
+                 sizeof(config_.client_sndbuf));
+
+    char peer[INET6_ADDRSTRLEN] = "?";
+    if (addr.ss_family == AF_INET)
+      inet_ntop(AF_INET, &((sockaddr_in *)&addr)->sin_addr, peer,
+                sizeof(peer));
+    else if (addr.ss_family == AF_INET6)
+      inet_ntop(AF_INET6, &((sockaddr_in6 *)&addr)->sin6_addr, peer,
+                sizeof(peer));
+    Client *client = new Client(this, fd, peer);
+    if (!client->begin()) {
+      delete client;
+      continue;
+    }
+    clients_.push_back(client);
+  }
+}
+
+void Relay::closeClient(Client *client) {
+  auto it = std::find(clients_.begin(), clients_.end(), client);
+  if (it == clients_.end())
+    return;
+  clients_.erase(it);
+  client->close();
+  loop_->defer([client] { delete client; });
+}
+
+void Relay::sweep() {
+  int64_t now = nowUs();
+  std::vector<Client *> stalled;
+  for (Client *client : clients_)
+    if (client->stalled(now, config_.client_stall_us))
+      stalled.push_back(client);
+  for (Client *client : stalled)
+    closeClient(client);
+  loop_->arm(&sweep_timer_, kSweepUs);
+}
+
+void Relay::formatMetrics(std::string *out) {
+  char line[256];
+  auto put = [&](const char *fmt, auto... args) {
+    snprintf(line, sizeof(line), fmt, args...);
+    out->append(line);
+  };
+  struct Family {
+    const char *name, *type, *help;
+  };
+  static const Family kCameraFamilies[] = {
+      {"relay_upstream_up", "gauge", "Upstream connection is streaming"},
+      {"relay_upstream_frames_total", "counter", "Frames received"},
+      {"relay_upstream_bytes_total", "counter", "Bytes received"},
+      {"relay_upstream_reconnects_total", "counter",
+       "Upstream connections lost or refused"},
+      {"relay_subscribers", "gauge", "Stream and waiting capture clients"},
+      {"relay_frames_sent_total", "counter", "Frames written to clients"},
+      {"relay_frames_dropped_total", "counter",
+       "Frames a slow stream client skipped"},
+  };
+  for (size_t f = 0; f < sizeof(kCameraFamilies) / sizeof(kCameraFamilies[0]);
+       f++) {
+    const Family &family = kCameraFamilies[f];
+    put("# HELP %s %s\n# TYPE %s %s\n", family.name, family.help,
+        family.name, family.type);
+    for (auto &camera : cameras_) {
+      const CameraStats &s = camera->stats();
+      uint64_t values[] = {s.connected,  s.frames,      s.bytes,
+                           s.reconnects, camera->subscribers(),
+                           s.frames_sent, s.frames_dropped};
+      put("%s{camera=\"%s\"} %" PRIu64 "\n", family.name,
+          camera->name().c_str(), values[f]);
+    }
+  }
+  put("# HELP relay_clients Open client connections\n"
+      "# TYPE relay_clients gauge\nrelay_clients %zu\n",
+      clients_.size());
+  put("# HELP relay_clients_rejected_total Connections over --max-clients\n"
+      "# TYPE relay_clients_rejected_total counter\n"
+      "relay_clients_rejected_total %" PRIu64 "\n",
+      rejected_);
+  put("# HELP relay_frame_pool_frames Frame buffers allocated\n"
+      "# TYPE relay_frame_pool_frames gauge\nrelay_frame_pool_frames %zu\n",
+      pool_.frames());
+  put("# HELP relay_frame_pool_bytes Bytes held by frame buffers\n"
+      "# TYPE relay_frame_pool_bytes gauge\nrelay_frame_pool_bytes %zu\n",
+      pool_.bytes());
+}
+
+}  // namespace relay
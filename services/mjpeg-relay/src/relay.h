@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "event_loop.h"
+#include "frame_pool.h"
+
+namespace relay {
+
+class Client;
+
+struct RelayConfig {
+  std::string listen_host = "0.0.0.0";
+  std::string listen_port = "8090";
+  std::vector<Camera::Config> cameras;
+  size_t max_clients = 256;
+  // SO_SNDBUF for client sockets, 0 = kernel default. Smaller buffers make
+  // slow clients skip frames sooner instead of falling seconds behind.
+  int client_sndbuf = 0;
+  // A client whose socket takes nothing for this long is dropped.
+  int64_t client_stall_us = 10000000;
+};
+
+// Owns the listening socket, the cameras and the client connections, all
+// driven by one EventLoop.
+class Relay : public EventLoop::Handler {
+public:
+  Relay(EventLoop *loop, const RelayConfig &config);
+  ~Relay();
+
+  bool begin();
+
+  // Camera by name; an empty name means the first one.
+  Camera *camera(const std::string &name);
+  FramePool *pool() { return &pool_; }
+  EventLoop *loop() { return loop_; }
+
+  // Closes the connection and frees the client once the current events are
+  // handled. Safe to call more than once.
+  void closeClient(Client *client);
+
+  // Prometheus text exposition of the relay's counters.
+  void formatMetrics(std::string *out);
+
+  void onEvent(uint32_t events) override;
+
+private:
+  void acceptAll();
+  void sweep();
+
+  EventLoop *loop_;
+  RelayConfig config_;
+  FramePool pool_;
+  std::vector<std::unique_ptr<Camera>> cameras_;
+  std::vector<Client *> clients_;
+  int listen_fd_ = -1;
+  uint64_t rejected_ = 0;
+  EventLoop::Timer sweep_timer_;
+};
+
+}  // namespace relay
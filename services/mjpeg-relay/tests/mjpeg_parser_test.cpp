@@ -0,0 +1,212 @@
+// MjpegParser on the streams the firmware and other cameras send: counted
+// and delimited parts, chunked and close-delimited (HTTP/1.0) bodies, and
+// JPEG data that starts to look like a boundary. Every stream is also fed
+// split at each byte, so boundaries and chunk sizes straddle feed() calls.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "mjpeg_parser.h"
+
+using namespace relay;
+
+namespace {
+
+struct Part {
+  std::string content_type;
+  size_t length = 0;
+  std::string data;
+  bool ended = false;
+};
+
+// Collects parts and checks that callbacks come in order.
+class Recorder : public MjpegParser::Listener {
+public:
+  void onPartBegin() override {
+    CHECK(parts.empty() || parts.back().ended);
+    parts.emplace_back();
+    in_body = false;
+  }
+  void onPartHeader(const char *name, const char *value) override {
+    CHECK(!parts.empty() && !in_body);
+    if (std::string(name) == "Content-Type")
+      parts.back().content_type = value;
+  }
+  void onPartBody(size_t length) override {
+    CHECK(!parts.empty() && !in_body);
+    parts.back().length = length;
+    in_body = true;
+  }
+  void onPartData(const uint8_t *data, size_t len) override {
+    CHECK(in_body);
+    if (!parts.empty())
+      parts.back().data.append(reinterpret_cast<const char *>(data), len);
+  }
+  void onPartEnd() override {
+    CHECK(in_body);
+    if (!parts.empty())
+      parts.back().ended = true;
+    in_body = false;
+  }
+
+  std::vector<Part> parts;
+  bool in_body = false;
+};
+
+const char kHead10[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Content-Type: multipart/x-mixed-replace;boundary=frame\r\n"
+    "\r\n";
+const char kHeadChunked[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: multipart/x-mixed-replace; boundary=\"frame\"\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n";
+
+// JPEG-ish payloads. The second holds the start of the delimiter
+// ("\r\n--frame") cut off at every length and a boundary with no CRLF
+// before it; the third has one mid-line and ends in a partial delimiter.
+std::vector<std::string> frames() {
+  std::string a("\xFF\xD8\xFF\xE0 plain \x00\r\n\xFF\xD9", 16);
+  std::string b("\xFF\xD8", 2);
+  const char delim[] = "\r\n--frame";
+  for (size_t i = 1; i < sizeof(delim) - 1; i++)
+    b += std::string(delim, i) + "x";
+  b += "--frame\r\r\n-\xFF\xD9";
+  std::string c = "\xFF\xD8 --frame \r\n--fram";
+  return {a, b, c};
+}
+
+// The firmware's layout: each part preceded by CRLF and the boundary.
+std::string counted(const std::vector<std::string> &jpegs) {
+  std::string body;
+  for (const std::string &jpeg : jpegs) {
+    body += "\r\n--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " +
+            std::to_string(jpeg.size()) + "\r\n\r\n" + jpeg;
+  }
+  return body;
+}
+
+// Parts without Content-Length, cut at the next boundary. The final
+// boundary ends the last one and begins a part that stays open.
+std::string delimited(const std::vector<std::string> &jpegs) {
+  std::string body;
+  for (const std::string &jpeg : jpegs)
+    body += "--frame\r\nContent-Type: image/jpeg\r\n\r\n" + jpeg + "\r\n";
+  return body + "--frame\r\n";
+}
+
+std::string chunked(const std::string &body, size_t chunk) {
+  std::string out;
+  for (size_t pos = 0; pos < body.size(); pos += chunk) {
+    std::string piece = body.substr(pos, chunk);
+    char size[16];
+    snprintf(size, sizeof(size), "%zx\r\n", piece.size());
+    out += size + piece + "\r\n";
+  }
+  return out;
+}
+
+bool feed(MjpegParser *parser, const std::string &s) {
+  return parser->feed(reinterpret_cast<const uint8_t *>(s.data()), s.size());
+}
+
+void checkParts(const Recorder &rec, const std::vector<std::string> &jpegs,
+                bool with_length) {
+  CHECK_EQ(rec.parts.size(), jpegs.size() + (with_length ? 0 : 1));
+  if (!with_length && !rec.parts.empty())
+    CHECK(!rec.parts.back().ended);
+  for (size_t i = 0; i < rec.parts.size() && i < jpegs.size(); i++) {
+    const Part &part = rec.parts[i];
+    CHECK(part.ended);
+    CHECK(part.content_type == "image/jpeg");
+    CHECK_EQ(part.length, with_length ? jpegs[i].size() : 0);
+    CHECK(part.data == jpegs[i]);
+  }
+}
+
+// Feeds `stream` whole, a byte at a time, and in two pieces split at every
+// offset; each run must yield the same parts.
+void checkStream(const std::string &stream,
+                 const std::vector<std::string> &jpegs, bool with_length) {
+  {
+    Recorder rec;
+    MjpegParser parser(&rec);
+    CHECK(feed(&parser, stream));
+    checkParts(rec, jpegs, with_length);
+  }
+  {
+    Recorder rec;
+    MjpegParser parser(&rec);
+    for (char c : stream)
+      CHECK(feed(&parser, std::string(1, c)));
+    checkParts(rec, jpegs, with_length);
+  }
+  for (size_t split = 1; split < stream.size(); split++) {
+    Recorder rec;
+    MjpegParser parser(&rec);
+    CHECK(feed(&parser, stream.substr(0, split)));
+    CHECK(feed(&parser, stream.substr(split)));
+    checkParts(rec, jpegs, with_length);
+  }
+}
+
+void testCounted() {
+  std::vector<std::string> jpegs = frames();
+  checkStream(kHead10 + counted(jpegs), jpegs, true);
+  checkStream(kHeadChunked + chunked(counted(jpegs), 7), jpegs, true);
+  checkStream(kHeadChunked + chunked(counted(jpegs), 4096), jpegs, true);
+}
+
+void testDelimited() {
+  std::vector<std::string> jpegs = frames();
+  checkStream(kHead10 + delimited(jpegs), jpegs, false);
+  checkStream(kHeadChunked + chunked(delimited(jpegs), 5), jpegs, false);
+}
+
+// A counted part is read by length, so a complete delimiter inside the
+// data is data.
+void testBoundaryInCountedPart() {
+  std::vector<std::string> jpegs = {"\xFF\xD8\r\n--frame\r\n\r\n\xFF\xD9"};
+  checkStream(kHead10 + counted(jpegs), jpegs, true);
+}
+
+// The parser keeps a reused instance clean after reset(), and fails on a
+// close delimiter, a last chunk and responses it cannot relay.
+void testEndAndErrors() {
+  Recorder rec;
+  MjpegParser parser(&rec);
+  std::vector<std::string> jpegs = {"\xFF\xD8\xFF\xD9"};
+  CHECK(!feed(&parser, kHead10 + counted(jpegs) + "\r\n--frame--\r\n"));
+  CHECK(std::string(parser.error()) == "upstream ended the stream");
+  checkParts(rec, jpegs, true);
+
+  rec.parts.clear();
+  parser.reset();
+  CHECK(!feed(&parser, kHeadChunked + chunked(counted(jpegs), 64) +
+                           "0\r\n\r\n"));
+  CHECK(std::string(parser.error()) == "upstream ended the stream");
+  checkParts(rec, jpegs, true);
+
+  parser.reset();
+  CHECK(!feed(&parser, "HTTP/1.1 503 Service Unavailable\r\n"));
+  parser.reset();
+  CHECK(!feed(&parser, "HTTP/1.0 200 OK\r\nContent-Type: image/jpeg\r\n"));
+  parser.reset();
+  CHECK(!feed(&parser, "HTTP/1.0 200 OK\r\n\r\n"));
+  parser.reset();
+  CHECK(!feed(&parser, std::string(kHeadChunked) + "zz\r\n"));
+  CHECK(std::string(parser.error()) == "bad chunk size");
+}
+
+}  // namespace
+
+int main() {
+  testCounted();
+  testDelimited();
+  testBoundaryInCountedPart();
+  testEndAndErrors();
+  return camcore_test::checkResult();
+}